@@ -0,0 +1,104 @@
+#include "bench_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int hostParseList(char* arg, int* values, int maxCount) {
+    int count = 0;
+
+    for (char* value = strtok(arg, ","); value && count < maxCount; value = strtok(NULL, ",")) {
+        values[count++] = atoi(value);
+    }
+
+    return count;
+}
+
+static int hostRowVertexCount(struct HostMeshTile* tiles, int xTiles, int y) {
+    int result = 0;
+
+    for (int x = 0; x < xTiles; ++x) {
+        struct HostMeshTile* tile = &tiles[x + y * xTiles];
+        result += tile->vertexCount - tile->beginningOverlap;
+    }
+
+    return result;
+}
+
+void hostMeshLayerBuild(struct MTMeshLayer* meshLayer, struct HostMeshTile* tiles, int xTiles, int yTiles, int spanRows, int blockRows, int* blockTriangleStarts) {
+    int tileCount = xTiles * yTiles;
+    int vertexCount = 0;
+    int triangleCount = 0;
+    int blockCount = 0;
+
+    for (int i = 0; i < tileCount; ++i) {
+        vertexCount += tiles[i].vertexCount - tiles[i].beginningOverlap;
+
+        if (tiles[i].vertexCount) {
+            triangleCount += tiles[i].vertexCount - 2;
+        }
+    }
+
+    memset(meshLayer, 0, sizeof(struct MTMeshLayer));
+    meshLayer->vertices = calloc(vertexCount, sizeof(struct MTVertex));
+    meshLayer->vertexCount = vertexCount;
+    // two commands per tile is plenty for the triangles and end command
+    meshLayer->triangles = calloc(tileCount * 2 + triangleCount, sizeof(Gfx));
+    meshLayer->tiles = calloc(tileCount, sizeof(struct MTMeshTile));
+    meshLayer->maxTileX = xTiles;
+    meshLayer->maxTileY = yTiles;
+
+    int nextVertex = 0;
+    int nextTriangle = 0;
+    int windowStart = -1;
+
+    for (int y = 0; y < yTiles; ++y) {
+        int rowEnd = nextVertex + hostRowVertexCount(tiles, xTiles, y);
+
+        if (!spanRows || rowEnd - windowStart > MT_VERTEX_CACHE_SIZE) {
+            windowStart = -1;
+        }
+
+        if (blockRows && y % blockRows == 0) {
+            blockTriangleStarts[blockCount++] = nextTriangle;
+            windowStart = -1;
+        }
+
+        int blockTriangleStart = blockCount ? blockTriangleStarts[blockCount - 1] : 0;
+
+        for (int x = 0; x < xTiles; ++x) {
+            struct HostMeshTile* tile = &tiles[x + y * xTiles];
+            struct MTMeshTile* meshTile = &meshLayer->tiles[x + y * xTiles];
+
+            meshTile->startVertex = nextVertex - tile->beginningOverlap;
+            meshTile->vertexCount = tile->vertexCount;
+            nextVertex += tile->vertexCount - tile->beginningOverlap;
+
+            if (!tile->vertexCount) {
+                meshTile->windowStart = windowStart < 0 ? meshTile->startVertex : windowStart;
+                meshTile->triangleStart = 0;
+                meshTile->triangleCount = 0;
+                continue;
+            }
+
+            if (windowStart < 0 || meshTile->startVertex + tile->vertexCount - windowStart > MT_VERTEX_CACHE_SIZE) {
+                windowStart = meshTile->startVertex;
+            }
+
+            int offset = meshTile->startVertex - windowStart;
+
+            meshTile->windowStart = windowStart;
+            meshTile->triangleStart = nextTriangle - blockTriangleStart;
+            meshTile->triangleCount = tile->vertexCount - 2;
+
+            for (int i = 1; i + 1 < tile->vertexCount; ++i) {
+                gSP1Triangle(&meshLayer->triangles[nextTriangle++], offset, offset + i, offset + i + 1, 0);
+            }
+
+            gSPEndDisplayList(&meshLayer->triangles[nextTriangle++]);
+        }
+    }
+
+    if (blockRows) {
+        blockTriangleStarts[blockCount] = nextTriangle;
+    }
+}
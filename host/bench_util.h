@@ -0,0 +1,27 @@
+#ifndef __HOST_BENCH_UTIL_H__
+#define __HOST_BENCH_UTIL_H__
+
+#include "megatextures/tile_index.h"
+
+// shared by the tools in host/tools
+
+struct HostMeshTile {
+    int vertexCount;
+    // vertices shared with the tile before it in the row
+    int beginningOverlap;
+};
+
+// parses a comma separated list of integers into values, keeps at
+// most maxCount of them and returns how many were read
+int hostParseList(char* arg, int* values, int maxCount);
+
+// lays out the vertices and bakes the triangles of a layer the same way
+// bake_row_triangles in tools/export_level/megatexture.lua does, each
+// tile is a fan over its outline. Vertex windows restart every row
+// unless spanRows is set. If blockRows isn't 0 windows also restart
+// every blockRows rows, triangles are numbered from the start of their
+// block and blockTriangleStarts gets the first triangle of each block
+// followed by the end of the last one. The vertices are left zeroed
+void hostMeshLayerBuild(struct MTMeshLayer* meshLayer, struct HostMeshTile* tiles, int xTiles, int yTiles, int spanRows, int blockRows, int* blockTriangleStarts);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __HOST_HOST_H__
+#define __HOST_HOST_H__
+
+#include <ultra64.h>
+
+// the heap used by malloc in src/util/memory.c lives in the low 2GB
+// of the address space since the N64 code casts pointers to int
+#define HOST_DEFAULT_HEAP_SIZE  (16 * 1024 * 1024)
+#define HOST_DEFAULT_ROM_SIZE   (32 * 1024 * 1024)
+
+struct HostPiStats {
+    u32 dmaCount;
+    u32 byteCount;
+};
+
+extern struct HostPiStats gHostPiStats;
+
+void hostInit(int heapSize, int romSize);
+void hostHeapReset();
+
+// rom addresses are offsets into a simulated cartridge
+// they can be stored anywhere the game expects a rom pointer
+u32 hostRomAlloc(int size);
+void* hostRomPointer(u32 romAddress);
+void hostRomReset();
+
+void hostPiStatsReset();
+
+#endif
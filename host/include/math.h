@@ -0,0 +1,12 @@
+#ifndef __HOST_MATH_H__
+#define __HOST_MATH_H__
+
+// the n64 build gets math.h from nustd which leaves isnan to mathf.h
+
+#pragma push_macro("isnan")
+#undef isnan
+#include_next <math.h>
+#undef isnan
+#pragma pop_macro("isnan")
+
+#endif
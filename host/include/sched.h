@@ -0,0 +1,60 @@
+#ifndef __HOST_SCHED_H__
+#define __HOST_SCHED_H__
+
+// stand-in for the libultra scheduler header, only the types
+// referenced by graphics.h are provided
+
+#include <ultra64.h>
+
+#define OS_SC_STACKSIZE         0x2000
+
+#define OS_SC_RETRACE_MSG       1
+#define OS_SC_DONE_MSG          2
+#define OS_SC_RDP_DONE_MSG      3
+#define OS_SC_PRE_NMI_MSG       4
+#define OS_SC_LAST_MSG          4
+
+typedef struct {
+    u32 type;
+    u32 flags;
+    u64* ucode_boot;
+    u32 ucode_boot_size;
+    u64* ucode;
+    u32 ucode_size;
+    u64* ucode_data;
+    u32 ucode_data_size;
+    u64* dram_stack;
+    u32 dram_stack_size;
+    u64* output_buff;
+    u64* output_buff_size;
+    u64* data_ptr;
+    u32 data_size;
+    u64* yield_data_ptr;
+    u32 yield_data_size;
+} OSTask_t;
+
+typedef union {
+    OSTask_t t;
+    long long force_structure_alignment;
+} OSTask;
+
+typedef short OSScMsgType;
+
+typedef struct {
+    OSScMsgType type;
+    char misc[30];
+} OSScMsg;
+
+typedef struct OSScTask_s {
+    struct OSScTask_s* next;
+    u32 state;
+    u32 flags;
+    void* framebuffer;
+    OSTask list;
+    OSMesgQueue* msgQ;
+    OSMesg msg;
+    OSTime startTime;
+    OSTime totalTime;
+} OSScTask;
+
+#endif
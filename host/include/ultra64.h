@@ -0,0 +1,488 @@
+#ifndef __HOST_ULTRA64_H__
+#define __HOST_ULTRA64_H__
+
+// A small stand-in for the parts of libultra used by the megatexture
+// renderer, the tile cache and the math library so they can be built
+// and run natively. Display list commands are encoded with the F3DEX2
+// opcodes but words are pointer sized so host addresses fit in w1.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define _LANGUAGE_C
+
+typedef uint8_t u8;
+typedef int8_t s8;
+typedef uint16_t u16;
+typedef int16_t s16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+typedef volatile u8 vu8;
+typedef volatile u16 vu16;
+typedef volatile u32 vu32;
+
+typedef float f32;
+typedef double f64;
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifndef MIN
+#define MIN(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b)   (((a) > (b)) ? (a) : (b))
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/////////////////////
+// os
+/////////////////////
+
+typedef void* OSMesg;
+typedef s32 OSPri;
+typedef s32 OSId;
+typedef u64 OSTime;
+
+typedef struct OSMesgQueue_s {
+    s32 validCount;
+    s32 first;
+    s32 msgCount;
+    OSMesg* msg;
+} OSMesgQueue;
+
+typedef struct {
+    u16 type;
+    u8 pri;
+    u8 status;
+    OSMesgQueue* retQueue;
+} OSIoMesgHdr;
+
+typedef struct OSPiHandle_s {
+    struct OSPiHandle_s* next;
+    u8 type;
+    u32 baseAddress;
+} OSPiHandle;
+
+typedef struct {
+    OSIoMesgHdr hdr;
+    void* dramAddr;
+    u32 devAddr;
+    u32 size;
+    OSPiHandle* piHandle;
+} OSIoMesg;
+
+typedef struct {
+    u32 pad;
+} OSThread;
+
+typedef struct {
+    u16 button;
+    s8 stick_x;
+    s8 stick_y;
+    u8 errno;
+} OSContPad;
+
+#define OS_MESG_NOBLOCK     0
+#define OS_MESG_BLOCK       1
+
+#define OS_MESG_PRI_NORMAL  0
+#define OS_MESG_PRI_HIGH    1
+
+#define OS_READ             0
+#define OS_WRITE            1
+
+#define OS_CPU_COUNTER      46875000
+#define OS_NSEC_TO_CYCLES(n)    (((u64)(n) * (OS_CPU_COUNTER / 15625000LL)) / (1000000000LL / 15625000LL))
+#define OS_USEC_TO_CYCLES(n)    (((u64)(n) * (OS_CPU_COUNTER / 15625LL)) / (1000000LL / 15625LL))
+#define OS_CYCLES_TO_NSEC(c)    (((u64)(c) * (1000000000LL / 15625000LL)) / (OS_CPU_COUNTER / 15625000LL))
+#define OS_CYCLES_TO_USEC(c)    (((u64)(c) * (1000000LL / 15625LL)) / (OS_CPU_COUNTER / 15625LL))
+
+#define OS_K0_TO_PHYSICAL(x)    ((u32)(uintptr_t)(x) & 0x1FFFFFFF)
+#define PHYS_TO_K0(x)           ((uintptr_t)(x) | 0x80000000)
+
+void osCreateMesgQueue(OSMesgQueue* mq, OSMesg* msg, s32 count);
+s32 osSendMesg(OSMesgQueue* mq, OSMesg msg, s32 flag);
+s32 osRecvMesg(OSMesgQueue* mq, OSMesg* msg, s32 flag);
+
+OSPiHandle* osCartRomInit(void);
+s32 osEPiStartDma(OSPiHandle* piHandle, OSIoMesg* mb, s32 direction);
+s32 osPiStartDma(OSIoMesg* mb, s32 priority, s32 direction, u32 devAddr, void* dramAddr, u32 size, OSMesgQueue* mq);
+
+void osInvalDCache(void* vaddr, s32 nbytes);
+void osInvalICache(void* vaddr, s32 nbytes);
+void osWritebackDCache(void* vaddr, s32 nbytes);
+void osWritebackDCacheAll(void);
+
+uintptr_t osVirtualToPhysical(void* virtualAddress);
+OSTime osGetTime(void);
+
+/////////////////////
+// gu
+/////////////////////
+
+typedef union {
+    s32 m[4][4];
+    long long force_structure_alignment;
+} Mtx;
+
+typedef float MtxF[4][4];
+
+void guMtxF2L(float mf[4][4], Mtx* m);
+void guMtxL2F(float mf[4][4], Mtx* m);
+void guMtxIdent(Mtx* m);
+void guMtxIdentF(float mf[4][4]);
+void guMtxCatF(float m[4][4], float n[4][4], float r[4][4]);
+void guPerspectiveF(float mf[4][4], u16* perspNorm, float fovy, float aspect, float near, float far, float scale);
+void guPerspective(Mtx* m, u16* perspNorm, float fovy, float aspect, float near, float far, float scale);
+void guOrthoF(float mf[4][4], float l, float r, float b, float t, float n, float f, float scale);
+void guScaleF(float mf[4][4], float x, float y, float z);
+void guTranslateF(float mf[4][4], float x, float y, float z);
+
+/////////////////////
+// gbi
+/////////////////////
+
+typedef struct {
+    short ob[3];
+    unsigned short flag;
+    short tc[2];
+    unsigned char cn[4];
+} Vtx_t;
+
+typedef struct {
+    short ob[3];
+    unsigned short flag;
+    short tc[2];
+    signed char n[3];
+    unsigned char a;
+} Vtx_tn;
+
+typedef union {
+    Vtx_t v;
+    Vtx_tn n;
+    long long force_structure_alignment;
+} Vtx;
+
+typedef struct {
+    short vscale[4];
+    short vtrans[4];
+} Vp_t;
+
+typedef union {
+    Vp_t vp;
+    long long force_structure_alignment;
+} Vp;
+
+typedef struct {
+    unsigned char col[3];
+    char pad1;
+    unsigned char colc[3];
+    char pad2;
+    signed char dir[3];
+    char pad3;
+} Light_t;
+
+typedef union {
+    Light_t l;
+    long long force_structure_alignment[2];
+} Light;
+
+typedef struct {
+    Light l[2];
+} LookAt;
+
+typedef struct {
+    uintptr_t w0;
+    uintptr_t w1;
+} Gwords;
+
+typedef union {
+    Gwords words;
+    long long force_structure_alignment;
+} Gfx;
+
+#define _SHIFTL(v, s, w)    ((uintptr_t)(((uintptr_t)(v) & ((0x01 << (w)) - 1)) << (s)))
+#define _SHIFTR(v, s, w)    ((uintptr_t)(((uintptr_t)(v) >> (s)) & ((0x01 << (w)) - 1)))
+
+#define G_VTX               0x01
+#define G_MODIFYVTX         0x02
+#define G_CULLDL            0x03
+#define G_BRANCH_Z          0x04
+#define G_TRI1              0x05
+#define G_TRI2              0x06
+#define G_QUAD              0x07
+#define G_GEOMETRYMODE      0xd9
+#define G_MTX               0xda
+#define G_MOVEWORD          0xdb
+#define G_MOVEMEM           0xdc
+#define G_DL                0xde
+#define G_ENDDL             0xdf
+#define G_NOOP              0xe0
+#define G_SETOTHERMODE_L    0xe2
+#define G_SETOTHERMODE_H    0xe3
+#define G_TEXRECT           0xe4
+#define G_RDPLOADSYNC       0xe6
+#define G_RDPPIPESYNC       0xe7
+#define G_RDPTILESYNC       0xe8
+#define G_RDPFULLSYNC       0xe9
+#define G_SETSCISSOR        0xed
+#define G_LOADTLUT          0xf0
+#define G_SETTILESIZE       0xf2
+#define G_LOADBLOCK         0xf3
+#define G_LOADTILE          0xf4
+#define G_SETTILE           0xf5
+#define G_FILLRECT          0xf6
+#define G_SETFILLCOLOR      0xf7
+#define G_SETPRIMCOLOR      0xfa
+#define G_SETCOMBINE        0xfc
+#define G_SETTIMG           0xfd
+#define G_SETZIMG           0xfe
+#define G_SETCIMG           0xff
+
+#define G_DL_PUSH           0x00
+#define G_DL_NOPUSH         0x01
+
+#define G_MTX_NOPUSH        0x00
+#define G_MTX_PUSH          0x01
+#define G_MTX_MUL           0x00
+#define G_MTX_LOAD          0x02
+#define G_MTX_MODELVIEW     0x00
+#define G_MTX_PROJECTION    0x04
+
+#define G_MW_MATRIX         0x02
+#define G_MW_SEGMENT        0x06
+#define G_MW_PERSPNORM      0x0e
+
+#define G_MAXZ              0x03ff
+
+#define G_IM_FMT_RGBA       0
+#define G_IM_FMT_YUV        1
+#define G_IM_FMT_CI         2
+#define G_IM_FMT_IA         3
+#define G_IM_FMT_I          4
+
+#define G_IM_SIZ_4b         0
+#define G_IM_SIZ_8b         1
+#define G_IM_SIZ_16b        2
+#define G_IM_SIZ_32b        3
+
+#define G_IM_SIZ_4b_LOAD_BLOCK      G_IM_SIZ_16b
+#define G_IM_SIZ_8b_LOAD_BLOCK      G_IM_SIZ_16b
+#define G_IM_SIZ_16b_LOAD_BLOCK     G_IM_SIZ_16b
+#define G_IM_SIZ_32b_LOAD_BLOCK     G_IM_SIZ_32b
+
+#define G_TX_LOADTILE       7
+#define G_TX_RENDERTILE     0
+
+#define G_TX_NOMIRROR       0
+#define G_TX_WRAP           0
+#define G_TX_MIRROR         0x1
+#define G_TX_CLAMP          0x2
+#define G_TX_NOMASK         0
+#define G_TX_NOLOD          0
+
+#define G_TX_DXT_FRAC       11
+
+#define G_MDSFT_TEXTLUT     14
+#define G_TT_NONE           (0 << G_MDSFT_TEXTLUT)
+#define G_TT_RGBA16         (2 << G_MDSFT_TEXTLUT)
+#define G_TT_IA16           (3 << G_MDSFT_TEXTLUT)
+
+#define G_SC_NON_INTERLACE  0
+
+#define gDma1p(pkt, c, s, l, p)                                         \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL((c), 24, 8) | _SHIFTL((p), 16, 8) |         \
+                    _SHIFTL((l), 0, 16));                               \
+    _g->words.w1 = (uintptr_t)(s);                                      \
+}
+
+#define gSPNoOp(pkt)                                                    \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = _SHIFTL(G_NOOP, 24, 8);                              \
+    _g->words.w1 = 0;                                                   \
+}
+
+#define gSPDisplayList(pkt, dl)     gDma1p(pkt, G_DL, dl, 0, G_DL_PUSH)
+#define gSPBranchList(pkt, dl)      gDma1p(pkt, G_DL, dl, 0, G_DL_NOPUSH)
+
+#define gSPEndDisplayList(pkt)                                          \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = _SHIFTL(G_ENDDL, 24, 8);                             \
+    _g->words.w1 = 0;                                                   \
+}
+
+#define gsSPEndDisplayList()        {{ _SHIFTL(G_ENDDL, 24, 8), 0 }}
+#define gsSPDisplayList(dl)         {{ _SHIFTL(G_DL, 24, 8) | _SHIFTL(G_DL_PUSH, 16, 8), (uintptr_t)(dl) }}
+#define gsSPNoOp()                  {{ _SHIFTL(G_NOOP, 24, 8), 0 }}
+
+#define gSPVertex(pkt, v, n, v0)                                        \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_VTX, 24, 8) | _SHIFTL((n), 12, 8) |       \
+                    _SHIFTL((v0) + (n), 1, 7));                         \
+    _g->words.w1 = (uintptr_t)(v);                                      \
+}
+
+#define gsSPVertex(v, n, v0)                                            \
+    {{ (_SHIFTL(G_VTX, 24, 8) | _SHIFTL((n), 12, 8) |                   \
+        _SHIFTL((v0) + (n), 1, 7)), (uintptr_t)(v) }}
+
+#define __gsSP1Triangle_w1(v0, v1, v2)                                  \
+    (_SHIFTL((v0) * 2, 16, 8) | _SHIFTL((v1) * 2, 8, 8) |               \
+     _SHIFTL((v2) * 2, 0, 8))
+
+#define __gsSP1Triangle_w1f(v0, v1, v2, flag)                           \
+    (((flag) == 0) ? __gsSP1Triangle_w1(v0, v1, v2) :                   \
+     ((flag) == 1) ? __gsSP1Triangle_w1(v1, v2, v0) :                   \
+                     __gsSP1Triangle_w1(v2, v0, v1))
+
+#define gSP1Triangle(pkt, v0, v1, v2, flag)                             \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_TRI1, 24, 8) |                            \
+                    __gsSP1Triangle_w1f(v0, v1, v2, flag));             \
+    _g->words.w1 = 0;                                                   \
+}
+
+#define gsSP1Triangle(v0, v1, v2, flag)                                 \
+    {{ (_SHIFTL(G_TRI1, 24, 8) | __gsSP1Triangle_w1f(v0, v1, v2, flag)), 0 }}
+
+#define gSP2Triangles(pkt, v00, v01, v02, flag0, v10, v11, v12, flag1)  \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_TRI2, 24, 8) |                            \
+                    __gsSP1Triangle_w1f(v00, v01, v02, flag0));         \
+    _g->words.w1 = __gsSP1Triangle_w1f(v10, v11, v12, flag1);           \
+}
+
+#define gsSP2Triangles(v00, v01, v02, flag0, v10, v11, v12, flag1)      \
+    {{ (_SHIFTL(G_TRI2, 24, 8) |                                        \
+        __gsSP1Triangle_w1f(v00, v01, v02, flag0)),                     \
+       __gsSP1Triangle_w1f(v10, v11, v12, flag1) }}
+
+#define gSPMatrix(pkt, m, p)                                            \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_MTX, 24, 8) | _SHIFTL((sizeof(Mtx) - 1) / 8, 19, 5) | \
+                    _SHIFTL((p) ^ G_MTX_PUSH, 0, 8));                   \
+    _g->words.w1 = (uintptr_t)(m);                                      \
+}
+
+#define gMoveWd(pkt, index, offset, data)                               \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_MOVEWORD, 24, 8) |                        \
+                    _SHIFTL((index), 16, 8) | _SHIFTL((offset), 0, 16)); \
+    _g->words.w1 = (uintptr_t)(data);                                   \
+}
+
+#define gSPSegment(pkt, segment, base)  gMoveWd(pkt, G_MW_SEGMENT, (segment) * 4, base)
+#define gSPPerspNormalize(pkt, s)       gMoveWd(pkt, G_MW_PERSPNORM, 0, (s))
+
+#define gDPNoParam(pkt, cmd)                                            \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = _SHIFTL(cmd, 24, 8);                                 \
+    _g->words.w1 = 0;                                                   \
+}
+
+#define gsDPNoParam(cmd)            {{ _SHIFTL(cmd, 24, 8), 0 }}
+
+#define gDPPipeSync(pkt)            gDPNoParam(pkt, G_RDPPIPESYNC)
+#define gDPTileSync(pkt)            gDPNoParam(pkt, G_RDPTILESYNC)
+#define gDPLoadSync(pkt)            gDPNoParam(pkt, G_RDPLOADSYNC)
+#define gDPFullSync(pkt)            gDPNoParam(pkt, G_RDPFULLSYNC)
+#define gsDPPipeSync()              gsDPNoParam(G_RDPPIPESYNC)
+#define gsDPTileSync()              gsDPNoParam(G_RDPTILESYNC)
+#define gsDPLoadSync()              gsDPNoParam(G_RDPLOADSYNC)
+#define gsDPFullSync()              gsDPNoParam(G_RDPFULLSYNC)
+
+#define gSPSetOtherMode(pkt, cmd, sft, len, data)                       \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(cmd, 24, 8) |                               \
+                    _SHIFTL(32 - (sft) - (len), 8, 8) |                 \
+                    _SHIFTL((len) - 1, 0, 8));                          \
+    _g->words.w1 = (uintptr_t)(data);                                   \
+}
+
+#define gDPSetTextureLUT(pkt, type)                                     \
+    gSPSetOtherMode(pkt, G_SETOTHERMODE_H, G_MDSFT_TEXTLUT, 2, type)
+
+#define gDPSetTextureImage(pkt, f, s, w, i)                             \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_SETTIMG, 24, 8) | _SHIFTL(f, 21, 3) |     \
+                    _SHIFTL(s, 19, 2) | _SHIFTL((w) - 1, 0, 12));       \
+    _g->words.w1 = (uintptr_t)(i);                                      \
+}
+
+#define gDPSetTile(pkt, fmt, siz, line, tmem, tile, palette, cmt,       \
+                   maskt, shiftt, cms, masks, shifts)                   \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_SETTILE, 24, 8) | _SHIFTL(fmt, 21, 3) |   \
+                    _SHIFTL(siz, 19, 2) | _SHIFTL(line, 9, 9) |         \
+                    _SHIFTL(tmem, 0, 9));                               \
+    _g->words.w1 = (_SHIFTL(tile, 24, 3) | _SHIFTL(palette, 20, 4) |    \
+                    _SHIFTL(cmt, 18, 2) | _SHIFTL(maskt, 14, 4) |       \
+                    _SHIFTL(shiftt, 10, 4) | _SHIFTL(cms, 8, 2) |       \
+                    _SHIFTL(masks, 4, 4) | _SHIFTL(shifts, 0, 4));      \
+}
+
+#define gDPLoadBlock(pkt, tile, uls, ult, lrs, dxt)                     \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_LOADBLOCK, 24, 8) |                       \
+                    _SHIFTL(uls, 12, 12) | _SHIFTL(ult, 0, 12));        \
+    _g->words.w1 = (_SHIFTL(tile, 24, 3) |                              \
+                    _SHIFTL((lrs), 12, 12) | _SHIFTL(dxt, 0, 12));      \
+}
+
+#define gDPLoadTLUTCmd(pkt, tile, count)                                \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = _SHIFTL(G_LOADTLUT, 24, 8);                          \
+    _g->words.w1 = (_SHIFTL((tile), 24, 3) | _SHIFTL((count), 14, 10)); \
+}
+
+#define gDPSetTileSize(pkt, t, uls, ult, lrs, lrt)                      \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_SETTILESIZE, 24, 8) |                     \
+                    _SHIFTL(uls, 12, 12) | _SHIFTL(ult, 0, 12));        \
+    _g->words.w1 = (_SHIFTL(t, 24, 3) |                                 \
+                    _SHIFTL(lrs, 12, 12) | _SHIFTL(lrt, 0, 12));        \
+}
+
+#define gDPSetPrimColor(pkt, m, l, r, g, b, a)                          \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_SETPRIMCOLOR, 24, 8) |                    \
+                    _SHIFTL(m, 8, 8) | _SHIFTL(l, 0, 8));               \
+    _g->words.w1 = (_SHIFTL(r, 24, 8) | _SHIFTL(g, 16, 8) |             \
+                    _SHIFTL(b, 8, 8) | _SHIFTL(a, 0, 8));               \
+}
+
+#define gDPFillRectangle(pkt, ulx, uly, lrx, lry)                       \
+{                                                                       \
+    Gfx* _g = (Gfx*)(pkt);                                              \
+    _g->words.w0 = (_SHIFTL(G_FILLRECT, 24, 8) |                        \
+                    _SHIFTL((lrx), 14, 10) | _SHIFTL((lry), 2, 10));    \
+    _g->words.w1 = (_SHIFTL((ulx), 14, 10) | _SHIFTL((uly), 2, 10));    \
+}
+
+#endif
@@ -0,0 +1,349 @@
+#include "tile_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "megatextures/megatexture_tilecache.h"
+
+#define MAX_LINE_LENGTH     1024
+#define MAX_TRACE_LAYERS    16
+
+static u32 gNextTileSerial = 1;
+
+int gHostTileTraceSmallPercent = 0;
+
+static void hostTileTraceBuildLayer(struct MTImageLayer* layer, int xTiles, int yTiles) {
+    int tileCount = xTiles * yTiles;
+    u32 romAddress = hostRomAlloc(tileCount * MT_TILE_SIZE);
+    u32* tileOffsets = calloc(tileCount, sizeof(u32));
+    int axisSize = 1;
+
+    while (axisSize < xTiles || axisSize < yTiles) {
+        axisSize <<= 1;
+    }
+
+    // tiles are placed in morton order like the level exporter does
+    u32* tileData = hostRomPointer(romAddress);
+    int romTile = 0;
+
+    for (int morton = 0; morton < axisSize * axisSize; ++morton) {
+        int x = 0;
+        int y = 0;
+
+        for (int bit = 0; (1 << bit) < axisSize; ++bit) {
+            x |= ((morton >> (bit * 2)) & 1) << bit;
+            y |= ((morton >> (bit * 2 + 1)) & 1) << bit;
+        }
+
+        if (x >= xTiles || y >= yTiles) {
+            continue;
+        }
+
+        // fill each tile with a unique value so loads can be checked
+        for (int word = 0; word < MT_TILE_SIZE / sizeof(u32); ++word) {
+            *tileData++ = gNextTileSerial;
+        }
+
+        ++gNextTileSerial;
+
+        u32 offset = (romTile * MT_TILE_SIZE / 8) << 8;
+
+        // scatter the small tiles with a hash of the serial
+        if (((gNextTileSerial - 1) * 2654435761u >> 16) % 100 < gHostTileTraceSmallPercent) {
+            tileOffsets[x + y * xTiles] = ((u32)MTTileFormatI4 << 29) | offset | (MT_TILE_SIZE / 4 / 8 - 1);
+        } else {
+            tileOffsets[x + y * xTiles] = offset | (MT_TILE_SIZE / 8 - 1);
+        }
+
+        ++romTile;
+    }
+
+    layer->tileSource = (u64*)(uintptr_t)romAddress;
+    layer->tileOffsets = tileOffsets;
+    layer->xTiles = xTiles;
+    layer->yTiles = yTiles;
+    layer->maxTileAxisTileCount = xTiles > yTiles ? xTiles : yTiles;
+}
+
+struct MTTileIndex* hostTileTraceBuildIndex(struct MTTileIndex* result, int layerCount, int* xTiles, int* yTiles) {
+    memset(result, 0, sizeof(struct MTTileIndex));
+
+    result->layerCount = layerCount;
+    result->imageLayers = calloc(layerCount, sizeof(struct MTImageLayer));
+    result->minUv.x = 0.0f;
+    result->minUv.y = 0.0f;
+    result->maxUv.x = 1.0f;
+    result->maxUv.y = 1.0f;
+
+    for (int i = 0; i < layerCount; ++i) {
+        struct MTImageLayer* layer = &result->imageLayers[i];
+
+        hostTileTraceBuildLayer(layer, xTiles[i], yTiles[i]);
+        layer->uShift = i;
+        layer->vShift = i;
+        layer->parentLayer = i + 1 < layerCount ? i + 1 : MT_NO_PARENT_LAYER;
+    }
+
+    return result;
+}
+
+void hostTileTraceAddRipChain(struct MTTileIndex* index, int axis, int ratioShift, int layerCount, int* xTiles, int* yTiles) {
+    int firstLayer = MT_TILE_INDEX_LAYER_COUNT(index);
+
+    index->imageLayers = realloc(index->imageLayers, sizeof(struct MTImageLayer) * (firstLayer + layerCount));
+    index->ripChains = realloc(index->ripChains, sizeof(struct MTRipChain) * (index->ripChainCount + 1));
+
+    struct MTRipChain* chain = &index->ripChains[index->ripChainCount];
+    chain->firstLayer = firstLayer;
+    chain->layerCount = layerCount;
+    chain->axis = axis;
+    chain->ratioShift = ratioShift;
+    ++index->ripChainCount;
+    index->ripLayerCount += layerCount;
+
+    for (int i = 0; i < layerCount; ++i) {
+        struct MTImageLayer* layer = &index->imageLayers[firstLayer + i];
+
+        hostTileTraceBuildLayer(layer, xTiles[i], yTiles[i]);
+        layer->uShift = axis == MTRipAxisU ? i + ratioShift : i;
+        layer->vShift = axis == MTRipAxisV ? i + ratioShift : i;
+
+        if (i + 1 < layerCount) {
+            layer->parentLayer = firstLayer + i + 1;
+        } else {
+            // the regular layer with the texels of the squashed axis
+            layer->parentLayer = MIN(i + ratioShift, index->layerCount - 1);
+        }
+    }
+}
+
+static struct HostTileTraceFrame* hostTileTraceAddFrame(struct HostTileTrace* trace) {
+    trace->frames = realloc(trace->frames, sizeof(struct HostTileTraceFrame) * (trace->frameCount + 1));
+    struct HostTileTraceFrame* result = &trace->frames[trace->frameCount];
+    ++trace->frameCount;
+
+    result->requests = NULL;
+    result->requestCount = 0;
+    result->requestCapacity = 0;
+
+    return result;
+}
+
+static void hostTileTraceAddRequest(struct HostTileTraceFrame* frame, struct HostTileRequest* request) {
+    if (frame->requestCount == frame->requestCapacity) {
+        frame->requestCapacity = frame->requestCapacity ? frame->requestCapacity * 2 : 64;
+        frame->requests = realloc(frame->requests, sizeof(struct HostTileRequest) * frame->requestCapacity);
+    }
+
+    frame->requests[frame->requestCount] = *request;
+    ++frame->requestCount;
+}
+
+int hostTileTraceLoad(FILE* file, struct HostTileTrace* trace) {
+    char line[MAX_LINE_LENGTH];
+    int lineNumber = 0;
+
+    memset(trace, 0, sizeof(struct HostTileTrace));
+
+    struct HostTileTraceFrame* currentFrame = NULL;
+
+    while (fgets(line, sizeof(line), file)) {
+        ++lineNumber;
+
+        char* command = strtok(line, " \t\r\n");
+
+        if (!command || command[0] == '#') {
+            continue;
+        }
+
+        if (strcmp(command, "frame") == 0) {
+            currentFrame = hostTileTraceAddFrame(trace);
+        } else if (strcmp(command, "megatexture") == 0) {
+            int id = atoi(strtok(NULL, " \t\r\n"));
+            int layerCount = atoi(strtok(NULL, " \t\r\n"));
+            int xTiles[MAX_TRACE_LAYERS];
+            int yTiles[MAX_TRACE_LAYERS];
+
+            if (id != trace->indexCount || layerCount <= 0 || layerCount > MAX_TRACE_LAYERS) {
+                fprintf(stderr, "line %d: megatexture ids must be sequential with 1-%d layers\n", lineNumber, MAX_TRACE_LAYERS);
+                return 0;
+            }
+
+            for (int i = 0; i < layerCount; ++i) {
+                char* x = strtok(NULL, " \t\r\n");
+                char* y = strtok(NULL, " \t\r\n");
+
+                if (!x || !y) {
+                    fprintf(stderr, "line %d: missing layer size\n", lineNumber);
+                    return 0;
+                }
+
+                xTiles[i] = atoi(x);
+                yTiles[i] = atoi(y);
+            }
+
+            trace->indexes = realloc(trace->indexes, sizeof(struct MTTileIndex) * (trace->indexCount + 1));
+            struct MTTileIndex* index = hostTileTraceBuildIndex(&trace->indexes[trace->indexCount], layerCount, xTiles, yTiles);
+            ++trace->indexCount;
+
+            char* rip;
+
+            while ((rip = strtok(NULL, " \t\r\n"))) {
+                char* axis = strtok(NULL, " \t\r\n");
+                char* ratioShift = strtok(NULL, " \t\r\n");
+                char* ripLayerCount = strtok(NULL, " \t\r\n");
+
+                if (strcmp(rip, "rip") != 0 || !axis || !ratioShift || !ripLayerCount) {
+                    fprintf(stderr, "line %d: expected rip <axis> <ratioShift> <layerCount> ...\n", lineNumber);
+                    return 0;
+                }
+
+                layerCount = atoi(ripLayerCount);
+
+                if (layerCount <= 0 || layerCount > MAX_TRACE_LAYERS || MT_TILE_INDEX_LAYER_COUNT(index) + layerCount > MT_NO_PARENT_LAYER) {
+                    fprintf(stderr, "line %d: rip chains must have 1-%d layers\n", lineNumber, MAX_TRACE_LAYERS);
+                    return 0;
+                }
+
+                for (int i = 0; i < layerCount; ++i) {
+                    char* x = strtok(NULL, " \t\r\n");
+                    char* y = strtok(NULL, " \t\r\n");
+
+                    if (!x || !y) {
+                        fprintf(stderr, "line %d: missing layer size\n", lineNumber);
+                        return 0;
+                    }
+
+                    xTiles[i] = atoi(x);
+                    yTiles[i] = atoi(y);
+                }
+
+                hostTileTraceAddRipChain(index, atoi(axis), atoi(ratioShift), layerCount, xTiles, yTiles);
+            }
+        } else if (strcmp(command, "r") == 0) {
+            char* args[4];
+
+            for (int i = 0; i < 4; ++i) {
+                args[i] = strtok(NULL, " \t\r\n");
+
+                if (!args[i]) {
+                    fprintf(stderr, "line %d: expected r <id> <x> <y> <lod>\n", lineNumber);
+                    return 0;
+                }
+            }
+
+            struct HostTileRequest request;
+            int index = atoi(args[0]);
+            request.index = index;
+            request.x = atoi(args[1]);
+            request.y = atoi(args[2]);
+            request.lod = atoi(args[3]);
+
+            if (index < 0 || index >= trace->indexCount || request.lod >= MT_TILE_INDEX_LAYER_COUNT(&trace->indexes[index])) {
+                fprintf(stderr, "line %d: request for an unknown megatexture or lod\n", lineNumber);
+                return 0;
+            }
+
+            struct MTImageLayer* layer = &trace->indexes[index].imageLayers[request.lod];
+
+            if (request.x >= layer->xTiles || request.y >= layer->yTiles) {
+                fprintf(stderr, "line %d: tile is outside the image layer\n", lineNumber);
+                return 0;
+            }
+
+            if (!currentFrame) {
+                currentFrame = hostTileTraceAddFrame(trace);
+            }
+
+            hostTileTraceAddRequest(currentFrame, &request);
+        } else {
+            fprintf(stderr, "line %d: unknown command %s\n", lineNumber, command);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void hostTileTraceFree(struct HostTileTrace* trace) {
+    for (int i = 0; i < trace->indexCount; ++i) {
+        for (int layer = 0; layer < MT_TILE_INDEX_LAYER_COUNT(&trace->indexes[i]); ++layer) {
+            free(trace->indexes[i].imageLayers[layer].tileOffsets);
+        }
+
+        free(trace->indexes[i].imageLayers);
+        free(trace->indexes[i].ripChains);
+    }
+
+    for (int i = 0; i < trace->frameCount; ++i) {
+        free(trace->frames[i].requests);
+    }
+
+    free(trace->indexes);
+    free(trace->frames);
+    memset(trace, 0, sizeof(struct HostTileTrace));
+}
+
+/////////////////////
+// recording
+/////////////////////
+
+static FILE* gRecordFile;
+static struct MTTileIndex** gRecordedIndexes;
+static int gRecordedIndexCount;
+
+void hostTileTraceRecord(FILE* file) {
+    gRecordFile = file;
+    free(gRecordedIndexes);
+    gRecordedIndexes = NULL;
+    gRecordedIndexCount = 0;
+}
+
+#ifdef MT_TILE_TRACE
+
+void mtTileCacheTraceFrame(struct MTTileCache* tileCache) {
+    if (gRecordFile) {
+        fprintf(gRecordFile, "frame\n");
+    }
+}
+
+void mtTileCacheTraceRequest(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod) {
+    if (!gRecordFile) {
+        return;
+    }
+
+    int id = 0;
+
+    while (id < gRecordedIndexCount && gRecordedIndexes[id] != index) {
+        ++id;
+    }
+
+    if (id == gRecordedIndexCount) {
+        gRecordedIndexes = realloc(gRecordedIndexes, sizeof(struct MTTileIndex*) * (gRecordedIndexCount + 1));
+        gRecordedIndexes[id] = index;
+        ++gRecordedIndexCount;
+
+        fprintf(gRecordFile, "megatexture %d %d", id, index->layerCount);
+
+        for (int i = 0; i < index->layerCount; ++i) {
+            fprintf(gRecordFile, " %d %d", index->imageLayers[i].xTiles, index->imageLayers[i].yTiles);
+        }
+
+        for (int chainIndex = 0; chainIndex < index->ripChainCount; ++chainIndex) {
+            struct MTRipChain* chain = &index->ripChains[chainIndex];
+
+            fprintf(gRecordFile, " rip %d %d %d", chain->axis, chain->ratioShift, chain->layerCount);
+
+            for (int i = chain->firstLayer; i < chain->firstLayer + chain->layerCount; ++i) {
+                fprintf(gRecordFile, " %d %d", index->imageLayers[i].xTiles, index->imageLayers[i].yTiles);
+            }
+        }
+
+        fprintf(gRecordFile, "\n");
+    }
+
+    fprintf(gRecordFile, "r %d %d %d %d\n", id, x, y, lod);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __HOST_TILE_TRACE_H__
+#define __HOST_TILE_TRACE_H__
+
+#include <stdio.h>
+#include "megatextures/tile_index.h"
+
+// A tile trace is a text file describing every call to
+// mtTileCacheRequestTile grouped by frame
+//
+//   megatexture <id> <layerCount> <xTiles> <yTiles> ... [rip <axis> <ratioShift> <layerCount> <xTiles> <yTiles> ...]...
+//   frame
+//   r <id> <x> <y> <lod>
+//
+// megatexture lines list the tile dimensions of each image layer and
+// must come before the first request for that id. Each rip chain, see
+// struct MTRipChain, adds its layers after the ones before it
+
+struct HostTileRequest {
+    u16 index;
+    u8 x;
+    u8 y;
+    u8 lod;
+};
+
+struct HostTileTraceFrame {
+    struct HostTileRequest* requests;
+    int requestCount;
+    int requestCapacity;
+};
+
+struct HostTileTrace {
+    struct MTTileIndex* indexes;
+    int indexCount;
+    struct HostTileTraceFrame* frames;
+    int frameCount;
+};
+
+int hostTileTraceLoad(FILE* file, struct HostTileTrace* trace);
+void hostTileTraceFree(struct HostTileTrace* trace);
+
+// the percent of tiles in indexes built after this is set that are
+// stored as I4 and take half a slot in the tile cache
+extern int gHostTileTraceSmallPercent;
+
+// builds an index with image layers backed by rom but no mesh
+struct MTTileIndex* hostTileTraceBuildIndex(struct MTTileIndex* result, int layerCount, int* xTiles, int* yTiles);
+// adds a rip chain to an index built by hostTileTraceBuildIndex
+void hostTileTraceAddRipChain(struct MTTileIndex* index, int axis, int ratioShift, int layerCount, int* xTiles, int* yTiles);
+
+// while a file is set every request made to the tile cache
+// is written to it. Requires MT_TILE_TRACE. The game records the same
+// format over the debugger link, see src/megatextures/megatexture_trace.c
+void hostTileTraceRecord(FILE* file);
+
+#endif
@@ -0,0 +1,366 @@
+// Culls synthetic levels of megatexture bounding boxes against a camera
+// walking through them. Compares testing every box against the frustum
+// like megatextureRender does with walking a bvh built the same way the
+// exporter builds it, with and without remembering the plane that last
+// culled each node
+//
+//   bvh_bench [--counts 100,1000,10000] [--frames 240] [--repeat 20] [--seed 1]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "host.h"
+#include "bench_util.h"
+#include "megatextures/megatexture_bvh.h"
+#include "math/quaternion.h"
+
+#define MAX_SWEEP_VALUES        16
+#define BENCH_MAX_LEAF_SIZE     4
+// the level grows with the surface count so the camera
+// sees about as many surfaces in each level
+#define BENCH_SURFACE_SPACING   4.0f
+#define BENCH_EYE_HEIGHT        1.5f
+
+#define BENCH_MODE_LINEAR       0
+#define BENCH_MODE_BVH          1
+#define BENCH_MODE_BVH_CACHED   2
+#define BENCH_MODE_COUNT        3
+
+struct BenchItem {
+    struct Box3D box;
+    struct Vector3 center;
+    int index;
+};
+
+struct BenchLevel {
+    struct Box3D* boxes;
+    int count;
+    struct MTBvhNode* nodes;
+    int nodeCount;
+    u16* indices;
+    int indexCount;
+    float size;
+};
+
+struct BenchResult {
+    double planeTests;
+    double candidates;
+    double visible;
+    double usPerFrame;
+    int missed;
+};
+
+static unsigned gBenchSeed = 1;
+static int gBenchSortAxis;
+
+static float benchRandomFloat(float min, float max) {
+    gBenchSeed = gBenchSeed * 1103515245 + 12345;
+    return min + (max - min) * ((gBenchSeed >> 8) & 0xFFFF) / 65535.0f;
+}
+
+static double benchNowUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0;
+}
+
+static float benchAxis(struct Vector3* vector, int axis) {
+    return axis == 0 ? vector->x : (axis == 1 ? vector->y : vector->z);
+}
+
+static int benchCompareItems(const void* a, const void* b) {
+    float aValue = benchAxis(&((struct BenchItem*)a)->center, gBenchSortAxis);
+    float bValue = benchAxis(&((struct BenchItem*)b)->center, gBenchSortAxis);
+    return (aValue > bValue) - (aValue < bValue);
+}
+
+// same as build_bvh_node in tools/export_level/megatexture.lua
+static void benchBuildNode(struct BenchLevel* level, int nodeIndex, struct BenchItem* items, int count) {
+    struct MTBvhNode* node = &level->nodes[nodeIndex];
+    struct Box3D centerBox;
+
+    node->boundingBox = items[0].box;
+    centerBox.min = items[0].center;
+    centerBox.max = items[0].center;
+
+    for (int i = 1; i < count; ++i) {
+        box3DUnion(&node->boundingBox, &items[i].box, &node->boundingBox);
+        box3DUnionPoint(&centerBox, &items[i].center, &centerBox);
+    }
+
+    if (count <= BENCH_MAX_LEAF_SIZE) {
+        node->first = level->indexCount;
+        node->indexCount = count;
+
+        for (int i = 0; i < count; ++i) {
+            level->indices[level->indexCount++] = items[i].index;
+        }
+
+        return;
+    }
+
+    struct Vector3 extent;
+    vector3Sub(&centerBox.max, &centerBox.min, &extent);
+    gBenchSortAxis = 0;
+
+    if (extent.y > benchAxis(&extent, gBenchSortAxis)) {
+        gBenchSortAxis = 1;
+    }
+
+    if (extent.z > benchAxis(&extent, gBenchSortAxis)) {
+        gBenchSortAxis = 2;
+    }
+
+    qsort(items, count, sizeof(struct BenchItem), benchCompareItems);
+
+    int first = level->nodeCount;
+    int half = count / 2;
+    level->nodeCount += 2;
+    node->first = first;
+    node->indexCount = 0;
+
+    benchBuildNode(level, first, items, half);
+    benchBuildNode(level, first + 1, items + half, count - half);
+}
+
+// floors and walls scattered over a square level
+static void benchGenerateLevel(struct BenchLevel* level, int count) {
+    level->count = count;
+    level->size = sqrtf((float)count) * BENCH_SURFACE_SPACING;
+    level->boxes = malloc(sizeof(struct Box3D) * count);
+    level->nodes = malloc(sizeof(struct MTBvhNode) * count * 2);
+    level->indices = malloc(sizeof(u16) * count);
+    level->nodeCount = 1;
+    level->indexCount = 0;
+
+    struct BenchItem* items = malloc(sizeof(struct BenchItem) * count);
+
+    for (int i = 0; i < count; ++i) {
+        struct Box3D* box = &level->boxes[i];
+        float width = benchRandomFloat(1.0f, 4.0f);
+        float height = benchRandomFloat(1.0f, 4.0f);
+
+        box->min.x = benchRandomFloat(0.0f, level->size);
+        box->min.y = benchRandomFloat(0.0f, 4.0f);
+        box->min.z = benchRandomFloat(0.0f, level->size);
+        box->max = box->min;
+
+        switch (i % 3) {
+            case 0:
+                box->max.x += width;
+                box->max.z += height;
+                break;
+            case 1:
+                box->max.x += width;
+                box->max.y += height;
+                break;
+            default:
+                box->max.z += width;
+                box->max.y += height;
+                break;
+        }
+
+        items[i].box = *box;
+        vector3Lerp(&box->min, &box->max, 0.5f, &items[i].center);
+        items[i].index = i;
+    }
+
+    benchBuildNode(level, 0, items, count);
+    free(items);
+}
+
+static void benchFreeLevel(struct BenchLevel* level) {
+    free(level->boxes);
+    free(level->nodes);
+    free(level->indices);
+}
+
+// walks in a circle around the middle of the level looking ahead
+static void benchCameraAtFrame(struct BenchLevel* level, int frame, int frameCount, struct CameraMatrixInfo* cameraInfo) {
+    struct Camera camera;
+    cameraInit(&camera, 70.0f, 0.05f * SCENE_SCALE, 20.0f * SCENE_SCALE);
+
+    float angle = 2.0f * M_PI * frame / frameCount;
+    float radius = level->size * 0.35f;
+
+    camera.transform.position.x = level->size * 0.5f + cosf(angle) * radius;
+    camera.transform.position.y = BENCH_EYE_HEIGHT;
+    camera.transform.position.z = level->size * 0.5f + sinf(angle) * radius;
+
+    // the camera looks down -z, turn it to face along the circle
+    // and sway a little so the view doesn't only turn one way
+    quatAxisAngle(&gUp, -angle + 0.3f * sinf(angle * 7.0f), &camera.transform.rotation);
+
+    cameraSetupCullingInformation(&camera, 4.0f / 3.0f, cameraInfo);
+}
+
+static int benchIsOutside(struct FrustrumCullingInformation* frustrum, struct Box3D* box, int* planeTests) {
+    // same as isOutsideFrustrum but counting the planes tested
+    for (int i = 0; i < frustrum->usedClippingPlaneCount; ++i) {
+        struct Vector3 closestPoint;
+        struct Vector3* normal = &frustrum->clippingPlanes[i].normal;
+
+        ++*planeTests;
+
+        closestPoint.x = normal->x < 0.0f ? box->min.x : box->max.x;
+        closestPoint.y = normal->y < 0.0f ? box->min.y : box->max.y;
+        closestPoint.z = normal->z < 0.0f ? box->min.z : box->max.z;
+
+        if (planePointDistance(&frustrum->clippingPlanes[i], &closestPoint) < 0.00001f) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int benchPopCount(u32* set, int words) {
+    int result = 0;
+
+    for (int i = 0; i < words; ++i) {
+        result += __builtin_popcount(set[i]);
+    }
+
+    return result;
+}
+
+static void benchRun(struct BenchLevel* level, struct CameraMatrixInfo* cameras, int frameCount, int repeat, int mode, struct BenchResult* result) {
+    int words = (level->count + 31) >> 5;
+    u32* linearSet = calloc(words, sizeof(u32));
+    u32* set = calloc(words, sizeof(u32));
+    u8* lastPlanes = mode == BENCH_MODE_BVH_CACHED ? calloc(level->nodeCount, sizeof(u8)) : NULL;
+    int planeTests = 0;
+
+    memset(result, 0, sizeof(struct BenchResult));
+
+    double startTime = benchNowUs();
+
+    for (int pass = 0; pass < repeat; ++pass) {
+        for (int frame = 0; frame < frameCount; ++frame) {
+            struct FrustrumCullingInformation* frustrum = &cameras[frame].cullingInformation;
+            memset(set, 0, sizeof(u32) * words);
+
+            if (mode != BENCH_MODE_LINEAR) {
+                mtBvhCull(level->nodes, level->indices, frustrum, lastPlanes, set);
+            } else {
+                for (int i = 0; i < level->count; ++i) {
+                    if (!benchIsOutside(frustrum, &level->boxes[i], &planeTests)) {
+                        set[i >> 5] |= 1u << (i & 31);
+                    }
+                }
+            }
+        }
+    }
+
+    result->usPerFrame = (benchNowUs() - startTime) / (repeat * frameCount);
+
+    // one more untimed pass to count and check what was culled
+    for (int frame = 0; frame < frameCount; ++frame) {
+        struct FrustrumCullingInformation* frustrum = &cameras[frame].cullingInformation;
+        memset(set, 0, sizeof(u32) * words);
+        memset(linearSet, 0, sizeof(u32) * words);
+        planeTests = 0;
+        gMtBvhPlaneTestCount = 0;
+
+        int linearTests = 0;
+
+        for (int i = 0; i < level->count; ++i) {
+            if (!benchIsOutside(frustrum, &level->boxes[i], &linearTests)) {
+                linearSet[i >> 5] |= 1u << (i & 31);
+            }
+        }
+
+        if (mode != BENCH_MODE_LINEAR) {
+            mtBvhCull(level->nodes, level->indices, frustrum, lastPlanes, set);
+            planeTests = gMtBvhPlaneTestCount;
+        } else {
+            memcpy(set, linearSet, sizeof(u32) * words);
+            planeTests = linearTests;
+        }
+
+        for (int i = 0; i < words; ++i) {
+            // a surface in the frustum the bvh culled
+            result->missed += __builtin_popcount(linearSet[i] & ~set[i]);
+        }
+
+        result->planeTests += planeTests;
+        result->candidates += benchPopCount(set, words);
+        result->visible += benchPopCount(linearSet, words);
+    }
+
+    result->planeTests /= frameCount;
+    result->candidates /= frameCount;
+    result->visible /= frameCount;
+
+    free(linearSet);
+    free(set);
+    free(lastPlanes);
+}
+
+int main(int argc, char** argv) {
+    int counts[MAX_SWEEP_VALUES] = {100, 1000, 10000};
+    int countCount = 3;
+    int frameCount = 240;
+    int repeat = 20;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--counts") == 0 && i + 1 < argc) {
+            countCount = hostParseList(argv[++i], counts, MAX_SWEEP_VALUES);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frameCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            gBenchSeed = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: bvh_bench [--counts 100,1000,10000] [--frames 240] [--repeat 20] [--seed 1]\n");
+            return 1;
+        }
+    }
+
+    if (frameCount <= 0 || repeat <= 0) {
+        fprintf(stderr, "--frames and --repeat must be positive\n");
+        return 1;
+    }
+
+    struct CameraMatrixInfo* cameras = malloc(sizeof(struct CameraMatrixInfo) * frameCount);
+
+    printf("%d frames, each timed %d times\n", frameCount, repeat);
+    printf("%8s %6s %-12s %10s %12s %10s %10s %6s\n",
+        "surfaces", "nodes", "cull", "in view/f", "candidates/f", "tests/f", "us/f", "missed"
+    );
+
+    for (int countIndex = 0; countIndex < countCount; ++countIndex) {
+        if (counts[countIndex] <= 0 || counts[countIndex] > 0xFFFF) {
+            fprintf(stderr, "surface counts must be between 1 and %d\n", 0xFFFF);
+            return 1;
+        }
+
+        struct BenchLevel level;
+        benchGenerateLevel(&level, counts[countIndex]);
+
+        for (int frame = 0; frame < frameCount; ++frame) {
+            benchCameraAtFrame(&level, frame, frameCount, &cameras[frame]);
+        }
+
+        static const char* names[] = {"linear", "bvh", "bvh cached"};
+
+        for (int mode = 0; mode < BENCH_MODE_COUNT; ++mode) {
+            struct BenchResult result;
+            benchRun(&level, cameras, frameCount, repeat, mode, &result);
+
+            printf("%8d %6d %-12s %10.1f %12.1f %10.1f %10.2f %6d\n",
+                level.count, level.nodeCount, names[mode], result.visible, result.candidates, result.planeTests, result.usPerFrame, result.missed
+            );
+        }
+
+        benchFreeLevel(&level);
+    }
+
+    free(cameras);
+
+    return 0;
+}
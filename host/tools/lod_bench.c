@@ -0,0 +1,471 @@
+// Renders a floor and a long wall along recorded camera paths and counts
+// the tiles requested and read from the cart each frame. Compares splitting
+// each megatexture into layers with planes parallel to the camera against
+// choosing the tiles of each row from their depth, see gMtRowLod, and
+// against also drawing rip-map layers where the texels are squashed, see
+// gMtRipMaps. --wobble moves the lod bias up and down each frame like a
+// hunting lod controller to compare tiles changing layer as soon as they
+// cross a layer depth against holding the layer depths, see
+// gMtLodHysteresis. switches/f is lodFlipCount of the tile cache
+//
+//   lod_bench [--entries 1024] [--bias 1.5] [--wobble 0.3] [--hysteresis 0,1] [--preload 2] [path.txt ...]
+//   lod_bench --generate-path walk|grazing [--frames 240] > path.txt
+//
+// A path has the camera of each frame on its own line
+//
+//   <x> <y> <z> <yaw> <pitch>
+//
+// in world units and degrees, a yaw of 0 looks down -z. The floor covers
+// x and z from 0 to BENCH_LEVEL_SIZE and the wall stands along x at z = 0.
+// Without any paths both generated paths are used
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "host.h"
+#include "tile_trace.h"
+#include "bench_util.h"
+#include "megatextures/megatexture_tilecache.h"
+#include "megatextures/megatexture_renderer.h"
+#include "megatextures/megatexture_row_cache.h"
+#include "megatextures/megatexture_vertex_cache.h"
+#include "megatextures/megatexture_mesh_cache.h"
+#include "math/quaternion.h"
+#include "graphics/graphics.h"
+
+#define BENCH_HEAP_SIZE         (64 * 1024 * 1024)
+// loading the trace of each run places the tiles in rom again
+#define BENCH_ROM_SIZE          (256 * 1024 * 1024)
+#define BENCH_DL_LENGTH         (64 * 1024)
+#define BENCH_MAX_LAYERS        8
+#define BENCH_MAX_PATHS         16
+#define BENCH_INDEX_COUNT       2
+#define BENCH_MAX_HYSTERESIS    2
+// frames per radian of the lod bias wobble
+#define BENCH_WOBBLE_RATE       0.7f
+
+#define BENCH_LEVEL_SIZE        16.0f
+#define BENCH_WALL_HEIGHT       4.0f
+// 1024 texels across the level
+#define BENCH_TEXEL_SIZE        (BENCH_LEVEL_SIZE / 1024.0f)
+#define BENCH_EYE_HEIGHT        1.5f
+// same as the vertex cache, tile corners in 1/32 texels
+#define BENCH_VERTEX_TILE_SIZE  (32 << 5)
+
+struct BenchFrame {
+    struct Vector3 position;
+    float yaw;
+    float pitch;
+};
+
+struct BenchPath {
+    const char* name;
+    struct BenchFrame* frames;
+    int frameCount;
+};
+
+struct BenchTotals {
+    int requests;
+    int finestRequests;
+    int fetched;
+    int bytes;
+    int fallbacks;
+    int overlaps;
+    int switches;
+};
+
+static int benchLoadPath(const char* filename, struct BenchPath* path) {
+    FILE* file = fopen(filename, "r");
+
+    if (!file) {
+        fprintf(stderr, "could not open %s\n", filename);
+        return 0;
+    }
+
+    char line[256];
+    int capacity = 0;
+    int lineNumber = 0;
+
+    path->name = filename;
+    path->frames = NULL;
+    path->frameCount = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        struct BenchFrame frame;
+        ++lineNumber;
+
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        if (sscanf(line, "%f %f %f %f %f", &frame.position.x, &frame.position.y, &frame.position.z, &frame.yaw, &frame.pitch) != 5) {
+            fprintf(stderr, "%s:%d: expected <x> <y> <z> <yaw> <pitch>\n", filename, lineNumber);
+            fclose(file);
+            return 0;
+        }
+
+        if (path->frameCount == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            path->frames = realloc(path->frames, sizeof(struct BenchFrame) * capacity);
+        }
+
+        path->frames[path->frameCount++] = frame;
+    }
+
+    fclose(file);
+
+    return 1;
+}
+
+// walks across the floor towards the wall looking around
+static void benchGenerateWalk(struct BenchPath* path, int frameCount) {
+    path->name = "walk";
+    path->frames = malloc(sizeof(struct BenchFrame) * frameCount);
+    path->frameCount = frameCount;
+
+    for (int i = 0; i < frameCount; ++i) {
+        float t = (float)i / frameCount;
+        struct BenchFrame* frame = &path->frames[i];
+
+        frame->position.x = BENCH_LEVEL_SIZE * 0.5f + 2.0f * sinf(t * 2.0f * M_PI);
+        frame->position.y = BENCH_EYE_HEIGHT;
+        frame->position.z = BENCH_LEVEL_SIZE * (0.95f - 0.8f * t);
+        frame->yaw = 30.0f * sinf(t * 6.0f * M_PI);
+        frame->pitch = -10.0f;
+    }
+}
+
+// walks along the wall looking down its length
+static void benchGenerateGrazing(struct BenchPath* path, int frameCount) {
+    path->name = "grazing";
+    path->frames = malloc(sizeof(struct BenchFrame) * frameCount);
+    path->frameCount = frameCount;
+
+    for (int i = 0; i < frameCount; ++i) {
+        float t = (float)i / frameCount;
+        struct BenchFrame* frame = &path->frames[i];
+
+        frame->position.x = BENCH_LEVEL_SIZE * (0.05f + 0.6f * t);
+        frame->position.y = BENCH_EYE_HEIGHT;
+        frame->position.z = 1.0f;
+        frame->yaw = -80.0f + 10.0f * sinf(t * 4.0f * M_PI);
+        frame->pitch = -5.0f;
+    }
+}
+
+// every tile is a quad over the whole tile
+static void benchBuildMeshLayer(struct MTTileIndex* index, int layerIndex, struct MTMeshLayer* meshLayer) {
+    struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+    int tileCount = imageLayer->xTiles * imageLayer->yTiles;
+    int tileU = index->imageLayers[0].xTiles / imageLayer->xTiles * BENCH_VERTEX_TILE_SIZE;
+    int tileV = index->imageLayers[0].yTiles / imageLayer->yTiles * BENCH_VERTEX_TILE_SIZE;
+    struct HostMeshTile* tiles = calloc(tileCount, sizeof(struct HostMeshTile));
+
+    for (int i = 0; i < tileCount; ++i) {
+        tiles[i].vertexCount = 4;
+    }
+
+    hostMeshLayerBuild(meshLayer, tiles, imageLayer->xTiles, imageLayer->yTiles, 0, 0, NULL);
+    free(tiles);
+
+    for (int y = 0; y < imageLayer->yTiles; ++y) {
+        for (int x = 0; x < imageLayer->xTiles; ++x) {
+            struct MTVertex* vertices = &meshLayer->vertices[meshLayer->tiles[x + y * imageLayer->xTiles].startVertex];
+
+            for (int corner = 0; corner < 4; ++corner) {
+                vertices[corner].u = (x + ((corner + 1) >> 1 & 1)) * tileU;
+                vertices[corner].v = (y + (corner >> 1)) * tileV;
+            }
+        }
+    }
+}
+
+static void benchBuildIndex(struct MTTileIndex* index, int xTiles, int yTiles, struct Vector3* right, struct Vector3* up, struct Vector3* normal) {
+    int layerXTiles[BENCH_MAX_LAYERS];
+    int layerYTiles[BENCH_MAX_LAYERS];
+    int layerCount = 0;
+
+    // the exporter keeps halving the texture while either side is a tile or more
+    for (int x = xTiles * 32, y = yTiles * 32; (x >= 32 || y >= 32) && layerCount < BENCH_MAX_LAYERS; x >>= 1, y >>= 1) {
+        layerXTiles[layerCount] = MAX(1, x / 32);
+        layerYTiles[layerCount] = MAX(1, y / 32);
+        ++layerCount;
+    }
+
+    hostTileTraceBuildIndex(index, layerCount, layerXTiles, layerYTiles);
+
+    // the exporter keeps halving a texture squashed along one
+    // axis while that axis is a tile or more
+    for (int axis = MTRipAxisU; axis <= MTRipAxisV; ++axis) {
+        for (int ratioShift = 1; ratioShift <= MT_MAX_RIP_SHIFT; ++ratioShift) {
+            int ripLayerCount = 0;
+
+            for (int x = xTiles * 32, y = yTiles * 32; ripLayerCount < BENCH_MAX_LAYERS; x >>= 1, y >>= 1) {
+                int squashedX = axis == MTRipAxisU ? x >> ratioShift : x;
+                int squashedY = axis == MTRipAxisV ? y >> ratioShift : y;
+
+                if ((axis == MTRipAxisU ? squashedX : squashedY) < 32) {
+                    break;
+                }
+
+                layerXTiles[ripLayerCount] = MAX(1, squashedX / 32);
+                layerYTiles[ripLayerCount] = MAX(1, squashedY / 32);
+                ++ripLayerCount;
+            }
+
+            if (ripLayerCount) {
+                hostTileTraceAddRipChain(index, axis, ratioShift, ripLayerCount, layerXTiles, layerYTiles);
+            }
+        }
+    }
+
+    int totalLayerCount = MT_TILE_INDEX_LAYER_COUNT(index);
+    index->meshLayers = calloc(totalLayerCount, sizeof(struct MTMeshLayer));
+
+    for (int i = 0; i < totalLayerCount; ++i) {
+        benchBuildMeshLayer(index, i, &index->meshLayers[i]);
+    }
+
+    index->uvBasis.uvOrigin = gZeroVec;
+    index->uvBasis.uvRight = *right;
+    index->uvBasis.uvUp = *up;
+    index->uvBasis.normal = *normal;
+    index->worldPixelSize = BENCH_TEXEL_SIZE;
+
+    index->boundingBox.min = gZeroVec;
+    vector3Add(right, up, &index->boundingBox.max);
+}
+
+// counts requested tiles with a coarser tile over
+// them that was requested in the same frame
+static int benchCountOverlaps(struct HostTileTrace* trace, struct HostTileTraceFrame* frame) {
+    int result = 0;
+
+    for (int i = 0; i < frame->requestCount; ++i) {
+        struct HostTileRequest* request = &frame->requests[i];
+        struct MTTileIndex* index = &trace->indexes[request->index];
+        struct MTImageLayer* layer = &index->imageLayers[request->lod];
+        int overlaps = 0;
+
+        for (int j = 0; j < frame->requestCount && !overlaps; ++j) {
+            struct HostTileRequest* other = &frame->requests[j];
+
+            // rip layers don't nest with the regular layers
+            if (other->index != request->index || other->lod <= request->lod || other->lod >= index->layerCount) {
+                continue;
+            }
+
+            struct MTImageLayer* otherLayer = &index->imageLayers[other->lod];
+
+            overlaps = request->x * otherLayer->xTiles / layer->xTiles == other->x &&
+                request->y * otherLayer->yTiles / layer->yTiles == other->y;
+        }
+
+        result += overlaps;
+    }
+
+    return result;
+}
+
+static void benchCameraAtFrame(struct BenchFrame* frame, struct Camera* camera) {
+    cameraInit(camera, 70.0f, 0.05f * SCENE_SCALE, 40.0f * SCENE_SCALE);
+    camera->transform.position = frame->position;
+
+    struct Quaternion yaw;
+    struct Quaternion pitch;
+    quatAxisAngle(&gUp, frame->yaw * (M_PI / 180.0f), &yaw);
+    quatAxisAngle(&gRight, frame->pitch * (M_PI / 180.0f), &pitch);
+    quatMultiply(&yaw, &pitch, &camera->transform.rotation);
+}
+
+static void benchRun(struct MTTileIndex* indexes, struct BenchPath* path, int rowLod, int ripMaps, int hysteresis, int entryCount, float lodBias, float wobble, int preloadAxis) {
+    hostHeapReset();
+
+    gMtRowLod = rowLod;
+    gMtRipMaps = ripMaps;
+    gMtLodHysteresis = hysteresis;
+    gMtRowCache.slots = NULL;
+
+    megatexturesInit(indexes, BENCH_INDEX_COUNT);
+
+    struct MTTileCache tileCache;
+    mtTileCacheInit(&tileCache, entryCount, MTTileCachePolicy2Q);
+    mtVertexCacheInit(&gMtVertexCache);
+    mtMeshCacheInit(&gMtMeshCache);
+    megatexturesPreloadAll(&tileCache, indexes, BENCH_INDEX_COUNT, NULL, NULL, preloadAxis);
+    mtTileCacheWaitForTiles(&tileCache);
+
+    struct RenderState renderState;
+    renderStateAlloc(&renderState, BENCH_DL_LENGTH);
+
+    struct BenchTotals totals;
+    memset(&totals, 0, sizeof(totals));
+
+    FILE* traceFile = tmpfile();
+    hostTileTraceRecord(traceFile);
+
+    for (int frameIndex = 0; frameIndex < path->frameCount; ++frameIndex) {
+        struct Camera camera;
+        benchCameraAtFrame(&path->frames[frameIndex], &camera);
+
+        renderStateInit(&renderState, NULL);
+
+        struct CameraMatrixInfo cameraInfo;
+        cameraSetupMatrices(&camera, &renderState, (float)gScreenWidth / gScreenHeight, 1, &cameraInfo);
+
+        // the lod controller would otherwise react to the
+        // frame times of whichever method is running
+        gMtLodBias = lodBias + wobble * sinf(frameIndex * BENCH_WOBBLE_RATE);
+
+        megatexturesRenderAll(&tileCache, indexes, BENCH_INDEX_COUNT, NULL, NULL, &cameraInfo, NULL, NULL, &renderState);
+        mtTileCacheWaitForTiles(&tileCache);
+
+        totals.requests += tileCache.totalTileRequests;
+        totals.fetched += tileCache.tilesRequestedFromCart;
+        totals.bytes += tileCache.bytesRequestedFromCart;
+        totals.fallbacks += tileCache.fallbackRequestCount;
+        totals.switches += tileCache.lodFlipCount;
+    }
+
+    hostTileTraceRecord(NULL);
+    rewind(traceFile);
+
+    struct HostTileTrace trace;
+    memset(&trace, 0, sizeof(trace));
+
+    if (hostTileTraceLoad(traceFile, &trace)) {
+        for (int i = 0; i < trace.frameCount; ++i) {
+            totals.overlaps += benchCountOverlaps(&trace, &trace.frames[i]);
+
+            for (int request = 0; request < trace.frames[i].requestCount; ++request) {
+                struct HostTileRequest* tileRequest = &trace.frames[i].requests[request];
+                struct MTImageLayer* imageLayer = &trace.indexes[tileRequest->index].imageLayers[tileRequest->lod];
+                // rip layers count by their finer axis
+                totals.finestRequests += MIN(imageLayer->uShift, imageLayer->vShift) == 0;
+            }
+        }
+
+        hostTileTraceFree(&trace);
+    }
+
+    fclose(traceFile);
+
+    float frames = path->frameCount ? path->frameCount : 1;
+
+    printf("%-12s %-7s %4d %10.1f %8.1f %9.1f %8.1f %10.1f %10.1f %10.2f\n",
+        path->name,
+        !rowLod ? "planes" : ripMaps ? "rip" : "rows",
+        hysteresis,
+        totals.requests / frames,
+        totals.finestRequests / frames,
+        totals.fetched / frames,
+        totals.bytes / 1024.0f / frames,
+        totals.fallbacks / frames,
+        totals.overlaps / frames,
+        totals.switches / frames
+    );
+}
+
+static void printUsage() {
+    fprintf(stderr, "usage: lod_bench [--entries 1024] [--bias 1.5] [--wobble 0.3] [--hysteresis 0,1] [--preload 2] [path.txt ...]\n");
+    fprintf(stderr, "       lod_bench --generate-path walk|grazing [--frames 240]\n");
+}
+
+int main(int argc, char** argv) {
+    int entryCount = 1024;
+    float lodBias = 1.5f;
+    float wobble = 0.0f;
+    int hysteresisModes[BENCH_MAX_HYSTERESIS] = {1};
+    int hysteresisModeCount = 1;
+    int preloadAxis = 2;
+    int frameCount = 240;
+    const char* generate = NULL;
+    struct BenchPath paths[BENCH_MAX_PATHS];
+    int pathCount = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc) {
+            entryCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bias") == 0 && i + 1 < argc) {
+            lodBias = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--wobble") == 0 && i + 1 < argc) {
+            wobble = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--hysteresis") == 0 && i + 1 < argc) {
+            hysteresisModeCount = hostParseList(argv[++i], hysteresisModes, BENCH_MAX_HYSTERESIS);
+        } else if (strcmp(argv[i], "--preload") == 0 && i + 1 < argc) {
+            preloadAxis = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frameCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--generate-path") == 0 && i + 1 < argc) {
+            generate = argv[++i];
+        } else if (argv[i][0] != '-' && pathCount < BENCH_MAX_PATHS) {
+            if (!benchLoadPath(argv[i], &paths[pathCount])) {
+                return 1;
+            }
+
+            ++pathCount;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (frameCount <= 0 || entryCount <= 0 || hysteresisModeCount == 0) {
+        printUsage();
+        return 1;
+    }
+
+    if (generate) {
+        struct BenchPath path;
+
+        if (strcmp(generate, "walk") == 0) {
+            benchGenerateWalk(&path, frameCount);
+        } else if (strcmp(generate, "grazing") == 0) {
+            benchGenerateGrazing(&path, frameCount);
+        } else {
+            printUsage();
+            return 1;
+        }
+
+        for (int i = 0; i < path.frameCount; ++i) {
+            struct BenchFrame* frame = &path.frames[i];
+            printf("%f %f %f %f %f\n", frame->position.x, frame->position.y, frame->position.z, frame->yaw, frame->pitch);
+        }
+
+        return 0;
+    }
+
+    if (!pathCount) {
+        benchGenerateWalk(&paths[pathCount++], frameCount);
+        benchGenerateGrazing(&paths[pathCount++], frameCount);
+    }
+
+    hostInit(BENCH_HEAP_SIZE, BENCH_ROM_SIZE);
+
+    struct MTTileIndex indexes[BENCH_INDEX_COUNT];
+
+    struct Vector3 floorRight = {BENCH_LEVEL_SIZE, 0.0f, 0.0f};
+    struct Vector3 floorUp = {0.0f, 0.0f, BENCH_LEVEL_SIZE};
+    struct Vector3 wallUp = {0.0f, BENCH_WALL_HEIGHT, 0.0f};
+    struct Vector3 wallNormal = {0.0f, 0.0f, 1.0f};
+
+    benchBuildIndex(&indexes[0], 32, 32, &floorRight, &floorUp, &gUp);
+    benchBuildIndex(&indexes[1], 32, (int)(32 * BENCH_WALL_HEIGHT / BENCH_LEVEL_SIZE), &floorRight, &wallUp, &wallNormal);
+
+    printf("%d entry tile cache, lod bias %.2f wobbling by %.2f\n", entryCount, lodBias, wobble);
+    printf("%-12s %-7s %4s %10s %8s %9s %8s %10s %10s %10s\n",
+        "path", "lod", "hyst", "requests/f", "finest/f", "fetched/f", "KB/f", "fallback/f", "overlap/f", "switches/f"
+    );
+
+    for (int i = 0; i < pathCount; ++i) {
+        for (int hysteresis = 0; hysteresis < hysteresisModeCount; ++hysteresis) {
+            benchRun(indexes, &paths[i], 0, 0, hysteresisModes[hysteresis], entryCount, lodBias, wobble, preloadAxis);
+            benchRun(indexes, &paths[i], 1, 0, hysteresisModes[hysteresis], entryCount, lodBias, wobble, preloadAxis);
+            benchRun(indexes, &paths[i], 1, 1, hysteresisModes[hysteresis], entryCount, lodBias, wobble, preloadAxis);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,414 @@
+// Replays a tile request trace through megatexture_tilecache.c for a
+// sweep of cache sizes and per frame request budgets
+//
+//   tilecache_sim [--entries 1024,2048] [--budget 56] [--policy lru,2q] [--coalesce 0,1] [--schedule 0,1] [--preload 2] [--small 50] [--prefetch] [--frames] trace.txt
+//   tilecache_sim --generate-pan|--generate-scan|--generate-sweep <frameCount> > trace.txt
+//
+// --prefetch prefetches the tiles of the next frame after each frame
+// like a perfectly predicted camera
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "bench_util.h"
+#include "tile_trace.h"
+#include "megatextures/megatexture_tilecache.h"
+#include "megatextures/megatexture_renderer.h"
+
+#define MAX_SWEEP_VALUES    16
+#define SIM_HEAP_SIZE       (64 * 1024 * 1024)
+
+// rough cost of a pi dma, a fixed setup time plus the cart bandwidth
+static float gPiDmaOverheadUs = 20.0f;
+static float gPiBytesPerUs = 5.0f;
+
+struct SimFrameStats {
+    int requests;
+    int hits;
+    int misses;
+    int evictions;
+    int overflow;
+    int fallback;
+    int missing;
+    int pending;
+    int bytes;
+    int dmas;
+};
+
+struct SimTotals {
+    struct SimFrameStats sum;
+    int maxBytes;
+    int maxMisses;
+    int framesOverBudget;
+};
+
+static void simAccumulate(struct SimTotals* totals, struct SimFrameStats* frame, int budget) {
+    totals->sum.requests += frame->requests;
+    totals->sum.hits += frame->hits;
+    totals->sum.misses += frame->misses;
+    totals->sum.evictions += frame->evictions;
+    totals->sum.overflow += frame->overflow;
+    totals->sum.fallback += frame->fallback;
+    totals->sum.missing += frame->missing;
+    totals->sum.pending += frame->pending;
+    totals->sum.bytes += frame->bytes;
+    totals->sum.dmas += frame->dmas;
+
+    if (frame->bytes > totals->maxBytes) {
+        totals->maxBytes = frame->bytes;
+    }
+
+    if (frame->misses > totals->maxMisses) {
+        totals->maxMisses = frame->misses;
+    }
+
+    if (frame->misses >= budget) {
+        ++totals->framesOverBudget;
+    }
+}
+
+static const char* gPolicyNames[] = {
+    "lru",
+    "2q",
+};
+
+#define POLICY_COUNT    (sizeof(gPolicyNames) / sizeof(*gPolicyNames))
+
+static int parsePolicies(char* arg, int* values) {
+    int count = 0;
+
+    for (char* value = strtok(arg, ","); value && count < MAX_SWEEP_VALUES; value = strtok(NULL, ",")) {
+        int policy = 0;
+
+        while (policy < POLICY_COUNT && strcmp(gPolicyNames[policy], value) != 0) {
+            ++policy;
+        }
+
+        if (policy == POLICY_COUNT) {
+            fprintf(stderr, "unknown policy %s\n", value);
+            return 0;
+        }
+
+        values[count++] = policy;
+    }
+
+    return count;
+}
+
+static float simPiTimeUs(int dmas, int bytes) {
+    return dmas * gPiDmaOverheadUs + bytes / gPiBytesPerUs;
+}
+
+static void simRun(struct HostTileTrace* trace, int entryCount, int budget, int policy, int coalesce, int schedule, int preloadAxisCount, int prefetch, int printFrames) {
+    hostHeapReset();
+    hostPiStatsReset();
+
+    gMtMaxTileRequestsPerFrame = budget;
+    gMtCoalesceTileLoads = coalesce;
+    gMtScheduleTileRequests = schedule;
+
+    struct MTTileCache tileCache;
+    mtTileCacheInit(&tileCache, entryCount, policy);
+
+    if (preloadAxisCount) {
+        megatexturesPreloadAll(&tileCache, trace->indexes, trace->indexCount, NULL, NULL, preloadAxisCount);
+        mtTileCacheWaitForTiles(&tileCache);
+    }
+
+    struct SimTotals totals;
+    memset(&totals, 0, sizeof(totals));
+
+    // the commands for each request are thrown away
+    Gfx scratchDl[4];
+
+    for (int frameIndex = 0; frameIndex < trace->frameCount; ++frameIndex) {
+        struct HostTileTraceFrame* frame = &trace->frames[frameIndex];
+
+        megatextureRenderStart(&tileCache);
+
+        for (int i = 0; i < frame->requestCount; ++i) {
+            struct HostTileRequest* request = &frame->requests[i];
+
+            // the renderer starts loads after each megatexture
+            if (i > 0 && request->index != frame->requests[i - 1].index) {
+                mtTileCacheFlushLoads(&tileCache);
+            }
+
+            mtTileCacheRequestTile(&tileCache, &trace->indexes[request->index], request->x, request->y, request->lod, MT_DEFAULT_TILE_IMPORTANCE, scratchDl);
+        }
+
+        mtTileCacheScheduleRequests(&tileCache);
+
+        if (prefetch && frameIndex + 1 < trace->frameCount) {
+            // the camera of the next frame is predicted exactly
+            struct HostTileTraceFrame* nextFrame = &trace->frames[frameIndex + 1];
+
+            for (int i = 0; i < nextFrame->requestCount; ++i) {
+                struct HostTileRequest* request = &nextFrame->requests[i];
+
+                if (!mtTileCachePrefetchTile(&tileCache, &trace->indexes[request->index], request->x, request->y, request->lod)) {
+                    break;
+                }
+            }
+        }
+
+        struct SimFrameStats stats;
+        stats.requests = tileCache.totalTileRequests;
+        stats.hits = tileCache.tileHitCount;
+        stats.misses = tileCache.tilesRequestedFromCart;
+        stats.evictions = tileCache.evictedTileCount;
+        stats.overflow = tileCache.overflowRequestCount;
+        stats.fallback = tileCache.fallbackRequestCount;
+        stats.missing = tileCache.missingTileCount;
+        stats.pending = tileCache.pendingTileCount;
+        stats.bytes = tileCache.bytesRequestedFromCart;
+
+        megatextureRenderEnd(&tileCache, NULL, 1);
+
+        stats.dmas = tileCache.dmaRequestCount;
+
+        simAccumulate(&totals, &stats, budget);
+
+        if (printFrames) {
+            printf("%d,%d,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.0f\n",
+                entryCount, budget, gPolicyNames[policy], coalesce, schedule, frameIndex,
+                stats.requests, stats.hits, stats.misses, stats.evictions,
+                stats.overflow, stats.fallback, stats.missing, stats.pending, stats.bytes,
+                stats.dmas, simPiTimeUs(stats.dmas, stats.bytes)
+            );
+        }
+    }
+
+    if (printFrames) {
+        return;
+    }
+
+    int frameCount = trace->frameCount ? trace->frameCount : 1;
+    float hitRate = totals.sum.requests ? 100.0f * totals.sum.hits / totals.sum.requests : 0.0f;
+
+    printf("%7d %6d %6s %4d %5d %7.2f%% %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %10.0f %10d %6d %8.2f %8.0f\n",
+        entryCount,
+        budget,
+        gPolicyNames[policy],
+        coalesce,
+        schedule,
+        hitRate,
+        (float)totals.sum.misses / frameCount,
+        (float)totals.sum.evictions / frameCount,
+        (float)totals.sum.overflow / frameCount,
+        (float)totals.sum.fallback / frameCount,
+        (float)totals.sum.missing / frameCount,
+        (float)totals.sum.pending / frameCount,
+        (float)totals.sum.bytes / frameCount,
+        totals.maxBytes,
+        totals.framesOverBudget,
+        (float)totals.sum.dmas / frameCount,
+        simPiTimeUs(totals.sum.dmas, totals.sum.bytes) / frameCount
+    );
+}
+
+// a single 1024x1024 megatexture with a window of fine
+// tiles panning across it surrounded by coarser tiles
+static void generatePan(int frameCount) {
+    int layerCount = 6;
+
+    printf("megatexture 0 %d", layerCount);
+
+    for (int lod = 0; lod < layerCount; ++lod) {
+        printf(" %d %d", 32 >> lod, 32 >> lod);
+    }
+
+    printf("\n");
+
+    for (int frame = 0; frame < frameCount; ++frame) {
+        float centerX = 4.0f + (frame * 0.125f);
+        float centerY = 16.0f + 6.0f * (frame % 240 < 120 ? (frame % 120) / 120.0f : 1.0f - (frame % 120) / 120.0f);
+
+        while (centerX > 28.0f) {
+            centerX -= 24.0f;
+        }
+
+        printf("frame\n");
+
+        for (int lod = 0; lod < 3; ++lod) {
+            int radius = 4;
+            int tileCount = 32 >> lod;
+            int minX = (int)(centerX / (1 << lod)) - radius;
+            int minY = (int)(centerY / (1 << lod)) - radius;
+
+            for (int y = minY; y < minY + radius * 2; ++y) {
+                for (int x = minX; x < minX + radius * 2; ++x) {
+                    if (x < 0 || y < 0 || x >= tileCount || y >= tileCount) {
+                        continue;
+                    }
+
+                    // the finer lod covers the center of each coarser window
+                    if (lod > 0 && abs(x - (minX + radius)) < radius / 2 && abs(y - (minY + radius)) < radius / 2) {
+                        continue;
+                    }
+
+                    printf("r 0 %d %d %d\n", x, y, lod);
+                }
+            }
+        }
+    }
+}
+
+// a set of coarse tiles each reused every coarsePeriod frames while a
+// stream of fine tiles that are only used once goes past, like a camera
+// sweeping across a wall in front of a floor it keeps seeing. The
+// fine tiles are a separate megatexture so they have no parent tiles
+static void generateScan(int frameCount, int coarseTileCount, int coarsePeriod) {
+    int coarseAxis = 16;
+    int fineAxis = 32;
+    int scanTilesPerFrame = 40;
+
+    printf("megatexture 0 1 %d %d\n", coarseAxis, coarseAxis);
+    printf("megatexture 1 1 %d %d\n", fineAxis, fineAxis);
+
+    int nextFineTile = 0;
+
+    for (int frame = 0; frame < frameCount; ++frame) {
+        printf("frame\n");
+
+        for (int i = frame % coarsePeriod; i < coarseTileCount; i += coarsePeriod) {
+            printf("r 0 %d %d 0\n", i % coarseAxis, i / coarseAxis);
+        }
+
+        for (int i = 0; i < scanTilesPerFrame; ++i) {
+            printf("r 1 %d %d 0\n", nextFineTile % fineAxis, nextFineTile / fineAxis);
+            nextFineTile = (nextFineTile + 1) % (fineAxis * fineAxis);
+        }
+    }
+}
+
+static void printUsage() {
+    fprintf(stderr, "usage: tilecache_sim [--entries 1024,2048] [--budget 56] [--policy lru,2q] [--coalesce 0,1] [--schedule 0,1] [--preload axisTileCount]\n");
+    fprintf(stderr, "                     [--pi-overhead us] [--pi-bandwidth bytesPerUs] [--small percent] [--prefetch] [--frames] trace.txt\n");
+    fprintf(stderr, "       tilecache_sim --generate-pan frameCount\n");
+    fprintf(stderr, "       tilecache_sim --generate-scan frameCount\n");
+    fprintf(stderr, "       tilecache_sim --generate-sweep frameCount\n");
+}
+
+int main(int argc, char** argv) {
+    int entryCounts[MAX_SWEEP_VALUES] = {1024, 2048};
+    int entryCountCount = 2;
+    int budgets[MAX_SWEEP_VALUES] = {56};
+    int budgetCount = 1;
+    int policies[MAX_SWEEP_VALUES] = {MTTileCachePolicyLRU, MTTileCachePolicy2Q};
+    int policyCount = 2;
+    int coalesceModes[MAX_SWEEP_VALUES] = {1};
+    int coalesceModeCount = 1;
+    int scheduleModes[MAX_SWEEP_VALUES] = {1};
+    int scheduleModeCount = 1;
+    int preloadAxisCount = 0;
+    int prefetch = 0;
+    int printFrames = 0;
+    char* tracePath = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc) {
+            entryCountCount = hostParseList(argv[++i], entryCounts, MAX_SWEEP_VALUES);
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budgetCount = hostParseList(argv[++i], budgets, MAX_SWEEP_VALUES);
+        } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            policyCount = parsePolicies(argv[++i], policies);
+
+            if (!policyCount) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--coalesce") == 0 && i + 1 < argc) {
+            coalesceModeCount = hostParseList(argv[++i], coalesceModes, MAX_SWEEP_VALUES);
+        } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+            scheduleModeCount = hostParseList(argv[++i], scheduleModes, MAX_SWEEP_VALUES);
+        } else if (strcmp(argv[i], "--pi-overhead") == 0 && i + 1 < argc) {
+            gPiDmaOverheadUs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--pi-bandwidth") == 0 && i + 1 < argc) {
+            gPiBytesPerUs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--preload") == 0 && i + 1 < argc) {
+            preloadAxisCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--small") == 0 && i + 1 < argc) {
+            gHostTileTraceSmallPercent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--prefetch") == 0) {
+            prefetch = 1;
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            printFrames = 1;
+        } else if (strcmp(argv[i], "--generate-pan") == 0 && i + 1 < argc) {
+            generatePan(atoi(argv[++i]));
+            return 0;
+        } else if (strcmp(argv[i], "--generate-scan") == 0 && i + 1 < argc) {
+            generateScan(atoi(argv[++i]), 150, 4);
+            return 0;
+        } else if (strcmp(argv[i], "--generate-sweep") == 0 && i + 1 < argc) {
+            // the floor is seen less often so the stream competes with it
+            generateScan(atoi(argv[++i]), 200, 8);
+            return 0;
+        } else if (argv[i][0] != '-' && !tracePath) {
+            tracePath = argv[i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (!tracePath) {
+        printUsage();
+        return 1;
+    }
+
+    FILE* traceFile = strcmp(tracePath, "-") == 0 ? stdin : fopen(tracePath, "r");
+
+    if (!traceFile) {
+        fprintf(stderr, "could not open %s\n", tracePath);
+        return 1;
+    }
+
+    hostInit(SIM_HEAP_SIZE, HOST_DEFAULT_ROM_SIZE);
+
+    struct HostTileTrace trace;
+
+    if (!hostTileTraceLoad(traceFile, &trace)) {
+        return 1;
+    }
+
+    if (traceFile != stdin) {
+        fclose(traceFile);
+    }
+
+    if (printFrames) {
+        printf("entries,budget,policy,coalesce,schedule,frame,requests,hits,misses,evictions,overflow,fallback,missing,pending,bytes,dmas,piUs\n");
+    } else {
+        printf("%d megatextures %d frames\n", trace.indexCount, trace.frameCount);
+        printf("%7s %6s %6s %4s %5s %8s %8s %8s %8s %8s %8s %8s %10s %10s %6s %8s %8s\n",
+            "entries", "budget", "policy", "coal", "sched", "hit", "miss/f", "evict/f", "ovrflw/f", "fallbk/f", "missng/f", "pendng/f", "bytes/f", "max bytes", "capped", "dma/f", "pi us/f"
+        );
+    }
+
+    for (int entryIndex = 0; entryIndex < entryCountCount; ++entryIndex) {
+        for (int budgetIndex = 0; budgetIndex < budgetCount; ++budgetIndex) {
+            for (int policyIndex = 0; policyIndex < policyCount; ++policyIndex) {
+                for (int coalesceIndex = 0; coalesceIndex < coalesceModeCount; ++coalesceIndex) {
+                    for (int scheduleIndex = 0; scheduleIndex < scheduleModeCount; ++scheduleIndex) {
+                        simRun(
+                            &trace,
+                            entryCounts[entryIndex],
+                            budgets[budgetIndex],
+                            policies[policyIndex],
+                            coalesceModes[coalesceIndex],
+                            scheduleModes[scheduleIndex],
+                            preloadAxisCount,
+                            prefetch,
+                            printFrames
+                        );
+                    }
+                }
+            }
+        }
+    }
+
+    hostTileTraceFree(&trace);
+
+    return 0;
+}
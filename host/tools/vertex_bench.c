@@ -0,0 +1,510 @@
+// Draws a synthetic megatexture mesh through megatextureRenderRows while a
+// view rectangle pans across it and counts the vertex loads in the display
+// lists produced. Compares windows that restart every row against windows
+// that span rows with vertices reused from the row before, then spanning
+// windows again with the finest layers streamed from rom in blocks of rows
+//
+//   vertex_bench [--frames 240] [--size 32] [--view 0.35] [--seed 1] [--stream-axis 16]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "host.h"
+#include "tile_trace.h"
+#include "bench_util.h"
+#include "megatextures/megatexture_tilecache.h"
+#include "megatextures/megatexture_renderer.h"
+#include "megatextures/megatexture_row_cache.h"
+#include "megatextures/megatexture_vertex_cache.h"
+#include "megatextures/megatexture_mesh_cache.h"
+
+#define BENCH_HEAP_SIZE         (64 * 1024 * 1024)
+#define BENCH_MAX_LAYERS        8
+#define BENCH_VERTEX_CACHE_SIZE 32
+#define BENCH_DL_LENGTH         (64 * 1024)
+#define BENCH_MAX_DL_DEPTH      4
+
+#define ALIGN_8(size) (((size) + 0x7) & ~0x7)
+
+// the shape is a disc with a ragged outline, tiles crossing the
+// outline have more vertices like the exporter would produce
+#define BENCH_DISC_RADIUS       0.45f
+#define BENCH_EDGE_MIN_VERTICES 4
+#define BENCH_EDGE_MAX_VERTICES 8
+
+struct BenchLayer {
+    struct HostMeshTile* tiles;
+    int xTiles;
+    int yTiles;
+    int vertexCount;
+    int triangleCount;
+};
+
+struct BenchStats {
+    int vertexLoads;
+    int verticesLoaded;
+    int tilesDrawn;
+    int badTriangles;
+    // windows rebuilt into gMtVertexCache
+    int windowsBuilt;
+    // blocks of streamed layers read from rom
+    int blocksLoaded;
+    // rows of streamed layers drawn with a coarser layer
+    int pendingRows;
+};
+
+static unsigned gBenchSeed = 1;
+
+static int benchRandom(int range) {
+    gBenchSeed = gBenchSeed * 1103515245 + 12345;
+    return (gBenchSeed >> 16) % range;
+}
+
+static int benchTileInside(float x, float y) {
+    float dx = x - 0.5f;
+    float dy = y - 0.5f;
+    return dx * dx + dy * dy < BENCH_DISC_RADIUS * BENCH_DISC_RADIUS;
+}
+
+static void benchGenerateLayer(struct BenchLayer* layer, int xTiles, int yTiles) {
+    layer->xTiles = xTiles;
+    layer->yTiles = yTiles;
+    layer->tiles = calloc(xTiles * yTiles, sizeof(struct HostMeshTile));
+    layer->vertexCount = 0;
+    layer->triangleCount = 0;
+
+    for (int y = 0; y < yTiles; ++y) {
+        for (int x = 0; x < xTiles; ++x) {
+            struct HostMeshTile* tile = &layer->tiles[x + y * xTiles];
+            int corners = 0;
+
+            for (int corner = 0; corner < 4; ++corner) {
+                corners += benchTileInside((float)(x + (corner & 1)) / xTiles, (float)(y + (corner >> 1)) / yTiles);
+            }
+
+            if (corners == 0) {
+                continue;
+            }
+
+            tile->vertexCount = corners == 4 ? 4 : BENCH_EDGE_MIN_VERTICES + benchRandom(BENCH_EDGE_MAX_VERTICES - BENCH_EDGE_MIN_VERTICES + 1);
+
+            // neighbors in a row share the vertices on their common edge
+            if (x > 0 && tile[-1].vertexCount) {
+                tile->beginningOverlap = 2;
+            }
+
+            layer->vertexCount += tile->vertexCount - tile->beginningOverlap;
+            layer->triangleCount += tile->vertexCount - 2;
+        }
+    }
+}
+
+static int benchRowVertexCount(struct BenchLayer* layer, int y) {
+    int result = 0;
+
+    for (int x = 0; x < layer->xTiles; ++x) {
+        struct HostMeshTile* tile = &layer->tiles[x + y * layer->xTiles];
+        result += tile->vertexCount - tile->beginningOverlap;
+    }
+
+    return result;
+}
+
+static int benchRowTriangleCount(struct BenchLayer* layer, int y) {
+    int result = 0;
+
+    for (int x = 0; x < layer->xTiles; ++x) {
+        struct HostMeshTile* tile = &layer->tiles[x + y * layer->xTiles];
+
+        if (tile->vertexCount) {
+            // the triangles and the end command
+            result += tile->vertexCount - 1;
+        }
+    }
+
+    return result;
+}
+
+// the bytes a block of rows needs laid out the same way as the exporter does it
+static int benchBlockSize(struct BenchLayer* layer, int firstRow, int lastRow) {
+    int vertexCount = 0;
+    int triangleCount = 0;
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        vertexCount += benchRowVertexCount(layer, y);
+        triangleCount += benchRowTriangleCount(layer, y);
+    }
+
+    return ALIGN_8(sizeof(struct MTMeshTile) * layer->xTiles * (lastRow - firstRow)) +
+        ALIGN_8(sizeof(struct MTVertex) * vertexCount) +
+        sizeof(Gfx) * triangleCount;
+}
+
+// the most rows per block that keeps every block under MT_MESH_BLOCK_SIZE
+static int benchChooseBlockRows(struct BenchLayer* layer) {
+    for (int blockRows = layer->yTiles; blockRows > 0; --blockRows) {
+        int fits = 1;
+
+        for (int y = 0; fits && y < layer->yTiles; y += blockRows) {
+            fits = benchBlockSize(layer, y, MIN(layer->yTiles, y + blockRows)) <= MT_MESH_BLOCK_SIZE;
+        }
+
+        if (fits) {
+            return blockRows;
+        }
+    }
+
+    return 0;
+}
+
+// copies the mesh of each block of rows into the simulated rom
+static void benchStreamMeshLayer(struct BenchLayer* layer, struct MTMeshLayer* meshLayer, int blockRows, int* blockTriangleStarts) {
+    int blockCount = (layer->yTiles + blockRows - 1) / blockRows;
+    meshLayer->blocks = calloc(blockCount, sizeof(struct MTMeshBlock));
+    meshLayer->blockRows = blockRows;
+
+    u8* buffer = calloc(1, MT_MESH_BLOCK_SIZE);
+
+    for (int block = 0; block < blockCount; ++block) {
+        int firstRow = block * blockRows;
+        int lastRow = MIN(layer->yTiles, firstRow + blockRows);
+        struct MTMeshTile* firstTile = &meshLayer->tiles[firstRow * layer->xTiles];
+        struct MTMeshTile* lastTile = &meshLayer->tiles[lastRow * layer->xTiles - 1];
+        struct MTMeshBlock* meshBlock = &meshLayer->blocks[block];
+
+        meshBlock->firstVertex = firstTile->startVertex;
+        meshBlock->vertexEnd = lastTile->startVertex + lastTile->vertexCount;
+
+        int tileBytes = sizeof(struct MTMeshTile) * layer->xTiles * (lastRow - firstRow);
+        int vertexBytes = sizeof(struct MTVertex) * (meshBlock->vertexEnd - meshBlock->firstVertex);
+        int triangleCount = blockTriangleStarts[block + 1] - blockTriangleStarts[block];
+
+        meshBlock->vertexOffset = ALIGN_8(tileBytes);
+        meshBlock->triangleOffset = meshBlock->vertexOffset + ALIGN_8(vertexBytes);
+        meshBlock->size = meshBlock->triangleOffset + sizeof(Gfx) * triangleCount;
+
+        memset(buffer, 0, MT_MESH_BLOCK_SIZE);
+        memcpy(buffer, firstTile, tileBytes);
+        memcpy(buffer + meshBlock->vertexOffset, &meshLayer->vertices[meshBlock->firstVertex], vertexBytes);
+        memcpy(buffer + meshBlock->triangleOffset, &meshLayer->triangles[blockTriangleStarts[block]], sizeof(Gfx) * triangleCount);
+
+        u32 romAddress = hostRomAlloc(meshBlock->size);
+        memcpy(hostRomPointer(romAddress), buffer, meshBlock->size);
+        meshBlock->romAddress = (u64*)(uintptr_t)romAddress;
+    }
+
+    free(buffer);
+
+    // the renderer has to go through the blocks
+    meshLayer->vertices = NULL;
+    meshLayer->triangles = NULL;
+    meshLayer->tiles = NULL;
+}
+
+// lays out the vertices and bakes the triangles the same way the
+// exporter does. If stream is set the layer is split into blocks
+// that fit in the mesh cache where possible
+static void benchBuildMeshLayer(struct BenchLayer* layer, struct MTMeshLayer* meshLayer, int spanRows, int stream) {
+    int blockRows = stream ? benchChooseBlockRows(layer) : 0;
+    int blockTriangleStarts[0x101];
+
+    hostMeshLayerBuild(meshLayer, layer->tiles, layer->xTiles, layer->yTiles, spanRows, blockRows, blockTriangleStarts);
+
+    for (int i = 0; i < meshLayer->vertexCount; ++i) {
+        // the index of each vertex is kept so triangles can be checked
+        meshLayer->vertices[i].u = i;
+    }
+
+    if (blockRows) {
+        benchStreamMeshLayer(layer, meshLayer, blockRows, blockTriangleStarts);
+    }
+}
+
+struct BenchWalk {
+    struct MTTileIndex* index;
+    struct BenchStats* stats;
+    Vtx* vertexCache[BENCH_VERTEX_CACHE_SIZE];
+};
+
+// finds the tile drawn with triangles in a block of the mesh cache
+static struct MTMeshTile* benchFindStreamedTile(Gfx* triangles) {
+    u8* blockData = (u8*)gMtMeshCache.blockData;
+
+    if (!blockData || (u8*)triangles < blockData || (u8*)triangles >= blockData + MT_MESH_BLOCK_SIZE * MT_MESH_CACHE_SLOT_COUNT) {
+        return NULL;
+    }
+
+    int slotIndex = ((u8*)triangles - blockData) / MT_MESH_BLOCK_SIZE;
+    struct MTMeshCacheSlot* slot = &gMtMeshCache.slots[slotIndex];
+    struct MTMeshLayer* meshLayer = &slot->index->meshLayers[slot->layer];
+    struct MTMeshBlock* meshBlock = &meshLayer->blocks[slot->block];
+    u8* data = (u8*)MT_MESH_CACHE_SLOT_DATA(&gMtMeshCache, slotIndex);
+    struct MTMeshTile* tiles = (struct MTMeshTile*)data;
+    Gfx* blockTriangles = (Gfx*)(data + meshBlock->triangleOffset);
+    int tileCount = (meshBlock->vertexOffset / sizeof(struct MTMeshTile));
+
+    for (int i = 0; i < tileCount; ++i) {
+        if (tiles[i].triangleCount && &blockTriangles[tiles[i].triangleStart] == triangles) {
+            return &tiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+static struct MTMeshTile* benchFindTile(struct MTTileIndex* index, Gfx* triangles) {
+    struct MTMeshTile* streamedTile = benchFindStreamedTile(triangles);
+
+    if (streamedTile) {
+        return streamedTile;
+    }
+
+    for (int layerIndex = 0; layerIndex < index->layerCount; ++layerIndex) {
+        struct MTMeshLayer* meshLayer = &index->meshLayers[layerIndex];
+        struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+        int tileCount = imageLayer->xTiles * imageLayer->yTiles;
+
+        if (meshLayer->blocks) {
+            continue;
+        }
+
+        for (int i = 0; i < tileCount; ++i) {
+            struct MTMeshTile* tile = &meshLayer->tiles[i];
+
+            if (tile->triangleCount && &meshLayer->triangles[tile->triangleStart] == triangles) {
+                return tile;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void benchCheckTriangle(struct BenchWalk* walk, struct MTMeshTile* tile, int slot) {
+    Vtx* vertex = walk->vertexCache[slot];
+    int vertexIndex = tile->windowStart + slot;
+
+    if (!vertex || vertex->v.tc[0] != vertexIndex ||
+        vertexIndex < tile->startVertex || vertexIndex >= tile->startVertex + tile->vertexCount) {
+        ++walk->stats->badTriangles;
+    }
+}
+
+static void benchWalk(struct BenchWalk* walk, Gfx* dl, int depth) {
+    for (;; ++dl) {
+        int command = (dl->words.w0 >> 24) & 0xFF;
+
+        if (command == G_ENDDL) {
+            return;
+        } else if (command == G_VTX) {
+            int count = (dl->words.w0 >> 12) & 0xFF;
+            int end = (dl->words.w0 >> 1) & 0x7F;
+            Vtx* vertices = (Vtx*)dl->words.w1;
+
+            ++walk->stats->vertexLoads;
+            walk->stats->verticesLoaded += count;
+
+            for (int i = 0; i < count && end - count + i < BENCH_VERTEX_CACHE_SIZE; ++i) {
+                walk->vertexCache[end - count + i] = &vertices[i];
+            }
+        } else if (command == G_DL && depth < BENCH_MAX_DL_DEPTH) {
+            Gfx* target = (Gfx*)dl->words.w1;
+            struct MTMeshTile* tile = benchFindTile(walk->index, target);
+
+            if (!tile) {
+                // a cached row, tile loaders have nothing of interest
+                if (gMtRowCache.slots && target >= gMtRowCache.displayLists &&
+                    target < gMtRowCache.displayLists + MT_ROW_CACHE_SLOT_GFX * MT_ROW_CACHE_SLOT_COUNT) {
+                    benchWalk(walk, target, depth + 1);
+                }
+
+                continue;
+            }
+
+            ++walk->stats->tilesDrawn;
+
+            for (Gfx* triangle = target; ((triangle->words.w0 >> 24) & 0xFF) != G_ENDDL; ++triangle) {
+                benchCheckTriangle(walk, tile, ((triangle->words.w0 >> 16) & 0xFF) / 2);
+                benchCheckTriangle(walk, tile, ((triangle->words.w0 >> 8) & 0xFF) / 2);
+                benchCheckTriangle(walk, tile, (triangle->words.w0 & 0xFF) / 2);
+            }
+        }
+    }
+}
+
+static void benchRun(struct MTTileIndex* index, struct MTMeshLayer* meshLayers, const char* name, int shareWindows, int useRowCache, int frameCount, float viewSize) {
+    hostHeapReset();
+
+    index->meshLayers = meshLayers;
+    gMtShareVertexWindows = shareWindows;
+    gMtRowCache.slots = NULL;
+
+    struct MTTileCache tileCache;
+    mtTileCacheInit(&tileCache, 2048, MTTileCachePolicyLRU);
+    mtTileCacheSetPinnedTileLimit(&tileCache, tileCache.entryCount);
+    megatexturePinLayers(&tileCache, index, 0xFF, MT_RESIDENCY_SET_PRELOAD);
+    mtTileCacheWaitForTiles(&tileCache);
+
+    mtVertexCacheInit(&gMtVertexCache);
+    mtMeshCacheInit(&gMtMeshCache);
+
+    if (useRowCache) {
+        mtRowCacheInit(&gMtRowCache);
+    }
+
+    struct RenderState renderState;
+    renderStateAlloc(&renderState, BENCH_DL_LENGTH);
+
+    struct CameraMatrixInfo cameraInfo;
+    memset(&cameraInfo, 0, sizeof(cameraInfo));
+    cameraInfo.cotFov = 1.0f;
+
+    struct BenchStats totals;
+    memset(&totals, 0, sizeof(totals));
+
+    for (int frame = 0; frame < frameCount; ++frame) {
+        // the view circles around the middle of the megatexture
+        float angle = 2.0f * M_PI * frame / frameCount;
+        float minU = 0.5f + 0.3f * cosf(angle) - viewSize * 0.5f;
+        float minV = 0.5f + 0.3f * sinf(angle) - viewSize * 0.5f;
+
+        megatextureRenderStart(&tileCache);
+        renderStateInit(&renderState, NULL);
+        Gfx* frameStart = renderState.dl;
+
+        for (int layerIndex = 0; layerIndex < index->layerCount; ++layerIndex) {
+            struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+            int minX = MAX(0, (int)floorf(minU * imageLayer->xTiles));
+            int maxX = MIN(imageLayer->xTiles, (int)ceilf((minU + viewSize) * imageLayer->xTiles));
+            int minY = MAX(0, (int)floorf(minV * imageLayer->yTiles));
+            int maxY = MIN(imageLayer->yTiles, (int)ceilf((minV + viewSize) * imageLayer->yTiles));
+
+            struct MTRowRange rowRanges[0x100];
+
+            for (int row = 0; row < imageLayer->yTiles; ++row) {
+                int visible = row >= minY && row < maxY;
+                rowRanges[row].minX = visible ? minX : 0;
+                rowRanges[row].maxX = visible ? maxX : 0;
+            }
+
+            megatextureRenderRows(&tileCache, index, layerIndex, rowRanges, &cameraInfo, &renderState);
+        }
+
+        gSPEndDisplayList(renderState.dl++);
+        megatextureRenderEnd(&tileCache, NULL, 1);
+        totals.windowsBuilt += gMtVertexCache.builtWindowCount;
+        totals.blocksLoaded += gMtMeshCache.loadCount;
+        totals.pendingRows += gMtMeshCache.pendingRowCount;
+
+        struct BenchWalk walk;
+        memset(&walk, 0, sizeof(walk));
+        walk.index = index;
+        walk.stats = &totals;
+        benchWalk(&walk, frameStart, 0);
+    }
+
+    float frames = frameCount ? frameCount : 1;
+
+    printf("%-12s %5d %9.2f %10.2f %10.0f %8.2f %8.2f %8.2f %8.2f %6d\n",
+        name,
+        useRowCache,
+        totals.vertexLoads / frames,
+        totals.verticesLoaded / frames,
+        totals.verticesLoaded * sizeof(Vtx) / frames,
+        totals.tilesDrawn / frames,
+        totals.windowsBuilt / frames,
+        totals.blocksLoaded / frames,
+        totals.pendingRows / frames,
+        totals.badTriangles
+    );
+
+    gMtRowCache.slots = NULL;
+    gMtMeshCache.blockData = NULL;
+}
+
+static void printUsage() {
+    fprintf(stderr, "usage: vertex_bench [--frames 240] [--size 32] [--view 0.35] [--seed 1] [--stream-axis 16]\n");
+}
+
+int main(int argc, char** argv) {
+    int frameCount = 240;
+    int size = 32;
+    float viewSize = 0.35f;
+    int streamAxis = 16;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frameCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--view") == 0 && i + 1 < argc) {
+            viewSize = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            gBenchSeed = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stream-axis") == 0 && i + 1 < argc) {
+            streamAxis = atoi(argv[++i]);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (size < 1 || size > 0xFF) {
+        printUsage();
+        return 1;
+    }
+
+    hostInit(BENCH_HEAP_SIZE, HOST_DEFAULT_ROM_SIZE);
+
+    int xTiles[BENCH_MAX_LAYERS];
+    int yTiles[BENCH_MAX_LAYERS];
+    int layerCount = 0;
+
+    for (int axis = size; axis >= 1 && layerCount < BENCH_MAX_LAYERS; axis >>= 1) {
+        xTiles[layerCount] = axis;
+        yTiles[layerCount] = axis;
+        ++layerCount;
+    }
+
+    struct MTTileIndex index;
+    hostTileTraceBuildIndex(&index, layerCount, xTiles, yTiles);
+
+    struct BenchLayer layers[BENCH_MAX_LAYERS];
+    struct MTMeshLayer rowWindows[BENCH_MAX_LAYERS];
+    struct MTMeshLayer spanningWindows[BENCH_MAX_LAYERS];
+    struct MTMeshLayer streamedLayers[BENCH_MAX_LAYERS];
+    int totalVertices = 0;
+    int meshBytes = 0;
+    int streamedMeshBytes = 0;
+
+    for (int i = 0; i < layerCount; ++i) {
+        benchGenerateLayer(&layers[i], xTiles[i], yTiles[i]);
+        benchBuildMeshLayer(&layers[i], &rowWindows[i], 0, 0);
+        benchBuildMeshLayer(&layers[i], &spanningWindows[i], 1, 0);
+        // the finest layers, like the exporter does with MESH_STREAM_MIN_AXIS
+        benchBuildMeshLayer(&layers[i], &streamedLayers[i], 1, MAX(xTiles[i], yTiles[i]) >= streamAxis);
+        totalVertices += layers[i].vertexCount;
+
+        int layerBytes = benchBlockSize(&layers[i], 0, yTiles[i]);
+        meshBytes += layerBytes;
+        streamedMeshBytes += streamedLayers[i].blocks ? 0 : layerBytes;
+    }
+
+    printf("%d layers %d vertices %d frames view %.2f\n", layerCount, totalVertices, frameCount, viewSize);
+    printf("mesh in ram %d bytes, %d when layers %d or more tiles across are streamed into a %d byte mesh cache\n",
+        meshBytes, streamedMeshBytes, streamAxis, MT_MESH_BLOCK_SIZE * MT_MESH_CACHE_SLOT_COUNT
+    );
+    printf("%-12s %5s %9s %10s %10s %8s %8s %8s %8s %6s\n",
+        "windows", "cache", "loads/f", "vertices/f", "bytes/f", "tiles/f", "built/f", "blocks/f", "pend/f", "bad"
+    );
+
+    for (int useRowCache = 0; useRowCache < 2; ++useRowCache) {
+        benchRun(&index, rowWindows, "per row", 0, useRowCache, frameCount, viewSize);
+        benchRun(&index, spanningWindows, "span rows", 1, useRowCache, frameCount, viewSize);
+        benchRun(&index, streamedLayers, "streamed", 1, useRowCache, frameCount, viewSize);
+    }
+
+    return 0;
+}
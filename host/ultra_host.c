@@ -0,0 +1,332 @@
+#include "host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// from util/memory.h, which can't be included alongside stdlib.h
+// since it declares its own malloc
+void heapInit(void* heapStart, void* heapEnd);
+void stackMallocReset();
+
+#define ALIGN_8(size) (((size) + 0x7) & ~0x7)
+
+// normally provided by graphics.c
+int gScreenWidth = 320;
+int gScreenHeight = 240;
+void* gLevelSegment;
+
+struct HostPiStats gHostPiStats;
+
+static char* gHostHeap;
+static int gHostHeapSize;
+
+static u8* gHostRom;
+static u32 gHostRomSize;
+static u32 gHostRomUsed;
+
+static OSPiHandle gHostPiHandle;
+
+// keep address 0 unused so a null rom pointer is never valid
+#define HOST_ROM_START  0x1000
+
+void hostInit(int heapSize, int romSize) {
+    if (!gHostHeap) {
+        gHostHeap = mmap(NULL, heapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+        if (gHostHeap == MAP_FAILED) {
+            fprintf(stderr, "hostInit: could not map a %d byte heap\n", heapSize);
+            exit(1);
+        }
+
+        gHostHeapSize = heapSize;
+    }
+
+    if (!gHostRom) {
+        gHostRom = calloc(1, romSize);
+        gHostRomSize = romSize;
+    }
+
+    hostHeapReset();
+    hostRomReset();
+    hostPiStatsReset();
+}
+
+void hostHeapReset() {
+    heapInit(gHostHeap, gHostHeap + gHostHeapSize);
+    stackMallocReset();
+}
+
+u32 hostRomAlloc(int size) {
+    u32 result = gHostRomUsed;
+    u32 alignedSize = ALIGN_8(size);
+
+    if (result + alignedSize > gHostRomSize) {
+        fprintf(stderr, "hostRomAlloc: out of rom space\n");
+        exit(1);
+    }
+
+    gHostRomUsed += alignedSize;
+
+    return result;
+}
+
+void* hostRomPointer(u32 romAddress) {
+    return gHostRom + romAddress;
+}
+
+void hostRomReset() {
+    gHostRomUsed = HOST_ROM_START;
+}
+
+void hostPiStatsReset() {
+    gHostPiStats.dmaCount = 0;
+    gHostPiStats.byteCount = 0;
+}
+
+/////////////////////
+// os
+/////////////////////
+
+void osCreateMesgQueue(OSMesgQueue* mq, OSMesg* msg, s32 count) {
+    mq->validCount = 0;
+    mq->first = 0;
+    mq->msgCount = count;
+    mq->msg = msg;
+}
+
+s32 osSendMesg(OSMesgQueue* mq, OSMesg msg, s32 flag) {
+    if (mq->validCount >= mq->msgCount) {
+        if (flag == OS_MESG_BLOCK) {
+            fprintf(stderr, "osSendMesg: queue full, a blocking send would never return\n");
+            abort();
+        }
+
+        return -1;
+    }
+
+    mq->msg[(mq->first + mq->validCount) % mq->msgCount] = msg;
+    ++mq->validCount;
+    return 0;
+}
+
+s32 osRecvMesg(OSMesgQueue* mq, OSMesg* msg, s32 flag) {
+    if (mq->validCount == 0) {
+        if (flag == OS_MESG_BLOCK) {
+            fprintf(stderr, "osRecvMesg: queue empty, a blocking receive would never return\n");
+            abort();
+        }
+
+        return -1;
+    }
+
+    if (msg) {
+        *msg = mq->msg[mq->first];
+    }
+
+    mq->first = (mq->first + 1) % mq->msgCount;
+    --mq->validCount;
+    return 0;
+}
+
+OSPiHandle* osCartRomInit(void) {
+    return &gHostPiHandle;
+}
+
+s32 osEPiStartDma(OSPiHandle* piHandle, OSIoMesg* mb, s32 direction) {
+    if (mb->devAddr < HOST_ROM_START || mb->devAddr + mb->size > gHostRomSize) {
+        fprintf(stderr, "osEPiStartDma: rom address 0x%08x size 0x%x out of range\n", mb->devAddr, mb->size);
+        abort();
+    }
+
+    if (direction == OS_READ) {
+        memcpy(mb->dramAddr, gHostRom + mb->devAddr, mb->size);
+    } else {
+        memcpy(gHostRom + mb->devAddr, mb->dramAddr, mb->size);
+    }
+
+    ++gHostPiStats.dmaCount;
+    gHostPiStats.byteCount += mb->size;
+
+    // the transfer is finished immediately
+    if (mb->hdr.retQueue) {
+        osSendMesg(mb->hdr.retQueue, (OSMesg)mb, OS_MESG_NOBLOCK);
+    }
+
+    return 0;
+}
+
+s32 osPiStartDma(OSIoMesg* mb, s32 priority, s32 direction, u32 devAddr, void* dramAddr, u32 size, OSMesgQueue* mq) {
+    mb->hdr.pri = priority;
+    mb->hdr.retQueue = mq;
+    mb->devAddr = devAddr;
+    mb->dramAddr = dramAddr;
+    mb->size = size;
+    return osEPiStartDma(&gHostPiHandle, mb, direction);
+}
+
+void osInvalDCache(void* vaddr, s32 nbytes) {
+
+}
+
+void osInvalICache(void* vaddr, s32 nbytes) {
+
+}
+
+void osWritebackDCache(void* vaddr, s32 nbytes) {
+
+}
+
+void osWritebackDCacheAll(void) {
+
+}
+
+uintptr_t osVirtualToPhysical(void* virtualAddress) {
+    return (uintptr_t)virtualAddress;
+}
+
+OSTime osGetTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    u64 nsec = (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    return OS_NSEC_TO_CYCLES(nsec);
+}
+
+/////////////////////
+// gu
+/////////////////////
+
+#define FTOFIX32(x) (s32)((x) * (float)0x00010000)
+
+void guMtxF2L(float mf[4][4], Mtx* m) {
+    u32* ai = (u32*)&m->m[0][0];
+    u32* af = (u32*)&m->m[2][0];
+
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            s32 e1 = FTOFIX32(mf[i][j * 2]);
+            s32 e2 = FTOFIX32(mf[i][j * 2 + 1]);
+            *(ai++) = (e1 & 0xffff0000) | ((e2 >> 16) & 0xffff);
+            *(af++) = ((e1 << 16) & 0xffff0000) | (e2 & 0xffff);
+        }
+    }
+}
+
+void guMtxL2F(float mf[4][4], Mtx* m) {
+    u32* ai = (u32*)&m->m[0][0];
+    u32* af = (u32*)&m->m[2][0];
+
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            s32 e1 = (ai[0] & 0xffff0000) | ((af[0] >> 16) & 0xffff);
+            s32 e2 = ((ai[0] << 16) & 0xffff0000) | (af[0] & 0xffff);
+            mf[i][j * 2] = (float)e1 / (float)0x00010000;
+            mf[i][j * 2 + 1] = (float)e2 / (float)0x00010000;
+            ++ai;
+            ++af;
+        }
+    }
+}
+
+void guMtxIdentF(float mf[4][4]) {
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            mf[i][j] = i == j ? 1.0f : 0.0f;
+        }
+    }
+}
+
+void guMtxIdent(Mtx* m) {
+    float mf[4][4];
+    guMtxIdentF(mf);
+    guMtxF2L(mf, m);
+}
+
+void guMtxCatF(float m[4][4], float n[4][4], float r[4][4]) {
+    float temp[4][4];
+
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            temp[i][j] = 0.0f;
+
+            for (int k = 0; k < 4; ++k) {
+                temp[i][j] += m[i][k] * n[k][j];
+            }
+        }
+    }
+
+    memcpy(r, temp, sizeof(temp));
+}
+
+void guPerspectiveF(float mf[4][4], u16* perspNorm, float fovy, float aspect, float near, float far, float scale) {
+    guMtxIdentF(mf);
+
+    fovy *= M_PI / 180.0;
+    float cot = cosf(fovy / 2) / sinf(fovy / 2);
+
+    mf[0][0] = cot / aspect;
+    mf[1][1] = cot;
+    mf[2][2] = (near + far) / (near - far);
+    mf[2][3] = -1;
+    mf[3][2] = (2 * near * far) / (near - far);
+    mf[3][3] = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            mf[i][j] *= scale;
+        }
+    }
+
+    if (perspNorm) {
+        if (near + far <= 2.0f) {
+            *perspNorm = 65535;
+        } else {
+            *perspNorm = (u16)((2.0f * 65536.0f) / (near + far));
+
+            if (*perspNorm == 0) {
+                *perspNorm = 1;
+            }
+        }
+    }
+}
+
+void guPerspective(Mtx* m, u16* perspNorm, float fovy, float aspect, float near, float far, float scale) {
+    float mf[4][4];
+    guPerspectiveF(mf, perspNorm, fovy, aspect, near, far, scale);
+    guMtxF2L(mf, m);
+}
+
+void guOrthoF(float mf[4][4], float l, float r, float b, float t, float n, float f, float scale) {
+    guMtxIdentF(mf);
+
+    mf[0][0] = 2 / (r - l);
+    mf[1][1] = 2 / (t - b);
+    mf[2][2] = -2 / (f - n);
+    mf[3][0] = -(r + l) / (r - l);
+    mf[3][1] = -(t + b) / (t - b);
+    mf[3][2] = -(f + n) / (f - n);
+    mf[3][3] = 1;
+
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            mf[i][j] *= scale;
+        }
+    }
+}
+
+void guScaleF(float mf[4][4], float x, float y, float z) {
+    guMtxIdentF(mf);
+    mf[0][0] = x;
+    mf[1][1] = y;
+    mf[2][2] = z;
+}
+
+void guTranslateF(float mf[4][4], float x, float y, float z) {
+    guMtxIdentF(mf);
+    mf[3][0] = x;
+    mf[3][1] = y;
+    mf[3][2] = z;
+}
@@ -11,6 +11,7 @@ extern OSMesgQueue  gfxFrameMsgQ;
 extern OSMesgQueue	*schedulerCommandQueue;
 
 void* gLevelSegment;
+u32 gLastGraphicsTaskTimeUs;
 
 #if WITH_GFX_VALIDATOR
 #include "../../gfxvalidator/validator.h"
@@ -71,6 +72,7 @@ void graphicsAlloc(int displayListLength) {
 int graphicsCreateTask(struct GraphicsTask* targetTask, GraphicsCallback callback, void* data) {
     struct RenderState *renderState = &targetTask->renderState;
 
+    targetTask->startTime = osGetTime();
     renderStateInit(renderState, targetTask->framebuffer);
     gSPSegment(renderState->dl++, 0, 0);
     gSPSegment(renderState->dl++, LEVEL_SEGMENT, gLevelSegment);
@@ -152,3 +154,12 @@ int graphicsCreateTask(struct GraphicsTask* targetTask, GraphicsCallback callbac
     osSendMesg(schedulerCommandQueue, (OSMesg)scTask, OS_MESG_BLOCK);
     return 1;
 }
+
+void graphicsTaskDone(OSScMsg* msg) {
+    for (int i = 0; i < 2; ++i) {
+        if (msg == &gGraphicsTasks[i].msg) {
+            gLastGraphicsTaskTimeUs = OS_CYCLES_TO_USEC(osGetTime() - gGraphicsTasks[i].startTime);
+            return;
+        }
+    }
+}
@@ -15,12 +15,15 @@ struct GraphicsTask {
     OSScMsg msg;
     u16 *framebuffer;
     u16 taskIndex;
+    OSTime startTime;
 };
 
 extern struct GraphicsTask gGraphicsTasks[2];
 extern Vp fullscreenViewport;
 
 extern void* gLevelSegment;
+// time from starting to build the last finished task until it was done
+extern u32 gLastGraphicsTaskTimeUs;
 
 #define GET_GFX_TYPE(gfx)       (_SHIFTR((gfx)->words.w0, 24, 8))
 
@@ -29,5 +32,6 @@ typedef int (*GraphicsCallback)(void* data, struct RenderState* renderState, str
 u16* graphicsLayoutScreenBuffers(u16* memoryEnd);
 void graphicsAlloc(int displayListLength);
 int graphicsCreateTask(struct GraphicsTask* targetTask, GraphicsCallback callback, void* data);
+void graphicsTaskDone(OSScMsg* msg);
 
 #endif
\ No newline at end of file
@@ -1,24 +1,36 @@
 #include "./level_definition.h"
 
+#include <math.h>
+
 void levelDefinitionFixTileIndexPointers(struct MTTileIndex* tileIndex, u32 pointerOffset, u32 imagePointerOffset) {
     tileIndex->meshLayers = ADJUST_POINTER_POS(tileIndex->meshLayers, pointerOffset);
+    tileIndex->ripChains = ADJUST_POINTER_POS(tileIndex->ripChains, pointerOffset);
 
-    for (int i = 0; i < tileIndex->layerCount; ++i) {
+    for (int i = 0; i < MT_TILE_INDEX_LAYER_COUNT(tileIndex); ++i) {
         struct MTMeshLayer* layer = &tileIndex->meshLayers[i];
 
         layer->vertices = ADJUST_POINTER_POS(layer->vertices, pointerOffset);
-        layer->indices = ADJUST_POINTER_POS(layer->indices, pointerOffset);
+        layer->triangles = ADJUST_POINTER_POS(layer->triangles, pointerOffset);
         layer->tiles = ADJUST_POINTER_POS(layer->tiles, pointerOffset);
+        layer->blocks = ADJUST_POINTER_POS(layer->blocks, pointerOffset);
+
+        if (layer->blocks) {
+            int blockCount = (layer->maxTileY - layer->minTileY + layer->blockRows - 1) / layer->blockRows;
 
+            for (int block = 0; block < blockCount; ++block) {
+                layer->blocks[block].romAddress = ADJUST_POINTER_POS(layer->blocks[block].romAddress, imagePointerOffset);
+            }
+        }
     }
 
 
     tileIndex->imageLayers = ADJUST_POINTER_POS(tileIndex->imageLayers, pointerOffset);
 
-    for (int i = 0; i < tileIndex->layerCount; ++i) {
+    for (int i = 0; i < MT_TILE_INDEX_LAYER_COUNT(tileIndex); ++i) {
         struct MTImageLayer* layer = &tileIndex->imageLayers[i];
         
         layer->tileSource = ADJUST_POINTER_POS(layer->tileSource, imagePointerOffset);
+        layer->tileOffsets = ADJUST_POINTER_POS(layer->tileOffsets, pointerOffset);
     }
 }
 
@@ -32,6 +44,53 @@ struct LevelDefinition* levelDefinitionFixPointers(struct LevelDefinition* sourc
     }
 
     result->collisionQuads = ADJUST_POINTER_POS(result->collisionQuads, pointerOffset);
+    result->bspNodes = ADJUST_POINTER_POS(result->bspNodes, pointerOffset);
+    result->bvhNodes = ADJUST_POINTER_POS(result->bvhNodes, pointerOffset);
+    result->bvhIndices = ADJUST_POINTER_POS(result->bvhIndices, pointerOffset);
+
+    result->visibility.cellSets = ADJUST_POINTER_POS(result->visibility.cellSets, pointerOffset);
+    result->visibility.visibilitySets = ADJUST_POINTER_POS(result->visibility.visibilitySets, pointerOffset);
+
+    return result;
+}
+
+u32* levelDefinitionVisibleMegatextures(struct LevelDefinition* level, struct Vector3* position) {
+    struct LevelVisibility* visibility = &level->visibility;
+
+    if (!visibility->cellSets) {
+        return NULL;
+    }
+
+    int x = (int)floorf((position->x - visibility->minX) / visibility->cellSize);
+    int z = (int)floorf((position->z - visibility->minZ) / visibility->cellSize);
+
+    if (x < 0 || z < 0 || x >= visibility->xCells || z >= visibility->zCells) {
+        return NULL;
+    }
+
+    int wordsPerSet = (level->megatextureIndexCount + 31) >> 5;
+
+    return &visibility->visibilitySets[visibility->cellSets[x + z * visibility->xCells] * wordsPerSet];
+}
+
+u32* levelDefinitionMegatexturesInView(struct LevelDefinition* level, struct FrustrumCullingInformation* frustrum, u32* visibleSet, u8* lastPlanes, u32* result) {
+    if (!level->bvhNodes) {
+        return visibleSet;
+    }
+
+    int wordsPerSet = (level->megatextureIndexCount + 31) >> 5;
+
+    for (int i = 0; i < wordsPerSet; ++i) {
+        result[i] = 0;
+    }
+
+    mtBvhCull(level->bvhNodes, level->bvhIndices, frustrum, lastPlanes, result);
+
+    if (visibleSet) {
+        for (int i = 0; i < wordsPerSet; ++i) {
+            result[i] &= visibleSet[i];
+        }
+    }
 
     return result;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define __LEVEL_LEVEL_DEFINITION_H__
 
 #include "../megatextures/tile_index.h"
+#include "../megatextures/megatexture_bsp.h"
+#include "../megatextures/megatexture_bvh.h"
 
 #include "../math/vector3.h"
 #include "../math/plane.h"
@@ -19,16 +21,52 @@ struct CollisionQuad {
     struct Box3D bb;
 };
 
+// the space the player can walk around in is split into a grid of square
+// cells on the xz plane. Each cell has a bitset with a bit for each
+// megatexture that can be seen from somewhere inside it, cells that see
+// the same megatextures share a set
+struct LevelVisibility {
+    float minX;
+    float minZ;
+    float cellSize;
+    u16 xCells;
+    u16 zCells;
+    // the set of each cell, row by row along x
+    u16* cellSets;
+    // (megatextureIndexCount + 31) / 32 words for each set
+    u32* visibilitySets;
+};
+
 struct LevelDefinition {
     struct MTTileIndex* megatextureIndexes;
     struct CollisionQuad* collisionQuads;
 
+    // NULL if the level was exported without a bsp, megatextures
+    // are then sorted by sortGroup and distance every frame
+    struct MTBspNode* bspNodes;
+    // NULL if the level was exported without a bvh
+    struct MTBvhNode* bvhNodes;
+    u16* bvhIndices;
+
     short megatextureIndexCount;
     short collisionQuadCount;
+    u16 bvhNodeCount;
+
+    // cellSets is NULL if the level was exported without visibility
+    struct LevelVisibility visibility;
 };
 
 #define ADJUST_POINTER_POS(ptr, offset) (void*)((ptr) ? (char*)(ptr) + (offset) : 0)
 
 struct LevelDefinition* levelDefinitionFixPointers(struct LevelDefinition* source, u32 pointerOffset, u32 imagePointerOffset);
+// the set of megatextures that can be seen from position, one bit for each
+// megatexture index. NULL if position is outside of every visibility cell
+// and everything has to be considered visible
+u32* levelDefinitionVisibleMegatextures(struct LevelDefinition* level, struct Vector3* position);
+// narrows visibleSet, which may be NULL, down to the megatextures that may
+// be in the frustum and writes it to result. result needs a bit for each
+// megatexture and lastPlanes a byte for each bvh node, see mtBvhCull.
+// Returns visibleSet as is if the level has no bvh
+u32* levelDefinitionMegatexturesInView(struct LevelDefinition* level, struct FrustrumCullingInformation* frustrum, u32* visibleSet, u8* lastPlanes, u32* result);
 
 #endif
\ No newline at end of file
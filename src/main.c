@@ -228,6 +228,7 @@ static void gameProc(void* arg) {
                 break;
 
             case (OS_SC_DONE_MSG):
+                graphicsTaskDone(msg);
                 --pendingGFX;
                 break;
             case (OS_SC_PRE_NMI_MSG):
@@ -0,0 +1,32 @@
+#include "megatexture_bsp.h"
+
+static u16* mtBspNodeDrawOrder(struct MTBspNode* nodes, int nodeIndex, struct FrustrumCullingInformation* frustrum, u16* order) {
+    struct MTBspNode* node = &nodes[nodeIndex];
+
+    if (isOutsideFrustrum(frustrum, &node->boundingBox)) {
+        return order;
+    }
+
+    int isInFront = planePointDistance(&node->plane, &frustrum->cameraPos) >= 0.0f;
+    int farSide = isInFront ? node->back : node->front;
+    int nearSide = isInFront ? node->front : node->back;
+
+    if (farSide != MT_BSP_NO_NODE) {
+        order = mtBspNodeDrawOrder(nodes, farSide, frustrum, order);
+    }
+
+    // megatextures in the same plane can't cover each other
+    for (int i = 0; i < node->indexCount; ++i) {
+        *order++ = node->firstIndex + i;
+    }
+
+    if (nearSide != MT_BSP_NO_NODE) {
+        order = mtBspNodeDrawOrder(nodes, nearSide, frustrum, order);
+    }
+
+    return order;
+}
+
+int mtBspDrawOrder(struct MTBspNode* nodes, struct FrustrumCullingInformation* frustrum, u16* order) {
+    return mtBspNodeDrawOrder(nodes, 0, frustrum, order) - order;
+}
@@ -0,0 +1,34 @@
+#ifndef __MEGATEXTURE_BSP_H__
+#define __MEGATEXTURE_BSP_H__
+
+#include <ultra64.h>
+#include "../math/plane.h"
+#include "../math/box3d.h"
+#include "../scene/camera.h"
+
+// the exporter splits megatextures along each others planes and builds
+// a bsp tree out of them so they can be put in painters order by
+// walking the tree instead of sorting them every frame
+
+#define MT_BSP_NO_NODE  -1
+
+struct MTBspNode {
+    struct Plane plane;
+    // contains every megatexture in this node and its children
+    struct Box3D boundingBox;
+    // the megatextures in the plane of this node are indices
+    // firstIndex up to firstIndex + indexCount in the level
+    u16 firstIndex;
+    u16 indexCount;
+    // MT_BSP_NO_NODE if nothing is on that side of the plane
+    s16 front;
+    s16 back;
+};
+
+// writes the megatexture indices of nodes in the frustum to order back
+// to front from the camera, the root is nodes[0]. order needs room for
+// every index. Reading the result backwards gives front to back order.
+// Returns the number of indices written
+int mtBspDrawOrder(struct MTBspNode* nodes, struct FrustrumCullingInformation* frustrum, u16* order);
+
+#endif
@@ -0,0 +1,110 @@
+#include "megatexture_bvh.h"
+
+#define MT_BVH_OUTSIDE      0
+#define MT_BVH_CROSSING     1
+#define MT_BVH_INSIDE       2
+
+u32 gMtBvhPlaneTestCount;
+
+static int mtBvhClassify(struct Plane* plane, struct Box3D* box) {
+    struct Vector3 insideCorner;
+    struct Vector3 outsideCorner;
+
+    ++gMtBvhPlaneTestCount;
+
+    if (plane->normal.x < 0.0f) {
+        insideCorner.x = box->min.x;
+        outsideCorner.x = box->max.x;
+    } else {
+        insideCorner.x = box->max.x;
+        outsideCorner.x = box->min.x;
+    }
+
+    if (plane->normal.y < 0.0f) {
+        insideCorner.y = box->min.y;
+        outsideCorner.y = box->max.y;
+    } else {
+        insideCorner.y = box->max.y;
+        outsideCorner.y = box->min.y;
+    }
+
+    if (plane->normal.z < 0.0f) {
+        insideCorner.z = box->min.z;
+        outsideCorner.z = box->max.z;
+    } else {
+        insideCorner.z = box->max.z;
+        outsideCorner.z = box->min.z;
+    }
+
+    // matches isOutsideFrustrum
+    if (planePointDistance(plane, &insideCorner) < 0.00001f) {
+        return MT_BVH_OUTSIDE;
+    }
+
+    if (planePointDistance(plane, &outsideCorner) >= 0.0f) {
+        return MT_BVH_INSIDE;
+    }
+
+    return MT_BVH_CROSSING;
+}
+
+// planeMask has a bit for each clipping plane the parent crosses, a
+// node entirely inside a plane doesn't test it again for its children
+static int mtBvhCullNode(struct MTBvhNode* nodes, int nodeIndex, u16* indices, struct FrustrumCullingInformation* frustrum, u8* lastPlanes, int planeMask, u32* inFrustum) {
+    struct MTBvhNode* node = &nodes[nodeIndex];
+    int testedMask = 0;
+
+    if (lastPlanes) {
+        int lastPlane = lastPlanes[nodeIndex];
+
+        if (planeMask & (1 << lastPlane)) {
+            int side = mtBvhClassify(&frustrum->clippingPlanes[lastPlane], &node->boundingBox);
+
+            if (side == MT_BVH_OUTSIDE) {
+                return 0;
+            }
+
+            if (side == MT_BVH_INSIDE) {
+                planeMask &= ~(1 << lastPlane);
+            }
+
+            testedMask = 1 << lastPlane;
+        }
+    }
+
+    for (int i = 0; i < frustrum->usedClippingPlaneCount; ++i) {
+        if (!(planeMask & ~testedMask & (1 << i))) {
+            continue;
+        }
+
+        int side = mtBvhClassify(&frustrum->clippingPlanes[i], &node->boundingBox);
+
+        if (side == MT_BVH_OUTSIDE) {
+            if (lastPlanes) {
+                lastPlanes[nodeIndex] = i;
+            }
+
+            return 0;
+        }
+
+        if (side == MT_BVH_INSIDE) {
+            planeMask &= ~(1 << i);
+        }
+    }
+
+    if (node->indexCount) {
+        for (int i = 0; i < node->indexCount; ++i) {
+            int index = indices[node->first + i];
+            inFrustum[index >> 5] |= 1u << (index & 31);
+        }
+
+        return node->indexCount;
+    }
+
+    return mtBvhCullNode(nodes, node->first, indices, frustrum, lastPlanes, planeMask, inFrustum) +
+        mtBvhCullNode(nodes, node->first + 1, indices, frustrum, lastPlanes, planeMask, inFrustum);
+}
+
+int mtBvhCull(struct MTBvhNode* nodes, u16* indices, struct FrustrumCullingInformation* frustrum, u8* lastPlanes, u32* inFrustum) {
+    return mtBvhCullNode(nodes, 0, indices, frustrum, lastPlanes, (1 << frustrum->usedClippingPlaneCount) - 1, inFrustum);
+}
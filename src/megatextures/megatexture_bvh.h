@@ -0,0 +1,35 @@
+#ifndef __MEGATEXTURE_BVH_H__
+#define __MEGATEXTURE_BVH_H__
+
+#include <ultra64.h>
+#include "../math/box3d.h"
+#include "../scene/camera.h"
+
+// the exporter builds a tree of bounding boxes over the megatextures so
+// a level with many of them can skip whole groups outside the frustum
+// instead of testing each one
+
+struct MTBvhNode {
+    struct Box3D boundingBox;
+    // a leaf if indexCount isn't 0, its megatextures are indices[first]
+    // up to indices[first + indexCount]. Otherwise the children are
+    // nodes[first] and nodes[first + 1]
+    u16 first;
+    u8 indexCount;
+};
+
+// box against clipping plane tests done by mtBvhCull
+extern u32 gMtBvhPlaneTestCount;
+
+// sets the bit of each megatexture that may be in the frustum, the root
+// is nodes[0]. inFrustum must start cleared and have a bit for each
+// megatexture. Returns the number of bits set
+//
+// lastPlanes has a byte for each node and remembers the clipping plane
+// that culled it last time, that plane is tested first since it most
+// likely culls the node again next frame. The nodes come from level
+// data so it has to be kept in ram separately, start it cleared.
+// May be NULL
+int mtBvhCull(struct MTBvhNode* nodes, u16* indices, struct FrustrumCullingInformation* frustrum, u8* lastPlanes, u32* inFrustum);
+
+#endif
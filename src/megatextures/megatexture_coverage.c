@@ -0,0 +1,239 @@
+#include "megatexture_coverage.h"
+
+#include <math.h>
+
+// points closer to the plane of the camera than this aren't projected
+#define MT_COVERAGE_MIN_DEPTH   0.0001f
+
+int gMtUseCoverage = 0;
+struct MTCoverageBuffer gMtCoverage;
+
+void mtCoverageReset(struct MTCoverageBuffer* coverage) {
+    for (int i = 0; i < MT_COVERAGE_BAND_COUNT; ++i) {
+        coverage->bands[i].spanCount = 0;
+    }
+
+    coverage->isActive = 0;
+    coverage->currentOrder = 0;
+    coverage->skippedRowCount = 0;
+    coverage->skippedTileRequests = 0;
+    coverage->skippedTileMisses = 0;
+    coverage->skippedBytesFromCart = 0;
+    coverage->skippedPixelCount = 0;
+}
+
+// the left, right, bottom and top clipping planes pass through the camera
+// so how far a point is between each pair is where it is on screen
+static int mtCoverageProject(struct FrustrumCullingInformation* frustrum, struct MTUVBasis* uvBasis, float u, float v, struct Vector2* result) {
+    struct Vector3 point;
+    vector3AddScaled(&uvBasis->uvOrigin, &uvBasis->uvRight, u, &point);
+    vector3AddScaled(&point, &uvBasis->uvUp, v, &point);
+
+    float left = planePointDistance(&frustrum->clippingPlanes[0], &point);
+    float right = planePointDistance(&frustrum->clippingPlanes[1], &point);
+    float bottom = planePointDistance(&frustrum->clippingPlanes[2], &point);
+    float top = planePointDistance(&frustrum->clippingPlanes[3], &point);
+
+    if (left + right < MT_COVERAGE_MIN_DEPTH || bottom + top < MT_COVERAGE_MIN_DEPTH) {
+        return 0;
+    }
+
+    result->x = left / (left + right);
+    result->y = top / (bottom + top);
+
+    return 1;
+}
+
+// finds where the horizontal line at y crosses a convex loop
+static int mtCoverageLoopSpan(struct Vector2* points, int count, float y, float* minX, float* maxX) {
+    int found = 0;
+
+    for (int i = 0; i < count; ++i) {
+        struct Vector2* a = &points[i];
+        struct Vector2* b = &points[i + 1 == count ? 0 : i + 1];
+
+        if ((a->y > y && b->y > y) || (a->y < y && b->y < y)) {
+            continue;
+        }
+
+        float edgeMin;
+        float edgeMax;
+
+        if (a->y == b->y) {
+            edgeMin = MIN(a->x, b->x);
+            edgeMax = MAX(a->x, b->x);
+        } else {
+            edgeMin = a->x + (b->x - a->x) * (y - a->y) / (b->y - a->y);
+            edgeMax = edgeMin;
+        }
+
+        if (!found) {
+            *minX = edgeMin;
+            *maxX = edgeMax;
+            found = 1;
+        } else {
+            *minX = MIN(*minX, edgeMin);
+            *maxX = MAX(*maxX, edgeMax);
+        }
+    }
+
+    return found;
+}
+
+// fills the gaps between minX and maxX that aren't covered yet
+static void mtCoverageBandAdd(struct MTCoverageBand* band, float minX, float maxX, int order) {
+    struct MTCoverageSpan result[MT_COVERAGE_MAX_SPANS * 2 + 1];
+    int resultCount = 0;
+    float cursor = minX;
+
+    for (int i = 0; i < band->spanCount; ++i) {
+        struct MTCoverageSpan* span = &band->spans[i];
+
+        if (cursor < maxX && span->minX > cursor) {
+            result[resultCount].minX = cursor;
+            result[resultCount].maxX = MIN(span->minX, maxX);
+            result[resultCount].order = order;
+            ++resultCount;
+        }
+
+        result[resultCount++] = *span;
+        cursor = MAX(cursor, span->maxX);
+    }
+
+    if (cursor < maxX) {
+        result[resultCount].minX = cursor;
+        result[resultCount].maxX = maxX;
+        result[resultCount].order = order;
+        ++resultCount;
+    }
+
+    if (resultCount > MT_COVERAGE_MAX_SPANS) {
+        // leaving a gap only means less is skipped
+        return;
+    }
+
+    for (int i = 0; i < resultCount; ++i) {
+        band->spans[i] = result[i];
+    }
+
+    band->spanCount = resultCount;
+}
+
+static int mtCoverageBandCovers(struct MTCoverageBand* band, float minX, float maxX, int order) {
+    float cursor = minX;
+
+    for (int i = 0; i < band->spanCount && cursor < maxX; ++i) {
+        struct MTCoverageSpan* span = &band->spans[i];
+
+        if (span->maxX <= cursor) {
+            continue;
+        }
+
+        if (span->minX > cursor || span->order <= order) {
+            return 0;
+        }
+
+        cursor = span->maxX;
+    }
+
+    return cursor >= maxX;
+}
+
+void mtCoverageAddLoop(struct MTCoverageBuffer* coverage, struct MTCullingLoop* loop, struct MTUVBasis* uvBasis, struct FrustrumCullingInformation* frustrum, int order) {
+    if (loop->loopSize < 3 || frustrum->usedClippingPlaneCount < 4) {
+        return;
+    }
+
+    struct Vector2 screen[MT_MAX_CULLING_LOOP_SIZE];
+    float minY = 1.0f;
+    float maxY = 0.0f;
+
+    for (int i = 0; i < loop->loopSize; ++i) {
+        if (!mtCoverageProject(frustrum, uvBasis, loop->loop[i].x, loop->loop[i].y, &screen[i])) {
+            return;
+        }
+
+        minY = MIN(minY, screen[i].y);
+        maxY = MAX(maxY, screen[i].y);
+    }
+
+    // only bands the loop covers from top to bottom
+    int firstBand = MAX(0, (int)ceilf(minY * MT_COVERAGE_BAND_COUNT));
+    int endBand = MIN(MT_COVERAGE_BAND_COUNT, (int)floorf(maxY * MT_COVERAGE_BAND_COUNT));
+
+    float topMinX;
+    float topMaxX;
+
+    if (firstBand >= endBand || !mtCoverageLoopSpan(screen, loop->loopSize, (float)firstBand / MT_COVERAGE_BAND_COUNT, &topMinX, &topMaxX)) {
+        return;
+    }
+
+    for (int band = firstBand; band < endBand; ++band) {
+        float bottomMinX;
+        float bottomMaxX;
+
+        if (!mtCoverageLoopSpan(screen, loop->loopSize, (float)(band + 1) / MT_COVERAGE_BAND_COUNT, &bottomMinX, &bottomMaxX)) {
+            return;
+        }
+
+        // the loop is convex so it covers the whole band between
+        // the spans at the top and the bottom of the band
+        float minX = MAX(0.0f, MAX(topMinX, bottomMinX));
+        float maxX = MIN(1.0f, MIN(topMaxX, bottomMaxX));
+
+        if (minX < maxX) {
+            mtCoverageBandAdd(&coverage->bands[band], minX, maxX, order);
+        }
+
+        topMinX = bottomMinX;
+        topMaxX = bottomMaxX;
+    }
+}
+
+int mtCoverageIsRectCovered(struct MTCoverageBuffer* coverage, struct Vector2* minUv, struct Vector2* maxUv, struct MTUVBasis* uvBasis, struct FrustrumCullingInformation* frustrum, int order, float* screenArea) {
+    if (frustrum->usedClippingPlaneCount < 4) {
+        return 0;
+    }
+
+    struct Vector2 corners[4];
+
+    if (!mtCoverageProject(frustrum, uvBasis, minUv->x, minUv->y, &corners[0]) ||
+        !mtCoverageProject(frustrum, uvBasis, maxUv->x, minUv->y, &corners[1]) ||
+        !mtCoverageProject(frustrum, uvBasis, minUv->x, maxUv->y, &corners[2]) ||
+        !mtCoverageProject(frustrum, uvBasis, maxUv->x, maxUv->y, &corners[3])) {
+        return 0;
+    }
+
+    float minX = corners[0].x;
+    float maxX = corners[0].x;
+    float minY = corners[0].y;
+    float maxY = corners[0].y;
+
+    for (int i = 1; i < 4; ++i) {
+        minX = MIN(minX, corners[i].x);
+        maxX = MAX(maxX, corners[i].x);
+        minY = MIN(minY, corners[i].y);
+        maxY = MAX(maxY, corners[i].y);
+    }
+
+    minX = MAX(0.0f, minX);
+    maxX = MIN(1.0f, maxX);
+    minY = MAX(0.0f, minY);
+    maxY = MIN(1.0f, maxY);
+
+    if (minX >= maxX || minY >= maxY) {
+        return 0;
+    }
+
+    int endBand = MIN(MT_COVERAGE_BAND_COUNT, (int)ceilf(maxY * MT_COVERAGE_BAND_COUNT));
+
+    for (int band = (int)floorf(minY * MT_COVERAGE_BAND_COUNT); band < endBand; ++band) {
+        if (!mtCoverageBandCovers(&coverage->bands[band], minX, maxX, order)) {
+            return 0;
+        }
+    }
+
+    *screenArea = (maxX - minX) * (maxY - minY);
+
+    return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef __MEGATEXTURE_COVERAGE_H__
+#define __MEGATEXTURE_COVERAGE_H__
+
+#include <ultra64.h>
+#include "tile_index.h"
+#include "megatexture_culling_loop.h"
+#include "../scene/camera.h"
+
+// without a z buffer every megatexture is drawn back to front, even the
+// parts painted over later. Before drawing, the megatextures are walked
+// front to back and the parts of the screen each one covers are added
+// to a coarse buffer of horizontal bands. A tile row is then skipped if
+// the bands it is in are covered by megatextures drawn after it
+
+#define MT_COVERAGE_BAND_COUNT      32
+#define MT_COVERAGE_MAX_SPANS       8
+
+// screen positions are from 0 to 1 across and down the screen
+struct MTCoverageSpan {
+    float minX;
+    float maxX;
+    // draw order of the megatexture covering the span
+    u16 order;
+};
+
+struct MTCoverageBand {
+    // sorted by minX and never overlapping
+    struct MTCoverageSpan spans[MT_COVERAGE_MAX_SPANS];
+    u8 spanCount;
+};
+
+struct MTCoverageBuffer {
+    struct MTCoverageBand bands[MT_COVERAGE_BAND_COUNT];
+    // only set for frames the buffer was built for
+    u8 isActive;
+    // draw order of the megatexture being drawn
+    u16 currentOrder;
+
+    // what was saved by skipping rows this frame
+    u16 skippedRowCount;
+    u16 skippedTileRequests;
+    // skipped tiles that weren't in the cache, each would have been a dma
+    u16 skippedTileMisses;
+    u32 skippedBytesFromCart;
+    // estimate of the pixels the rdp didn't have to fill
+    u32 skippedPixelCount;
+};
+
+// zero to draw everything like before. Only levels with a bsp have
+// a front to back order to build the buffer with
+extern int gMtUseCoverage;
+extern struct MTCoverageBuffer gMtCoverage;
+
+void mtCoverageReset(struct MTCoverageBuffer* coverage);
+// adds the part of the screen covered by the uv space loop, a culling
+// loop already clipped to the frustum. order must be lower than the
+// order of anything added before it
+void mtCoverageAddLoop(struct MTCoverageBuffer* coverage, struct MTCullingLoop* loop, struct MTUVBasis* uvBasis, struct FrustrumCullingInformation* frustrum, int order);
+// true if the uv space rectangle is hidden behind megatextures with a
+// higher order than order
+int mtCoverageIsRectCovered(struct MTCoverageBuffer* coverage, struct Vector2* minUv, struct Vector2* maxUv, struct MTUVBasis* uvBasis, struct FrustrumCullingInformation* frustrum, int order, float* screenArea);
+
+#endif
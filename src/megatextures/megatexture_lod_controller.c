@@ -0,0 +1,86 @@
+#include "megatexture_lod_controller.h"
+
+#include "../math/mathf.h"
+#include <math.h>
+
+#define MT_LOD_PROPORTIONAL_GAIN    0.5f
+#define MT_LOD_INTEGRAL_GAIN        (1.0f / 32.0f)
+#define MT_MAX_LOD_BIAS             6.0f
+// errors smaller than this are ignored so the bias settles
+#define MT_LOD_DEADBAND             0.1f
+// the bias only moves once the output is this far from it
+#define MT_LOD_BIAS_HYSTERESIS      (1.0f / 16.0f)
+// running out of display list means a broken frame, back off quickly
+#define MT_LOD_FAIL_STEP            0.5f
+
+struct MTLodController gMtLodController;
+
+void mtLodControllerInit(struct MTLodController* controller, float frameBudgetUs, float startBias) {
+    controller->frameBudgetUs = frameBudgetUs;
+    controller->dmaBudgetFraction = 0.5f;
+    controller->targetMissRate = 0.1f;
+    controller->targetDisplayListFill = 0.85f;
+    controller->graphicsTimeUs = 0.0f;
+
+    controller->lastInput.dmaTimeUs = 0.0f;
+    controller->lastInput.graphicsTimeUs = 0.0f;
+    controller->lastInput.missRate = 0.0f;
+    controller->lastInput.displayListFill = 0.0f;
+    controller->lastInput.failed = 0;
+    controller->lastInput.cacheFull = 0;
+    controller->load = 0.0f;
+    controller->error = 0.0f;
+    controller->integral = startBias;
+    controller->output = startBias;
+    controller->adjustmentCount = 0;
+}
+
+void mtLodControllerReportGraphicsTime(struct MTLodController* controller, float graphicsTimeUs) {
+    controller->graphicsTimeUs = graphicsTimeUs;
+}
+
+float mtLodControllerUpdate(struct MTLodController* controller, struct MTLodControllerInput* input, float currentBias, float minBias) {
+    controller->lastInput = *input;
+
+    float load = input->graphicsTimeUs / controller->frameBudgetUs;
+    load = MAX(load, input->dmaTimeUs / (controller->frameBudgetUs * controller->dmaBudgetFraction));
+    load = MAX(load, input->missRate / controller->targetMissRate);
+    load = MAX(load, input->displayListFill / controller->targetDisplayListFill);
+
+    float error = load - 1.0f;
+
+    if (fabsf(error) < MT_LOD_DEADBAND || (error < 0.0f && input->cacheFull)) {
+        error = 0.0f;
+    }
+
+    float integral = controller->integral + error * MT_LOD_INTEGRAL_GAIN;
+
+    if (input->failed) {
+        integral += MT_LOD_FAIL_STEP;
+    }
+
+    float output = integral + error * MT_LOD_PROPORTIONAL_GAIN;
+
+    // only keep integrating while the output isn't clamped
+    if (output > MT_MAX_LOD_BIAS) {
+        output = MT_MAX_LOD_BIAS;
+        integral = MIN(integral, controller->integral);
+    } else if (output < minBias) {
+        output = minBias;
+        integral = MAX(integral, controller->integral);
+    }
+
+    integral = clampf(integral, minBias, MT_MAX_LOD_BIAS);
+
+    controller->load = load;
+    controller->error = error;
+    controller->integral = integral;
+    controller->output = output;
+
+    if (input->failed || fabsf(output - currentBias) >= MT_LOD_BIAS_HYSTERESIS) {
+        ++controller->adjustmentCount;
+        return output;
+    }
+
+    return currentBias;
+}
@@ -0,0 +1,51 @@
+#ifndef __MEGATEXTURE_LOD_CONTROLLER_H__
+#define __MEGATEXTURE_LOD_CONTROLLER_H__
+
+#include <ultra64.h>
+
+// measurements from the frame that just finished
+struct MTLodControllerInput {
+    // time the pi spent reading tiles
+    float dmaTimeUs;
+    // time from building the last finished graphics task
+    // until the scheduler reported it done, 0 if unknown
+    float graphicsTimeUs;
+    // fraction of tile requests drawn with a coarser tile
+    float missRate;
+    // fraction of the display list used
+    float displayListFill;
+    // the frame ran out of display list or matrices
+    u8 failed;
+    // there are no idle tiles to make room for finer ones
+    u8 cacheFull;
+};
+
+// drives gMtLodBias with a PI controller. Each input is divided by its
+// budget and the largest becomes the load, the controller tries to keep
+// the load at 1. Everything other than the budgets is telemetry
+struct MTLodController {
+    float frameBudgetUs;
+    // fraction of the frame the pi can spend on tiles
+    float dmaBudgetFraction;
+    float targetMissRate;
+    float targetDisplayListFill;
+    // latest measurement from mtLodControllerReportGraphicsTime
+    float graphicsTimeUs;
+
+    struct MTLodControllerInput lastInput;
+    float load;
+    float error;
+    float integral;
+    float output;
+    // frames the output moved far enough to change the bias
+    u16 adjustmentCount;
+};
+
+extern struct MTLodController gMtLodController;
+
+void mtLodControllerInit(struct MTLodController* controller, float frameBudgetUs, float startBias);
+void mtLodControllerReportGraphicsTime(struct MTLodController* controller, float graphicsTimeUs);
+// returns the lod bias to use for the next frame
+float mtLodControllerUpdate(struct MTLodController* controller, struct MTLodControllerInput* input, float currentBias, float minBias);
+
+#endif
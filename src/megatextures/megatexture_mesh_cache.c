@@ -0,0 +1,173 @@
+#include "megatexture_mesh_cache.h"
+
+#include "../util/memory.h"
+
+#define LARGE_PRIME_NUMBER  1160939981
+
+// triangles of a block drawn last frame may still be read by the rsp
+#define MT_MESH_SLOT_IN_FLIGHT(meshCache, slot)   ((u16)((meshCache)->currentFrame - (slot)->lastUsedFrame) < 2)
+
+struct MTMeshCache gMtMeshCache;
+
+#define MT_MESH_HASH(index, layer, block) ((LARGE_PRIME_NUMBER * ((u32)(index) + ((layer) << 8) + (block))) >> 24 & (MT_MESH_CACHE_HASH_SIZE - 1))
+
+void mtMeshCacheInit(struct MTMeshCache* meshCache) {
+    meshCache->slots = malloc(sizeof(struct MTMeshCacheSlot) * MT_MESH_CACHE_SLOT_COUNT);
+    meshCache->blockData = malloc(MT_MESH_BLOCK_SIZE * MT_MESH_CACHE_SLOT_COUNT);
+    meshCache->currentFrame = 0;
+    meshCache->bytesRequestedFromCart = 0;
+
+    for (int i = 0; i < MT_MESH_CACHE_SLOT_COUNT; ++i) {
+        // never used so it can be taken right away
+        meshCache->slots[i].lastUsedFrame = meshCache->currentFrame - 0x8000;
+        meshCache->slots[i].flags = 0;
+    }
+
+    mtMeshCacheInvalidate(meshCache);
+    mtMeshCacheStartFrame(meshCache);
+}
+
+void mtMeshCacheStartFrame(struct MTMeshCache* meshCache) {
+    ++meshCache->currentFrame;
+    meshCache->loadCount = 0;
+    meshCache->pendingRowCount = 0;
+}
+
+void mtMeshCacheInvalidate(struct MTMeshCache* meshCache) {
+    for (int i = 0; i < MT_MESH_CACHE_HASH_SIZE; ++i) {
+        meshCache->hashTable[i] = MT_MESH_CACHE_NO_SLOT;
+    }
+
+    for (int i = 0; i < MT_MESH_CACHE_SLOT_COUNT; ++i) {
+        meshCache->slots[i].nextHashSlot = MT_MESH_CACHE_NO_SLOT;
+        meshCache->slots[i].hashIndex = MT_MESH_CACHE_NO_SLOT;
+    }
+}
+
+static void mtMeshCacheUnlink(struct MTMeshCache* meshCache, int slotIndex) {
+    struct MTMeshCacheSlot* slot = &meshCache->slots[slotIndex];
+
+    if (slot->hashIndex == MT_MESH_CACHE_NO_SLOT) {
+        return;
+    }
+
+    u8* prev = &meshCache->hashTable[slot->hashIndex];
+
+    while (*prev != slotIndex) {
+        prev = &meshCache->slots[*prev].nextHashSlot;
+    }
+
+    *prev = slot->nextHashSlot;
+    slot->nextHashSlot = MT_MESH_CACHE_NO_SLOT;
+    slot->hashIndex = MT_MESH_CACHE_NO_SLOT;
+}
+
+static int mtMeshCacheSearch(struct MTMeshCache* meshCache, struct MTTileIndex* index, int layer, int block) {
+    int slotIndex = meshCache->hashTable[MT_MESH_HASH(index, layer, block)];
+
+    while (slotIndex != MT_MESH_CACHE_NO_SLOT) {
+        struct MTMeshCacheSlot* slot = &meshCache->slots[slotIndex];
+
+        if (slot->index == index && slot->layer == layer && slot->block == block) {
+            return slotIndex;
+        }
+
+        slotIndex = slot->nextHashSlot;
+    }
+
+    return MT_MESH_CACHE_NO_SLOT;
+}
+
+// evicts the least recently used block and starts reading block in its
+// place. Returns MT_MESH_CACHE_NO_SLOT if every slot is in use or the
+// dma queue is full
+static int mtMeshCacheLoadBlock(struct MTMeshCache* meshCache, struct MTTileCache* tileCache, struct MTTileIndex* index, int layer, int block) {
+    int slotIndex = MT_MESH_CACHE_NO_SLOT;
+    u16 oldestAge = 0;
+
+    for (int i = 0; i < MT_MESH_CACHE_SLOT_COUNT; ++i) {
+        struct MTMeshCacheSlot* slot = &meshCache->slots[i];
+        u16 age = meshCache->currentFrame - slot->lastUsedFrame;
+
+        if (!(slot->flags & MT_TILE_FLAGS_PENDING) && !MT_MESH_SLOT_IN_FLIGHT(meshCache, slot) && age > oldestAge) {
+            slotIndex = i;
+            oldestAge = age;
+        }
+    }
+
+    if (slotIndex == MT_MESH_CACHE_NO_SLOT) {
+        return MT_MESH_CACHE_NO_SLOT;
+    }
+
+    struct MTMeshBlock* meshBlock = &index->meshLayers[layer].blocks[block];
+    struct MTMeshCacheSlot* slot = &meshCache->slots[slotIndex];
+
+    mtMeshCacheUnlink(meshCache, slotIndex);
+
+    if (!mtTileCacheReadRom(tileCache, meshBlock->romAddress, MT_MESH_CACHE_SLOT_DATA(meshCache, slotIndex), meshBlock->size, &slot->flags)) {
+        return MT_MESH_CACHE_NO_SLOT;
+    }
+
+    slot->index = index;
+    slot->layer = layer;
+    slot->block = block;
+
+    int hashIndex = MT_MESH_HASH(index, layer, block);
+    slot->hashIndex = hashIndex;
+    slot->nextHashSlot = meshCache->hashTable[hashIndex];
+    meshCache->hashTable[hashIndex] = slotIndex;
+
+    ++meshCache->loadCount;
+    meshCache->bytesRequestedFromCart += meshBlock->size;
+
+    return slotIndex;
+}
+
+int mtMeshCacheFindRows(struct MTMeshCache* meshCache, struct MTTileCache* tileCache, struct MTTileIndex* index, int layer, int row, struct MTMeshRows* result) {
+    struct MTMeshLayer* meshLayer = &index->meshLayers[layer];
+
+    if (!meshLayer->blocks) {
+        result->tiles = meshLayer->tiles;
+        result->vertices = meshLayer->vertices;
+        result->triangles = meshLayer->triangles;
+        result->firstVertex = 0;
+        result->vertexEnd = meshLayer->vertexCount;
+        result->firstRow = meshLayer->minTileY;
+        result->lastRow = meshLayer->maxTileY;
+        result->meshSlot = MT_MESH_CACHE_NO_SLOT;
+        return 1;
+    }
+
+    int block = (row - meshLayer->minTileY) / meshLayer->blockRows;
+    result->firstRow = meshLayer->minTileY + block * meshLayer->blockRows;
+    result->lastRow = MIN(meshLayer->maxTileY, result->firstRow + meshLayer->blockRows);
+
+    int slotIndex = mtMeshCacheSearch(meshCache, index, layer, block);
+
+    if (slotIndex == MT_MESH_CACHE_NO_SLOT) {
+        slotIndex = mtMeshCacheLoadBlock(meshCache, tileCache, index, layer, block);
+
+        if (slotIndex == MT_MESH_CACHE_NO_SLOT) {
+            return 0;
+        }
+    }
+
+    struct MTMeshCacheSlot* slot = &meshCache->slots[slotIndex];
+    slot->lastUsedFrame = meshCache->currentFrame;
+
+    if (slot->flags & MT_TILE_FLAGS_PENDING) {
+        return 0;
+    }
+
+    struct MTMeshBlock* meshBlock = &meshLayer->blocks[block];
+    u8* data = (u8*)MT_MESH_CACHE_SLOT_DATA(meshCache, slotIndex);
+
+    result->tiles = (struct MTMeshTile*)data;
+    result->vertices = (struct MTVertex*)(data + meshBlock->vertexOffset);
+    result->triangles = (Gfx*)(data + meshBlock->triangleOffset);
+    result->firstVertex = meshBlock->firstVertex;
+    result->vertexEnd = meshBlock->vertexEnd;
+    result->meshSlot = slotIndex;
+
+    return 1;
+}
@@ -0,0 +1,75 @@
+#ifndef __MEGATEXTURE_MESH_CACHE_H__
+#define __MEGATEXTURE_MESH_CACHE_H__
+
+#include <ultra64.h>
+#include "tile_index.h"
+#include "megatexture_tilecache.h"
+
+// the finest layers of a megatexture are only drawn when the camera is
+// close so their meshes aren't kept in ram. The exporter splits them
+// into blocks of rows that are read from rom through the tile cache
+// dma queue the first time they are drawn and stay until evicted
+
+// the exporter keeps blocks at most this size
+#define MT_MESH_BLOCK_SIZE          (8 * 1024)
+#define MT_MESH_CACHE_SLOT_COUNT    16
+#define MT_MESH_CACHE_HASH_SIZE     32
+#define MT_MESH_CACHE_NO_SLOT       0xFF
+
+struct MTMeshCacheSlot {
+    struct MTTileIndex* index;
+    u8 layer;
+    u8 block;
+    u8 nextHashSlot;
+    // MT_MESH_CACHE_NO_SLOT if the slot isn't in the hash table
+    u8 hashIndex;
+    // MT_TILE_FLAGS_PENDING while the block is being read
+    u8 flags;
+    u16 lastUsedFrame;
+};
+
+struct MTMeshCache {
+    struct MTMeshCacheSlot* slots;
+    // MT_MESH_BLOCK_SIZE bytes for each slot
+    u64* blockData;
+    u8 hashTable[MT_MESH_CACHE_HASH_SIZE];
+    u16 currentFrame;
+    // blocks read from rom this frame
+    u16 loadCount;
+    // rows that couldn't be drawn since their block wasn't ready
+    u16 pendingRowCount;
+    u32 bytesRequestedFromCart;
+};
+
+// the mesh of the rows from firstRow up to lastRow. For a layer that
+// isn't streamed this is the whole layer
+struct MTMeshRows {
+    // tiles of firstRow starting at MTMeshLayer.minTileX
+    struct MTMeshTile* tiles;
+    // vertices from firstVertex up to vertexEnd
+    struct MTVertex* vertices;
+    Gfx* triangles;
+    u16 firstVertex;
+    u16 vertexEnd;
+    u8 firstRow;
+    u8 lastRow;
+    // slot holding the block or MT_MESH_CACHE_NO_SLOT if the layer isn't streamed
+    u8 meshSlot;
+};
+
+#define MT_MESH_CACHE_SLOT_DATA(meshCache, slot)   (&(meshCache)->blockData[(slot) * (MT_MESH_BLOCK_SIZE / sizeof(u64))])
+#define MT_MESH_ROWS_TILE(meshRows, meshLayer, x, row)  (&(meshRows)->tiles[((row) - (meshRows)->firstRow) * ((meshLayer)->maxTileX - (meshLayer)->minTileX) + (x) - (meshLayer)->minTileX])
+
+// the renderer can't draw streamed layers until this has been initialized
+extern struct MTMeshCache gMtMeshCache;
+
+void mtMeshCacheInit(struct MTMeshCache* meshCache);
+void mtMeshCacheStartFrame(struct MTMeshCache* meshCache);
+// forgets every block, needed if a level is unloaded
+void mtMeshCacheInvalidate(struct MTMeshCache* meshCache);
+// finds the mesh of the rows around row, starting to read it if needed.
+// Returns 0 if it isn't ready yet, firstRow and lastRow are still set
+// so the rest of the rows waiting on the same block can be skipped
+int mtMeshCacheFindRows(struct MTMeshCache* meshCache, struct MTTileCache* tileCache, struct MTTileIndex* index, int layer, int row, struct MTMeshRows* result);
+
+#endif
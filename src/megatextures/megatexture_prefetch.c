@@ -0,0 +1,227 @@
+#include "megatexture_prefetch.h"
+
+#include "./megatexture_culling_loop.h"
+#include "./megatexture_renderer.h"
+#include "./megatexture_mesh_cache.h"
+#include "../math/mathf.h"
+#include <math.h>
+
+#define MT_PREDICTOR_SMOOTHING      0.5f
+#define MT_MIN_PREDICT_DISTANCE     0.01f
+// cos of half the smallest rotation per frame worth predicting
+#define MT_MIN_PREDICT_ROTATION     0.99999f
+
+void mtCameraPredictorInit(struct MTCameraPredictor* predictor) {
+    transformInitIdentity(&predictor->lastTransform);
+    predictor->velocity = gZeroVec;
+    quatIdent(&predictor->rotationDelta);
+    predictor->hasHistory = 0;
+}
+
+void mtCameraPredictorUpdate(struct MTCameraPredictor* predictor, struct Transform* cameraTransform) {
+    if (!predictor->hasHistory) {
+        predictor->lastTransform = *cameraTransform;
+        predictor->hasHistory = 1;
+        return;
+    }
+
+    struct Vector3 velocity;
+    vector3Sub(&cameraTransform->position, &predictor->lastTransform.position, &velocity);
+    vector3Lerp(&predictor->velocity, &velocity, MT_PREDICTOR_SMOOTHING, &predictor->velocity);
+
+    struct Quaternion inverseLast;
+    struct Quaternion rotationDelta;
+    quatConjugate(&predictor->lastTransform.rotation, &inverseLast);
+    quatMultiply(&cameraTransform->rotation, &inverseLast, &rotationDelta);
+    quatLerp(&predictor->rotationDelta, &rotationDelta, MT_PREDICTOR_SMOOTHING, &predictor->rotationDelta);
+
+    predictor->lastTransform = *cameraTransform;
+}
+
+int mtCameraPredictorPredict(struct MTCameraPredictor* predictor, struct Camera* camera, int frames, struct Camera* result) {
+    if (!predictor->hasHistory) {
+        return 0;
+    }
+
+    int isMoving = vector3MagSqrd(&predictor->velocity) * (frames * frames) > MT_MIN_PREDICT_DISTANCE * MT_MIN_PREDICT_DISTANCE;
+    int isTurning = fabsf(predictor->rotationDelta.w) < MT_MIN_PREDICT_ROTATION;
+
+    if (!isMoving && !isTurning) {
+        return 0;
+    }
+
+    *result = *camera;
+    vector3AddScaled(&camera->transform.position, &predictor->velocity, (float)frames, &result->transform.position);
+
+    for (int i = 0; i < frames; ++i) {
+        struct Quaternion rotation;
+        quatMultiply(&predictor->rotationDelta, &result->transform.rotation, &rotation);
+        quatNormalize(&rotation, &result->transform.rotation);
+    }
+
+    return 1;
+}
+
+static int megatexturePrefetchRows(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTRowRange* rowRanges) {
+    struct MTMeshLayer* meshLayer = &index->meshLayers[layerIndex];
+
+    struct MTMeshRows meshRows;
+    meshRows.lastRow = 0;
+    int meshReady = 0;
+
+    for (int row = meshLayer->minTileY; row < meshLayer->maxTileY; ++row) {
+        struct MTRowRange* range = &rowRanges[row - meshLayer->minTileY];
+
+        if (range->minX >= range->maxX) {
+            continue;
+        }
+
+        if (row >= meshRows.lastRow) {
+            // starts reading the mesh of streamed layers ahead of time too
+            meshReady = mtMeshCacheFindRows(&gMtMeshCache, tileCache, index, layerIndex, row, &meshRows);
+        }
+
+        if (!meshReady) {
+            continue;
+        }
+
+        struct MTMeshTile* tile = MT_MESH_ROWS_TILE(&meshRows, meshLayer, range->minX, row);
+
+        for (int x = range->minX; x < range->maxX; ++x, ++tile) {
+            if (tile->triangleCount == 0) {
+                continue;
+            }
+
+            if (!mtTileCachePrefetchTile(tileCache, index, x, row, layerIndex)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int megatexturePrefetchLayer(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTCullingLoop* currentLoop) {
+    if (currentLoop->loopSize == 0) {
+        return 1;
+    }
+
+    struct MTRowRange rowRanges[MT_MAX_TILE_ROWS];
+    megatextureFindRowRanges(index, layerIndex, currentLoop, NULL, rowRanges);
+
+    return megatexturePrefetchRows(tileCache, index, layerIndex, rowRanges);
+}
+
+// requests the same tiles megatextureRender would draw with gMtRowLod set
+static int megatexturePrefetchRowLods(struct MTTileCache* tileCache, struct MTTileIndex* index, struct MTCullingLoop* cullingLoop, struct CameraMatrixInfo* cameraInfo) {
+    struct MTRowLod rowLod;
+    // holds the layer depths the same way without changing them
+    struct MTLodState lodState;
+    megatextureCopyLodState(index, &lodState);
+
+    int layerIndex = megatextureDetermineRowLod(index, cullingLoop, cameraInfo, &lodState, &rowLod);
+
+    for (; layerIndex >= 0; --layerIndex) {
+        struct MTRowRange rowRanges[MT_MAX_TILE_ROWS];
+        int needsFinerLayer = megatextureFindRowRanges(index, layerIndex, cullingLoop, &rowLod, rowRanges);
+
+        struct MTRipRanges ripRanges;
+        megatextureSplitRipRanges(index, layerIndex, &rowLod, rowRanges, &ripRanges);
+        int result = 1;
+
+        for (int level = 0; level < ripRanges.levelCount && result; ++level) {
+            for (int half = 0; half < 2 && result; ++half) {
+                if (ripRanges.ranges[level][half]) {
+                    result = megatexturePrefetchRows(tileCache, index, ripRanges.layers[level], ripRanges.ranges[level][half]);
+                }
+            }
+        }
+
+        megatextureFreeRipRanges(&ripRanges);
+
+        if (!result) {
+            return 0;
+        }
+
+        if (!needsFinerLayer) {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+int megatexturePrefetch(struct MTTileCache* tileCache, struct MTTileIndex* index, struct CameraMatrixInfo* cameraInfo) {
+    if (mtIsBackFacing(cameraInfo, &index->uvBasis)) {
+        return 1;
+    }
+
+    if (isOutsideFrustrum(&cameraInfo->cullingInformation, &index->boundingBox)) {
+        return 1;
+    }
+
+    struct MTCullingLoop cullingLoop;
+
+    mtCullingLoopInit(&cullingLoop, &index->minUv, &index->maxUv);
+    mtCullingLoopClip(&cullingLoop, &index->uvBasis, &cameraInfo->cullingInformation);
+
+    if (cullingLoop.loopSize == 0) {
+        return 1;
+    }
+
+    if (gMtRowLod) {
+        return megatexturePrefetchRowLods(tileCache, index, &cullingLoop, cameraInfo);
+    }
+
+    float clipingPlaneDistances[MT_MAX_LOD];
+    int minLod;
+    int maxLod;
+    struct MTLodState lodState;
+    megatextureCopyLodState(index, &lodState);
+    megatextureDetermineMipLevels(
+        &index->uvBasis, 
+        index->worldPixelSize, 
+        &cullingLoop, 
+        cameraInfo, 
+        &lodState,
+        index->layerCount - 1, 
+        clipingPlaneDistances,
+        &minLod,
+        &maxLod
+    );
+
+    for (int layerIndex = minLod; layerIndex <= maxLod; ++layerIndex) {
+        if (layerIndex == maxLod) {
+            return megatexturePrefetchLayer(tileCache, index, layerIndex, &cullingLoop);
+        }
+
+        struct Plane mipClippingPlane;
+        mipClippingPlane.normal = cameraInfo->forwardVector;
+        mipClippingPlane.d = -(vector3Dot(&mipClippingPlane.normal, &cameraInfo->cameraPosition) + clipingPlaneDistances[layerIndex]);
+
+        struct Plane2 clippingPlane;
+        mtProjectClippingPlane(&mipClippingPlane, &index->uvBasis, &clippingPlane);
+
+        struct MTCullingLoop currentLoop;
+        mtCullingLoopSplit(&cullingLoop, &clippingPlane, &currentLoop);
+        
+        if (!megatexturePrefetchLayer(tileCache, index, layerIndex, &currentLoop)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void megatexturesPrefetchAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, u32* visibleSet, struct CameraMatrixInfo* predictedCameraInfo) {
+    for (int i = 0; i < count; ++i) {
+        if (!MT_IS_IN_VISIBLE_SET(visibleSet, i)) {
+            continue;
+        }
+
+        if (!megatexturePrefetch(tileCache, &index[i], predictedCameraInfo)) {
+            // out of request budget
+            return;
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef __MEGATEXTURE_PREFETCH_H__
+#define __MEGATEXTURE_PREFETCH_H__
+
+#include "tile_index.h"
+#include "./megatexture_tilecache.h"
+#include "../scene/camera.h"
+#include "../math/transform.h"
+
+// how far ahead the camera is extrapolated
+#define MT_PREFETCH_FRAMES      4
+
+struct MTCameraPredictor {
+    struct Transform lastTransform;
+    // both are per frame and smoothed over a few frames
+    struct Vector3 velocity;
+    struct Quaternion rotationDelta;
+    u8 hasHistory;
+};
+
+void mtCameraPredictorInit(struct MTCameraPredictor* predictor);
+void mtCameraPredictorUpdate(struct MTCameraPredictor* predictor, struct Transform* cameraTransform);
+// returns 0 if the camera isn't moving enough for a prediction to be useful
+int mtCameraPredictorPredict(struct MTCameraPredictor* predictor, struct Camera* camera, int frames, struct Camera* result);
+
+// requests tiles visible from the predicted camera using only
+// the cache space and dma budget not needed by the current frame.
+// Indices not in visibleSet are skipped, see MT_IS_IN_VISIBLE_SET
+void megatexturesPrefetchAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, u32* visibleSet, struct CameraMatrixInfo* predictedCameraInfo);
+
+#endif
@@ -1,30 +1,117 @@
 #include "megatexture_renderer.h"
 
-#define MAX_VERTEX_CACHE_SIZE   32
-
 #include "./megatexture_culling_loop.h"
+#include "./megatexture_prefetch.h"
+#include "./megatexture_lod_controller.h"
+#include "./megatexture_row_cache.h"
+#include "./megatexture_vertex_cache.h"
+#include "./megatexture_mesh_cache.h"
+#include "./megatexture_coverage.h"
 #include "../math/mathf.h"
 #include <math.h>
 #include "../graphics/graphics.h"
 #include "../util/memory.h"
 
-#define MT_MAX_LOD              5
 #define MT_MIP_SAMPLE_COUNT     3
 #define MT_LOG_INV_2 1.442695041
+#define MT_LOG_2     0.693147181
+// how much further away each layer can be drawn than the one before
+// it, each layer has texels twice the size which cover four times the
+// area and the area falls off with depth cubed
+#define MT_LAYER_DEPTH_SCALE    1.587401052
+// further than anything is ever drawn
+#define MT_FAR_DEPTH            1.0e30f
+// a layer depth is held while the one for the frame is within this
+// factor of it, about a quarter of a step of the lod bias
+#define MT_LOD_DEPTH_BAND       1.122462048f
+// a layer depth that just moved is held for this many frames while the
+// one for the frame is within MT_LOD_DWELL_BAND, half a step of the bias
+#define MT_LOD_MIN_DWELL        15
+#define MT_LOD_DWELL_BAND       1.259921050f
 
-#define MT_MAX_TOTAL_TILE_REQUESTS  500
-
-#define MT_MIN_TOTAL_TILE_REQUESTS  400
 #define MT_MAX_TILE_UNDER_LOADED    64
 
+// vertices not drawn that are cheaper to load along
+// with the ones around them than to start another load
+#define MT_MAX_VERTEX_LOAD_GAP      8
+
 #define MIN_PIXEL_AREA          0.000015259
 
-#define MT_LOD_BIAS_START       1.5f
-#define MT_LOD_BIAS_STEP        (1.0f / 32.0f)
-#define MT_LOD_BIAS_FAIL_STEP   (1.0f / 2.0f)
+
+// how the importance of a tile request is split between
+// its size on screen and how close it is to the center
+#define MT_IMPORTANCE_AREA      128
+#define MT_IMPORTANCE_CENTER    64
 
 float gMtLodBias = 1.5f;
 float gMtMinLoadBias = 1.0f;
+int gMtShareVertexWindows = 1;
+int gMtRowLod = 1;
+int gMtLodHysteresis = 1;
+u16 gMtLodFrame;
+int gMtRipMaps = 1;
+
+// the bsp draw order, one entry for each megatexture in the level
+static u16* gMtDrawOrder;
+// the megatextures of the level and the lod state of each
+static struct MTTileIndex* gMtLevelIndexes;
+static struct MTLodState* gMtLodStates;
+static int gMtLevelIndexCount;
+
+void megatexturesInit(struct MTTileIndex* index, int count) {
+    gMtDrawOrder = malloc(sizeof(u16) * count);
+    gMtLevelIndexes = index;
+    gMtLodStates = malloc(sizeof(struct MTLodState) * count);
+    gMtLevelIndexCount = count;
+
+    for (int i = 0; i < count; ++i) {
+        gMtLodStates[i].isSet = 0;
+    }
+}
+
+struct MTLodState* megatextureLodState(struct MTTileIndex* index) {
+    if (index < gMtLevelIndexes || index >= gMtLevelIndexes + gMtLevelIndexCount) {
+        return NULL;
+    }
+
+    return &gMtLodStates[index - gMtLevelIndexes];
+}
+
+void megatextureCopyLodState(struct MTTileIndex* index, struct MTLodState* lodState) {
+    struct MTLodState* drawnState = megatextureLodState(index);
+
+    if (drawnState) {
+        *lodState = *drawnState;
+    } else {
+        lodState->isSet = 0;
+    }
+}
+
+// the depth layer is drawn to this frame, the one held by lodState
+// unless depth has moved too far from it
+static float mtLodStateHoldDepth(struct MTLodState* lodState, int layer, float depth) {
+    if (!lodState) {
+        return depth;
+    }
+
+    if (lodState->isSet && gMtLodHysteresis && depth > 0.0f) {
+        float held = lodState->layerDepths[layer];
+        float band = (u16)(gMtLodFrame - lodState->movedFrames[layer]) < MT_LOD_MIN_DWELL ? MT_LOD_DWELL_BAND : MT_LOD_DEPTH_BAND;
+
+        if (held * band >= depth && depth * band >= held) {
+            return held;
+        }
+
+        // only dragged to the edge of the band so a bias going back
+        // and forth moves the layer by how far it overshoots
+        depth = depth > held ? depth * (1.0f / band) : depth * band;
+    }
+
+    lodState->layerDepths[layer] = depth;
+    lodState->movedFrames[layer] = gMtLodFrame;
+
+    return depth;
+}
 
 float mtCalculateMipLevel(float pixelArea) {
     if (pixelArea < MIN_PIXEL_AREA) {
@@ -43,7 +130,7 @@ void mtUvBasisTransform(struct Vector3* axis, struct Vector3* right, struct Vect
     result->y = vector3Dot(up, axis);
 }
 
-void megatextureDetermineMipLevels(struct MTUVBasis* uvBasis, float worldPixelWidth, struct MTCullingLoop* cullingLoop, struct CameraMatrixInfo* cameraInfo, int mipPlaneCount, float* mipPlanesOut, int* minLodOut, int* maxLodOut) {
+void megatextureDetermineMipLevels(struct MTUVBasis* uvBasis, float worldPixelWidth, struct MTCullingLoop* cullingLoop, struct CameraMatrixInfo* cameraInfo, struct MTLodState* lodState, int mipPlaneCount, float* mipPlanesOut, int* minLodOut, int* maxLodOut) {
     struct Vector2 uvSpaceCameraDirection;
 
     uvSpaceCameraDirection.x = vector3Dot(&uvBasis->uvRight, &cameraInfo->forwardVector);
@@ -127,102 +214,244 @@ void megatextureDetermineMipLevels(struct MTUVBasis* uvBasis, float worldPixelWi
     *minLodOut = 0;
     *maxLodOut = 0;
 
-    for (int i = 0; i < mipPlaneCount; ++i) {
+    for (int i = 0; i < mipPlaneCount && i < MT_MAX_LOD; ++i) {
         while (currentMipIndex < MT_MIP_SAMPLE_COUNT && (float)i > mipLevel[currentMipIndex]) {
             ++currentMipIndex;
         }
 
-        if (currentMipIndex == MT_MIP_SAMPLE_COUNT) {
+        // past either end of the polygon the plane is extended from
+        // the two closest samples so it has a depth to hold
+        int sampleIndex = MIN(MAX(currentMipIndex, 1), MT_MIP_SAMPLE_COUNT - 1);
+        float depth = distance[sampleIndex];
+
+        if (mipLevel[sampleIndex - 1] != mipLevel[sampleIndex]) {
+            float lerp = mathfInvLerp(mipLevel[sampleIndex - 1], mipLevel[sampleIndex], (float)i);
+            depth = mathfLerp(distance[sampleIndex - 1], distance[sampleIndex], lerp);
+        }
+
+        if (currentMipIndex == MT_MIP_SAMPLE_COUNT && !(depth > distance[MT_MIP_SAMPLE_COUNT - 1])) {
+            depth = distance[MT_MIP_SAMPLE_COUNT - 1] + 1.0f;
+        } else if (currentMipIndex == 0 && !(depth < distance[0])) {
+            depth = distance[0] - 1.0f;
+        }
+
+        depth = mtLodStateHoldDepth(lodState, i, depth);
+        mipPlanesOut[i] = depth;
+
+        if (depth > distance[MT_MIP_SAMPLE_COUNT - 1]) {
             // clipping plane is past the end of the polygon
-            mipPlanesOut[i] = distance[MT_MIP_SAMPLE_COUNT - 1] + 1.0f;
             continue;
         }
 
-        if (currentMipIndex == 0) {
+        if (depth < distance[0]) {
             // clipping plane is in front of the polygon
-            mipPlanesOut[i] = distance[0] - 1.0f;
             // skip the current mip level
             *minLodOut = i + 1;
             *maxLodOut = i + 1;
             continue;
         }
 
-        float lerp = mathfInvLerp(mipLevel[currentMipIndex - 1], mipLevel[currentMipIndex], (float)i);
-        mipPlanesOut[i] = mathfLerp(distance[currentMipIndex - 1], distance[currentMipIndex], lerp);
         *maxLodOut = i;
     }
+
+    if (lodState) {
+        lodState->isSet = 1;
+    }
 }
 
-void megatextureRenderRow(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, int row, int minX, int maxX, struct RenderState* renderState) {
-    struct MTMeshLayer* meshLayer = &index->meshLayers[layerIndex];
-    int currentVertexCount = 0;
+// for a point d from the camera on a plane the screen gradient of the
+// distance along a unit axis a is proportional to |(m x d) x forward|
+// where m is the unit axis across a on the plane. The rate only depends
+// on the coordinate it is the gradient of
+static void mtRowLodTexelRate(struct Vector3* across, struct Vector3* step, struct Vector3* cameraOffset, struct Vector3* forward, float texelSize, struct Vector3* rateOffset, struct Vector3* rateStep) {
+    struct Vector3 cross;
 
-    Gfx* vertexCopyCommand = renderState->dl++;
+    vector3Cross(across, cameraOffset, &cross);
+    vector3Cross(&cross, forward, rateOffset);
+    vector3Scale(rateOffset, rateOffset, 1.0f / texelSize);
 
-    struct MTMeshTile* tile = &meshLayer->tiles[((row - meshLayer->minTileY) * (meshLayer->maxTileX - meshLayer->minTileX)) + (minX - meshLayer->minTileX)];
-    int startVertex = tile->startVertex;
+    vector3Cross(across, step, &cross);
+    vector3Cross(&cross, forward, rateStep);
+    vector3Scale(rateStep, rateStep, 1.0f / texelSize);
+}
 
-    for (int x = minX; x < maxX; ++x, ++tile) {
-        if (tile->indexCount == 0) {
-            continue;
-        }
+static void mtRowLodFindRipChains(struct MTTileIndex* index, struct CameraMatrixInfo* cameraInfo, struct Vector3* cameraOffset, struct MTRowLod* rowLod) {
+    struct MTUVBasis* uvBasis = &index->uvBasis;
 
-        int startIndex = tile->startVertex - startVertex;
+    for (int i = 0; i < MT_MAX_RIP_SHIFT; ++i) {
+        rowLod->ripChains[i] = NULL;
+    }
 
-        if (tile->vertexCount + startIndex > MAX_VERTEX_CACHE_SIZE) {
-            if (currentVertexCount == 0) {
-                continue;
-            }
+    if (!gMtRipMaps || !index->ripChainCount) {
+        return;
+    }
 
-            // retroactively update the vertex command
-            gSPVertex(vertexCopyCommand, &meshLayer->vertices[startVertex], currentVertexCount, 0);
-            vertexCopyCommand = renderState->dl++;
-            startVertex = tile->startVertex;
-            startIndex = 0;
-        }
+    float uLength = sqrtf(vector3MagSqrd(&uvBasis->uvRight));
+    float vLength = sqrtf(vector3MagSqrd(&uvBasis->uvUp));
+    struct Vector3 uDirection;
+    struct Vector3 vDirection;
+    vector3Scale(&uvBasis->uvRight, &uDirection, 1.0f / uLength);
+    vector3Scale(&uvBasis->uvUp, &vDirection, 1.0f / vLength);
 
-        currentVertexCount = startIndex + tile->vertexCount;
+    mtRowLodTexelRate(&vDirection, &uvBasis->uvRight, cameraOffset, &cameraInfo->forwardVector, uLength / index->imageLayers[0].xTiles, &rowLod->uRateOffset, &rowLod->uRateStep);
+    mtRowLodTexelRate(&uDirection, &uvBasis->uvUp, cameraOffset, &cameraInfo->forwardVector, vLength / index->imageLayers[0].yTiles, &rowLod->vRateOffset, &rowLod->vRateStep);
 
-        Gfx* tileRequest = mtTileCacheRequestTile(tileCache, index, x, row, layerIndex);
-        gSPDisplayList(renderState->dl++, tileRequest)
+    // the axis with the most texels per pixel in the middle
+    struct Vector3 uRate;
+    struct Vector3 vRate;
+    vector3AddScaled(&rowLod->uRateOffset, &rowLod->uRateStep, (index->minUv.x + index->maxUv.x) * 0.5f, &uRate);
+    vector3AddScaled(&rowLod->vRateOffset, &rowLod->vRateStep, (index->minUv.y + index->maxUv.y) * 0.5f, &vRate);
+    int axis = vector3MagSqrd(&uRate) > vector3MagSqrd(&vRate) ? MTRipAxisU : MTRipAxisV;
 
-        u8* indices = &meshLayer->indices[tile->startIndex];
-        u8* indexEnd = indices + tile->indexCount;
+    for (int i = 0; i < index->ripChainCount; ++i) {
+        struct MTRipChain* chain = &index->ripChains[i];
 
-        for (; indices + 5 < indexEnd; indices += 6) {
-            gSP2Triangles(
-                renderState->dl++, 
-                indices[0] + startIndex, indices[1] + startIndex, indices[2] + startIndex, 0,
-                indices[3] + startIndex, indices[4] + startIndex, indices[5] + startIndex, 0
-            );
+        if (chain->axis == axis && chain->ratioShift >= 1 && chain->ratioShift <= MT_MAX_RIP_SHIFT) {
+            rowLod->ripChains[chain->ratioShift - 1] = chain;
         }
+    }
+}
 
-        if (indices + 2 < indexEnd) {
-            gSP1Triangle(renderState->dl++, indices[0] + startIndex, indices[1] + startIndex, indices[2] + startIndex, 0);
+int megatextureDetermineRowLod(struct MTTileIndex* index, struct MTCullingLoop* cullingLoop, struct CameraMatrixInfo* cameraInfo, struct MTLodState* lodState, struct MTRowLod* rowLod) {
+    struct MTUVBasis* uvBasis = &index->uvBasis;
+
+    struct Vector3 cameraOffset;
+    vector3Sub(&uvBasis->uvOrigin, &cameraInfo->cameraPosition, &cameraOffset);
+
+    rowLod->originDepth = vector3Dot(&cameraOffset, &cameraInfo->forwardVector);
+    rowLod->uDepth = vector3Dot(&uvBasis->uvRight, &cameraInfo->forwardVector);
+    rowLod->vDepth = vector3Dot(&uvBasis->uvUp, &cameraInfo->forwardVector);
+
+    // a texel at depth z covers texelSize^2 * planeDistance / z^3 pixels
+    // where planeDistance is how far the camera is from the plane. Layer i
+    // is fine enough where mtCalculateMipLevel of that area is at most i
+    float texelSize = (gScreenHeight / 2.0f) * cameraInfo->cotFov * index->worldPixelSize;
+    float planeDistance = MAX(-vector3Dot(&cameraOffset, &uvBasis->normal), 0.00001f);
+    float layerDepth = expf((logf(texelSize * texelSize * planeDistance) - 2.0f * MT_LOG_2 * gMtLodBias) * (1.0f / 3.0f));
+
+    float maxDepth = rowLod->originDepth;
+
+    for (int i = 0; i < cullingLoop->loopSize; ++i) {
+        struct Vector2* point = &cullingLoop->loop[i];
+        maxDepth = MAX(maxDepth, rowLod->originDepth + point->x * rowLod->uDepth + point->y * rowLod->vDepth);
+    }
+
+    int coarsestLayer = 0;
+
+    for (int i = 0; i + 1 < index->layerCount && i < MT_MAX_LOD; ++i) {
+        float depth = mtLodStateHoldDepth(lodState, i, layerDepth);
+
+        rowLod->layerDepths[i] = depth;
+
+        if (maxDepth >= depth) {
+            coarsestLayer = i + 1;
         }
+
+        layerDepth *= MT_LAYER_DEPTH_SCALE;
     }
 
-    if (currentVertexCount) {
-        // retroactively update the vertex command
-        gSPVertex(vertexCopyCommand, &meshLayer->vertices[startVertex], currentVertexCount, 0);
-    } else {
-        // if there are no vertices used then unallocate the gSPVertex command
-        renderState->dl = vertexCopyCommand;
+    rowLod->coarsestLayer = coarsestLayer;
+
+    if (lodState) {
+        lodState->isSet = 1;
     }
+
+    mtRowLodFindRipChains(index, cameraInfo, &cameraOffset, rowLod);
+
+    return coarsestLayer;
 }
 
-int megatextureRenderLayer(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTCullingLoop* currentLoop, float nearPlane, float farPlane, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
-    if (currentLoop->loopSize == 0) {
-        // the plane is entirely outside the view
-        return 1;
+// the depth of the closest point of tile 0 of a row
+static float mtRowLodNearDepth(struct MTRowLod* rowLod, struct MTImageLayer* imageLayer, int row) {
+    float tileDepthX = rowLod->uDepth / imageLayer->xTiles;
+    float tileDepthY = rowLod->vDepth / imageLayer->yTiles;
+
+    return rowLod->originDepth + tileDepthY * row + MIN(tileDepthY, 0.0f) + MIN(tileDepthX, 0.0f);
+}
+
+// keeps the tiles from minX up to maxX whose closest point is at least
+// minDepth and less than maxDepth from the camera. nearDepth + x * tileDepth
+// is the depth of the closest point of tile x
+static void mtClipTileSpan(int* minX, int* maxX, float nearDepth, float tileDepth, float minDepth, float maxDepth) {
+    float low = (float)*minX;
+    float high = (float)*maxX;
+
+    if (tileDepth > 0.0f) {
+        low = MAX(low, ceilf((minDepth - nearDepth) / tileDepth));
+        high = MIN(high, ceilf((maxDepth - nearDepth) / tileDepth));
+    } else if (tileDepth < 0.0f) {
+        low = MAX(low, floorf((maxDepth - nearDepth) / tileDepth) + 1.0f);
+        high = MIN(high, floorf((minDepth - nearDepth) / tileDepth) + 1.0f);
+    } else if (nearDepth < minDepth || nearDepth >= maxDepth) {
+        high = low;
     }
 
-    nearPlane *= SCENE_SCALE;
-    farPlane *= SCENE_SCALE;
+    if (low >= high) {
+        *maxX = *minX;
+        return;
+    }
 
-    cameraInfo->projectionMatrix[2][2] = (nearPlane + farPlane) / (nearPlane - farPlane);
-    cameraInfo->projectionMatrix[3][2] = (2 * nearPlane * farPlane) / (nearPlane - farPlane);
+    *minX = (int)low;
+    *maxX = (int)high;
+}
+
+// keeps the tiles of a row that are drawn with layerIndex. Returns 1 if
+// tiles were left out for needing a finer layer
+static int mtRowLodClip(struct MTTileIndex* index, int layerIndex, int row, struct MTRowLod* rowLod, struct MTRowRange* range) {
+    struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+    int minX = range->minX;
+    int maxX = range->maxX;
+
+    if (layerIndex < rowLod->coarsestLayer) {
+        // the tile of the next coarser layer covering this one
+        // has to be too close to be drawn instead
+        struct MTImageLayer* coarseLayer = &index->imageLayers[layerIndex + 1];
+        int coarseRow = row * coarseLayer->yTiles / imageLayer->yTiles;
+        int coarseMinX = minX * coarseLayer->xTiles / imageLayer->xTiles;
+        int coarseMaxX = (maxX - 1) * coarseLayer->xTiles / imageLayer->xTiles + 1;
+
+        mtClipTileSpan(
+            &coarseMinX,
+            &coarseMaxX,
+            mtRowLodNearDepth(rowLod, coarseLayer, coarseRow),
+            rowLod->uDepth / coarseLayer->xTiles,
+            -MT_FAR_DEPTH,
+            rowLod->layerDepths[layerIndex]
+        );
+
+        minX = MAX(minX, coarseMinX * imageLayer->xTiles / coarseLayer->xTiles);
+        maxX = MIN(maxX, coarseMaxX * imageLayer->xTiles / coarseLayer->xTiles);
+    }
+
+    int needsFinerLayer = 0;
+
+    if (layerIndex > 0 && minX < maxX) {
+        int tileCount = maxX - minX;
+
+        mtClipTileSpan(
+            &minX,
+            &maxX,
+            mtRowLodNearDepth(rowLod, imageLayer, row),
+            rowLod->uDepth / imageLayer->xTiles,
+            rowLod->layerDepths[layerIndex - 1],
+            MT_FAR_DEPTH
+        );
+
+        needsFinerLayer = maxX - minX < tileCount;
+    }
+
+    if (minX >= maxX) {
+        range->minX = 0;
+        range->maxX = 0;
+    } else {
+        range->minX = minX;
+        range->maxX = maxX;
+    }
 
+    return needsFinerLayer;
+}
+
+int megatextureFindRowRanges(struct MTTileIndex* index, int layerIndex, struct MTCullingLoop* currentLoop, struct MTRowLod* rowLod, struct MTRowRange* rowRanges) {
     int leftIndex = mtCullingLoopTopIndex(currentLoop);
     int rightIndex = leftIndex;
 
@@ -240,35 +469,744 @@ int megatextureRenderLayer(struct MTTileCache* tileCache, struct MTTileIndex* in
         mtCullingLoopFindExtent(currentLoop, &rightIndex, &lastRightBoundary, meshLayer->minTileY * tileStep, -1);
     }
 
+    int needsFinerLayer = 0;
+
     for (int row = meshLayer->minTileY; row < meshLayer->maxTileY; ++row, nextBoundary += tileStep) {
         float minX = mtCullingLoopFindExtent(currentLoop, &leftIndex, &lastLeftBoundary, nextBoundary, 1);
         float maxX = mtCullingLoopFindExtent(currentLoop, &rightIndex, &lastRightBoundary, nextBoundary, -1);
+        struct MTRowRange* range = &rowRanges[row - meshLayer->minTileY];
 
         if (minX == maxX) {
             // empty row
+            range->minX = 0;
+            range->maxX = 0;
             continue;
         }
 
+        range->minX = MAX(meshLayer->minTileX, (int)floorf(minX * imageLayer->xTiles));
+        range->maxX = MIN(meshLayer->maxTileX, (int)ceilf(maxX * imageLayer->xTiles));
+
+        if (rowLod && range->minX < range->maxX) {
+            needsFinerLayer |= mtRowLodClip(index, layerIndex, row, rowLod, range);
+        }
+    }
 
-        Mtx* projection = renderStateRequestMatrices(renderState, 1);   
+    return needsFinerLayer;
+}
 
-        if (!projection) {
-            return 0;
+// keeps the tiles between low and high inside where a * u^2 + b * u + c
+// is at most 0. Where that is outside of two roots the larger side is kept
+static void mtRipClipQuadratic(float a, float b, float c, int xTiles, float* low, float* high) {
+    // tiles are inside 0 to 1 so these work as infinity
+    float minU = -1.0f;
+    float maxU = 2.0f;
+
+    if (a != 0.0f) {
+        float discriminant = b * b - 4.0f * a * c;
+
+        if (discriminant < 0.0f) {
+            if (a > 0.0f) {
+                *high = *low;
+            }
+
+            return;
         }
 
-        guMtxF2L(cameraInfo->projectionMatrix, projection);
-        gSPMatrix(renderState->dl++, projection, G_MTX_LOAD | G_MTX_PROJECTION | G_MTX_NOPUSH);
-        gSPMatrix(renderState->dl++, cameraInfo->viewMtx, G_MTX_MUL | G_MTX_PROJECTION | G_MTX_NOPUSH);
+        float root = sqrtf(discriminant);
+        float firstRoot = (-b - root) / (2.0f * a);
+        float secondRoot = (-b + root) / (2.0f * a);
 
-        megatextureRenderRow(
-            tileCache, 
-            index,
-            layerIndex, 
-            row, 
-            MAX(meshLayer->minTileX, (int)floorf(minX * imageLayer->xTiles)), 
-            MIN(meshLayer->maxTileX, (int)ceilf(maxX * imageLayer->xTiles)), 
-            renderState
-        );
+        if (a > 0.0f) {
+            minU = firstRoot;
+            maxU = secondRoot;
+        } else {
+            float before = MIN(*high, floorf(clampf(secondRoot, -1.0f, 2.0f) * xTiles));
+            float after = MAX(*low, ceilf(clampf(firstRoot, -1.0f, 2.0f) * xTiles));
+
+            if (before - *low >= *high - after) {
+                *high = before;
+            } else {
+                *low = after;
+            }
+
+            return;
+        }
+    } else if (b > 0.0f) {
+        maxU = -c / b;
+    } else if (b < 0.0f) {
+        minU = -c / b;
+    } else if (c > 0.0f) {
+        *high = *low;
+        return;
+    }
+
+    *low = MAX(*low, ceilf(clampf(minU, -1.0f, 2.0f) * xTiles));
+    *high = MIN(*high, floorf(clampf(maxU, -1.0f, 2.0f) * xTiles));
+}
+
+// the smallest and largest |offset + t * step|^2 for t from start to end
+static void mtRipRateRange(struct Vector3* offset, struct Vector3* step, float start, float end, float* minRate, float* maxRate) {
+    struct Vector3 rate;
+    vector3AddScaled(offset, step, start, &rate);
+    float startRate = vector3MagSqrd(&rate);
+    vector3AddScaled(offset, step, end, &rate);
+    float endRate = vector3MagSqrd(&rate);
+
+    float stepLength = vector3MagSqrd(step);
+    float closest = stepLength > 0.0f ? clampf(-vector3Dot(offset, step) / stepLength, start, end) : start;
+    vector3AddScaled(offset, step, closest, &rate);
+
+    *minRate = MIN(vector3MagSqrd(&rate), MIN(startRate, endRate));
+    *maxRate = MAX(startRate, endRate);
+}
+
+// keeps the tiles of a row that can be drawn squashed 1 << level times
+// along axis. The rate along v only changes from row to row and the rate
+// along u only along the row so comparing the extremes is exact
+static void mtRipClipRow(struct MTRowLod* rowLod, struct MTImageLayer* imageLayer, int axis, int level, int row, int* minX, int* maxX) {
+    float low = (float)*minX;
+    float high = (float)*maxX;
+    // the rates are squared
+    float levelScale = (float)(1 << (2 * level));
+    float minVRate;
+    float maxVRate;
+
+    mtRipRateRange(&rowLod->vRateOffset, &rowLod->vRateStep, (float)row / imageLayer->yTiles, (float)(row + 1) / imageLayer->yTiles, &minVRate, &maxVRate);
+
+    float a = vector3MagSqrd(&rowLod->uRateStep);
+    float b = 2.0f * vector3Dot(&rowLod->uRateOffset, &rowLod->uRateStep);
+    float c = vector3MagSqrd(&rowLod->uRateOffset);
+
+    if (axis == MTRipAxisU) {
+        // levelScale * maxVRate - uRate^2 <= 0
+        mtRipClipQuadratic(-a, -b, levelScale * maxVRate - c, imageLayer->xTiles, &low, &high);
+    } else {
+        // levelScale * uRate^2 - minVRate <= 0
+        mtRipClipQuadratic(levelScale * a, levelScale * b, levelScale * c - minVRate, imageLayer->xTiles, &low, &high);
+    }
+
+    if (low >= high) {
+        *maxX = *minX;
+        return;
+    }
+
+    *minX = (int)low;
+    *maxX = (int)high;
+}
+
+// the tiles of a row of level that the levels after it draw
+static int mtRipCoveredSpan(struct MTTileIndex* index, struct MTRipRanges* ripRanges, int axis, int level, int row, int* minX, int* maxX) {
+    if (level + 1 >= ripRanges->levelCount) {
+        return 0;
+    }
+
+    struct MTMeshLayer* nextMeshLayer = &index->meshLayers[ripRanges->layers[level + 1]];
+    int nextRow = axis == MTRipAxisV ? row >> 1 : row;
+
+    if (nextRow < nextMeshLayer->minTileY || nextRow >= nextMeshLayer->maxTileY) {
+        return 0;
+    }
+
+    struct MTRowRange* span = &ripRanges->spans[level + 1][nextRow - nextMeshLayer->minTileY];
+
+    if (span->minX >= span->maxX) {
+        return 0;
+    }
+
+    int shift = axis == MTRipAxisU ? 1 : 0;
+    *minX = span->minX << shift;
+    *maxX = span->maxX << shift;
+
+    return 1;
+}
+
+// the tiles of layerIndex a row of a rip level covers, they all have to
+// be drawn with layerIndex for the rip tile to be drawn instead
+static void mtRipCoveredTiles(struct MTTileIndex* index, int layerIndex, struct MTRowRange* rowRanges, int axis, int level, int row, int* minX, int* maxX) {
+    struct MTMeshLayer* meshLayer = &index->meshLayers[layerIndex];
+    int firstRow = axis == MTRipAxisV ? row << level : row;
+    int lastRow = axis == MTRipAxisV ? (row + 1) << level : row + 1;
+
+    *minX = 0;
+    *maxX = 0xFF;
+
+    for (int coveredRow = firstRow; coveredRow < lastRow; ++coveredRow) {
+        if (coveredRow < meshLayer->minTileY || coveredRow >= meshLayer->maxTileY) {
+            *maxX = *minX;
+            return;
+        }
+
+        struct MTRowRange* range = &rowRanges[coveredRow - meshLayer->minTileY];
+        *minX = MAX(*minX, range->minX);
+        *maxX = MIN(*maxX, range->maxX);
+    }
+
+    if (axis == MTRipAxisU) {
+        *minX = (*minX + (1 << level) - 1) >> level;
+        *maxX >>= level;
+    }
+}
+
+void megatextureSplitRipRanges(struct MTTileIndex* index, int layerIndex, struct MTRowLod* rowLod, struct MTRowRange* rowRanges, struct MTRipRanges* ripRanges) {
+    struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+    int levelCount = 1;
+
+    ripRanges->layers[0] = layerIndex;
+
+    for (; levelCount <= MT_MAX_RIP_SHIFT; ++levelCount) {
+        struct MTRipChain* chain = rowLod->ripChains[levelCount - 1];
+
+        if (!chain || layerIndex >= chain->layerCount) {
+            break;
+        }
+
+        struct MTImageLayer* ripImageLayer = &index->imageLayers[chain->firstLayer + layerIndex];
+        int isAligned = chain->axis == MTRipAxisU ?
+            (ripImageLayer->xTiles << levelCount) == imageLayer->xTiles && ripImageLayer->yTiles == imageLayer->yTiles :
+            (ripImageLayer->yTiles << levelCount) == imageLayer->yTiles && ripImageLayer->xTiles == imageLayer->xTiles;
+
+        // a rip tile has to cover whole tiles of the layer
+        if (!isAligned) {
+            break;
+        }
+
+        ripRanges->layers[levelCount] = chain->firstLayer + layerIndex;
+    }
+
+    ripRanges->levelCount = levelCount;
+    ripRanges->spans[0] = rowRanges;
+
+    if (levelCount == 1) {
+        ripRanges->ranges[0][0] = rowRanges;
+        ripRanges->ranges[0][1] = NULL;
+        return;
+    }
+
+    int axis = rowLod->ripChains[0]->axis;
+
+    // spans[1] is allocated first so freeing it frees the rest
+    for (int level = 1; level < levelCount; ++level) {
+        struct MTMeshLayer* meshLayer = &index->meshLayers[ripRanges->layers[level]];
+        ripRanges->spans[level] = stackMalloc(sizeof(struct MTRowRange) * (meshLayer->maxTileY - meshLayer->minTileY));
+    }
+
+    for (int level = 0; level < levelCount; ++level) {
+        struct MTMeshLayer* meshLayer = &index->meshLayers[ripRanges->layers[level]];
+        int rowCount = meshLayer->maxTileY - meshLayer->minTileY;
+
+        ripRanges->ranges[level][0] = stackMalloc(sizeof(struct MTRowRange) * rowCount);
+        ripRanges->ranges[level][1] = stackMalloc(sizeof(struct MTRowRange) * rowCount);
+    }
+
+    // coarsest first so each level also keeps the tiles the level after
+    // it draws. Rounding could otherwise leave gaps between them
+    for (int level = levelCount - 1; level > 0; --level) {
+        struct MTImageLayer* ripImageLayer = &index->imageLayers[ripRanges->layers[level]];
+        struct MTMeshLayer* ripMeshLayer = &index->meshLayers[ripRanges->layers[level]];
+
+        for (int row = ripMeshLayer->minTileY; row < ripMeshLayer->maxTileY; ++row) {
+            struct MTRowRange* span = &ripRanges->spans[level][row - ripMeshLayer->minTileY];
+            int minX;
+            int maxX;
+            int coveredMinX;
+            int coveredMaxX;
+
+            mtRipCoveredTiles(index, layerIndex, rowRanges, axis, level, row, &minX, &maxX);
+            minX = MAX(minX, ripMeshLayer->minTileX);
+            maxX = MIN(maxX, ripMeshLayer->maxTileX);
+
+            if (minX < maxX) {
+                mtRipClipRow(rowLod, ripImageLayer, axis, level, row, &minX, &maxX);
+            }
+
+            if (mtRipCoveredSpan(index, ripRanges, axis, level, row, &coveredMinX, &coveredMaxX)) {
+                if (minX >= maxX) {
+                    minX = coveredMinX;
+                    maxX = coveredMaxX;
+                } else {
+                    minX = MIN(minX, coveredMinX);
+                    maxX = MAX(maxX, coveredMaxX);
+                }
+            }
+
+            if (minX >= maxX) {
+                span->minX = 0;
+                span->maxX = 0;
+            } else {
+                span->minX = minX;
+                span->maxX = maxX;
+            }
+        }
+    }
+
+    // each level draws its span on either side of what the next level draws
+    for (int level = 0; level < levelCount; ++level) {
+        struct MTMeshLayer* meshLayer = &index->meshLayers[ripRanges->layers[level]];
+        int hasRange[2] = {0, 0};
+
+        for (int row = meshLayer->minTileY; row < meshLayer->maxTileY; ++row) {
+            struct MTRowRange* span = &ripRanges->spans[level][row - meshLayer->minTileY];
+            struct MTRowRange* before = &ripRanges->ranges[level][0][row - meshLayer->minTileY];
+            struct MTRowRange* after = &ripRanges->ranges[level][1][row - meshLayer->minTileY];
+            int coveredMinX;
+            int coveredMaxX;
+
+            *before = *span;
+            after->minX = 0;
+            after->maxX = 0;
+
+            if (span->minX < span->maxX && mtRipCoveredSpan(index, ripRanges, axis, level, row, &coveredMinX, &coveredMaxX)) {
+                before->maxX = MAX(span->minX, MIN(span->maxX, coveredMinX));
+
+                if (coveredMaxX < span->maxX) {
+                    after->minX = MAX(span->minX, coveredMaxX);
+                    after->maxX = span->maxX;
+                }
+            }
+
+            hasRange[0] |= before->minX < before->maxX;
+            hasRange[1] |= after->minX < after->maxX;
+        }
+
+        // skips setting up the projection for nothing
+        for (int half = 0; half < 2; ++half) {
+            if (!hasRange[half]) {
+                ripRanges->ranges[level][half] = NULL;
+            }
+        }
+    }
+}
+
+void megatextureFreeRipRanges(struct MTRipRanges* ripRanges) {
+    if (ripRanges->levelCount > 1) {
+        stackMallocFree(ripRanges->spans[1]);
+    }
+}
+
+int mtTileImportance(struct CameraMatrixInfo* cameraInfo, struct Vector3* tileOffset, float tileScreenSizeSqrd) {
+    float depth = vector3Dot(tileOffset, &cameraInfo->forwardVector);
+
+    if (depth <= cameraInfo->nearPlane) {
+        // the camera is right next to this tile
+        return MT_IMPORTANCE_AREA + MT_IMPORTANCE_CENTER;
+    }
+
+    float depthSqrd = depth * depth;
+    // fraction of the screen height covered by the tile squared
+    float area = tileScreenSizeSqrd / depthSqrd;
+    // cosine squared of the angle between the tile and forward
+    float center = depthSqrd / vector3MagSqrd(tileOffset);
+
+    return (int)(MT_IMPORTANCE_AREA * clampf(area, 0.0f, 1.0f)) + (int)(MT_IMPORTANCE_CENTER * clampf(center * 2.0f - 1.0f, 0.0f, 1.0f));
+}
+
+// finds what to texture a tile with and builds the vertices it is drawn
+// with. use->entryIndex is MT_NO_TILE_INDEX if the tile can't be drawn.
+// Returns the vertex cache slot of the window the tile is in
+static int mtResolveRowTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTMeshRows* meshRows, int x, int row, struct MTMeshTile* tile, int importance, struct MTTileUse* use) {
+    mtTileCacheResolveTile(tileCache, index, x, row, layerIndex, importance, use);
+
+    if (use->entryIndex == MT_NO_TILE_INDEX) {
+        return MT_VERTEX_CACHE_NO_SLOT;
+    }
+
+    int vertexSlot = mtVertexCacheRequestWindow(&gMtVertexCache, index, layerIndex, meshRows, tile->windowStart);
+
+    if (vertexSlot == MT_VERTEX_CACHE_NO_SLOT) {
+        use->entryIndex = MT_NO_TILE_INDEX;
+    }
+
+    return vertexSlot;
+}
+
+// writes the vertex load started for the current window once the
+// last vertex it needs is known. windowVertices is the first
+// vertex of the window in the vertex cache
+static void mtFinishVertexLoad(Vtx* windowVertices, struct MTVertexWindow* window, Gfx* vertexCopyCommand, int loadStart, int loadEnd) {
+    gSPVertex(vertexCopyCommand, &windowVertices[loadStart - window->start], loadEnd - loadStart, loadStart - window->start);
+
+    if (window->loadedStart < window->loadedEnd && loadStart <= window->loadedEnd && loadEnd >= window->loadedStart) {
+        window->loadedStart = MIN(window->loadedStart, loadStart);
+        window->loadedEnd = MAX(window->loadedEnd, loadEnd);
+    } else {
+        window->loadedStart = loadStart;
+        window->loadedEnd = loadEnd;
+    }
+}
+
+void megatextureRenderRow(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTMeshRows* meshRows, int row, int minX, int maxX, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState, struct MTVertexWindow* window) {
+    struct MTMeshLayer* meshLayer = &index->meshLayers[layerIndex];
+    struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+
+    if (!gMtShareVertexWindows) {
+        window->start = MT_NO_VERTEX_WINDOW;
+    }
+
+    // offset from the camera to the center of the tile at minX
+    struct Vector3 rowOffset;
+    struct Vector3 tileStep;
+    vector3Sub(&index->uvBasis.uvOrigin, &cameraInfo->cameraPosition, &rowOffset);
+    vector3AddScaled(&rowOffset, &index->uvBasis.uvUp, (row + 0.5f) / imageLayer->yTiles, &rowOffset);
+    vector3AddScaled(&rowOffset, &index->uvBasis.uvRight, (minX + 0.5f) / imageLayer->xTiles, &rowOffset);
+    vector3Scale(&index->uvBasis.uvRight, &tileStep, 1.0f / imageLayer->xTiles);
+    float tileScreenSizeSqrd = vector3MagSqrd(&tileStep) * cameraInfo->cotFov * cameraInfo->cotFov;
+
+    struct MTMeshTile* firstTile = MT_MESH_ROWS_TILE(meshRows, meshLayer, minX, row);
+    struct MTMeshTile* tile = firstTile;
+
+    struct MTTileUse uses[MT_ROW_CACHE_MAX_TILES];
+    u32 tileKeys[MT_ROW_CACHE_MAX_TILES];
+    u8 vertexSlots[MT_ROW_CACHE_MAX_TILES];
+    int useCount = 0;
+    // wider rows resolve each tile as it is drawn
+    int useRowCache = gMtRowCache.slots && maxX - minX <= MT_ROW_CACHE_MAX_TILES;
+
+    if (useRowCache) {
+        // every tile still has to be requested to keep it
+        // resident even if the row commands are reused
+        for (int x = minX; x < maxX; ++x, ++tile) {
+            if (tile->triangleCount == 0) {
+                continue;
+            }
+
+            struct Vector3 tileOffset;
+            vector3AddScaled(&rowOffset, &tileStep, (float)(x - minX), &tileOffset);
+            int importance = mtTileImportance(cameraInfo, &tileOffset, tileScreenSizeSqrd);
+
+            vertexSlots[useCount] = mtResolveRowTile(tileCache, index, layerIndex, meshRows, x, row, tile, importance, &uses[useCount]);
+            tileKeys[useCount] = mtTileCacheUseKey(tileCache, &uses[useCount]);
+            ++useCount;
+        }
+
+        Gfx* cachedRow = mtRowCacheFind(&gMtRowCache, index, layerIndex, row, minX, maxX, meshRows->meshSlot, tileKeys, vertexSlots, useCount, window);
+
+        if (cachedRow) {
+            gSPDisplayList(renderState->dl++, cachedRow);
+            return;
+        }
+
+        tile = firstTile;
+    }
+
+    struct MTVertexWindow windowIn = *window;
+    Gfx* rowStart = renderState->dl;
+    Gfx* vertexCopyCommand = NULL;
+    Vtx* loadVertices = NULL;
+    int loadStart = 0;
+    int loadEnd = 0;
+    int useIndex = 0;
+
+    for (int x = minX; x < maxX; ++x, ++tile) {
+        if (tile->triangleCount == 0) {
+            continue;
+        }
+
+        struct MTTileUse* use;
+        struct MTTileUse uncachedUse;
+        int vertexSlot;
+
+        if (useRowCache) {
+            vertexSlot = vertexSlots[useIndex];
+            use = &uses[useIndex++];
+        } else {
+            struct Vector3 tileOffset;
+            vector3AddScaled(&rowOffset, &tileStep, (float)(x - minX), &tileOffset);
+            int importance = mtTileImportance(cameraInfo, &tileOffset, tileScreenSizeSqrd);
+
+            vertexSlot = mtResolveRowTile(tileCache, index, layerIndex, meshRows, x, row, tile, importance, &uncachedUse);
+            use = &uncachedUse;
+        }
+
+        if (use->entryIndex == MT_NO_TILE_INDEX) {
+            // nothing is loaded to texture this tile with, leave a
+            // gap instead of drawing it with the last tile loaded
+            continue;
+        }
+
+        int tileEnd = tile->startVertex + tile->vertexCount;
+
+        if (tile->windowStart != window->start) {
+            if (vertexCopyCommand) {
+                // retroactively update the vertex command
+                mtFinishVertexLoad(loadVertices, window, vertexCopyCommand, loadStart, loadEnd);
+                vertexCopyCommand = NULL;
+            }
+
+            window->start = tile->windowStart;
+            window->loadedStart = tile->windowStart;
+            window->loadedEnd = tile->windowStart;
+        }
+
+        // windows can span rows so the vertices may still be
+        // loaded from the row before
+        if (tile->startVertex < window->loadedStart || tileEnd > window->loadedEnd) {
+            if (!vertexCopyCommand) {
+                vertexCopyCommand = renderState->dl++;
+                loadVertices = MT_VERTEX_CACHE_SLOT_VERTICES(&gMtVertexCache, vertexSlot);
+                // vertices before the first tile drawn aren't needed
+                loadStart = gMtShareVertexWindows ? tile->startVertex : window->start;
+                loadEnd = tileEnd;
+            } else {
+                loadEnd = MAX(loadEnd, tileEnd);
+            }
+        }
+
+        renderState->dl = mtTileCacheUseTile(tileCache, use, renderState->dl);
+        gSPDisplayList(renderState->dl++, &meshRows->triangles[tile->triangleStart]);
+    }
+
+    if (vertexCopyCommand) {
+        // load what the next rows need from the window now
+        // instead of each of them starting another load
+        if (window->aheadEnd > loadEnd && window->aheadEnd - window->start <= MT_VERTEX_CACHE_SIZE) {
+            loadEnd = window->aheadEnd;
+        }
+
+        mtFinishVertexLoad(loadVertices, window, vertexCopyCommand, loadStart, loadEnd);
+    }
+
+    if (useRowCache && renderState->dl != rowStart) {
+        mtRowCacheStore(&gMtRowCache, index, layerIndex, row, minX, maxX, meshRows->meshSlot, tileKeys, vertexSlots, useCount, &windowIn, window, rowStart, renderState->dl - rowStart);
+    }
+}
+
+// the end of the vertices the rows after row need from window. Stops at
+// the first tile in another window or once the vertices skipped in
+// between would cost more to load than another load
+static int mtVertexLoadAhead(struct MTMeshLayer* meshLayer, struct MTMeshRows* meshRows, struct MTRowRange* rowRanges, int row, int window, int loadEnd) {
+    // the rows of the next block start their own window
+    for (int nextRow = row + 1; nextRow < meshRows->lastRow; ++nextRow) {
+        struct MTRowRange* range = &rowRanges[nextRow - meshLayer->minTileY];
+
+        if (range->minX >= range->maxX) {
+            continue;
+        }
+
+        struct MTMeshTile* tile = MT_MESH_ROWS_TILE(meshRows, meshLayer, range->minX, nextRow);
+
+        for (int x = range->minX; x < range->maxX; ++x, ++tile) {
+            if (tile->triangleCount == 0) {
+                continue;
+            }
+
+            if (tile->windowStart != window || tile->startVertex - loadEnd > MT_MAX_VERTEX_LOAD_GAP) {
+                return loadEnd;
+            }
+
+            loadEnd = MAX(loadEnd, tile->startVertex + tile->vertexCount);
+        }
+    }
+
+    return loadEnd;
+}
+
+// adds a row still waiting on its mesh to the rows of the parent
+// layer. Those rows may overlap what that layer draws itself
+static void mtAddFallbackRow(struct MTTileIndex* index, int layerIndex, int row, struct MTRowRange* range, struct MTRowRange* fallbackRanges) {
+    struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+    struct MTImageLayer* coarseImageLayer = &index->imageLayers[imageLayer->parentLayer];
+    struct MTMeshLayer* coarseMeshLayer = &index->meshLayers[imageLayer->parentLayer];
+
+    int coarseRow = row * coarseImageLayer->yTiles / imageLayer->yTiles;
+
+    if (coarseRow < coarseMeshLayer->minTileY || coarseRow >= coarseMeshLayer->maxTileY) {
+        return;
+    }
+
+    int minX = MAX(coarseMeshLayer->minTileX, range->minX * coarseImageLayer->xTiles / imageLayer->xTiles);
+    int maxX = MIN(coarseMeshLayer->maxTileX, (range->maxX * coarseImageLayer->xTiles + imageLayer->xTiles - 1) / imageLayer->xTiles);
+
+    if (minX >= maxX) {
+        return;
+    }
+
+    struct MTRowRange* fallback = &fallbackRanges[coarseRow - coarseMeshLayer->minTileY];
+
+    if (fallback->minX >= fallback->maxX) {
+        fallback->minX = minX;
+        fallback->maxX = maxX;
+    } else {
+        fallback->minX = MIN(fallback->minX, minX);
+        fallback->maxX = MAX(fallback->maxX, maxX);
+    }
+}
+
+// true if megatextures drawn later will paint over the whole row
+static int mtIsRowCovered(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, int row, struct MTRowRange* range, struct CameraMatrixInfo* cameraInfo) {
+    struct MTImageLayer* imageLayer = &index->imageLayers[layerIndex];
+
+    struct Vector2 minUv;
+    struct Vector2 maxUv;
+    minUv.x = (float)range->minX / imageLayer->xTiles;
+    minUv.y = (float)row / imageLayer->yTiles;
+    maxUv.x = (float)range->maxX / imageLayer->xTiles;
+    maxUv.y = (float)(row + 1) / imageLayer->yTiles;
+
+    float screenArea;
+
+    if (!mtCoverageIsRectCovered(&gMtCoverage, &minUv, &maxUv, &index->uvBasis, &cameraInfo->cullingInformation, gMtCoverage.currentOrder, &screenArea)) {
+        return 0;
+    }
+
+    ++gMtCoverage.skippedRowCount;
+    gMtCoverage.skippedPixelCount += (u32)(screenArea * gScreenWidth * gScreenHeight);
+
+    for (int x = range->minX; x < range->maxX; ++x) {
+        int tileSize;
+
+        ++gMtCoverage.skippedTileRequests;
+
+        if (!mtTileCacheIsResident(tileCache, index, x, row, layerIndex, &tileSize)) {
+            ++gMtCoverage.skippedTileMisses;
+            gMtCoverage.skippedBytesFromCart += tileSize;
+        }
+    }
+
+    return 1;
+}
+
+void megatextureRenderRows(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTRowRange* rowRanges, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
+    struct MTMeshLayer* meshLayer = &index->meshLayers[layerIndex];
+
+    struct MTVertexWindow window;
+    window.start = MT_NO_VERTEX_WINDOW;
+
+    struct MTMeshRows meshRows;
+    meshRows.lastRow = 0;
+    int meshReady = 0;
+    struct MTRowRange* fallbackRanges = NULL;
+
+    for (int row = meshLayer->minTileY; row < meshLayer->maxTileY; ++row) {
+        struct MTRowRange* range = &rowRanges[row - meshLayer->minTileY];
+
+        if (range->minX >= range->maxX) {
+            continue;
+        }
+
+        if (gMtCoverage.isActive && mtIsRowCovered(tileCache, index, layerIndex, row, range, cameraInfo)) {
+            continue;
+        }
+
+        if (row >= meshRows.lastRow) {
+            meshReady = mtMeshCacheFindRows(&gMtMeshCache, tileCache, index, layerIndex, row, &meshRows);
+        }
+
+        if (!meshReady) {
+            ++gMtMeshCache.pendingRowCount;
+
+            if (index->imageLayers[layerIndex].parentLayer != MT_NO_PARENT_LAYER) {
+                if (!fallbackRanges) {
+                    struct MTMeshLayer* coarseMeshLayer = &index->meshLayers[index->imageLayers[layerIndex].parentLayer];
+                    int coarseRowCount = coarseMeshLayer->maxTileY - coarseMeshLayer->minTileY;
+                    fallbackRanges = stackMalloc(sizeof(struct MTRowRange) * coarseRowCount);
+                    zeroMemory(fallbackRanges, sizeof(struct MTRowRange) * coarseRowCount);
+                }
+
+                mtAddFallbackRow(index, layerIndex, row, range, fallbackRanges);
+            }
+
+            continue;
+        }
+
+        window.aheadEnd = 0;
+
+        if (gMtShareVertexWindows) {
+            for (int x = range->maxX - 1; x >= range->minX; --x) {
+                struct MTMeshTile* tile = MT_MESH_ROWS_TILE(&meshRows, meshLayer, x, row);
+
+                if (tile->triangleCount) {
+                    window.aheadEnd = mtVertexLoadAhead(meshLayer, &meshRows, rowRanges, row, tile->windowStart, tile->startVertex + tile->vertexCount);
+                    break;
+                }
+            }
+        }
+
+        megatextureRenderRow(tileCache, index, layerIndex, &meshRows, row, range->minX, range->maxX, cameraInfo, renderState, &window);
+    }
+
+    if (fallbackRanges) {
+        megatextureRenderRows(tileCache, index, index->imageLayers[layerIndex].parentLayer, fallbackRanges, cameraInfo, renderState);
+        stackMallocFree(fallbackRanges);
+    }
+}
+
+static int megatextureRenderRowRanges(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTRowRange* rowRanges, float nearPlane, float farPlane, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
+    nearPlane *= SCENE_SCALE;
+    farPlane *= SCENE_SCALE;
+
+    cameraInfo->projectionMatrix[2][2] = (nearPlane + farPlane) / (nearPlane - farPlane);
+    cameraInfo->projectionMatrix[3][2] = (2 * nearPlane * farPlane) / (nearPlane - farPlane);
+
+    // the projection only depends on the layer. Vertices are transformed
+    // as they are loaded so every row can share it
+    Mtx* projection = renderStateRequestMatrices(renderState, 1);
+
+    if (!projection) {
+        return 0;
+    }
+
+    guMtxF2L(cameraInfo->projectionMatrix, projection);
+    gSPMatrix(renderState->dl++, projection, G_MTX_LOAD | G_MTX_PROJECTION | G_MTX_NOPUSH);
+    gSPMatrix(renderState->dl++, cameraInfo->viewMtx, G_MTX_MUL | G_MTX_PROJECTION | G_MTX_NOPUSH);
+
+    megatextureRenderRows(tileCache, index, layerIndex, rowRanges, cameraInfo, renderState);
+
+    return 1;
+}
+
+int megatextureRenderLayer(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTCullingLoop* currentLoop, float nearPlane, float farPlane, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
+    if (currentLoop->loopSize == 0) {
+        // the plane is entirely outside the view
+        return 1;
+    }
+
+    // every row is found before any is drawn so a
+    // row can load vertices for the rows after it
+    struct MTRowRange rowRanges[MT_MAX_TILE_ROWS];
+    megatextureFindRowRanges(index, layerIndex, currentLoop, NULL, rowRanges);
+
+    return megatextureRenderRowRanges(tileCache, index, layerIndex, rowRanges, nearPlane, farPlane, cameraInfo, renderState);
+}
+
+// draws the tiles a layer keeps for itself and those each rip
+// level draws in its place
+static int megatextureRenderRipRanges(struct MTTileCache* tileCache, struct MTTileIndex* index, struct MTRipRanges* ripRanges, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
+    for (int level = 0; level < ripRanges->levelCount; ++level) {
+        for (int half = 0; half < 2; ++half) {
+            struct MTRowRange* rowRanges = ripRanges->ranges[level][half];
+
+            if (rowRanges && !megatextureRenderRowRanges(tileCache, index, ripRanges->layers[level], rowRanges, cameraInfo->nearPlane, cameraInfo->farPlane, cameraInfo, renderState)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+// draws each layer from the coarsest needed down to the finest. Tiles of
+// a layer are only drawn where the tile of the coarser layer covering
+// them wasn't so they line up without clipping by depth
+static int megatextureRenderRowLods(struct MTTileCache* tileCache, struct MTTileIndex* index, struct MTCullingLoop* cullingLoop, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
+    struct MTRowLod rowLod;
+    int layerIndex = megatextureDetermineRowLod(index, cullingLoop, cameraInfo, megatextureLodState(index), &rowLod);
+
+    for (; layerIndex >= 0; --layerIndex) {
+        struct MTRowRange rowRanges[MT_MAX_TILE_ROWS];
+        int needsFinerLayer = megatextureFindRowRanges(index, layerIndex, cullingLoop, &rowLod, rowRanges);
+
+        struct MTRipRanges ripRanges;
+        megatextureSplitRipRanges(index, layerIndex, &rowLod, rowRanges, &ripRanges);
+        int result = megatextureRenderRipRanges(tileCache, index, &ripRanges, cameraInfo, renderState);
+        megatextureFreeRipRanges(&ripRanges);
+
+        if (!result) {
+            return 0;
+        }
+
+        if (!needsFinerLayer) {
+            break;
+        }
     }
 
     return 1;
@@ -299,6 +1237,10 @@ int megatextureRender(struct MTTileCache* tileCache, struct MTTileIndex* index,
         return 1;
     }
 
+    if (gMtRowLod) {
+        return megatextureRenderRowLods(tileCache, index, &cullingLoop, cameraInfo, renderState);
+    }
+
     float clipingPlaneDistances[MT_MAX_LOD];
     int minLod;
     int maxLod;
@@ -307,6 +1249,7 @@ int megatextureRender(struct MTTileCache* tileCache, struct MTTileIndex* index,
         index->worldPixelSize, 
         &cullingLoop, 
         cameraInfo, 
+        megatextureLodState(index),
         index->layerCount - 1, 
         clipingPlaneDistances,
         &minLod,
@@ -341,7 +1284,7 @@ int megatextureRender(struct MTTileCache* tileCache, struct MTTileIndex* index,
     return 1;
 }
 
-void megatexturePreload(struct MTTileCache* tileCache, struct MTTileIndex* index, int minTileAxisTileCount) {
+int megatexturePinLayers(struct MTTileCache* tileCache, struct MTTileIndex* index, int minTileAxisTileCount, int setIndex) {
     for (int layerIndex = 0; layerIndex < index->layerCount; ++layerIndex) {
         struct MTImageLayer* layer = &index->imageLayers[layerIndex];
 
@@ -351,62 +1294,169 @@ void megatexturePreload(struct MTTileCache* tileCache, struct MTTileIndex* index
 
         for (int y = 0; y < layer->yTiles; ++y) {
             for (int x = 0; x < layer->xTiles; ++x) {
-                mtTileCachePreloadTile(tileCache, index, x, y, layerIndex);
+                if (!mtTileCachePinTile(tileCache, index, x, y, layerIndex, setIndex)) {
+                    return 0;
+                }
             }
         }
     }
+
+    return 1;
 }
 
-void megatextureRenderStart(struct MTTileCache* tileCache) {
-    tileCache->oldestTileFromFrame[1] = tileCache->oldestTileFromFrame[0];
-    tileCache->oldestTileFromFrame[0] = MT_NO_TILE_INDEX;
-    tileCache->tilesRequestedFromCart = 0;
-    tileCache->totalTileRequests = 0;
-    tileCache->overflowRequestCount = 0;
+void megatexturePreload(struct MTTileCache* tileCache, struct MTTileIndex* index, int minTileAxisTileCount) {
+    megatexturePinLayers(tileCache, index, minTileAxisTileCount, MT_RESIDENCY_SET_PRELOAD);
+}
+
+void megatexturesPreloadAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, u32* visibleSet, u32* inViewSet, int minTileAxisTileCount) {
+    // the coarsest layer of every megatexture comes first so there is always
+    // a tile to draw in place of one still loading, even if the pinned
+    // tile limit stops the finer layers from being preloaded
+    for (int i = 0; i < count; ++i) {
+        if (!MT_IS_IN_VISIBLE_SET(visibleSet, i)) {
+            continue;
+        }
 
-    for (int i = 0; i < 6; ++i) {
-        tileCache->tileRequests[i] = 0;
+        int rootLod = index[i].layerCount - 1;
+        struct MTImageLayer* layer = &index[i].imageLayers[rootLod];
+
+        for (int y = 0; y < layer->yTiles; ++y) {
+            for (int x = 0; x < layer->xTiles; ++x) {
+                mtTileCachePinTile(tileCache, &index[i], x, y, rootLod, MT_RESIDENCY_SET_PRELOAD);
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (!MT_IS_IN_VISIBLE_SET(inViewSet, i)) {
+            continue;
+        }
+
+        megatexturePreload(tileCache, &index[i], minTileAxisTileCount);
     }
 }
 
-int megatexturesDoesHaveExtraSpace(struct MTTileCache* tileCache) {
-    int extraCount = 0;
-    
-    int entryIndex = tileCache->oldestUsedTile;
+int megatexturesPinSortGroup(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, int sortGroup, int minTileAxisTileCount, int setIndex) {
+    for (int i = 0; i < count; ++i) {
+        if (index[i].sortGroup != sortGroup) {
+            continue;
+        }
 
-    while (entryIndex != tileCache->oldestTileFromFrame[1]) {
-        // this tile was already used this frame and
-        // there are no more availible tiles
-        ++extraCount;
+        if (!megatexturePinLayers(tileCache, &index[i], minTileAxisTileCount, setIndex)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int megatexturePinAround(struct MTTileCache* tileCache, struct MTTileIndex* index, struct Vector3* point, float radius, int lod, int setIndex) {
+    if (lod >= index->layerCount) {
+        lod = index->layerCount - 1;
+    }
+
+    struct Vector3 offset;
+    vector3Sub(point, &index->uvBasis.uvOrigin, &offset);
+
+    if (fabsf(vector3Dot(&offset, &index->uvBasis.normal)) > radius) {
+        return 1;
+    }
+
+    float rightLengthSqrd = vector3MagSqrd(&index->uvBasis.uvRight);
+    float upLengthSqrd = vector3MagSqrd(&index->uvBasis.uvUp);
+
+    if (rightLengthSqrd == 0.0f || upLengthSqrd == 0.0f) {
+        return 1;
+    }
+
+    float u = vector3Dot(&offset, &index->uvBasis.uvRight) / rightLengthSqrd;
+    float v = vector3Dot(&offset, &index->uvBasis.uvUp) / upLengthSqrd;
+    float uRadius = radius / sqrtf(rightLengthSqrd);
+    float vRadius = radius / sqrtf(upLengthSqrd);
+
+    struct MTImageLayer* layer = &index->imageLayers[lod];
 
-        if (extraCount == MT_MAX_TILE_UNDER_LOADED) {
-            return 1;
+    int minX = MAX(0, (int)floorf((u - uRadius) * layer->xTiles));
+    int maxX = MIN(layer->xTiles, (int)ceilf((u + uRadius) * layer->xTiles));
+    int minY = MAX(0, (int)floorf((v - vRadius) * layer->yTiles));
+    int maxY = MIN(layer->yTiles, (int)ceilf((v + vRadius) * layer->yTiles));
+
+    for (int y = minY; y < maxY; ++y) {
+        for (int x = minX; x < maxX; ++x) {
+            if (!mtTileCachePinTile(tileCache, index, x, y, lod, setIndex)) {
+                return 0;
+            }
         }
-        
-        entryIndex = tileCache->entries[entryIndex].newerTile;
     }
 
+    return 1;
+}
+
+int megatexturesPinAround(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, struct Vector3* point, float radius, int lod, int setIndex) {
+    for (int i = 0; i < count; ++i) {
+        if (!megatexturePinAround(tileCache, &index[i], point, radius, lod, setIndex)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void megatexturesUnpin(struct MTTileCache* tileCache, int setIndex) {
+    mtTileCacheUnpinSet(tileCache, setIndex);
+}
+
+void megatextureRenderStart(struct MTTileCache* tileCache) {
+    mtTileCacheStartFrame(tileCache);
+    ++gMtLodFrame;
+
+    if (gMtRowCache.slots) {
+        mtRowCacheStartFrame(&gMtRowCache);
+    }
+
+    mtVertexCacheStartFrame(&gMtVertexCache);
+    mtMeshCacheStartFrame(&gMtMeshCache);
+    mtCoverageReset(&gMtCoverage);
 
-    return 0;
+#ifdef MT_TILE_TRACE
+    mtTileCacheTraceFrame(tileCache);
+#endif
 }
 
-void megatextureRenderEnd(struct MTTileCache* tileCache, int success) {
-    mtTileCacheWaitForTiles(tileCache);
+int megatexturesDoesHaveExtraSpace(struct MTTileCache* tileCache) {
+    return mtTileCacheEvictableCount(tileCache, MT_MAX_TILE_UNDER_LOADED) == MT_MAX_TILE_UNDER_LOADED;
+}
 
-    if (!success) {
-        gMtLodBias += MT_LOD_BIAS_FAIL_STEP;
-        return;
+void megatextureRenderEnd(struct MTTileCache* tileCache, struct RenderState* renderState, int success) {
+    // tiles finish loading in the background and are
+    // drawn once they are ready in a later frame
+    mtTileCacheFlushLoads(tileCache);
+
+    if (renderState) {
+        // tile loaders for CI tiles leave palette lookup on, this
+        // is needed even if drawing stopped partway through
+        gDPPipeSync(renderState->dl++);
+        gDPSetTextureLUT(renderState->dl++, G_TT_NONE);
     }
 
-    if (tileCache->overflowRequestCount || tileCache->totalTileRequests > MT_MAX_TOTAL_TILE_REQUESTS) {
-        gMtLodBias += MT_LOD_BIAS_STEP;
-    } else if (megatexturesDoesHaveExtraSpace(tileCache) && tileCache->totalTileRequests < MT_MIN_TOTAL_TILE_REQUESTS) {
-        gMtLodBias -= MT_LOD_BIAS_STEP * 0.25;
+    struct MTLodControllerInput input;
+    input.dmaTimeUs = tileCache->dmaTimeUs;
+    input.graphicsTimeUs = gMtLodController.graphicsTimeUs;
+    input.missRate = 0.0f;
+    input.displayListFill = 0.0f;
+    input.failed = !success;
+    input.cacheFull = !megatexturesDoesHaveExtraSpace(tileCache);
 
-        if (gMtLodBias < gMtMinLoadBias) {
-            gMtLodBias = gMtMinLoadBias;
-        }
+    if (tileCache->totalTileRequests) {
+        input.missRate = (float)(tileCache->fallbackRequestCount + tileCache->missingTileCount + tileCache->pendingTileCount) / tileCache->totalTileRequests;
+    }
+
+    if (renderState) {
+        // the display list grows up and allocated memory grows down
+        input.displayListFill = 1.0f - (float)(renderState->currentMemoryChunk - renderState->dl) / renderState->displayListLength;
     }
+
+    gMtLodBias = mtLodControllerUpdate(&gMtLodController, &input, gMtLodBias, gMtMinLoadBias);
 }
 
 struct SortInfo {
@@ -444,17 +1494,21 @@ void megatexturesSort(struct SortInfo* values, struct SortInfo* tmp, int min, in
 
 #define GROUP_SORT_OFFSET   1000.0f
 
-int megatexturesRenderAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
-    megatextureRenderStart(tileCache);
-
+static int megatexturesRenderSorted(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, u32* visibleSet, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
     int currentFace = 0;
 
     while (currentFace < count && index[currentFace].sortGroup < 0) {
+        if (!MT_IS_IN_VISIBLE_SET(visibleSet, currentFace)) {
+            ++currentFace;
+            continue;
+        }
+
         if (!megatextureRender(tileCache, &index[currentFace], cameraInfo, renderState)) {
-            megatextureRenderEnd(tileCache, 0);
             return 0;
         }
 
+        // start loading this megatexture while the next one is built
+        mtTileCacheFlushLoads(tileCache);
         ++currentFace;
     }
 
@@ -463,6 +1517,11 @@ int megatexturesRenderAll(struct MTTileCache* tileCache, struct MTTileIndex* ind
     int currentSortFace = 0;
 
     while (currentFace < count) {
+        if (!MT_IS_IN_VISIBLE_SET(visibleSet, currentFace)) {
+            ++currentFace;
+            continue;
+        }
+
         struct Vector3 furthestPoint;
         box3DSupportFunction(&index[currentFace].boundingBox, &cameraInfo->forwardVector, &furthestPoint);
         furthestPoint.y = 0.0f;
@@ -474,19 +1533,91 @@ int megatexturesRenderAll(struct MTTileCache* tileCache, struct MTTileIndex* ind
 
     struct SortInfo* tmpMemory = stackMalloc(sizeof(struct SortInfo) * sortedFaceCount);
 
-    megatexturesSort(sortInfo, tmpMemory, 0, sortedFaceCount);
+    megatexturesSort(sortInfo, tmpMemory, 0, currentSortFace);
 
-    for (int i = 0; i < sortedFaceCount; ++i) {
+    for (int i = 0; i < currentSortFace; ++i) {
         if (!megatextureRender(tileCache, &index[sortInfo[i].index], cameraInfo, renderState)) {
-            megatextureRenderEnd(tileCache, 0);
             return 0;
         }
+
+        mtTileCacheFlushLoads(tileCache);
     }
 
     stackMallocFree(tmpMemory);
     stackMallocFree(sortInfo);
 
-    megatextureRenderEnd(tileCache, 1);
+    return 1;
+}
+
+// walks the megatextures front to back adding what they cover to
+// gMtCoverage, the position in order is used as the draw order
+static void megatexturesBuildCoverage(struct MTTileIndex* index, u16* order, int orderCount, u32* visibleSet, struct CameraMatrixInfo* cameraInfo) {
+    for (int i = orderCount - 1; i >= 0; --i) {
+        struct MTTileIndex* current = &index[order[i]];
+
+        if (!MT_IS_IN_VISIBLE_SET(visibleSet, order[i]) ||
+            current->occluderMinUv.x >= current->occluderMaxUv.x ||
+            mtIsBackFacing(cameraInfo, &current->uvBasis)) {
+            continue;
+        }
+
+        struct MTCullingLoop cullingLoop;
+        mtCullingLoopInit(&cullingLoop, &current->occluderMinUv, &current->occluderMaxUv);
+        mtCullingLoopClip(&cullingLoop, &current->uvBasis, &cameraInfo->cullingInformation);
+        mtCoverageAddLoop(&gMtCoverage, &cullingLoop, &current->uvBasis, &cameraInfo->cullingInformation, i);
+    }
+
+    gMtCoverage.isActive = 1;
+}
+
+static int megatexturesRenderBsp(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, struct MTBspNode* bspNodes, u32* visibleSet, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState) {
+    u16* order = gMtDrawOrder;
+    int orderCount = mtBspDrawOrder(bspNodes, &cameraInfo->cullingInformation, order);
+
+    if (gMtUseCoverage) {
+        megatexturesBuildCoverage(index, order, orderCount, visibleSet, cameraInfo);
+    }
+
+    for (int i = 0; i < orderCount; ++i) {
+        if (!MT_IS_IN_VISIBLE_SET(visibleSet, order[i])) {
+            continue;
+        }
+
+        gMtCoverage.currentOrder = i;
+
+        if (!megatextureRender(tileCache, &index[order[i]], cameraInfo, renderState)) {
+            gMtCoverage.isActive = 0;
+            return 0;
+        }
+
+        mtTileCacheFlushLoads(tileCache);
+    }
+
+    // the prefetch pass requests tiles for another camera
+    gMtCoverage.isActive = 0;
+
+    return 1;
+}
+
+int megatexturesRenderAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, struct MTBspNode* bspNodes, u32* visibleSet, struct CameraMatrixInfo* cameraInfo, struct CameraMatrixInfo* predictedCameraInfo, u32* predictedVisibleSet, struct RenderState* renderState) {
+    megatextureRenderStart(tileCache);
+
+    int didRender = bspNodes ?
+        megatexturesRenderBsp(tileCache, index, count, bspNodes, visibleSet, cameraInfo, renderState) :
+        megatexturesRenderSorted(tileCache, index, count, visibleSet, cameraInfo, renderState);
+
+    if (!didRender) {
+        megatextureRenderEnd(tileCache, renderState, 0);
+        return 0;
+    }
+
+    mtTileCacheScheduleRequests(tileCache);
+
+    if (predictedCameraInfo) {
+        megatexturesPrefetchAll(tileCache, index, count, predictedVisibleSet, predictedCameraInfo);
+    }
+
+    megatextureRenderEnd(tileCache, renderState, 1);
 
     return 1;
 }
\ No newline at end of file
@@ -4,16 +4,164 @@
 #include "tile_index.h"
 #include "../graphics/renderstate.h"
 #include "./megatexture_tilecache.h"
+#include "./megatexture_bsp.h"
 #include "../scene/camera.h"
 
+struct MTCullingLoop;
+struct MTVertexWindow;
+struct MTMeshRows;
+
+#define MT_MAX_LOD              5
+// rip layers are only used up to this ratioShift
+#define MT_MAX_RIP_SHIFT        2
+
+// tile rows are indexed with a u8
+#define MT_MAX_TILE_ROWS        256
+
+// the visible tiles of a row from minX up to maxX
+struct MTRowRange {
+    u8 minX;
+    u8 maxX;
+};
+
+// the texels of a flat megatexture cover less of the screen the further
+// they are from the camera so the lod of a tile only depends on the depth
+// of its closest point. See megatextureDetermineRowLod
+struct MTRowLod {
+    // the depth of the point at uv is
+    // originDepth + u * uDepth + v * vDepth
+    float originDepth;
+    float uDepth;
+    float vDepth;
+    // tiles of layer i are drawn when their closest point is at least
+    // layerDepths[i - 1] from the camera and the tile of layer i + 1
+    // they are part of is closer than layerDepths[i]
+    float layerDepths[MT_MAX_LOD];
+    u8 coarsestLayer;
+    // ripChains[k - 1] is squashed 1 << k times along the axis facing
+    // away from the camera the most, NULL if there is none. The texels
+    // per pixel along u are proportional to |uRateOffset + u * uRateStep|
+    // and along v to |vRateOffset + v * vRateStep|. A tile can be drawn
+    // squashed 1 << k times where that axis has 1 << k times the texels
+    // per pixel of the other one at all of its corners, so it is still
+    // as sharp as the other axis
+    struct MTRipChain* ripChains[MT_MAX_RIP_SHIFT];
+    struct Vector3 uRateOffset;
+    struct Vector3 uRateStep;
+    struct Vector3 vRateOffset;
+    struct Vector3 vRateStep;
+};
+
+// the tiles of a layer found by megatextureFindRowRanges split between the
+// layer and its rip layers. Level k draws what is squashed 1 << k times
+struct MTRipRanges {
+    // level 0 is the layer itself
+    u8 layers[MT_MAX_RIP_SHIFT + 1];
+    u8 levelCount;
+    // each row of a level has two ranges, one on either
+    // side of the tiles drawn by the next level
+    struct MTRowRange* ranges[MT_MAX_RIP_SHIFT + 1][2];
+    // ranges of the tiles each level and the levels after it draw
+    struct MTRowRange* spans[MT_MAX_RIP_SHIFT + 1];
+};
+
+// the layer depths a megatexture was last drawn with. Each only follows
+// the depth worked out for the frame once that has moved more than
+// MT_LOD_DEPTH_BAND away from it, staying that far behind, and for
+// MT_LOD_MIN_DWELL frames after moving only once it is more than
+// MT_LOD_DWELL_BAND away. Otherwise tiles
+// near a layer depth flip between layers every time the lod bias or the
+// camera moves a little, each flip costing a dma and evicting another
+// tile. With gMtRowLod clear these are the depths of the clipping planes
+struct MTLodState {
+    float layerDepths[MT_MAX_LOD];
+    // the frame each layer depth last moved, see gMtLodFrame
+    u16 movedFrames[MT_MAX_LOD];
+    u8 isSet;
+};
+
 extern float gMtLodBias;
 extern float gMtMinLoadBias;
+// when zero every row loads its vertices from the start of their
+// window instead of reusing vertices loaded by the row before
+extern int gMtShareVertexWindows;
+// when zero each layer is drawn between planes parallel to the camera
+// placed from a few samples instead of choosing the tiles of each row
+// with megatextureDetermineRowLod
+extern int gMtRowLod;
+// when zero tiles change layer as soon as they cross a layer depth
+extern int gMtLodHysteresis;
+// counts the frames drawn, see MTLodState
+extern u16 gMtLodFrame;
+// when zero rip layers are never drawn
+extern int gMtRipMaps;
+
+// places the clipping planes between layers, they are held by lodState
+// like the layer depths of megatextureDetermineRowLod. lodState may be NULL
+void megatextureDetermineMipLevels(struct MTUVBasis* uvBasis, float worldPixelWidth, struct MTCullingLoop* cullingLoop, struct CameraMatrixInfo* cameraInfo, struct MTLodState* lodState, int mipPlaneCount, float* mipPlanesOut, int* minLodOut, int* maxLodOut);
+// fills rowLod for the part of index inside cullingLoop and returns the
+// coarsest layer it needs. Finer layers are needed for as long as
+// megatextureFindRowRanges says so. The layer depths are held by lodState
+// and it is updated with the ones used, lodState may be NULL
+int megatextureDetermineRowLod(struct MTTileIndex* index, struct MTCullingLoop* cullingLoop, struct CameraMatrixInfo* cameraInfo, struct MTLodState* lodState, struct MTRowLod* rowLod);
+// the lod state of index if it is one of the megatextures
+// passed to megatexturesInit, NULL otherwise
+struct MTLodState* megatextureLodState(struct MTTileIndex* index);
+// copies the lod state of index so it can be held without changing it
+void megatextureCopyLodState(struct MTTileIndex* index, struct MTLodState* lodState);
+// finds the tiles of each row of a layer inside currentLoop, rowRanges has
+// one range for each row from meshLayer->minTileY. If rowLod is set only
+// the tiles that should be drawn with this layer are kept. Returns 1 if
+// tiles were left out for needing a finer layer
+int megatextureFindRowRanges(struct MTTileIndex* index, int layerIndex, struct MTCullingLoop* currentLoop, struct MTRowLod* rowLod, struct MTRowRange* rowRanges);
+// splits the rowRanges megatextureFindRowRanges found for layerIndex into
+// the tiles drawn by each rip level. The ranges are allocated with
+// stackMalloc, free them with megatextureFreeRipRanges
+void megatextureSplitRipRanges(struct MTTileIndex* index, int layerIndex, struct MTRowLod* rowLod, struct MTRowRange* rowRanges, struct MTRipRanges* ripRanges);
+void megatextureFreeRipRanges(struct MTRipRanges* ripRanges);
+int mtIsBackFacing(struct CameraMatrixInfo* cameraInfo, struct MTUVBasis* basis);
 
 void megatextureRenderStart(struct MTTileCache* tileCache);
+// draws the tiles from minX up to maxX of a row from meshRows. window is
+// what the rows drawn before left in the vertex cache and is updated for
+// the next row
+void megatextureRenderRow(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTMeshRows* meshRows, int row, int minX, int maxX, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState, struct MTVertexWindow* window);
+// draws each row of a layer from meshLayer->minTileY up to
+// meshLayer->maxTileY, rowRanges has one range for each. Rows of a
+// streamed layer whose mesh is still being read are drawn with the
+// next coarser layer
+void megatextureRenderRows(struct MTTileCache* tileCache, struct MTTileIndex* index, int layerIndex, struct MTRowRange* rowRanges, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState);
 int megatextureRender(struct MTTileCache* tileCache, struct MTTileIndex* index, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState);
 void megatexturePreload(struct MTTileCache* tileCache, struct MTTileIndex* index, int minTileAxisTileCount);
-void megatextureRenderEnd(struct MTTileCache* tileCache, int success);
+// preloads the coarsest layer of the megatextures in visibleSet, then the
+// layers megatexturePreload pins for the ones in inViewSet. Either set may
+// be NULL to preload every megatexture, see MT_IS_IN_VISIBLE_SET
+void megatexturesPreloadAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, u32* visibleSet, u32* inViewSet, int minTileAxisTileCount);
+
+// residency sets keep tiles loaded until they are unpinned. Pinned tiles
+// share the tile cache with streamed tiles but are limited to
+// tileCache->pinnedTileLimit. Each returns 0 once that limit is reached
+
+// pins every tile in layers with at most minTileAxisTileCount tiles on a side
+int megatexturePinLayers(struct MTTileCache* tileCache, struct MTTileIndex* index, int minTileAxisTileCount, int setIndex);
+int megatexturesPinSortGroup(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, int sortGroup, int minTileAxisTileCount, int setIndex);
+// pins the tiles at lod within radius of point, such as around a spawn point
+int megatexturePinAround(struct MTTileCache* tileCache, struct MTTileIndex* index, struct Vector3* point, float radius, int lod, int setIndex);
+int megatexturesPinAround(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, struct Vector3* point, float radius, int lod, int setIndex);
+void megatexturesUnpin(struct MTTileCache* tileCache, int setIndex);
+// renderState is used to measure display list use and may be NULL
+void megatextureRenderEnd(struct MTTileCache* tileCache, struct RenderState* renderState, int success);
+
+// visibleSet has a bit for each index that may be seen from the camera,
+// the rest are skipped. A NULL set has every index visible
+#define MT_IS_IN_VISIBLE_SET(visibleSet, index)    (!(visibleSet) || ((visibleSet)[(index) >> 5] & (1u << ((index) & 31))))
+
+// allocates what drawing the count megatextures of a level needs,
+// call it once the level is loaded
+void megatexturesInit(struct MTTileIndex* index, int count);
 
-int megatexturesRenderAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, struct CameraMatrixInfo* cameraInfo, struct RenderState* renderState);
+// draws in the order of bspNodes if the level has them, otherwise
+// by sortGroup then by distance from the camera
+int megatexturesRenderAll(struct MTTileCache* tileCache, struct MTTileIndex* index, int count, struct MTBspNode* bspNodes, u32* visibleSet, struct CameraMatrixInfo* cameraInfo, struct CameraMatrixInfo* predictedCameraInfo, u32* predictedVisibleSet, struct RenderState* renderState);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "megatexture_row_cache.h"
+
+#include "../util/memory.h"
+
+#define LARGE_PRIME_NUMBER  1160939981
+
+// a row drawn last frame may still be read by the rdp
+#define MT_ROW_SLOT_IN_FLIGHT(rowCache, slot)   ((u16)((rowCache)->currentFrame - (slot)->lastUsedFrame) < 2)
+
+struct MTRowCache gMtRowCache;
+
+#define MT_ROW_HASH(index, layer, row) ((LARGE_PRIME_NUMBER * ((u32)(index) + ((layer) << 8) + (row))) >> 24 & (MT_ROW_CACHE_HASH_SIZE - 1))
+
+void mtRowCacheInit(struct MTRowCache* rowCache) {
+    rowCache->slots = malloc(sizeof(struct MTRowCacheSlot) * MT_ROW_CACHE_SLOT_COUNT);
+    rowCache->displayLists = malloc(sizeof(Gfx) * MT_ROW_CACHE_SLOT_GFX * MT_ROW_CACHE_SLOT_COUNT);
+    rowCache->currentFrame = 0;
+
+    for (int i = 0; i < MT_ROW_CACHE_SLOT_COUNT; ++i) {
+        // never used so it can be taken right away
+        rowCache->slots[i].lastUsedFrame = rowCache->currentFrame - 0x8000;
+    }
+
+    mtRowCacheInvalidate(rowCache);
+    mtRowCacheStartFrame(rowCache);
+}
+
+void mtRowCacheStartFrame(struct MTRowCache* rowCache) {
+    ++rowCache->currentFrame;
+    rowCache->hitCount = 0;
+    rowCache->missCount = 0;
+    rowCache->invalidatedCount = 0;
+}
+
+void mtRowCacheInvalidate(struct MTRowCache* rowCache) {
+    for (int i = 0; i < MT_ROW_CACHE_HASH_SIZE; ++i) {
+        rowCache->hashTable[i] = MT_ROW_CACHE_NO_SLOT;
+    }
+
+    for (int i = 0; i < MT_ROW_CACHE_SLOT_COUNT; ++i) {
+        rowCache->slots[i].nextHashSlot = MT_ROW_CACHE_NO_SLOT;
+        rowCache->slots[i].hashIndex = MT_ROW_CACHE_NO_SLOT;
+    }
+}
+
+int mtRowCacheSearch(struct MTRowCache* rowCache, struct MTTileIndex* index, int layer, int row) {
+    int slotIndex = rowCache->hashTable[MT_ROW_HASH(index, layer, row)];
+
+    while (slotIndex != MT_ROW_CACHE_NO_SLOT) {
+        struct MTRowCacheSlot* slot = &rowCache->slots[slotIndex];
+
+        if (slot->index == index && slot->layer == layer && slot->row == row) {
+            return slotIndex;
+        }
+
+        slotIndex = slot->nextHashSlot;
+    }
+
+    return MT_ROW_CACHE_NO_SLOT;
+}
+
+static int mtVertexWindowEqual(struct MTVertexWindow* a, struct MTVertexWindow* b) {
+    return a->start == b->start && a->loadedStart == b->loadedStart && a->loadedEnd == b->loadedEnd && a->aheadEnd == b->aheadEnd;
+}
+
+void mtRowCacheUnlink(struct MTRowCache* rowCache, int slotIndex) {
+    struct MTRowCacheSlot* slot = &rowCache->slots[slotIndex];
+
+    if (slot->hashIndex == MT_ROW_CACHE_NO_SLOT) {
+        return;
+    }
+
+    u8* prev = &rowCache->hashTable[slot->hashIndex];
+
+    while (*prev != slotIndex) {
+        prev = &rowCache->slots[*prev].nextHashSlot;
+    }
+
+    *prev = slot->nextHashSlot;
+    slot->nextHashSlot = MT_ROW_CACHE_NO_SLOT;
+    slot->hashIndex = MT_ROW_CACHE_NO_SLOT;
+}
+
+Gfx* mtRowCacheFind(struct MTRowCache* rowCache, struct MTTileIndex* index, int layer, int row, int minX, int maxX, int meshSlot, u32* tileKeys, u8* vertexSlots, int tileCount, struct MTVertexWindow* window) {
+    int slotIndex = mtRowCacheSearch(rowCache, index, layer, row);
+
+    if (slotIndex == MT_ROW_CACHE_NO_SLOT) {
+        ++rowCache->missCount;
+        return NULL;
+    }
+
+    struct MTRowCacheSlot* slot = &rowCache->slots[slotIndex];
+    // a block read into another slot leaves the old commands
+    // pointing at whatever replaced it
+    int matches = slot->minX == minX && slot->maxX == maxX && slot->tileCount == tileCount && slot->meshSlot == meshSlot &&
+        mtVertexWindowEqual(&slot->windowIn, window);
+
+    for (int i = 0; matches && i < tileCount; ++i) {
+        matches = slot->tileKeys[i] == tileKeys[i] && slot->vertexSlots[i] == vertexSlots[i];
+    }
+
+    if (!matches) {
+        ++rowCache->missCount;
+        ++rowCache->invalidatedCount;
+        return NULL;
+    }
+
+    ++rowCache->hitCount;
+    slot->lastUsedFrame = rowCache->currentFrame;
+    *window = slot->windowOut;
+    return &rowCache->displayLists[slotIndex * MT_ROW_CACHE_SLOT_GFX];
+}
+
+void mtRowCacheStore(struct MTRowCache* rowCache, struct MTTileIndex* index, int layer, int row, int minX, int maxX, int meshSlot, u32* tileKeys, u8* vertexSlots, int tileCount, struct MTVertexWindow* windowIn, struct MTVertexWindow* windowOut, Gfx* dl, int dlLength) {
+    // leave room for the end command
+    if (dlLength + 1 > MT_ROW_CACHE_SLOT_GFX || tileCount > MT_ROW_CACHE_MAX_TILES) {
+        return;
+    }
+
+    int existing = mtRowCacheSearch(rowCache, index, layer, row);
+
+    if (existing != MT_ROW_CACHE_NO_SLOT) {
+        // the old commands are left alone in case the
+        // rdp is still using them and the slot ages out
+        mtRowCacheUnlink(rowCache, existing);
+    }
+
+    int slotIndex = MT_ROW_CACHE_NO_SLOT;
+    u16 oldestAge = 0;
+
+    for (int i = 0; i < MT_ROW_CACHE_SLOT_COUNT; ++i) {
+        struct MTRowCacheSlot* slot = &rowCache->slots[i];
+        u16 age = rowCache->currentFrame - slot->lastUsedFrame;
+
+        if (!MT_ROW_SLOT_IN_FLIGHT(rowCache, slot) && age > oldestAge) {
+            slotIndex = i;
+            oldestAge = age;
+        }
+    }
+
+    if (slotIndex == MT_ROW_CACHE_NO_SLOT) {
+        return;
+    }
+
+    mtRowCacheUnlink(rowCache, slotIndex);
+
+    struct MTRowCacheSlot* slot = &rowCache->slots[slotIndex];
+    slot->index = index;
+    slot->layer = layer;
+    slot->row = row;
+    slot->minX = minX;
+    slot->maxX = maxX;
+    slot->tileCount = tileCount;
+    slot->meshSlot = meshSlot;
+    slot->windowIn = *windowIn;
+    slot->windowOut = *windowOut;
+    // this frame drew the row inline so the slot isn't in flight
+    // but it shouldn't be handed out again right away either
+    slot->lastUsedFrame = rowCache->currentFrame;
+
+    for (int i = 0; i < tileCount; ++i) {
+        slot->tileKeys[i] = tileKeys[i];
+        slot->vertexSlots[i] = vertexSlots[i];
+    }
+
+    Gfx* slotDl = &rowCache->displayLists[slotIndex * MT_ROW_CACHE_SLOT_GFX];
+    memCopy(slotDl, dl, sizeof(Gfx) * dlLength);
+    gSPEndDisplayList(&slotDl[dlLength]);
+    osWritebackDCache(slotDl, sizeof(Gfx) * (dlLength + 1));
+
+    int hashIndex = MT_ROW_HASH(index, layer, row);
+    slot->hashIndex = hashIndex;
+    slot->nextHashSlot = rowCache->hashTable[hashIndex];
+    rowCache->hashTable[hashIndex] = slotIndex;
+}
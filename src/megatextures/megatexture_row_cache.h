@@ -0,0 +1,85 @@
+#ifndef __MEGATEXTURE_ROW_CACHE_H__
+#define __MEGATEXTURE_ROW_CACHE_H__
+
+#include <ultra64.h>
+#include "tile_index.h"
+#include "megatexture_tilecache.h"
+
+// rows of a megatexture layer usually draw the same tiles frame after
+// frame. Once built the commands for a row are kept and reused as long
+// as the row covers the same tiles, each tile is drawn with the same
+// tile loader and vertices built in the same slot of gMtVertexCache and
+// the vertex cache is in the same state at the start of the row
+
+#define MT_ROW_CACHE_SLOT_COUNT     64
+// rows longer than this aren't cached
+#define MT_ROW_CACHE_SLOT_GFX       96
+#define MT_ROW_CACHE_MAX_TILES      32
+#define MT_ROW_CACHE_HASH_SIZE      128
+#define MT_ROW_CACHE_NO_SLOT        0xFF
+
+#define MT_NO_VERTEX_WINDOW         0xFFFF
+
+// the vertices of a mesh layer in the vertex cache. Vertices are always
+// loaded at their offset from the start of their window so the baked
+// triangles work no matter which part of the window was loaded
+struct MTVertexWindow {
+    // MT_NO_VERTEX_WINDOW if nothing usable is loaded
+    u16 start;
+    u16 loadedStart;
+    u16 loadedEnd;
+    // set before each row, the end of the vertices the rows after it
+    // will need from the window. The last load of the row is extended
+    // up to here so those rows don't have to start their own
+    u16 aheadEnd;
+};
+
+struct MTRowCacheSlot {
+    struct MTTileIndex* index;
+    u8 layer;
+    u8 row;
+    u8 minX;
+    u8 maxX;
+    u8 tileCount;
+    u8 nextHashSlot;
+    // MT_ROW_CACHE_NO_SLOT if the slot isn't in the hash table
+    u8 hashIndex;
+    // the mesh cache slot the triangles are drawn from
+    u8 meshSlot;
+    u16 lastUsedFrame;
+    // the vertex cache before and after the row is drawn
+    struct MTVertexWindow windowIn;
+    struct MTVertexWindow windowOut;
+    u32 tileKeys[MT_ROW_CACHE_MAX_TILES];
+    u8 vertexSlots[MT_ROW_CACHE_MAX_TILES];
+};
+
+struct MTRowCache {
+    struct MTRowCacheSlot* slots;
+    Gfx* displayLists;
+    u8 hashTable[MT_ROW_CACHE_HASH_SIZE];
+    u16 currentFrame;
+    // rows drawn from the cache this frame
+    u16 hitCount;
+    // rows built this frame
+    u16 missCount;
+    // misses for a row that was cached but had changed
+    u16 invalidatedCount;
+};
+
+// the renderer only caches rows once this has been initialized
+extern struct MTRowCache gMtRowCache;
+
+void mtRowCacheInit(struct MTRowCache* rowCache);
+void mtRowCacheStartFrame(struct MTRowCache* rowCache);
+// forgets every row, needed if the tile cache is reset
+void mtRowCacheInvalidate(struct MTRowCache* rowCache);
+// returns the display list for the row or NULL if it has to be built.
+// On a hit window is updated to what the row leaves in the vertex cache.
+// meshSlot is the mesh cache slot of the row, MT_MESH_CACHE_NO_SLOT if
+// the layer isn't streamed
+Gfx* mtRowCacheFind(struct MTRowCache* rowCache, struct MTTileIndex* index, int layer, int row, int minX, int maxX, int meshSlot, u32* tileKeys, u8* vertexSlots, int tileCount, struct MTVertexWindow* window);
+// keeps a copy of the commands for a row that was just built
+void mtRowCacheStore(struct MTRowCache* rowCache, struct MTTileIndex* index, int layer, int row, int minX, int maxX, int meshSlot, u32* tileKeys, u8* vertexSlots, int tileCount, struct MTVertexWindow* windowIn, struct MTVertexWindow* windowOut, Gfx* dl, int dlLength);
+
+#endif
@@ -0,0 +1,25 @@
+#include "megatexture_tile_codec.h"
+
+void mtTileDecompress(u16* output, u16* input) {
+    u16* outputEnd = output + MT_TILE_PIXEL_COUNT;
+
+    while (output < outputEnd) {
+        u16 command = *input++;
+
+        if (command & MT_TILE_CODEC_MATCH) {
+            int length = ((command >> MT_TILE_CODEC_LENGTH_SHIFT) & MT_TILE_CODEC_LENGTH_MASK) + MT_TILE_CODEC_MIN_MATCH;
+            u16* from = output - (command & MT_TILE_CODEC_DISTANCE_MASK) - 1;
+
+            // the source can overlap the output to repeat a run
+            while (length--) {
+                *output++ = *from++;
+            }
+        } else {
+            // the input is always at or ahead of the
+            // output so expanding in place is safe
+            while (command--) {
+                *output++ = *input++;
+            }
+        }
+    }
+}
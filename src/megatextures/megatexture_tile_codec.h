@@ -0,0 +1,27 @@
+#ifndef __MEGATEXTURE_TILE_CODEC_H__
+#define __MEGATEXTURE_TILE_CODEC_H__
+
+#include <ultra64.h>
+
+// Compressed tiles are a stream of 16 bit commands that
+// expand to the 32x32 16 bit pixels of a tile
+//
+//   0LLLLLLLLLLLLLLL   copy the next L pixels from the stream, L can be 0
+//   1LLLLLDDDDDDDDDD   repeat L + 2 pixels starting D + 1 pixels back
+//
+// The exporter (tools/export_level/megatexture.lua) pads the stream
+// at the front with zero commands to a multiple of 8 bytes and only
+// compresses a tile if it can be expanded in place when placed at
+// the end of its slot in the tile cache
+
+#define MT_TILE_PIXEL_COUNT         (32 * 32)
+
+#define MT_TILE_CODEC_MATCH         0x8000
+#define MT_TILE_CODEC_MIN_MATCH     2
+#define MT_TILE_CODEC_LENGTH_SHIFT  10
+#define MT_TILE_CODEC_LENGTH_MASK   0x1F
+#define MT_TILE_CODEC_DISTANCE_MASK 0x3FF
+
+void mtTileDecompress(u16* output, u16* input);
+
+#endif
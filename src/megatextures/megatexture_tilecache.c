@@ -1,88 +1,360 @@
 #include "megatexture_tilecache.h"
 
+#include "./megatexture_tile_codec.h"
 #include "../util/memory.h"
 
 #define LARGE_PRIME_NUMBER  1160939981
 
 int gMtMaxTileRequestsPerFrame = 56;
-
-Gfx mtNopDisplayList[] = {gsSPEndDisplayList()};
-
-#define MT_IS_ENTRY_PRELOADED(entry)        ((entry)->newerTile == MT_NO_TILE_INDEX && (entry)->olderTile == MT_NO_TILE_INDEX)
-
-void mtTileCacheBuildTileLoader(struct MTTileCache* tileCache, int entryIndex) {
+int gMtCoalesceTileLoads = 1;
+int gMtScheduleTileRequests = 1;
+
+// used this frame or last frame
+#define MT_IS_ENTRY_IN_USE(tileCache, entry)    ((u16)((tileCache)->currentFrame - (entry)->lastUsedFrame) < 2)
+// a dma may still be writing to a pending tile
+#define MT_CAN_EVICT_ENTRY(tileCache, entry)    (!MT_IS_ENTRY_IN_USE(tileCache, entry) && !((entry)->flags & MT_TILE_FLAGS_PENDING))
+#define MT_ENTRY_DATA(tileCache, entryIndex)    (&(tileCache)->tileData[(entryIndex) * MT_HALF_TILE_WORDS])
+// the entries a tile takes up, 2 for a full tile
+#define MT_ENTRY_HALVES(tileCache, entryIndex)  (((tileCache)->entries[(entryIndex) | 1].flags & MT_TILE_FLAGS_TAIL) ? 2 : 1)
+
+// prefetching won't replace a tile used more recently than this
+#define MT_PREFETCH_MIN_IDLE_FRAMES             8
+// entries checked from the old end of a list for a slot where both
+// halves can be evicted to make room for a full tile
+#define MT_MAX_EVICTION_SEARCH                  8
+
+// tiles are at least 8 byte aligned so the first 3 bits will always be
+// zero. Multiplying by an odd number scrambles the address without
+// losing any bits, the top bits then pick the hash slot so tiles at
+// aligned addresses still spread over the whole table
+#define MT_HASH_KEY(romAddress)                 (LARGE_PRIME_NUMBER * ((u32)(romAddress) >> 3))
+#define MT_HASH(tileCache, romAddress)          (MT_HASH_KEY(romAddress) >> (tileCache)->hashTableShift)
+// the bits of the key picking the hash slot are implied by the hash
+// index so the tag is made of the 16 bits just below them
+#define MT_ROM_TAG(tileCache, romAddress)       ((u16)(MT_HASH_KEY(romAddress) >> ((tileCache)->hashTableShift - 16)))
+#define MT_NO_ROM_TAG                           0
+
+// added to the importance of a candidate for each lod between
+// it and the tile drawn in its place and each frame it has waited
+#define MT_LOD_GAP_IMPORTANCE                   32
+#define MT_WAIT_IMPORTANCE                      8
+#define MT_MAX_WAIT_FRAMES                      16
+
+void mtTileCacheListPushNewest(struct MTTileCache* tileCache, int listIndex, int entryIndex);
+
+struct MTTileFormatInfo {
+    u8 format;
+    u8 size;
+    // 8 byte words per row of texels
+    u8 line;
+    // texels are loaded as 16 bit values with load block
+    u16 loadTexels;
+    u16 dxt;
+    u16 texelBytes;
+};
+
+static struct MTTileFormatInfo gMtTileFormats[MTTileFormatCount] = {
+    [MTTileFormatRGBA16] = {G_IM_FMT_RGBA, G_IM_SIZ_16b, 8, 1024, 256, MT_TILE_SIZE},
+    [MTTileFormatCI8] = {G_IM_FMT_CI, G_IM_SIZ_8b, 4, 512, 512, MT_TILE_SIZE / 2},
+    [MTTileFormatCI4] = {G_IM_FMT_CI, G_IM_SIZ_4b, 2, 256, 1024, MT_TILE_SIZE / 4},
+    [MTTileFormatIA8] = {G_IM_FMT_IA, G_IM_SIZ_8b, 4, 512, 512, MT_TILE_SIZE / 2},
+    [MTTileFormatI4] = {G_IM_FMT_I, G_IM_SIZ_4b, 2, 256, 1024, MT_TILE_SIZE / 4},
+};
+
+#define MT_TILE_IS_COMPRESSED(format, size)     ((format) == MTTileFormatRGBA16 && (size) < MT_TILE_SIZE)
+
+Gfx* mtTileCacheSetupTile(Gfx* dl, int x, int y, int shifts, int format);
+
+// the render tile is setup before the load so its position can
+// be changed without knowing how long the rest of the loader is
+void mtTileCacheBuildTileLoader(struct MTTileCache* tileCache, int entryIndex, int size) {
     Gfx* dl = &tileCache->tileLoaders[entryIndex * MT_GFX_SIZE];
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+    struct MTTileFormatInfo* info = &gMtTileFormats[entry->format];
+    u64* tileData = MT_ENTRY_DATA(tileCache, entryIndex);
+
     // call this before using the display list
     gDPPipeSync(dl++);
     gDPTileSync(dl++);
-    gDPSetTextureImage(dl++, G_IM_FMT_RGBA, G_IM_SIZ_16b_LOAD_BLOCK, 1, &tileCache->tileData[entryIndex * MT_TILE_WORDS]);
-    gDPSetTile(dl++, G_IM_FMT_RGBA, G_IM_SIZ_16b_LOAD_BLOCK, 0, 0, G_TX_LOADTILE, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, 0);
+    dl = mtTileCacheSetupTile(dl, entry->loaderX, entry->loaderY, entry->loaderShifts, entry->format);
+
+    if (info->format == G_IM_FMT_CI) {
+        // the palette follows the texels
+        int colorCount = (size - info->texelBytes) >> 1;
+        gDPSetTextureLUT(dl++, G_TT_RGBA16);
+        gDPSetTextureImage(dl++, G_IM_FMT_RGBA, G_IM_SIZ_16b, 1, (u8*)tileData + info->texelBytes);
+        gDPSetTile(dl++, 0, 0, 0, MT_TLUT_TMEM, G_TX_LOADTILE, 0, 0, 0, 0, 0, 0, 0);
+        gDPLoadSync(dl++);
+        gDPLoadTLUTCmd(dl++, G_TX_LOADTILE, colorCount - 1);
+        gDPPipeSync(dl++);
+    } else {
+        gDPSetTextureLUT(dl++, G_TT_NONE);
+    }
+
+    gDPSetTextureImage(dl++, info->format, G_IM_SIZ_16b_LOAD_BLOCK, 1, tileData);
+    gDPSetTile(dl++, info->format, G_IM_SIZ_16b_LOAD_BLOCK, 0, 0, G_TX_LOADTILE, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, 0);
     gDPLoadSync(dl++);
-    gDPLoadBlock(dl++, G_TX_LOADTILE, 0, 0, 1023, 256);
-    gDPPipeSync(dl++);
-    gDPSetTile(dl++, G_IM_FMT_RGBA, G_IM_SIZ_16b, 8, 0, 0, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, 0);
-    gDPSetTileSize(dl++, 0, 0, 0, 124, 124);
+    gDPLoadBlock(dl++, G_TX_LOADTILE, 0, 0, info->loadTexels - 1, info->dxt);
     gSPEndDisplayList(dl++);
+
+    osWritebackDCache(&tileCache->tileLoaders[entryIndex * MT_GFX_SIZE], sizeof(Gfx) * MT_GFX_SIZE);
 }
 
-void mtTileCacheInit(struct MTTileCache* tileCache, int entryCount) {
+void mtTileCacheInit(struct MTTileCache* tileCache, int slotCount, enum MTTileCachePolicy policy) {
+    int entryCount = slotCount * 2;
+
     tileCache->piHandle = osCartRomInit();
     tileCache->entries = malloc(sizeof(struct MTTileCacheEntry) * entryCount);
-    tileCache->tileData = malloc(MT_TILE_SIZE * entryCount);
+    tileCache->tileData = malloc(MT_TILE_SIZE * slotCount);
     tileCache->tileLoaders = malloc(sizeof(Gfx) * MT_GFX_SIZE * entryCount);
-    osInvalDCache((void *)tileCache->tileData, MT_TILE_SIZE * entryCount);
-    int hashSize = 1;
+    osInvalDCache((void *)tileCache->tileData, MT_TILE_SIZE * slotCount);
+    int hashSize = 2;
+    int hashShift = 31;
 
-    while (hashSize < entryCount) {
+    // sized by slots, a cache of only small tiles averages one per
+    // bucket and a bigger table would also remember more 2Q ghosts
+    while (hashSize < slotCount * 2) {
         hashSize <<= 1;
+        --hashShift;
     }
 
-    hashSize <<= 1;
-
     tileCache->hashTable = malloc(sizeof(u16*) * hashSize);
 
     tileCache->entryCount = entryCount;
-    tileCache->hashTableMask = hashSize - 1;
+    tileCache->slotCount = slotCount;
+    tileCache->hashTableShift = hashShift;
+    tileCache->currentFrame = 0;
+    tileCache->policy = policy;
+    // the 2Q paper suggests a quarter of the cache, the
+    // lists count tiles so this is measured in full tiles
+    tileCache->recentListTarget = slotCount >> 2;
+    tileCache->ghostTags = NULL;
+
+    if (policy == MTTileCachePolicy2Q) {
+        tileCache->ghostTags = malloc(sizeof(u16) * hashSize);
+    }
 
-    tileCache->oldestUsedTile = 0;
-    tileCache->newestUsedTile = entryCount - 1;
+    tileCache->waits = malloc(sizeof(struct MTTileWait) * hashSize);
+    tileCache->pinnedTileCount = 0;
+    // leave at least half the cache for streaming
+    tileCache->pinnedTileLimit = slotCount;
+
+    for (int i = 0; i < MT_MAX_RESIDENCY_SETS; ++i) {
+        tileCache->residencySetTileCount[i] = 0;
+    }
+
+    tileCache->candidateCount = 0;
+    tileCache->candidateGroup = 0;
 
     for (int i = 0; i < hashSize; ++i) {
         tileCache->hashTable[i] = MT_NO_TILE_INDEX;
+        tileCache->waits[i].tag = MT_NO_ROM_TAG;
+        tileCache->waits[i].lastFrame = tileCache->currentFrame - 0x8000;
+
+        if (tileCache->ghostTags) {
+            tileCache->ghostTags[i] = MT_NO_ROM_TAG;
+        }
     }
 
-    for (int i = 0; i < entryCount; ++i) {
-        tileCache->entries[i].newerTile = (i == entryCount - 1) ? MT_NO_TILE_INDEX : i + 1;
-        tileCache->entries[i].olderTile = (i == 0) ? MT_NO_TILE_INDEX : i - 1;
+    for (int list = 0; list < MT_TILE_LIST_COUNT; ++list) {
+        tileCache->lists[list].oldestTile = MT_NO_TILE_INDEX;
+        tileCache->lists[list].newestTile = MT_NO_TILE_INDEX;
+        tileCache->lists[list].count = 0;
+    }
 
-        tileCache->entries[i].nextHashTile = MT_NO_TILE_INDEX;
-        tileCache->entries[i].hashTableIndex = MT_NO_TILE_INDEX;
-        tileCache->entries[i].romAddress = NULL;
+    for (int i = 0; i < entryCount; ++i) {
+        struct MTTileCacheEntry* entry = &tileCache->entries[i];
 
-        mtTileCacheBuildTileLoader(tileCache, i);
+        entry->nextHashTile = MT_NO_TILE_INDEX;
+        entry->hashTableIndex = MT_NO_TILE_INDEX;
+        entry->romAddress = NULL;
+        // never used so it can be evicted right away
+        entry->lastUsedFrame = tileCache->currentFrame - 0x8000;
+        entry->list = MT_TILE_LIST_NONE;
+        entry->flags = 0;
+        entry->loaderX = 0;
+        entry->loaderY = 0;
+        entry->loaderShifts = 0;
+        entry->pinnedSets = 0;
+        entry->format = MTTileFormatRGBA16;
+
+        mtTileCacheListPushNewest(tileCache, MT_TILE_LIST_RECENT, i);
+
+        mtTileCacheBuildTileLoader(tileCache, i, MT_HALF_TILE_SIZE);
     }
 
-    osWritebackDCache(tileCache->tileLoaders, sizeof(Gfx) * MT_GFX_SIZE * entryCount);
     osCreateMesgQueue(&tileCache->tileQueue, &tileCache->inboundMessages[0], MT_TILE_QUEUE_SIZE);
     tileCache->pendingMessages = 0;
     tileCache->nextOutboundMessage = 0;
-    tileCache->oldestTileFromFrame[0] = MT_NO_TILE_INDEX;
-    tileCache->oldestTileFromFrame[1] = MT_NO_TILE_INDEX;
+    tileCache->queuedLoadCount = 0;
+    tileCache->dmaStaging = malloc(MT_DMA_STAGING_SIZE);
+    tileCache->stagingHead = 0;
+    tileCache->stagingTail = 0;
+    tileCache->stagedMessageCount = 0;
+    tileCache->lastDmaRetireTime = 0;
+
+    mtTileCacheResetStats(tileCache);
+}
+
+void mtTileCacheStartFrame(struct MTTileCache* tileCache) {
+    ++tileCache->currentFrame;
+    tileCache->candidateCount = 0;
+    tileCache->candidateGroup = 0;
+    mtTileCacheResetStats(tileCache);
+    mtTileCachePollTiles(tileCache);
+}
+
+void mtTileCacheResetStats(struct MTTileCache* tileCache) {
     tileCache->tilesRequestedFromCart = 0;
     tileCache->totalTileRequests = 0;
     tileCache->overflowRequestCount = 0;
+    tileCache->tileHitCount = 0;
+    tileCache->evictedTileCount = 0;
+    tileCache->fallbackRequestCount = 0;
+    tileCache->missingTileCount = 0;
+    tileCache->pendingTileCount = 0;
+    tileCache->candidateTileCount = 0;
+    tileCache->bytesRequestedFromCart = 0;
+    tileCache->prefetchRequestCount = 0;
+    tileCache->prefetchUsedCount = 0;
+    tileCache->prefetchWastedCount = 0;
+    tileCache->sharedTileUseCount = 0;
+    tileCache->lodFlipCount = 0;
+    tileCache->dmaRequestCount = 0;
+    tileCache->dmaTimeUs = 0;
+
+    for (int i = 0; i < MT_TILE_REQUEST_LODS; ++i) {
+        tileCache->tileRequests[i] = 0;
+    }
 }
 
-int mtTileCacheRemoveOldestUsedTile(struct MTTileCache* tileCache) {
-    int entryIndex = tileCache->oldestUsedTile;
+int mtTileCacheEvictableCount(struct MTTileCache* tileCache, int maxCount) {
+    int result = 0;
 
-    if (entryIndex == tileCache->oldestTileFromFrame[1]) {
-        // this tile was already used this frame and
-        // there are no more availible tiles
-        ++tileCache->overflowRequestCount;
-        return MT_NO_TILE_INDEX;
+    for (int list = 0; list < MT_TILE_LIST_COUNT; ++list) {
+        int entryIndex = tileCache->lists[list].oldestTile;
+
+        // lists are sorted by use so stop at the first recent tile
+        while (entryIndex != MT_NO_TILE_INDEX && MT_CAN_EVICT_ENTRY(tileCache, &tileCache->entries[entryIndex])) {
+            ++result;
+
+            if (result == maxCount) {
+                return result;
+            }
+
+            entryIndex = tileCache->entries[entryIndex].newerTile;
+        }
     }
 
+    return result;
+}
+
+void mtTileCacheListPushNewest(struct MTTileCache* tileCache, int listIndex, int entryIndex) {
+    struct MTTileList* list = &tileCache->lists[listIndex];
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+    entry->olderTile = list->newestTile;
+    entry->newerTile = MT_NO_TILE_INDEX;
+    entry->list = listIndex;
+
+    if (list->newestTile == MT_NO_TILE_INDEX) {
+        list->oldestTile = entryIndex;
+    } else {
+        tileCache->entries[list->newestTile].newerTile = entryIndex;
+    }
+
+    list->newestTile = entryIndex;
+    ++list->count;
+}
+
+void mtTileCacheListPushOldest(struct MTTileCache* tileCache, int listIndex, int entryIndex) {
+    struct MTTileList* list = &tileCache->lists[listIndex];
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+    entry->olderTile = MT_NO_TILE_INDEX;
+    entry->newerTile = list->oldestTile;
+    entry->list = listIndex;
+
+    if (list->oldestTile == MT_NO_TILE_INDEX) {
+        list->newestTile = entryIndex;
+    } else {
+        tileCache->entries[list->oldestTile].olderTile = entryIndex;
+    }
+
+    list->oldestTile = entryIndex;
+    ++list->count;
+}
+
+void mtTileCacheListRemove(struct MTTileCache* tileCache, int entryIndex) {
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+    struct MTTileList* list = &tileCache->lists[entry->list];
+
+    if (entry->olderTile == MT_NO_TILE_INDEX) {
+        list->oldestTile = entry->newerTile;
+    } else {
+        tileCache->entries[entry->olderTile].newerTile = entry->newerTile;
+    }
+
+    if (entry->newerTile == MT_NO_TILE_INDEX) {
+        list->newestTile = entry->olderTile;
+    } else {
+        tileCache->entries[entry->newerTile].olderTile = entry->olderTile;
+    }
+
+    entry->newerTile = MT_NO_TILE_INDEX;
+    entry->olderTile = MT_NO_TILE_INDEX;
+    entry->list = MT_TILE_LIST_NONE;
+    --list->count;
+}
+
+// 2Q evicts from the frequent list once the recent list is small enough
+int mtTileCachePreferredEvictionList(struct MTTileCache* tileCache) {
+    if (tileCache->policy == MTTileCachePolicy2Q && tileCache->lists[MT_TILE_LIST_RECENT].count <= tileCache->recentListTarget) {
+        return MT_TILE_LIST_FREQUENT;
+    }
+
+    return MT_TILE_LIST_RECENT;
+}
+
+int mtTileCacheCanEvictEntry(struct MTTileCache* tileCache, int entryIndex, int minIdleFrames) {
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+    return entry->list != MT_TILE_LIST_NONE &&
+        MT_CAN_EVICT_ENTRY(tileCache, entry) &&
+        (u16)(tileCache->currentFrame - entry->lastUsedFrame) >= minIdleFrames;
+}
+
+// the entry to evict to make room for a tile or MT_NO_TILE_INDEX. A
+// full tile needs both halves of a slot and gets the first entry
+int mtTileCacheFindEviction(struct MTTileCache* tileCache, int isHalf, int minIdleFrames) {
+    int preferred = mtTileCachePreferredEvictionList(tileCache);
+
+    for (int i = 0; i < MT_TILE_LIST_COUNT; ++i) {
+        int entryIndex = tileCache->lists[i == 0 ? preferred : !preferred].oldestTile;
+
+        // lists are sorted by use so stop at the first recent tile
+        for (int searched = 0; searched < MT_MAX_EVICTION_SEARCH && entryIndex != MT_NO_TILE_INDEX; ++searched) {
+            if (!mtTileCacheCanEvictEntry(tileCache, entryIndex, minIdleFrames)) {
+                break;
+            }
+
+            if (isHalf || MT_ENTRY_HALVES(tileCache, entryIndex) == 2) {
+                return entryIndex;
+            }
+
+            if (mtTileCacheCanEvictEntry(tileCache, entryIndex ^ 1, minIdleFrames)) {
+                return entryIndex & ~1;
+            }
+
+            entryIndex = tileCache->entries[entryIndex].newerTile;
+        }
+    }
+
+    return MT_NO_TILE_INDEX;
+}
+
+// removes a tile from its list and the hash table
+void mtTileCacheEvictEntry(struct MTTileCache* tileCache, int entryIndex) {
     struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
 
     if (entry->hashTableIndex != MT_NO_TILE_INDEX) {
@@ -102,32 +374,69 @@ int mtTileCacheRemoveOldestUsedTile(struct MTTileCache* tileCache) {
             prevTile->nextHashTile = entry->nextHashTile;
         }
 
+        if (tileCache->ghostTags && entry->list == MT_TILE_LIST_RECENT) {
+            // remember the tile so it is promoted if requested again
+            tileCache->ghostTags[entry->hashTableIndex] = MT_ROM_TAG(tileCache, entry->romAddress);
+        }
+
         entry->hashTableIndex = MT_NO_TILE_INDEX;
         entry->nextHashTile = MT_NO_TILE_INDEX;
+        ++tileCache->evictedTileCount;
     }
 
-    tileCache->oldestUsedTile = entry->newerTile;
-    struct MTTileCacheEntry* nextTile = &tileCache->entries[entry->newerTile];
-    nextTile->olderTile = MT_NO_TILE_INDEX;
-    entry->newerTile = MT_NO_TILE_INDEX;
+    if (entry->flags & MT_TILE_FLAGS_PREFETCHED) {
+        ++tileCache->prefetchWastedCount;
+        entry->flags &= ~MT_TILE_FLAGS_PREFETCHED;
+    }
+
+    mtTileCacheListRemove(tileCache, entryIndex);
+}
+
+// evicts what is in the way of a tile at an entry from mtTileCacheFindEviction
+void mtTileCacheEvictFor(struct MTTileCache* tileCache, int entryIndex, int isHalf) {
+    struct MTTileCacheEntry* tail = &tileCache->entries[entryIndex | 1];
+    int wasFull = tail->flags & MT_TILE_FLAGS_TAIL;
+
+    mtTileCacheEvictEntry(tileCache, entryIndex);
+
+    if (isHalf && wasFull) {
+        // the other half is free for the next small tile
+        tail->flags &= ~MT_TILE_FLAGS_TAIL;
+        tail->lastUsedFrame = tileCache->currentFrame - 0x8000;
+        mtTileCacheListPushOldest(tileCache, MT_TILE_LIST_RECENT, entryIndex | 1);
+    } else if (!isHalf && !wasFull) {
+        mtTileCacheEvictEntry(tileCache, entryIndex | 1);
+        tail->flags |= MT_TILE_FLAGS_TAIL;
+    }
+}
+
+int mtTileCacheRemoveOldestUsedTile(struct MTTileCache* tileCache, int isHalf) {
+    int entryIndex = mtTileCacheFindEviction(tileCache, isHalf, 0);
+
+    if (entryIndex == MT_NO_TILE_INDEX) {
+        // every tile was already used this frame or
+        // last frame and there are no more availible tiles
+        ++tileCache->overflowRequestCount;
+        return MT_NO_TILE_INDEX;
+    }
+
+    mtTileCacheEvictFor(tileCache, entryIndex, isHalf);
 
     return entryIndex;
 }
 
-void mtTileCacheAdd(struct MTTileCache* tileCache, int entryIndex, int hashIndex) {
-    struct MTTileCacheEntry* prevTile = &tileCache->entries[tileCache->newestUsedTile];
+void mtTileCacheAdd(struct MTTileCache* tileCache, int entryIndex, int hashIndex, void* romAddress) {
     struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+    int listIndex = MT_TILE_LIST_RECENT;
 
-    if (tileCache->oldestTileFromFrame[0] == MT_NO_TILE_INDEX) {
-        // mark this as the first tile used ths frame
-        tileCache->oldestTileFromFrame[0] = entryIndex;
+    if (tileCache->ghostTags && tileCache->ghostTags[hashIndex] == MT_ROM_TAG(tileCache, romAddress)) {
+        // the tile was evicted and is needed again
+        tileCache->ghostTags[hashIndex] = MT_NO_ROM_TAG;
+        listIndex = MT_TILE_LIST_FREQUENT;
     }
 
-    entry->olderTile = tileCache->newestUsedTile;
-    entry->newerTile = MT_NO_TILE_INDEX;
-
-    prevTile->newerTile = entryIndex;
-    tileCache->newestUsedTile = entryIndex;
+    entry->lastUsedFrame = tileCache->currentFrame;
+    mtTileCacheListPushNewest(tileCache, listIndex, entryIndex);
 
     entry->nextHashTile = tileCache->hashTable[hashIndex];
     entry->hashTableIndex = hashIndex;
@@ -137,196 +446,879 @@ void mtTileCacheAdd(struct MTTileCache* tileCache, int entryIndex, int hashIndex
 void mtTileCacheMarkMostRecent(struct MTTileCache* tileCache, int entryIndex) {
     struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
 
-    if (entry->newerTile == MT_NO_TILE_INDEX) {
-        // already newest tile or this tile is permanantly loaded
+    if (entry->list == MT_TILE_LIST_NONE) {
+        // this tile is permanantly loaded
         return;
     }
 
-    // keep track of which tile is the oldest tile used this frame
-    if (entryIndex == tileCache->oldestTileFromFrame[0]) {
-        tileCache->oldestTileFromFrame[0] = entry->newerTile;
+    int listIndex = entry->list;
+
+    if (listIndex == MT_TILE_LIST_RECENT && tileCache->ghostTags && !MT_IS_ENTRY_IN_USE(tileCache, entry) && !(entry->flags & MT_TILE_FLAGS_PREFETCHED)) {
+        // used again after going unused for a frame. Tiles a sweeping
+        // camera sees once never get here, even when they were
+        // prefetched since that isn't a use
+        listIndex = MT_TILE_LIST_FREQUENT;
+    }
+
+    entry->lastUsedFrame = tileCache->currentFrame;
+
+    if (listIndex == entry->list && entry->newerTile == MT_NO_TILE_INDEX) {
+        // already newest tile
+        return;
     }
-    if (entryIndex == tileCache->oldestTileFromFrame[1]) {
-        tileCache->oldestTileFromFrame[1] = entry->newerTile;
+
+    mtTileCacheListRemove(tileCache, entryIndex);
+    mtTileCacheListPushNewest(tileCache, listIndex, entryIndex);
+}
+
+void mtTileCacheRetireMessage(struct MTTileCache* tileCache, OSMesg message) {
+    int messageIndex = (OSIoMesg*)message - tileCache->outboundMessages;
+    struct MTTileDma* dma = &tileCache->dmas[messageIndex];
+    OSIoMesg* dmaIoMesgBuf = &tileCache->outboundMessages[messageIndex];
+
+    --tileCache->pendingMessages;
+
+    // the pi works through dmas in order so it was busy from
+    // when this dma started or the last one finished until now
+    OSTime now = osGetTime();
+    OSTime busyStart = MAX(dma->startTime, tileCache->lastDmaRetireTime);
+    tileCache->dmaTimeUs += OS_CYCLES_TO_USEC(now - busyStart);
+    tileCache->lastDmaRetireTime = now;
+
+    if (dma->tileCount == 0) {
+        *dma->readFlags &= ~MT_TILE_FLAGS_PENDING;
+        return;
     }
-    
-    if (tileCache->oldestTileFromFrame[0] == MT_NO_TILE_INDEX) {
-        tileCache->oldestTileFromFrame[0] = entryIndex;
+
+    for (int i = 0; i < dma->tileCount; ++i) {
+        tileCache->entries[dma->entries[i]].flags &= ~MT_TILE_FLAGS_PENDING;
     }
 
-    // remove from linked list
-    struct MTTileCacheEntry* newerTile = &tileCache->entries[entry->newerTile];
+    if (dma->stagingEnd == MT_DMA_NOT_STAGED) {
+        if (MT_TILE_IS_COMPRESSED(tileCache->entries[dma->entries[0]].format, dma->sizes[0])) {
+            u64* tileData = MT_ENTRY_DATA(tileCache, dma->entries[0]);
+            mtTileDecompress((u16*)tileData, (u16*)dmaIoMesgBuf->dramAddr);
+            osWritebackDCache(tileData, MT_TILE_SIZE);
+        }
 
-    if (entry->olderTile == MT_NO_TILE_INDEX) {
-        tileCache->oldestUsedTile = entry->newerTile;
-        newerTile->olderTile = MT_NO_TILE_INDEX;
-    } else {
-        struct MTTileCacheEntry* olderTile = &tileCache->entries[entry->olderTile];
-        olderTile->newerTile = entry->newerTile;
-        newerTile->olderTile = entry->olderTile;
+        return;
     }
 
-    // add back to the beginning
-    struct MTTileCacheEntry* newestTile = &tileCache->entries[tileCache->newestUsedTile];
-    newestTile->newerTile = entryIndex;
-    entry->olderTile = tileCache->newestUsedTile;
-    tileCache->newestUsedTile = entryIndex;
-    entry->newerTile = MT_NO_TILE_INDEX;
+    u8* source = (u8*)dmaIoMesgBuf->dramAddr;
+
+    for (int i = 0; i < dma->tileCount; ++i) {
+        u64* tileData = MT_ENTRY_DATA(tileCache, dma->entries[i]);
+
+        if (MT_TILE_IS_COMPRESSED(tileCache->entries[dma->entries[i]].format, dma->sizes[i])) {
+            mtTileDecompress((u16*)tileData, (u16*)source);
+            osWritebackDCache(tileData, MT_TILE_SIZE);
+        } else {
+            memCopy(tileData, source, dma->sizes[i]);
+            osWritebackDCache(tileData, dma->sizes[i]);
+        }
+
+        source += dma->sizes[i];
+    }
+
+    // staged dmas finish in order so the space is freed in order
+    tileCache->stagingTail = dma->stagingEnd;
+    --tileCache->stagedMessageCount;
 }
 
-void mtTileCacheRequestFromRom(struct MTTileCache* tileCache, int entryIndex, void* romAddress) {
-    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+void mtTileCacheRetireOldestMessage(struct MTTileCache* tileCache) {
+    OSMesg message;
+    (void)osRecvMesg(&tileCache->tileQueue, &message, OS_MESG_BLOCK);
+    mtTileCacheRetireMessage(tileCache, message);
+}
 
-    entry->romAddress = romAddress;
+void mtTileCachePollTiles(struct MTTileCache* tileCache) {
+    OSMesg message;
 
-    if (tileCache->pendingMessages == MT_TILE_QUEUE_SIZE) {
-        OSMesg dummyMesg;
-        (void)osRecvMesg(&tileCache->tileQueue, &dummyMesg, OS_MESG_BLOCK);
-        --tileCache->pendingMessages;
+    while (tileCache->pendingMessages > 0 && osRecvMesg(&tileCache->tileQueue, &message, OS_MESG_NOBLOCK) == 0) {
+        mtTileCacheRetireMessage(tileCache, message);
+    }
+}
+
+// returns -1 if there isn't room until more dmas finish
+int mtTileCacheAllocStaging(struct MTTileCache* tileCache, int size) {
+    if (tileCache->stagedMessageCount == 0) {
+        tileCache->stagingHead = 0;
+        tileCache->stagingTail = 0;
     }
 
-    OSIoMesg* dmaIoMesgBuf = &tileCache->outboundMessages[tileCache->nextOutboundMessage];
+    int head = tileCache->stagingHead;
+    int tail = tileCache->stagingTail;
+
+    if (head == tail && tileCache->stagedMessageCount > 0) {
+        return -1;
+    }
+
+    if (head >= tail) {
+        if (head + size <= MT_DMA_STAGING_SIZE) {
+            tileCache->stagingHead = head + size;
+            return head;
+        }
+
+        if (size <= tail) {
+            tileCache->stagingHead = size;
+            return 0;
+        }
+    } else if (head + size <= tail) {
+        tileCache->stagingHead = head + size;
+        return head;
+    }
+
+    return -1;
+}
+
+struct MTTileDma* mtTileCacheNextDma(struct MTTileCache* tileCache) {
+    struct MTTileDma* dma = &tileCache->dmas[tileCache->nextOutboundMessage];
     ++tileCache->nextOutboundMessage;
 
     if (tileCache->nextOutboundMessage == MT_TILE_QUEUE_SIZE) {
         tileCache->nextOutboundMessage = 0;
     }
 
+    return dma;
+}
+
+void mtTileCacheSendDma(struct MTTileCache* tileCache, struct MTTileDma* dma, void* romAddress, void* dramAddr, int size) {
+    OSIoMesg* dmaIoMesgBuf = &tileCache->outboundMessages[dma - tileCache->dmas];
+
     dmaIoMesgBuf->hdr.pri      = OS_MESG_PRI_NORMAL;
     dmaIoMesgBuf->hdr.retQueue = &tileCache->tileQueue;
-    dmaIoMesgBuf->dramAddr     = (void*)&tileCache->tileData[entryIndex * MT_TILE_WORDS];
+    dmaIoMesgBuf->dramAddr     = dramAddr;
     dmaIoMesgBuf->devAddr      = (u32)romAddress;
-    dmaIoMesgBuf->size         = MT_TILE_SIZE;
+    dmaIoMesgBuf->size         = size;
 
+    dma->startTime = osGetTime();
     osEPiStartDma(tileCache->piHandle, dmaIoMesgBuf, OS_READ);
     ++tileCache->pendingMessages;
+    ++tileCache->dmaRequestCount;
 }
 
-void mtTileCacheFixDisplayList(struct MTTileCache* tileCache, int entryIndex, int x, int y, int lod) {
-    Gfx* dl = &tileCache->tileLoaders[entryIndex * MT_GFX_SIZE];
+void mtTileCacheStartDma(struct MTTileCache* tileCache, struct MTQueuedLoad* loads, int loadCount, int size, int stagingOffset) {
+    struct MTTileDma* dma = mtTileCacheNextDma(tileCache);
+
+    for (int i = 0; i < loadCount; ++i) {
+        dma->entries[i] = loads[i].entryIndex;
+        dma->sizes[i] = loads[i].size;
+    }
+
+    dma->tileCount = loadCount;
+
+    void* dramAddr;
+
+    if (loadCount > 1) {
+        dramAddr = &tileCache->dmaStaging[stagingOffset];
+        osInvalDCache(dramAddr, size);
+        dma->stagingEnd = stagingOffset + size;
+        ++tileCache->stagedMessageCount;
+    } else {
+        u64* tileData = MT_ENTRY_DATA(tileCache, loads[0].entryIndex);
+
+        if (MT_TILE_IS_COMPRESSED(tileCache->entries[loads[0].entryIndex].format, size)) {
+            // compressed tiles are placed at the end of the slot
+            // and expanded in place once the dma finishes
+            tileData += (MT_TILE_SIZE - size) / sizeof(u64);
+            // the cpu may have touched this slot decoding an earlier tile
+            osInvalDCache(tileData, size);
+        }
+
+        dramAddr = tileData;
+        dma->stagingEnd = MT_DMA_NOT_STAGED;
+    }
+
+    mtTileCacheSendDma(tileCache, dma, loads[0].romAddress, dramAddr, size);
+}
+
+int mtTileCacheReadRom(struct MTTileCache* tileCache, void* romAddress, void* dramAddr, int size, u8* flags) {
+    mtTileCachePollTiles(tileCache);
+
+    if (tileCache->pendingMessages == MT_TILE_QUEUE_SIZE) {
+        return 0;
+    }
+
+    struct MTTileDma* dma = mtTileCacheNextDma(tileCache);
+    dma->tileCount = 0;
+    dma->stagingEnd = MT_DMA_NOT_STAGED;
+    dma->readFlags = flags;
+    *flags |= MT_TILE_FLAGS_PENDING;
+
+    osInvalDCache(dramAddr, size);
+    mtTileCacheSendDma(tileCache, dma, romAddress, dramAddr, size);
+
+    return 1;
+}
+
+void mtTileCacheFlushLoads(struct MTTileCache* tileCache) {
+    // frees up messages and staging space
+    mtTileCachePollTiles(tileCache);
+
+    struct MTQueuedLoad* loads = tileCache->queuedLoads;
+    int count = tileCache->queuedLoadCount;
+
+    // insertion sort, the renderer mostly requests tiles in order already
+    for (int i = 1; i < count; ++i) {
+        struct MTQueuedLoad load = loads[i];
+        int j = i;
+
+        while (j > 0 && (u32)loads[j - 1].romAddress > (u32)load.romAddress) {
+            loads[j] = loads[j - 1];
+            --j;
+        }
+
+        loads[j] = load;
+    }
+
+    int runStart = 0;
+
+    while (runStart < count && tileCache->pendingMessages < MT_TILE_QUEUE_SIZE) {
+        int runEnd = runStart + 1;
+        int runSize = loads[runStart].size;
+
+        while (gMtCoalesceTileLoads &&
+            runEnd < count &&
+            runEnd - runStart < MT_MAX_DMA_RUN_TILES &&
+            (u32)loads[runEnd - 1].romAddress + loads[runEnd - 1].size == (u32)loads[runEnd].romAddress) {
+            runSize += loads[runEnd].size;
+            ++runEnd;
+        }
 
-    dl += (MT_GFX_SIZE - 3);
+        int stagingOffset = 0;
+
+        if (runEnd - runStart > 1) {
+            stagingOffset = mtTileCacheAllocStaging(tileCache, runSize);
+
+            if (stagingOffset == -1) {
+                // read the first tile directly and try the rest later
+                runEnd = runStart + 1;
+                runSize = loads[runStart].size;
+                stagingOffset = 0;
+            }
+        }
+
+        mtTileCacheStartDma(tileCache, &loads[runStart], runEnd - runStart, runSize, stagingOffset);
+        runStart = runEnd;
+    }
+
+    // loads that didn't fit in the dma queue wait for the next flush
+    for (int i = runStart; i < count; ++i) {
+        loads[i - runStart] = loads[i];
+    }
+
+    tileCache->queuedLoadCount = count - runStart;
+}
+
+void mtTileCacheRequestFromRom(struct MTTileCache* tileCache, int entryIndex, void* romAddress, int size, int format) {
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+    entry->romAddress = romAddress;
+    // needed to place the tile when the dma starts
+    entry->format = format;
+    tileCache->bytesRequestedFromCart += size;
+
+    entry->flags |= MT_TILE_FLAGS_PENDING;
+
+    if (tileCache->queuedLoadCount == MT_MAX_QUEUED_LOADS) {
+        mtTileCacheFlushLoads(tileCache);
+
+        // only happens if the pi falls far behind
+        while (tileCache->queuedLoadCount == MT_MAX_QUEUED_LOADS) {
+            mtTileCacheRetireOldestMessage(tileCache);
+            mtTileCacheFlushLoads(tileCache);
+        }
+    }
+
+    struct MTQueuedLoad* load = &tileCache->queuedLoads[tileCache->queuedLoadCount];
+    load->romAddress = romAddress;
+    load->entryIndex = entryIndex;
+    load->size = size;
+    ++tileCache->queuedLoadCount;
+
+    if (!gMtCoalesceTileLoads || tileCache->queuedLoadCount == MT_MAX_QUEUED_LOADS) {
+        mtTileCacheFlushLoads(tileCache);
+    }
+}
+
+Gfx* mtTileCacheSetupTile(Gfx* dl, int x, int y, int shifts, int format) {
+    struct MTTileFormatInfo* info = &gMtTileFormats[format];
 
     // multiply to convert tileX to pixel x, bit shift for fixed point texture coordinates
     // x = (x * 32) << 2
     x <<= 7;
     y <<= 7;
 
-    gDPSetTile(dl++, G_IM_FMT_RGBA, G_IM_SIZ_16b, 8, 0, 0, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, lod, G_TX_CLAMP | G_TX_NOMIRROR, 5, lod);
+    gDPSetTile(dl++, info->format, info->size, info->line, 0, 0, 0, G_TX_CLAMP | G_TX_NOMIRROR, 5, MT_TILE_T_SHIFT(shifts), G_TX_CLAMP | G_TX_NOMIRROR, 5, MT_TILE_S_SHIFT(shifts));
     gDPSetTileSize(dl++, 0, x, y, x + 124, y + 124);
 
-    osWritebackDCache(dl - 2, sizeof(Gfx) * 2);
+    return dl;
 }
 
-#define MT_DETERMINE_ROM_ADDRESS(imageLayer, x, y)  (&(imageLayer)->tileSource[MT_TILE_WORDS * ((x) + (y) * (imageLayer)->xTiles)])
+// rebuilds the loader for the format and position of a newly requested tile
+void mtTileCacheFixDisplayList(struct MTTileCache* tileCache, int entryIndex, int x, int y, int shifts, int size) {
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+    entry->loaderX = x;
+    entry->loaderY = y;
+    entry->loaderShifts = shifts;
+
+    mtTileCacheBuildTileLoader(tileCache, entryIndex, size);
+}
+
+u64* mtTileCacheTileAddress(struct MTImageLayer* imageLayer, int x, int y, int* size, int* format) {
+    int tileIndex = x + y * imageLayer->xTiles;
+
+    if (!imageLayer->tileOffsets) {
+        *size = MT_TILE_SIZE;
+        *format = MTTileFormatRGBA16;
+        return &imageLayer->tileSource[MT_TILE_WORDS * tileIndex];
+    }
 
-// the first 11 bits will always be zero. Shifting right leads to fewer collisions-
-#define MT_HASH(tileCache, romAddress) ((LARGE_PRIME_NUMBER * ((u32)(romAddress) >> 11)) & (tileCache)->hashTableMask)
+    u32 entry = imageLayer->tileOffsets[tileIndex];
+    *size = MT_TILE_OFFSET_ENTRY_SIZE(entry);
+    *format = MT_TILE_OFFSET_ENTRY_FORMAT(entry);
+    return (u64*)((char*)imageLayer->tileSource + MT_TILE_OFFSET_ENTRY_OFFSET(entry));
+}
 
-Gfx* mtTileCacheSearch(struct MTTileCache* tileCache, u64* romAddress, int hashIndex) {
+int mtTileCacheFind(struct MTTileCache* tileCache, u64* romAddress, int hashIndex) {
     int entryIndex = tileCache->hashTable[hashIndex];
 
     while (entryIndex != MT_NO_TILE_INDEX) {
         struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
 
         if (entry->romAddress == romAddress) {
-            mtTileCacheMarkMostRecent(tileCache, entryIndex);
-            return &tileCache->tileLoaders[entryIndex * MT_GFX_SIZE];
+            return entryIndex;
         }
 
         entryIndex = entry->nextHashTile;
     }
 
-    return NULL;
+    return MT_NO_TILE_INDEX;
+}
+
+void mtTileCacheUseEntry(struct MTTileCache* tileCache, int entryIndex) {
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+    // checks the prefetched flag so the first use keeps the tile recent
+    mtTileCacheMarkMostRecent(tileCache, entryIndex);
+
+    if (entry->flags & MT_TILE_FLAGS_PREFETCHED) {
+        ++tileCache->prefetchUsedCount;
+        entry->flags &= ~MT_TILE_FLAGS_PREFETCHED;
+    }
 }
 
-Gfx* mtTileCacheRequestTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod) {
+int mtTileCacheSearch(struct MTTileCache* tileCache, u64* romAddress, int hashIndex) {
+    int entryIndex = mtTileCacheFind(tileCache, romAddress, hashIndex);
+
+    if (entryIndex == MT_NO_TILE_INDEX) {
+        return MT_NO_TILE_INDEX;
+    }
+
+    mtTileCacheUseEntry(tileCache, entryIndex);
+
+    return entryIndex;
+}
+
+int mtTileCacheIsResident(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int* tileSize) {
+    int tileFormat;
+    u64* romAddress = mtTileCacheTileAddress(&index->imageLayers[lod], x, y, tileSize, &tileFormat);
+    return mtTileCacheFind(tileCache, romAddress, MT_HASH(tileCache, romAddress)) != MT_NO_TILE_INDEX;
+}
+
+int mtTileCacheUseNeedsSetup(struct MTTileCache* tileCache, struct MTTileUse* use) {
+    struct MTTileCacheEntry* entry = &tileCache->entries[use->entryIndex];
+    return entry->loaderX != use->x || entry->loaderY != use->y || entry->loaderShifts != use->shifts;
+}
+
+Gfx* mtTileCacheUseTile(struct MTTileCache* tileCache, struct MTTileUse* use, Gfx* dl) {
+    gSPDisplayList(dl++, &tileCache->tileLoaders[use->entryIndex * MT_GFX_SIZE]);
+
+    if (mtTileCacheUseNeedsSetup(tileCache, use)) {
+        // identical tiles share a single entry so the loader
+        // may have been setup for a different part of a texture
+        dl = mtTileCacheSetupTile(dl, use->x, use->y, use->shifts, tileCache->entries[use->entryIndex].format);
+    }
+
+    return dl;
+}
+
+u32 mtTileCacheUseKey(struct MTTileCache* tileCache, struct MTTileUse* use) {
+    if (use->entryIndex == MT_NO_TILE_INDEX) {
+        return 0xFFFFFFFF;
+    }
+
+    // the position drawn follows from the position
+    // requested and the lod so it doesn't need to be part of the key
+    return ((u32)use->entryIndex << 16) | (use->lod << 8) | mtTileCacheUseNeedsSetup(tileCache, use);
+}
+
+// searches for the first coarser tile that is ready and
+// moves x, y and lod to that tile
+int mtTileCacheFindReadyParent(struct MTTileCache* tileCache, struct MTTileIndex* index, int* x, int* y, int* lod) {
+    while (index->imageLayers[*lod].parentLayer != MT_NO_PARENT_LAYER) {
+        struct MTImageLayer* imageLayer = &index->imageLayers[*lod];
+        struct MTImageLayer* parentLayer = &index->imageLayers[imageLayer->parentLayer];
+
+        *lod = imageLayer->parentLayer;
+        *x >>= parentLayer->uShift - imageLayer->uShift;
+        *y >>= parentLayer->vShift - imageLayer->vShift;
+
+        int tileSize;
+        int tileFormat;
+        u64* romAddress = mtTileCacheTileAddress(&index->imageLayers[*lod], *x, *y, &tileSize, &tileFormat);
+        int entryIndex = mtTileCacheSearch(tileCache, romAddress, MT_HASH(tileCache, romAddress));
+
+        if (entryIndex != MT_NO_TILE_INDEX && !(tileCache->entries[entryIndex].flags & MT_TILE_FLAGS_PENDING)) {
+            return entryIndex;
+        }
+    }
+
+    return MT_NO_TILE_INDEX;
+}
+
+// evicts a tile and starts loading romAddress in its place. Returns
+// MT_NO_TILE_INDEX if the budget is spent or nothing can be evicted
+int mtTileCacheLoadTile(struct MTTileCache* tileCache, u64* romAddress, int hashIndex, int tileSize, int tileFormat, int x, int y, int shifts) {
+    if (tileCache->tilesRequestedFromCart >= gMtMaxTileRequestsPerFrame) {
+        return MT_NO_TILE_INDEX;
+    }
+
+    int entryIndex = mtTileCacheRemoveOldestUsedTile(tileCache, MT_TILE_IS_HALF(tileFormat, tileSize));
+
+    if (entryIndex == MT_NO_TILE_INDEX) {
+        return MT_NO_TILE_INDEX;
+    }
+
+    ++tileCache->tilesRequestedFromCart;
+
+    mtTileCacheAdd(tileCache, entryIndex, hashIndex, romAddress);
+
+    mtTileCacheRequestFromRom(tileCache, entryIndex, romAddress, tileSize, tileFormat);
+    ++tileCache->tileRequests[MIN(MIN(MT_TILE_S_SHIFT(shifts), MT_TILE_T_SHIFT(shifts)), MT_TILE_REQUEST_LODS - 1)];
+    mtTileCacheFixDisplayList(tileCache, entryIndex, x, y, shifts, tileSize);
+
+    return entryIndex;
+}
+
+// the group of index this frame. Megatextures are requested in bursts
+// so the last group is checked first
+int mtTileCacheCandidateGroup(struct MTTileCache* tileCache, struct MTTileIndex* index) {
+    int groupCount = tileCache->candidateGroup;
+
+    if (groupCount && tileCache->candidateGroupIndexes[groupCount - 1] == index) {
+        return groupCount;
+    }
+
+    for (int i = 0; i < groupCount; ++i) {
+        if (tileCache->candidateGroupIndexes[i] == index) {
+            return i + 1;
+        }
+    }
+
+    if (groupCount == MT_MAX_CANDIDATE_GROUPS) {
+        return groupCount;
+    }
+
+    tileCache->candidateGroupIndexes[groupCount] = index;
+    tileCache->candidateGroup = groupCount + 1;
+
+    return groupCount + 1;
+}
+
+void mtTileCacheAddCandidate(struct MTTileCache* tileCache, struct MTTileIndex* index, u64* romAddress, int hashIndex, int tileSize, int tileFormat, int x, int y, int shifts, int importance) {
+    struct MTTileWait* wait = &tileCache->waits[hashIndex];
+    u16 tag = MT_ROM_TAG(tileCache, romAddress);
+
+    if (wait->tag == tag && wait->lastFrame == tileCache->currentFrame) {
+        // already a candidate this frame
+        return;
+    }
+
+    if (wait->tag != tag || (u16)(tileCache->currentFrame - wait->lastFrame) > 1) {
+        wait->tag = tag;
+        wait->firstFrame = tileCache->currentFrame;
+    }
+
+    wait->lastFrame = tileCache->currentFrame;
+
+    int waitFrames = (u16)(tileCache->currentFrame - wait->firstFrame);
+
+    if (waitFrames > MT_MAX_WAIT_FRAMES) {
+        waitFrames = MT_MAX_WAIT_FRAMES;
+    }
+
+    int score = importance + waitFrames * MT_WAIT_IMPORTANCE;
+
+    if (score > 0xFFFF) {
+        score = 0xFFFF;
+    }
+
+    int group = mtTileCacheCandidateGroup(tileCache, index);
+
+    ++tileCache->candidateTileCount;
+
+    struct MTTileCandidate* candidate;
+
+    if (tileCache->candidateCount < MT_MAX_TILE_CANDIDATES) {
+        candidate = &tileCache->candidates[tileCache->candidateCount];
+        ++tileCache->candidateCount;
+    } else {
+        // replace the least important candidate
+        candidate = &tileCache->candidates[0];
+
+        for (int i = 1; i < MT_MAX_TILE_CANDIDATES; ++i) {
+            if (tileCache->candidates[i].score < candidate->score) {
+                candidate = &tileCache->candidates[i];
+            }
+        }
+
+        if (candidate->score >= score) {
+            return;
+        }
+    }
+
+    candidate->romAddress = romAddress;
+    candidate->size = tileSize;
+    candidate->format = tileFormat;
+    candidate->score = score;
+    candidate->x = x;
+    candidate->y = y;
+    candidate->shifts = shifts;
+    candidate->group = group;
+}
+
+int mtTileCacheIsTileInUse(struct MTTileCache* tileCache, struct MTImageLayer* imageLayer, int x, int y) {
+    int tileSize;
+    int tileFormat;
+    u64* romAddress = mtTileCacheTileAddress(imageLayer, x, y, &tileSize, &tileFormat);
+    int entryIndex = mtTileCacheFind(tileCache, romAddress, MT_HASH(tileCache, romAddress));
+    return entryIndex != MT_NO_TILE_INDEX && MT_IS_ENTRY_IN_USE(tileCache, &tileCache->entries[entryIndex]);
+}
+
+// checks the tile of the parent layer and the top left
+// tile of the next finer regular layer over x, y
+int mtTileCacheIsOtherLayerInUse(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod) {
+    struct MTImageLayer* imageLayer = &index->imageLayers[lod];
+
+    if (imageLayer->parentLayer != MT_NO_PARENT_LAYER) {
+        struct MTImageLayer* parentLayer = &index->imageLayers[imageLayer->parentLayer];
+
+        if (mtTileCacheIsTileInUse(tileCache, parentLayer, x >> (parentLayer->uShift - imageLayer->uShift), y >> (parentLayer->vShift - imageLayer->vShift))) {
+            return 1;
+        }
+    }
+
+    if (lod > 0 && lod < index->layerCount) {
+        struct MTImageLayer* childLayer = &index->imageLayers[lod - 1];
+        return mtTileCacheIsTileInUse(tileCache, childLayer, x << (imageLayer->uShift - childLayer->uShift), y << (imageLayer->vShift - childLayer->vShift));
+    }
+
+    return 0;
+}
+
+void mtTileCacheResolveTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int importance, struct MTTileUse* use) {
     struct MTImageLayer* imageLayer = &index->imageLayers[lod];
-    u64* romAddress = MT_DETERMINE_ROM_ADDRESS(imageLayer, x, y);
+    int tileSize;
+    int tileFormat;
+    u64* romAddress = mtTileCacheTileAddress(imageLayer, x, y, &tileSize, &tileFormat);
     int hashIndex = MT_HASH(tileCache, romAddress);
 
     ++tileCache->totalTileRequests;
 
-    Gfx* result = mtTileCacheSearch(tileCache, romAddress, hashIndex);
+#ifdef MT_TILE_TRACE
+    mtTileCacheTraceRequest(tileCache, index, x, y, lod);
+#endif
+
+    int entryIndex = mtTileCacheFind(tileCache, romAddress, hashIndex);
+
+    if (entryIndex != MT_NO_TILE_INDEX) {
+        if (!MT_IS_ENTRY_IN_USE(tileCache, &tileCache->entries[entryIndex]) && mtTileCacheIsOtherLayerInUse(tileCache, index, x, y, lod)) {
+            ++tileCache->lodFlipCount;
+        }
+
+        mtTileCacheUseEntry(tileCache, entryIndex);
+
+        if (!(tileCache->entries[entryIndex].flags & MT_TILE_FLAGS_PENDING)) {
+            ++tileCache->tileHitCount;
+            use->entryIndex = entryIndex;
+            use->x = x;
+            use->y = y;
+            use->lod = lod;
+            use->shifts = MT_TILE_SHIFTS(imageLayer);
+
+            if (mtTileCacheUseNeedsSetup(tileCache, use)) {
+                ++tileCache->sharedTileUseCount;
+            }
+
+            return;
+        }
+    } else if (!gMtScheduleTileRequests) {
+        entryIndex = mtTileCacheLoadTile(tileCache, romAddress, hashIndex, tileSize, tileFormat, x, y, MT_TILE_SHIFTS(imageLayer));
+    }
+
+    if (entryIndex != MT_NO_TILE_INDEX) {
+        // the tile is loading, a coarser tile is shown until it is ready
+        ++tileCache->pendingTileCount;
+    }
 
-    if (result) {
-        return result;
+    int requestX = x;
+    int requestY = y;
+    int requestLod = lod;
+    int requestLevel = MIN(imageLayer->uShift, imageLayer->vShift);
+
+    // either the tile is still loading or we cant
+    // request any new tiles this frame resort to
+    // searching for any existing loaded tile
+    int fallbackIndex = mtTileCacheFindReadyParent(tileCache, index, &x, &y, &lod);
+
+    if (entryIndex == MT_NO_TILE_INDEX && gMtScheduleTileRequests) {
+        // rip layers are compared by their finer axis
+        int drawnLevel = fallbackIndex == MT_NO_TILE_INDEX ? index->layerCount : MIN(index->imageLayers[lod].uShift, index->imageLayers[lod].vShift);
+        int score = importance + (drawnLevel - requestLevel) * MT_LOD_GAP_IMPORTANCE;
+
+        mtTileCacheAddCandidate(
+            tileCache, index, romAddress, hashIndex, tileSize, tileFormat,
+            requestX, requestY, MT_TILE_SHIFTS(imageLayer),
+            score
+        );
+
+        if (fallbackIndex == MT_NO_TILE_INDEX && lod != requestLod) {
+            // nothing can be drawn here so the coarsest tile, which
+            // covers the most area, is loaded before anything else
+            struct MTImageLayer* coarseLayer = &index->imageLayers[lod];
+            u64* coarseAddress = mtTileCacheTileAddress(coarseLayer, x, y, &tileSize, &tileFormat);
+            int coarseHashIndex = MT_HASH(tileCache, coarseAddress);
+
+            if (mtTileCacheFind(tileCache, coarseAddress, coarseHashIndex) == MT_NO_TILE_INDEX) {
+                mtTileCacheAddCandidate(tileCache, index, coarseAddress, coarseHashIndex, tileSize, tileFormat, x, y, MT_TILE_SHIFTS(coarseLayer), score + MT_LOD_GAP_IMPORTANCE);
+            }
+        }
     }
 
-    int entryIndex = MT_NO_TILE_INDEX;
-    
-    if (tileCache->tilesRequestedFromCart < gMtMaxTileRequestsPerFrame) {
-        entryIndex = mtTileCacheRemoveOldestUsedTile(tileCache);
+    use->entryIndex = fallbackIndex;
+    use->x = x;
+    use->y = y;
+    use->lod = lod;
+    use->shifts = MT_TILE_SHIFTS(&index->imageLayers[lod]);
+
+    if (fallbackIndex == MT_NO_TILE_INDEX) {
+        ++tileCache->missingTileCount;
+        return;
     }
 
     if (entryIndex == MT_NO_TILE_INDEX) {
-        // cant request any new tiles this frame
-        // resort to searching for any existing
-        // loaded tile
+        ++tileCache->fallbackRequestCount;
+    }
 
-        while (lod + 1 < index->layerCount) {
-            ++lod;
-            x >>= 1;
-            y >>= 1;
+    if (mtTileCacheUseNeedsSetup(tileCache, use)) {
+        ++tileCache->sharedTileUseCount;
+    }
+}
 
-            imageLayer = &index->imageLayers[lod];
+Gfx* mtTileCacheRequestTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int importance, Gfx* dl) {
+    struct MTTileUse use;
+    mtTileCacheResolveTile(tileCache, index, x, y, lod, importance, &use);
 
-            romAddress = MT_DETERMINE_ROM_ADDRESS(imageLayer, x, y);
-            hashIndex = MT_HASH(tileCache, romAddress);
-            result = mtTileCacheSearch(tileCache, romAddress, hashIndex);
+    if (use.entryIndex == MT_NO_TILE_INDEX) {
+        return dl;
+    }
 
-            if (result) {
-                return result;
-            }
+    return mtTileCacheUseTile(tileCache, &use, dl);
+}
+
+void mtTileCacheScheduleRequests(struct MTTileCache* tileCache) {
+    struct MTTileCandidate* candidates = tileCache->candidates;
+    int count = tileCache->candidateCount;
+
+    // most important first
+    for (int i = 1; i < count; ++i) {
+        struct MTTileCandidate candidate = candidates[i];
+        int j = i;
+
+        while (j > 0 && candidates[j - 1].score < candidate.score) {
+            candidates[j] = candidates[j - 1];
+            --j;
         }
 
-        return mtNopDisplayList;
+        candidates[j] = candidate;
     }
 
-    ++tileCache->tilesRequestedFromCart;
+    u8 groupLoadCount[MT_MAX_CANDIDATE_GROUPS + 1];
+
+    for (int i = 0; i <= tileCache->candidateGroup; ++i) {
+        groupLoadCount[i] = 0;
+    }
+
+    int budget = gMtMaxTileRequestsPerFrame - tileCache->tilesRequestedFromCart;
+    int fairShare = tileCache->candidateGroup ? budget / tileCache->candidateGroup : budget;
+
+    if (fairShare < 1) {
+        fairShare = 1;
+    }
+
+    // the first pass gives each megatexture up to its fair
+    // share and the second pass hands out what is left
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < count; ++i) {
+            struct MTTileCandidate* candidate = &candidates[i];
+
+            if (!candidate->size || (pass == 0 && groupLoadCount[candidate->group] >= fairShare)) {
+                continue;
+            }
+
+            u64* romAddress = candidate->romAddress;
+            int hashIndex = MT_HASH(tileCache, romAddress);
+
+            if (mtTileCacheFind(tileCache, romAddress, hashIndex) == MT_NO_TILE_INDEX &&
+                mtTileCacheLoadTile(tileCache, romAddress, hashIndex, candidate->size, candidate->format, candidate->x, candidate->y, candidate->shifts) == MT_NO_TILE_INDEX) {
+                // out of budget or nothing left to evict
+                tileCache->candidateCount = 0;
+                return;
+            }
 
-    mtTileCacheAdd(tileCache, entryIndex, hashIndex);
+            candidate->size = 0;
 
-    mtTileCacheRequestFromRom(tileCache, entryIndex, romAddress);
-    ++tileCache->tileRequests[lod];
-    mtTileCacheFixDisplayList(tileCache, entryIndex, x, y, lod);
-    return &tileCache->tileLoaders[entryIndex * MT_GFX_SIZE];
+            if (groupLoadCount[candidate->group] < 0xFF) {
+                ++groupLoadCount[candidate->group];
+            }
+        }
+    }
+
+    tileCache->candidateCount = 0;
 }
 
-void mtTileCachePreloadTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod) {
+int mtTileCachePrefetchTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod) {
     struct MTImageLayer* imageLayer = &index->imageLayers[lod];
-    u64* romAddress = MT_DETERMINE_ROM_ADDRESS(imageLayer, x, y);
+    int tileSize;
+    int tileFormat;
+    u64* romAddress = mtTileCacheTileAddress(imageLayer, x, y, &tileSize, &tileFormat);
     int hashIndex = MT_HASH(tileCache, romAddress);
 
-    Gfx* result = mtTileCacheSearch(tileCache, romAddress, hashIndex);
+    if (mtTileCacheFind(tileCache, romAddress, hashIndex) != MT_NO_TILE_INDEX) {
+        return 1;
+    }
 
-    if (result) {
-        // already preloaded
-        return;
+    if (tileCache->tilesRequestedFromCart + tileCache->prefetchRequestCount >= gMtMaxTileRequestsPerFrame) {
+        return 0;
     }
 
-    int entryIndex = mtTileCacheRemoveOldestUsedTile(tileCache);
+    int isHalf = MT_TILE_IS_HALF(tileFormat, tileSize);
+    // don't push out tiles that are likely still needed
+    int entryIndex = mtTileCacheFindEviction(tileCache, isHalf, MT_PREFETCH_MIN_IDLE_FRAMES);
 
     if (entryIndex == MT_NO_TILE_INDEX) {
-        // no more space for entries
-        return;
+        return 0;
     }
 
-    mtTileCacheRequestFromRom(tileCache, entryIndex, romAddress);
-    mtTileCacheFixDisplayList(tileCache, entryIndex, x, y, lod);
+    mtTileCacheEvictFor(tileCache, entryIndex, isHalf);
+    mtTileCacheAdd(tileCache, entryIndex, hashIndex, romAddress);
 
-    // only add to hash table
     struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
-    entry->nextHashTile = tileCache->hashTable[hashIndex];
-    entry->hashTableIndex = hashIndex;
-    tileCache->hashTable[hashIndex] = entryIndex;
+    // not used yet so a bad prediction can be evicted next frame. It
+    // can't be evicted this frame since it may still need decoding
+    entry->lastUsedFrame = tileCache->currentFrame - 1;
+    entry->flags |= MT_TILE_FLAGS_PREFETCHED;
+
+    mtTileCacheRequestFromRom(tileCache, entryIndex, romAddress, tileSize, tileFormat);
+    mtTileCacheFixDisplayList(tileCache, entryIndex, x, y, MT_TILE_SHIFTS(imageLayer), tileSize);
+    ++tileCache->prefetchRequestCount;
+
+    return 1;
+}
+
+int mtTileCachePinTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int setIndex) {
+    struct MTImageLayer* imageLayer = &index->imageLayers[lod];
+    int tileSize;
+    int tileFormat;
+    u64* romAddress = mtTileCacheTileAddress(imageLayer, x, y, &tileSize, &tileFormat);
+    int hashIndex = MT_HASH(tileCache, romAddress);
+    int setMask = 1 << setIndex;
+
+    int entryIndex = mtTileCacheFind(tileCache, romAddress, hashIndex);
+
+    if (entryIndex != MT_NO_TILE_INDEX && tileCache->entries[entryIndex].pinnedSets) {
+        // already pinned by another set
+        struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+        if (!(entry->pinnedSets & setMask)) {
+            entry->pinnedSets |= setMask;
+            ++tileCache->residencySetTileCount[setIndex];
+        }
+
+        return 1;
+    }
+
+    if (tileCache->pinnedTileCount + (MT_TILE_IS_HALF(tileFormat, tileSize) ? 1 : 2) > tileCache->pinnedTileLimit) {
+        return 0;
+    }
+
+    if (entryIndex != MT_NO_TILE_INDEX) {
+        // take an already loaded tile out of the streaming lists
+        mtTileCacheListRemove(tileCache, entryIndex);
+    } else {
+        entryIndex = mtTileCacheRemoveOldestUsedTile(tileCache, MT_TILE_IS_HALF(tileFormat, tileSize));
+
+        if (entryIndex == MT_NO_TILE_INDEX) {
+            // no more space for entries
+            return 0;
+        }
+
+        // pinned tiles don't count against the per frame budget
+        mtTileCacheRequestFromRom(tileCache, entryIndex, romAddress, tileSize, tileFormat);
+        mtTileCacheFixDisplayList(tileCache, entryIndex, x, y, MT_TILE_SHIFTS(imageLayer), tileSize);
+
+        // only add to hash table
+        struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+        entry->nextHashTile = tileCache->hashTable[hashIndex];
+        entry->hashTableIndex = hashIndex;
+        tileCache->hashTable[hashIndex] = entryIndex;
+    }
+
+    struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+    entry->pinnedSets = setMask;
+    entry->flags &= ~MT_TILE_FLAGS_PREFETCHED;
+    tileCache->pinnedTileCount += MT_ENTRY_HALVES(tileCache, entryIndex);
+    ++tileCache->residencySetTileCount[setIndex];
+
+    return 1;
+}
+
+void mtTileCacheUnpinSet(struct MTTileCache* tileCache, int setIndex) {
+    int setMask = 1 << setIndex;
+
+    for (int entryIndex = 0; entryIndex < tileCache->entryCount && tileCache->residencySetTileCount[setIndex]; ++entryIndex) {
+        struct MTTileCacheEntry* entry = &tileCache->entries[entryIndex];
+
+        if (!(entry->pinnedSets & setMask)) {
+            continue;
+        }
+
+        entry->pinnedSets &= ~setMask;
+        --tileCache->residencySetTileCount[setIndex];
+
+        if (entry->pinnedSets) {
+            continue;
+        }
+
+        tileCache->pinnedTileCount -= MT_ENTRY_HALVES(tileCache, entryIndex);
+        // the tile may still be on screen so it goes to the newest
+        // end of the list and ages out like any other tile
+        entry->lastUsedFrame = tileCache->currentFrame;
+        mtTileCacheListPushNewest(tileCache, MT_TILE_LIST_RECENT, entryIndex);
+    }
+}
+
+void mtTileCacheSetPinnedTileLimit(struct MTTileCache* tileCache, int limit) {
+    tileCache->pinnedTileLimit = limit;
 }
 
 void mtTileCacheWaitForTiles(struct MTTileCache* tileCache) {
-    OSMesg dummyMesg;
+    mtTileCacheFlushLoads(tileCache);
 
     while (tileCache->pendingMessages > 0) {
-        (void)osRecvMesg(&tileCache->tileQueue, &dummyMesg, OS_MESG_BLOCK);
-        --tileCache->pendingMessages;
+        mtTileCacheRetireOldestMessage(tileCache);
+        mtTileCacheFlushLoads(tileCache);
     }
 }
\ No newline at end of file
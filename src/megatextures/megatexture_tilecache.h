@@ -6,12 +6,78 @@
 
 #define MT_TILE_SIZE   (32 * 32 * 2)
 #define MT_TILE_WORDS  (MT_TILE_SIZE / sizeof(u64))
-#define MT_GFX_SIZE    10
+// each slot of tile data holds either one tile or two tiles stored in a
+// format that takes at most half the space. Every slot has two entries,
+// a full tile uses the first one and marks the second MT_TILE_FLAGS_TAIL
+#define MT_HALF_TILE_SIZE   (MT_TILE_SIZE / 2)
+#define MT_HALF_TILE_WORDS  (MT_HALF_TILE_SIZE / sizeof(u64))
+// compressed RGBA16 tiles are expanded to a full tile once loaded
+#define MT_TILE_IS_HALF(format, size)   ((format) != MTTileFormatRGBA16 && (size) <= MT_HALF_TILE_SIZE)
+// long enough for the loader of a CI tile, see mtTileCacheBuildTileLoader
+#define MT_GFX_SIZE    15
+// where palettes are loaded in tmem, in 8 byte words
+#define MT_TLUT_TMEM   256
 
 #define MT_TILE_QUEUE_SIZE     64
 
+// loads are queued up and sorted by rom address so tiles
+// next to each other in rom can be read with a single dma
+#define MT_MAX_QUEUED_LOADS    64
+#define MT_MAX_DMA_RUN_TILES   8
+// runs of more than one tile are read here then copied into their slots
+#define MT_DMA_STAGING_SIZE    (MT_TILE_SIZE * MT_MAX_DMA_RUN_TILES * 2)
+#define MT_DMA_NOT_STAGED      0xFFFF
+
+// misses gathered each frame before the request budget is spent
+#define MT_MAX_TILE_CANDIDATES      128
+// megatextures with their own share of the request budget each
+// frame, any after that share the last group
+#define MT_MAX_CANDIDATE_GROUPS     32
+// importance of a request when where the tile is on screen isn't known
+#define MT_DEFAULT_TILE_IMPORTANCE  64
+
 #define MT_NO_TILE_INDEX       0xFFFF
 
+// the texture coordinate shifts of an image layer packed into a byte
+#define MT_TILE_SHIFTS(imageLayer)  ((imageLayer)->uShift | ((imageLayer)->vShift << 4))
+#define MT_TILE_S_SHIFT(shifts)     ((shifts) & 0xF)
+#define MT_TILE_T_SHIFT(shifts)     ((shifts) >> 4)
+
+// tile loads are counted by the finer of their two shifts
+#define MT_TILE_REQUEST_LODS   6
+
+#define MT_TILE_LIST_RECENT    0
+#define MT_TILE_LIST_FREQUENT  1
+#define MT_TILE_LIST_COUNT     2
+// pinned tiles are in no list and are never evicted
+#define MT_TILE_LIST_NONE      0xFF
+
+// tiles are pinned as part of a residency set and stay loaded until
+// every set they belong to is unpinned. Set 0 is used by
+// megatexturePreload, the rest are free for level scripts
+#define MT_MAX_RESIDENCY_SETS       8
+#define MT_RESIDENCY_SET_PRELOAD    0
+
+// loaded by a prefetch and not yet requested by the renderer
+#define MT_TILE_FLAGS_PREFETCHED    (1 << 0)
+// the tile data is still being read from the cart. Cleared
+// once the dma is retired and the tile has been decompressed
+#define MT_TILE_FLAGS_PENDING       (1 << 1)
+// the second half of a slot holding a full tile, the entry is in
+// no list and is freed when the first half is evicted
+#define MT_TILE_FLAGS_TAIL          (1 << 2)
+
+enum MTTileCachePolicy {
+    // a single least recently used list
+    MTTileCachePolicyLRU,
+    // new tiles start in the recent list and are moved to the
+    // frequent list when they are used again after going unused
+    // for a frame or are requested again after being evicted. A
+    // camera sweeping over fine tiles it sees once only churns
+    // the recent list leaving reused tiles resident
+    MTTileCachePolicy2Q,
+};
+
 struct MTTileCacheEntry {
     u16 newerTile;
     u16 olderTile;
@@ -20,6 +86,77 @@ struct MTTileCacheEntry {
     u16 hashTableIndex;
 
     void* romAddress;
+
+    u16 lastUsedFrame;
+    u8 list;
+    u8 flags;
+
+    // the tile position the loader display list is setup for
+    u8 loaderX;
+    u8 loaderY;
+    // see MT_TILE_SHIFTS
+    u8 loaderShifts;
+    // one bit for each residency set this tile is pinned by
+    u8 pinnedSets;
+    // enum MTTileFormat
+    u8 format;
+};
+
+struct MTTileList {
+    u16 oldestTile;
+    u16 newestTile;
+    u16 count;
+};
+
+struct MTQueuedLoad {
+    void* romAddress;
+    u16 entryIndex;
+    u16 size;
+};
+
+struct MTTileDma {
+    u16 entries[MT_MAX_DMA_RUN_TILES];
+    u16 sizes[MT_MAX_DMA_RUN_TILES];
+    // where the staging buffer is free up to once this dma
+    // is retired or MT_DMA_NOT_STAGED if read directly to a slot
+    u16 stagingEnd;
+    // 0 for reads started by mtTileCacheReadRom
+    u8 tileCount;
+    // flags of whatever mtTileCacheReadRom is reading
+    u8* readFlags;
+    OSTime startTime;
+};
+
+// a tile that missed this frame waiting to be loaded
+struct MTTileCandidate {
+    void* romAddress;
+    u16 size;
+    u16 score;
+    u8 x;
+    u8 y;
+    u8 shifts;
+    // requests from the same megatexture share a group
+    u8 group;
+    u8 format;
+};
+
+// how long a tile has been a candidate, indexed by hash
+struct MTTileWait {
+    u16 tag;
+    u16 firstFrame;
+    u16 lastFrame;
+};
+
+// the loaded tile chosen to draw a requested tile, which may be
+// a coarser tile if the one requested isn't ready yet
+struct MTTileUse {
+    // MT_NO_TILE_INDEX if there is nothing to draw
+    u16 entryIndex;
+    u8 x;
+    u8 y;
+    u8 lod;
+    // see MT_TILE_SHIFTS
+    u8 shifts;
 };
 
 struct MTTileCache {
@@ -31,26 +168,142 @@ struct MTTileCache {
     OSMesgQueue tileQueue;
     OSMesg inboundMessages[MT_TILE_QUEUE_SIZE];
     OSIoMesg outboundMessages[MT_TILE_QUEUE_SIZE];
+    // tiles to copy or decompress once the matching message is done
+    struct MTTileDma dmas[MT_TILE_QUEUE_SIZE];
     u16 pendingMessages;
     u16 nextOutboundMessage;
+    struct MTQueuedLoad queuedLoads[MT_MAX_QUEUED_LOADS];
+    u16 queuedLoadCount;
+    u8* dmaStaging;
+    u16 stagingHead;
+    u16 stagingTail;
+    u16 stagedMessageCount;
+    OSTime lastDmaRetireTime;
+    // two entries per slot
     u16 entryCount;
-    u16 hashTableMask;
-    u16 oldestUsedTile;
-    u16 newestUsedTile;
-
-    // index 0 is the current frame
-    // index 1 is the previous frame
-    u16 oldestTileFromFrame[2];
+    u16 slotCount;
+    // the hash index is the top bits of the hash key, see MT_HASH
+    u8 hashTableShift;
+    struct MTTileList lists[MT_TILE_LIST_COUNT];
+    // tiles used this frame or last frame are never evicted
+    u16 currentFrame;
+    u8 policy;
+    // 2Q only, size the recent list is allowed to
+    // grow to before tiles are evicted from it
+    u16 recentListTarget;
+    // 2Q only, tags of rom addresses recently evicted from the
+    // recent list indexed by hash, MT_NO_ROM_TAG if empty
+    u16* ghostTags;
+    struct MTTileCandidate candidates[MT_MAX_TILE_CANDIDATES];
+    u16 candidateCount;
+    // groups handed out this frame, group i + 1 is candidateGroupIndexes[i]
+    u8 candidateGroup;
+    struct MTTileIndex* candidateGroupIndexes[MT_MAX_CANDIDATE_GROUPS];
+    struct MTTileWait* waits;
+    // pinned tiles come out of the same entries as streamed tiles
+    // but are counted separately and limited to pinnedTileLimit. Both
+    // are in entries so a full tile counts twice
+    u16 pinnedTileCount;
+    u16 pinnedTileLimit;
+    u16 residencySetTileCount[MT_MAX_RESIDENCY_SETS];
     u16 tilesRequestedFromCart;
     u16 totalTileRequests;
     u16 overflowRequestCount;
+    // requests drawn with the tile itself, tiles still
+    // loading are counted in pendingTileCount instead
+    u16 tileHitCount;
+    u16 evictedTileCount;
+    // requests that were drawn with a coarser lod
+    u16 fallbackRequestCount;
+    // requests that couldn't be drawn at all
+    u16 missingTileCount;
+    // requests for a tile that was still loading
+    u16 pendingTileCount;
+    // misses that were considered for loading this frame
+    u16 candidateTileCount;
+    u32 bytesRequestedFromCart;
+    // tiles loaded ahead of time for a predicted camera
+    u16 prefetchRequestCount;
+    // prefetched tiles that the renderer then asked for
+    u16 prefetchUsedCount;
+    // prefetched tiles evicted without ever being used
+    u16 prefetchWastedCount;
+    // requests for a tile that shares its data with another position
+    u16 sharedTileUseCount;
+    // requests for a cached tile that wasn't in use while the tile of
+    // the next coarser or finer layer over the same spot was, the
+    // position changed layer. Tiles still to be loaded aren't counted
+    u16 lodFlipCount;
+    // dmas started this frame, less than the tiles loaded
+    // when neighboring tiles are read together
+    u16 dmaRequestCount;
+    // time the pi was busy with tile dmas retired this frame. Dmas are
+    // only seen to finish when they are polled so this runs a bit long
+    u32 dmaTimeUs;
 
-    u16 tileRequests[6];
+    u16 tileRequests[MT_TILE_REQUEST_LODS];
 };
 
-void mtTileCacheInit(struct MTTileCache* tileCache, int entryCount);
-Gfx* mtTileCacheRequestTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod);
-void mtTileCachePreloadTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod);
+extern int gMtMaxTileRequestsPerFrame;
+// when zero every tile is read with its own dma as soon as it is requested
+extern int gMtCoalesceTileLoads;
+// when zero misses are loaded in the order they are requested until the
+// budget runs out. Otherwise they are gathered for the whole frame and
+// loaded most important first by mtTileCacheScheduleRequests
+extern int gMtScheduleTileRequests;
+
+// allocates slotCount slots of MT_TILE_SIZE bytes, see MT_TILE_IS_HALF
+void mtTileCacheInit(struct MTTileCache* tileCache, int slotCount, enum MTTileCachePolicy policy);
+void mtTileCacheStartFrame(struct MTTileCache* tileCache);
+// writes the commands to load and setup a tile to dl and
+// returns the new end of the display list. importance ranks
+// misses against each other, larger tiles nearer the center
+// of the screen should be more important
+Gfx* mtTileCacheRequestTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int importance, Gfx* dl);
+// does the bookkeeping of mtTileCacheRequestTile without writing
+// any commands. The tile is drawn with mtTileCacheUseTile
+void mtTileCacheResolveTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int importance, struct MTTileUse* use);
+Gfx* mtTileCacheUseTile(struct MTTileCache* tileCache, struct MTTileUse* use, Gfx* dl);
+// true if the tile is loaded or loading, doesn't count as a use
+int mtTileCacheIsResident(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int* tileSize);
+// two uses with the same key write the same commands
+u32 mtTileCacheUseKey(struct MTTileCache* tileCache, struct MTTileUse* use);
+// spends the request budget left this frame on the gathered misses,
+// each megatexture gets a fair share before the rest is handed out
+void mtTileCacheScheduleRequests(struct MTTileCache* tileCache);
+// loads a tile without marking it as used. Only spends request
+// budget left over this frame and only replaces tiles that have
+// been idle for a while. Returns 0 once no more tiles can be loaded
+int mtTileCachePrefetchTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod);
+// loads a tile if needed and keeps it loaded until setIndex is
+// unpinned. Returns 0 if the pinned tile limit was reached or
+// there was no room for the tile
+int mtTileCachePinTile(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod, int setIndex);
+// tiles no longer pinned by any set go back to being streamed
+void mtTileCacheUnpinSet(struct MTTileCache* tileCache, int setIndex);
+// limit is in entries, two per slot
+void mtTileCacheSetPinnedTileLimit(struct MTTileCache* tileCache, int limit);
+// finishes any tile loads that are done without waiting
+void mtTileCachePollTiles(struct MTTileCache* tileCache);
+// starts the dmas for queued tile loads. Loads that don't fit in
+// the dma queue stay queued until a later flush
+void mtTileCacheFlushLoads(struct MTTileCache* tileCache);
+// reads size bytes from romAddress into dramAddr through the same dma
+// queue as tiles, for data other than tiles that is streamed in. Sets
+// MT_TILE_FLAGS_PENDING in flags until the read has been retired.
+// Returns 0 without reading anything if the dma queue is full
+int mtTileCacheReadRom(struct MTTileCache* tileCache, void* romAddress, void* dramAddr, int size, u8* flags);
+// blocks until every requested tile is ready
 void mtTileCacheWaitForTiles(struct MTTileCache* tileCache);
+void mtTileCacheResetStats(struct MTTileCache* tileCache);
+// counts tiles that could be evicted without touching a tile used
+// this frame or last frame, stops counting at maxCount
+int mtTileCacheEvictableCount(struct MTTileCache* tileCache, int maxCount);
+
+#ifdef MT_TILE_TRACE
+// implemented by whoever is recording tile request traces
+void mtTileCacheTraceFrame(struct MTTileCache* tileCache);
+void mtTileCacheTraceRequest(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod);
+#endif
 
 #endif
\ No newline at end of file
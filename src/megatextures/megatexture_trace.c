@@ -0,0 +1,124 @@
+// records every tile request in the trace format read by
+// host/tile_trace.c and sends it over the debugger link one frame
+// at a time. Build with make WITH_DEBUGGER=1 WITH_TILE_TRACE=1
+
+#if defined(MT_TILE_TRACE) && defined(WITH_DEBUGGER)
+
+#include "megatexture_tilecache.h"
+
+#include "../../debugger/debugger.h"
+
+#define MT_TRACE_BUFFER_SIZE    4096
+// longest line written, a megatexture line with every rip chain
+#define MT_TRACE_MAX_LINE       512
+#define MT_TRACE_MAX_INDEXES    1024
+
+static char gMtTraceBuffer[MT_TRACE_BUFFER_SIZE];
+static int gMtTraceLength;
+
+static struct MTTileIndex* gMtTraceIndexes[MT_TRACE_MAX_INDEXES];
+static int gMtTraceIndexCount;
+
+static void mtTraceFlush() {
+    if (gMtTraceLength) {
+        gdbSendMessage(GDBDataTypeText, gMtTraceBuffer, gMtTraceLength);
+        gMtTraceLength = 0;
+    }
+}
+
+// makes sure a line fits in the buffer before it is written
+static void mtTraceStartLine() {
+    if (gMtTraceLength + MT_TRACE_MAX_LINE > MT_TRACE_BUFFER_SIZE) {
+        mtTraceFlush();
+    }
+}
+
+static void mtTraceWrite(const char* text) {
+    while (*text) {
+        gMtTraceBuffer[gMtTraceLength++] = *text++;
+    }
+}
+
+static void mtTraceWriteInt(int value) {
+    char digits[12];
+    int count = 0;
+
+    gMtTraceBuffer[gMtTraceLength++] = ' ';
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (count) {
+        gMtTraceBuffer[gMtTraceLength++] = digits[--count];
+    }
+}
+
+static void mtTraceWriteLayers(struct MTTileIndex* index, int firstLayer, int layerCount) {
+    for (int i = firstLayer; i < firstLayer + layerCount; ++i) {
+        mtTraceWriteInt(index->imageLayers[i].xTiles);
+        mtTraceWriteInt(index->imageLayers[i].yTiles);
+    }
+}
+
+// megatextures get ids in the order they are first requested
+static int mtTraceIndexId(struct MTTileIndex* index) {
+    for (int id = 0; id < gMtTraceIndexCount; ++id) {
+        if (gMtTraceIndexes[id] == index) {
+            return id;
+        }
+    }
+
+    if (gMtTraceIndexCount == MT_TRACE_MAX_INDEXES) {
+        return -1;
+    }
+
+    int id = gMtTraceIndexCount;
+    gMtTraceIndexes[id] = index;
+    ++gMtTraceIndexCount;
+
+    mtTraceStartLine();
+    mtTraceWrite("megatexture");
+    mtTraceWriteInt(id);
+    mtTraceWriteInt(index->layerCount);
+    mtTraceWriteLayers(index, 0, index->layerCount);
+
+    for (int chainIndex = 0; chainIndex < index->ripChainCount; ++chainIndex) {
+        struct MTRipChain* chain = &index->ripChains[chainIndex];
+
+        mtTraceWrite(" rip");
+        mtTraceWriteInt(chain->axis);
+        mtTraceWriteInt(chain->ratioShift);
+        mtTraceWriteInt(chain->layerCount);
+        mtTraceWriteLayers(index, chain->firstLayer, chain->layerCount);
+    }
+
+    mtTraceWrite("\n");
+
+    return id;
+}
+
+void mtTileCacheTraceFrame(struct MTTileCache* tileCache) {
+    // the requests of the last frame are sent together
+    mtTraceFlush();
+    mtTraceWrite("frame\n");
+}
+
+void mtTileCacheTraceRequest(struct MTTileCache* tileCache, struct MTTileIndex* index, int x, int y, int lod) {
+    int id = mtTraceIndexId(index);
+
+    if (id < 0) {
+        return;
+    }
+
+    mtTraceStartLine();
+    mtTraceWrite("r");
+    mtTraceWriteInt(id);
+    mtTraceWriteInt(x);
+    mtTraceWriteInt(y);
+    mtTraceWriteInt(lod);
+    mtTraceWrite("\n");
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include "megatexture_vertex_cache.h"
+
+#include "../util/memory.h"
+#include "../math/mathf.h"
+
+#define LARGE_PRIME_NUMBER  1160939981
+
+// a window drawn last frame may still be read by the rsp
+#define MT_VERTEX_SLOT_IN_FLIGHT(vertexCache, slot)   ((u16)((vertexCache)->currentFrame - (slot)->lastUsedFrame) < 2)
+
+// MTVertex coordinates are in 1/32 texels and tiles are 32 texels wide
+#define MT_VERTEX_TILE_SIZE     (32 << 5)
+
+struct MTVertexCache gMtVertexCache;
+
+#define MT_VERTEX_HASH(index, layer, windowStart) ((LARGE_PRIME_NUMBER * ((u32)(index) + ((layer) << 16) + (windowStart))) >> 24 & (MT_VERTEX_CACHE_HASH_SIZE - 1))
+
+void mtVertexCacheInit(struct MTVertexCache* vertexCache) {
+    vertexCache->slots = malloc(sizeof(struct MTVertexCacheSlot) * MT_VERTEX_CACHE_SLOT_COUNT);
+    vertexCache->vertices = malloc(sizeof(Vtx) * MT_VERTEX_CACHE_SIZE * MT_VERTEX_CACHE_SLOT_COUNT);
+    vertexCache->currentFrame = 0;
+
+    for (int i = 0; i < MT_VERTEX_CACHE_SLOT_COUNT; ++i) {
+        // never used so it can be taken right away
+        vertexCache->slots[i].lastUsedFrame = vertexCache->currentFrame - 0x8000;
+    }
+
+    mtVertexCacheInvalidate(vertexCache);
+    mtVertexCacheStartFrame(vertexCache);
+}
+
+void mtVertexCacheStartFrame(struct MTVertexCache* vertexCache) {
+    ++vertexCache->currentFrame;
+    vertexCache->lastIndex = NULL;
+    vertexCache->builtWindowCount = 0;
+    vertexCache->overflowCount = 0;
+}
+
+void mtVertexCacheInvalidate(struct MTVertexCache* vertexCache) {
+    for (int i = 0; i < MT_VERTEX_CACHE_HASH_SIZE; ++i) {
+        vertexCache->hashTable[i] = MT_VERTEX_CACHE_NO_SLOT;
+    }
+
+    for (int i = 0; i < MT_VERTEX_CACHE_SLOT_COUNT; ++i) {
+        vertexCache->slots[i].nextHashSlot = MT_VERTEX_CACHE_NO_SLOT;
+        vertexCache->slots[i].hashIndex = MT_VERTEX_CACHE_NO_SLOT;
+    }
+
+    vertexCache->lastIndex = NULL;
+}
+
+static void mtVertexCacheUnlink(struct MTVertexCache* vertexCache, int slotIndex) {
+    struct MTVertexCacheSlot* slot = &vertexCache->slots[slotIndex];
+
+    if (slot->hashIndex == MT_VERTEX_CACHE_NO_SLOT) {
+        return;
+    }
+
+    u8* prev = &vertexCache->hashTable[slot->hashIndex];
+
+    while (*prev != slotIndex) {
+        prev = &vertexCache->slots[*prev].nextHashSlot;
+    }
+
+    *prev = slot->nextHashSlot;
+    slot->nextHashSlot = MT_VERTEX_CACHE_NO_SLOT;
+    slot->hashIndex = MT_VERTEX_CACHE_NO_SLOT;
+}
+
+static void mtVertexCacheBuildWindow(struct MTTileIndex* index, struct MTMeshRows* meshRows, int windowStart, Vtx* result) {
+    struct MTUVBasis* basis = &index->uvBasis;
+    // texture coordinates are for the full size texture
+    float uScale = 1.0f / (index->imageLayers[0].xTiles * MT_VERTEX_TILE_SIZE);
+    float vScale = 1.0f / (index->imageLayers[0].yTiles * MT_VERTEX_TILE_SIZE);
+
+    struct Vector3 origin;
+    struct Vector3 right;
+    struct Vector3 up;
+    vector3Scale(&basis->uvOrigin, &origin, SCENE_SCALE);
+    vector3Scale(&basis->uvRight, &right, SCENE_SCALE * uScale);
+    vector3Scale(&basis->uvUp, &up, SCENE_SCALE * vScale);
+
+    signed char normalX = (signed char)floorf(basis->normal.x * 127.0f + 0.5f);
+    signed char normalY = (signed char)floorf(basis->normal.y * 127.0f + 0.5f);
+    signed char normalZ = (signed char)floorf(basis->normal.z * 127.0f + 0.5f);
+
+    int count = MIN(MT_VERTEX_CACHE_SIZE, meshRows->vertexEnd - windowStart);
+    struct MTVertex* vertex = &meshRows->vertices[windowStart - meshRows->firstVertex];
+
+    for (int i = 0; i < count; ++i, ++vertex, ++result) {
+        struct Vector3 position;
+        vector3AddScaled(&origin, &right, vertex->u, &position);
+        vector3AddScaled(&position, &up, vertex->v, &position);
+
+        result->n.ob[0] = (short)floorf(position.x + 0.5f);
+        result->n.ob[1] = (short)floorf(position.y + 0.5f);
+        result->n.ob[2] = (short)floorf(position.z + 0.5f);
+        result->n.flag = 0;
+        // s10.5 can't quite reach the far edge of a 1024 texel texture
+        result->n.tc[0] = MIN(vertex->u, 0x7FFF);
+        result->n.tc[1] = MIN(vertex->v, 0x7FFF);
+        result->n.n[0] = normalX;
+        result->n.n[1] = normalY;
+        result->n.n[2] = normalZ;
+        result->n.a = 255;
+    }
+
+    osWritebackDCache(result - count, sizeof(Vtx) * count);
+}
+
+static int mtVertexCacheSearch(struct MTVertexCache* vertexCache, struct MTTileIndex* index, int layer, int windowStart) {
+    int slotIndex = vertexCache->hashTable[MT_VERTEX_HASH(index, layer, windowStart)];
+
+    while (slotIndex != MT_VERTEX_CACHE_NO_SLOT) {
+        struct MTVertexCacheSlot* slot = &vertexCache->slots[slotIndex];
+
+        if (slot->index == index && slot->layer == layer && slot->windowStart == windowStart) {
+            return slotIndex;
+        }
+
+        slotIndex = slot->nextHashSlot;
+    }
+
+    return MT_VERTEX_CACHE_NO_SLOT;
+}
+
+int mtVertexCacheRequestWindow(struct MTVertexCache* vertexCache, struct MTTileIndex* index, int layer, struct MTMeshRows* meshRows, int windowStart) {
+    if (vertexCache->lastIndex == index && vertexCache->lastLayer == layer && vertexCache->lastWindowStart == windowStart) {
+        return vertexCache->lastSlot;
+    }
+
+    int slotIndex = mtVertexCacheSearch(vertexCache, index, layer, windowStart);
+
+    if (slotIndex == MT_VERTEX_CACHE_NO_SLOT) {
+        u16 oldestAge = 0;
+
+        for (int i = 0; i < MT_VERTEX_CACHE_SLOT_COUNT; ++i) {
+            struct MTVertexCacheSlot* slot = &vertexCache->slots[i];
+            u16 age = vertexCache->currentFrame - slot->lastUsedFrame;
+
+            if (!MT_VERTEX_SLOT_IN_FLIGHT(vertexCache, slot) && age > oldestAge) {
+                slotIndex = i;
+                oldestAge = age;
+            }
+        }
+
+        if (slotIndex == MT_VERTEX_CACHE_NO_SLOT) {
+            ++vertexCache->overflowCount;
+            return MT_VERTEX_CACHE_NO_SLOT;
+        }
+
+        mtVertexCacheUnlink(vertexCache, slotIndex);
+
+        struct MTVertexCacheSlot* slot = &vertexCache->slots[slotIndex];
+        slot->index = index;
+        slot->layer = layer;
+        slot->windowStart = windowStart;
+
+        int hashIndex = MT_VERTEX_HASH(index, layer, windowStart);
+        slot->hashIndex = hashIndex;
+        slot->nextHashSlot = vertexCache->hashTable[hashIndex];
+        vertexCache->hashTable[hashIndex] = slotIndex;
+
+        mtVertexCacheBuildWindow(index, meshRows, windowStart, MT_VERTEX_CACHE_SLOT_VERTICES(vertexCache, slotIndex));
+        ++vertexCache->builtWindowCount;
+    }
+
+    vertexCache->slots[slotIndex].lastUsedFrame = vertexCache->currentFrame;
+
+    vertexCache->lastIndex = index;
+    vertexCache->lastLayer = layer;
+    vertexCache->lastWindowStart = windowStart;
+    vertexCache->lastSlot = slotIndex;
+
+    return slotIndex;
+}
@@ -0,0 +1,58 @@
+#ifndef __MEGATEXTURE_VERTEX_CACHE_H__
+#define __MEGATEXTURE_VERTEX_CACHE_H__
+
+#include <ultra64.h>
+#include "tile_index.h"
+#include "megatexture_mesh_cache.h"
+
+// megatexture meshes are stored as MTVertex and rebuilt into full Vtx
+// one window at a time as they are drawn. A window stays built for as
+// long as it keeps being drawn so only the windows near the camera
+// take up the 16 bytes a Vtx needs
+
+#define MT_VERTEX_CACHE_SLOT_COUNT  128
+#define MT_VERTEX_CACHE_HASH_SIZE   256
+#define MT_VERTEX_CACHE_NO_SLOT     0xFF
+
+struct MTVertexCacheSlot {
+    struct MTTileIndex* index;
+    u16 windowStart;
+    u8 layer;
+    u8 nextHashSlot;
+    // MT_VERTEX_CACHE_NO_SLOT if the slot isn't in the hash table
+    u8 hashIndex;
+    u16 lastUsedFrame;
+};
+
+struct MTVertexCache {
+    struct MTVertexCacheSlot* slots;
+    // MT_VERTEX_CACHE_SIZE vertices for each slot
+    Vtx* vertices;
+    u8 hashTable[MT_VERTEX_CACHE_HASH_SIZE];
+    u16 currentFrame;
+    // the last window requested, rows ask for the same window many times
+    struct MTTileIndex* lastIndex;
+    u16 lastWindowStart;
+    u8 lastLayer;
+    u8 lastSlot;
+    // windows rebuilt this frame
+    u16 builtWindowCount;
+    // requests that couldn't be drawn since every slot was in use
+    u16 overflowCount;
+};
+
+#define MT_VERTEX_CACHE_SLOT_VERTICES(vertexCache, slot)   (&(vertexCache)->vertices[(slot) * MT_VERTEX_CACHE_SIZE])
+
+// the renderer can't draw megatexture meshes until this has been initialized
+extern struct MTVertexCache gMtVertexCache;
+
+void mtVertexCacheInit(struct MTVertexCache* vertexCache);
+void mtVertexCacheStartFrame(struct MTVertexCache* vertexCache);
+// forgets every window, needed if a level is unloaded
+void mtVertexCacheInvalidate(struct MTVertexCache* vertexCache);
+// returns the slot holding the vertices of the window starting at
+// windowStart, building it from meshRows if needed. Returns
+// MT_VERTEX_CACHE_NO_SLOT if every slot was used this frame or last frame
+int mtVertexCacheRequestWindow(struct MTVertexCache* vertexCache, struct MTTileIndex* index, int layer, struct MTMeshRows* meshRows, int windowStart);
+
+#endif
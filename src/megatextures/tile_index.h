@@ -6,17 +6,57 @@
 #include "../math/box3d.h"
 #include "../math/vector3.h"
 
+// vertices that fit in the F3DEX2 vertex cache
+#define MT_VERTEX_CACHE_SIZE    32
+
+// megatextures are flat so only where a vertex is on the texture is
+// stored, its position is rebuilt from the uv basis. u and v are in
+// 1/32 texels of the full size texture like Vtx texture coordinates
+struct MTVertex {
+    u16 u;
+    u16 v;
+};
+
+// the exporter groups the tiles of a row into windows of vertices that
+// fit in the vertex cache and bakes the triangles of each tile into a
+// display list indexing vertices relative to the start of its window
 struct MTMeshTile {
     u16 startVertex;
-    u16 startIndex;
-    u8 indexCount;
+    // first vertex of the window, vertices are loaded into the
+    // vertex cache at their offset from the start of their window
+    u16 windowStart;
+    // offset into MTMeshLayer.triangles or into the
+    // triangles of its block if the layer is streamed
+    u16 triangleStart;
+    // 0 for tiles with nothing to draw
+    u8 triangleCount;
     u8 vertexCount;
 };
 
+// rows of a streamed layer that are read from rom together. A block
+// holds the tiles of its rows followed by their vertices then their
+// triangles, see megatexture_mesh_cache.h
+struct MTMeshBlock {
+    u64* romAddress;
+    u16 size;
+    // in bytes from the start of the block
+    u16 vertexOffset;
+    u16 triangleOffset;
+    // vertices are numbered across the whole layer
+    u16 firstVertex;
+    u16 vertexEnd;
+};
+
 struct MTMeshLayer {
-    Vtx* vertices;
-    u8* indices;
+    // NULL for streamed layers
+    struct MTVertex* vertices;
+    Gfx* triangles;
     struct MTMeshTile* tiles;
+    u16 vertexCount;
+    // NULL if the mesh is always in ram. Otherwise rows
+    // are read from rom blockRows at a time as needed
+    struct MTMeshBlock* blocks;
+    u8 blockRows;
 
     u8 minTileX;
     u8 minTileY;
@@ -31,21 +71,83 @@ struct MTUVBasis {
     struct Vector3 normal;
 };
 
+// texel format of a single tile. CI tiles are followed by their
+// palette, RGBA16 tiles smaller than MT_TILE_SIZE are compressed
+enum MTTileFormat {
+    MTTileFormatRGBA16,
+    MTTileFormatCI8,
+    MTTileFormatCI4,
+    MTTileFormatIA8,
+    MTTileFormatI4,
+    MTTileFormatCount,
+};
+
+// when an image layer has tileOffsets tiles are found through it. A
+// tile smaller than MT_TILE_SIZE is compressed, see megatexture_tile_codec.h
+// and identical tiles share the same data. Each entry is the format in the
+// upper 3 bits, the offset from tileSource in the next 21 bits and the size
+// minus one in the lower 8 bits, offset and size measured in 8 byte units
+#define MT_TILE_OFFSET_ENTRY_FORMAT(entry)  ((entry) >> 29)
+#define MT_TILE_OFFSET_ENTRY_OFFSET(entry)  ((((entry) >> 8) & 0x1FFFFF) << 3)
+#define MT_TILE_OFFSET_ENTRY_SIZE(entry)    ((((entry) & 0xFF) + 1) << 3)
+
+#define MT_NO_PARENT_LAYER  0xFF
+
 struct MTImageLayer {
     u64* tileSource;
+    u32* tileOffsets;
     u8 xTiles;
     u8 yTiles;
     u8 maxTileAxisTileCount;
+    // texels of this layer are 1 << uShift texels of layer 0 wide and
+    // 1 << vShift tall. Only rip layers have different shifts
+    u8 uShift;
+    u8 vShift;
+    // the next coarser layer, each of its tiles covers whole tiles
+    // of this one. MT_NO_PARENT_LAYER for the coarsest layer
+    u8 parentLayer;
+};
+
+enum MTRipAxis {
+    MTRipAxisU,
+    MTRipAxisV,
 };
 
+// rip layers are downsampled more along one axis than the other. A surface
+// seen at a grazing angle has its texels squashed along the axis pointing
+// away from the camera and draws one rip tile in place of 2 or 4 tiles of
+// the regular layer, see megatextureSplitRipRanges
+struct MTRipChain {
+    // the first layer of the chain is layer 0 downsampled another
+    // 1 << ratioShift times along axis, it continues with
+    // layerCount layers each half the size of the one before
+    u8 firstLayer;
+    u8 layerCount;
+    // enum MTRipAxis
+    u8 axis;
+    u8 ratioShift;
+};
+
+// regular layers followed by the layers of every rip chain
+#define MT_TILE_INDEX_LAYER_COUNT(index)    ((index)->layerCount + (index)->ripLayerCount)
+
 struct MTTileIndex {
     struct MTMeshLayer* meshLayers;
     struct MTImageLayer* imageLayers;
     u8 layerCount;
+    // rip layers come after the regular layers in meshLayers and
+    // imageLayers, NULL and 0 if the megatexture has none
+    struct MTRipChain* ripChains;
+    u8 ripChainCount;
+    u8 ripLayerCount;
     struct Box3D boundingBox;
     struct MTUVBasis uvBasis;
     struct Vector2 minUv;
     struct Vector2 maxUv;
+    // the part that hides what is behind it, empty if the
+    // mesh has holes or see through texels
+    struct Vector2 occluderMinUv;
+    struct Vector2 occluderMaxUv;
     float worldPixelSize;
     s16 sortGroup;
 };
@@ -74,10 +74,7 @@ int cameraIsValidMatrix(float matrix[4][4]) {
     return fabsf(matrix[3][0]) <= 0x7fff && fabsf(matrix[3][1]) <= 0x7fff && fabsf(matrix[3][2]) <= 0x7fff;
 }
 
-int cameraSetupMatrices(struct Camera* camera, struct RenderState* renderState, float aspectRatio, int extractClippingPlanes, struct CameraMatrixInfo* output) {
-    float view[4][4];
-    float combined[4][4];
-
+void cameraSetupMatrixInfo(struct Camera* camera, float aspectRatio, float view[4][4], float combined[4][4], struct CameraMatrixInfo* output) {
 	float fovy = camera->fov * 3.1415926 / 180.0;
     output->cotFov = cosf (fovy/2) / sinf (fovy/2);
     output->nearPlane = camera->nearPlane * (1.0f / SCENE_SCALE);
@@ -90,6 +87,24 @@ int cameraSetupMatrices(struct Camera* camera, struct RenderState* renderState,
     cameraBuildProjectionMatrix(camera, output->projectionMatrix, &output->perspectiveNormalize, aspectRatio);
 
     cameraBuildViewMatrix(camera, view);
+    
+    guMtxCatF(view, output->projectionMatrix, combined);
+}
+
+void cameraExtractClippingPlanes(struct Camera* camera, float combined[4][4], struct CameraMatrixInfo* output) {
+    cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[0], 0, 1.0f);
+    cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[1], 0, -1.0f);
+    cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[2], 1, 1.0f);
+    cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[3], 1, -1.0f);
+    output->cullingInformation.cameraPos = camera->transform.position;
+    output->cullingInformation.usedClippingPlaneCount = 4;
+}
+
+int cameraSetupMatrices(struct Camera* camera, struct RenderState* renderState, float aspectRatio, int extractClippingPlanes, struct CameraMatrixInfo* output) {
+    float view[4][4];
+    float combined[4][4];
+
+    cameraSetupMatrixInfo(camera, aspectRatio, view, combined, output);
 
     output->viewMtx = renderStateRequestMatrices(renderState, 1);
 
@@ -98,8 +113,6 @@ int cameraSetupMatrices(struct Camera* camera, struct RenderState* renderState,
     }
 
     guMtxF2L(view, output->viewMtx);
-    
-    guMtxCatF(view, output->projectionMatrix, combined);
 
     if (!cameraIsValidMatrix(combined)) {
         goto error;
@@ -114,12 +127,7 @@ int cameraSetupMatrices(struct Camera* camera, struct RenderState* renderState,
     guMtxF2L(combined, output->projectionView);
 
     if (extractClippingPlanes) {
-        cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[0], 0, 1.0f);
-        cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[1], 0, -1.0f);
-        cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[2], 1, 1.0f);
-        cameraExtractClippingPlane(combined, &output->cullingInformation.clippingPlanes[3], 1, -1.0f);
-        output->cullingInformation.cameraPos = camera->transform.position;
-        output->cullingInformation.usedClippingPlaneCount = 4;
+        cameraExtractClippingPlanes(camera, combined, output);
     }
 
     return 1;
@@ -127,6 +135,17 @@ error:
     return 0;
 }
 
+void cameraSetupCullingInformation(struct Camera* camera, float aspectRatio, struct CameraMatrixInfo* output) {
+    float view[4][4];
+    float combined[4][4];
+
+    cameraSetupMatrixInfo(camera, aspectRatio, view, combined, output);
+    cameraExtractClippingPlanes(camera, combined, output);
+
+    output->viewMtx = NULL;
+    output->projectionView = NULL;
+}
+
 int cameraApplyMatrices(struct RenderState* renderState, struct CameraMatrixInfo* matrixInfo) {
     Mtx* modelMatrix = renderStateRequestMatrices(renderState, 1);
     
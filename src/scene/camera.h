@@ -48,6 +48,9 @@ void cameraInit(struct Camera* camera, float fov, float near, float far);
 void cameraBuildViewMatrix(struct Camera* camera, float matrix[4][4]);
 void cameraBuildProjectionMatrix(struct Camera* camera, float matrix[4][4], u16* perspectiveNorm, float aspectRatio);
 int cameraSetupMatrices(struct Camera* camera, struct RenderState* renderState, float aspectRatio, int extractClippingPlanes, struct CameraMatrixInfo* output);
+// same as cameraSetupMatrices but doesn't allocate any display list
+// matrices. Used to cull against a camera that isn't rendered
+void cameraSetupCullingInformation(struct Camera* camera, float aspectRatio, struct CameraMatrixInfo* output);
 
 int cameraApplyMatrices(struct RenderState* renderState, struct CameraMatrixInfo* matrixInfo);
 
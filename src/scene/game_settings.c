@@ -1,15 +1,20 @@
 #include "game_settings.h"
 
 #include "../megatextures/megatexture_renderer.h"
+#include "../megatextures/megatexture_tilecache.h"
 
 struct GameSettings gUseSettings;
 
 void gameSettingsConfigure(int hasExpansion) {
     gUseSettings.displayListLength = hasExpansion ? 14400 : 3600;
-    gUseSettings.tileCacheEntryCount = hasExpansion ? 2048 : 1024;
+    gUseSettings.tileCacheSlotCount = hasExpansion ? 2048 : 1024;
+    gUseSettings.tileCachePolicy = MTTileCachePolicy2Q;
     gUseSettings.highRes = hasExpansion ? 1 : 0;
     gUseSettings.minLodBias = hasExpansion ? 0.0f : 0.0f;
     gUseSettings.minTileAxisTileCount = hasExpansion ? 4 : 2;
+    // aim for 30 fps
+    gUseSettings.frameBudgetUs = 33333.0f;
+    gUseSettings.useCoverage = 1;
 
     gMtMinLoadBias = gUseSettings.minLodBias;
 }
\ No newline at end of file
@@ -3,10 +3,15 @@
 
 struct GameSettings {
     int displayListLength;
-    int tileCacheEntryCount;
+    int tileCacheSlotCount;
+    int tileCachePolicy;
     int highRes;
     float minLodBias;
     int minTileAxisTileCount;
+    // time the lod bias controller tries to keep a frame under
+    float frameBudgetUs;
+    // skip tile rows hidden behind other megatextures, see gMtUseCoverage
+    int useCoverage;
 };
 
 extern struct GameSettings gUseSettings;
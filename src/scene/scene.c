@@ -4,6 +4,11 @@
 #include "../build/assets/materials/static.h"
 #include "../levels/level.h"
 #include "../megatextures/megatexture_renderer.h"
+#include "../megatextures/megatexture_lod_controller.h"
+#include "../megatextures/megatexture_row_cache.h"
+#include "../megatextures/megatexture_vertex_cache.h"
+#include "../megatextures/megatexture_mesh_cache.h"
+#include "../megatextures/megatexture_coverage.h"
 #include "./collision.h"
 #include "../math/mathf.h"
 
@@ -12,6 +17,7 @@
 #include "../build/src/audio/clips.h"
 
 #include "../util/time.h"
+#include "../util/memory.h"
 #include "game_settings.h"
 
 #define PLAYER_RADIUS   0.125f
@@ -34,11 +40,30 @@ void sceneInit(struct Scene* scene) {
 
     // quatAxisAngle(&gUp, -M_PI * 0.5f, &scene->camera.transform.rotation);
 
-    mtTileCacheInit(&scene->tileCache, gUseSettings.tileCacheEntryCount);
+    mtTileCacheInit(&scene->tileCache, gUseSettings.tileCacheSlotCount, gUseSettings.tileCachePolicy);
+    mtRowCacheInit(&gMtRowCache);
+    mtVertexCacheInit(&gMtVertexCache);
+    mtMeshCacheInit(&gMtMeshCache);
+    gMtUseCoverage = gUseSettings.useCoverage;
+    megatexturesInit(gLoadedLevel->megatextureIndexes, gLoadedLevel->megatextureIndexCount);
+    scene->inViewSets = malloc(sizeof(u32) * ((gLoadedLevel->megatextureIndexCount + 31) >> 5) * 2);
+    scene->bvhLastPlanes = malloc(gLoadedLevel->bvhNodeCount * 2);
+    zeroMemory(scene->bvhLastPlanes, gLoadedLevel->bvhNodeCount * 2);
 
-    for (int i = 0; i < gLoadedLevel->megatextureIndexCount; ++i) {
-        megatexturePreload(&scene->tileCache, &gLoadedLevel->megatextureIndexes[i], gUseSettings.minTileAxisTileCount);
-    }
+    // only what can be seen from where the player starts is preloaded,
+    // everything else streams in like any other tile
+    struct CameraMatrixInfo startCameraInfo;
+    cameraSetupCullingInformation(&scene->camera, (float)gScreenWidth / gScreenHeight, &startCameraInfo);
+    u32* startVisibleSet = levelDefinitionVisibleMegatextures(gLoadedLevel, &scene->camera.transform.position);
+    u32* startInView = levelDefinitionMegatexturesInView(gLoadedLevel, &startCameraInfo.cullingInformation, startVisibleSet, scene->bvhLastPlanes, scene->inViewSets);
+
+    megatexturesPreloadAll(&scene->tileCache, gLoadedLevel->megatextureIndexes, gLoadedLevel->megatextureIndexCount, startVisibleSet, startInView, gUseSettings.minTileAxisTileCount);
+
+    // preloaded tiles are what pending tiles fall back to so they have to be ready
+    mtTileCacheWaitForTiles(&scene->tileCache);
+
+    mtCameraPredictorInit(&scene->cameraPredictor);
+    mtLodControllerInit(&gMtLodController, gUseSettings.frameBudgetUs, gMtLodBias);
 
     scene->verticalVelocity = 0.0f;
 
@@ -66,14 +91,43 @@ void sceneRenderDebug(struct Scene* scene, struct RenderState* renderState) {
 
     gDPSetPrimColor(renderState->dl++, 255, 255, 255, 0, 0, 255);
     gDPFillRectangle(renderState->dl++, 64, 178, 64 + scene->tileCache.overflowRequestCount, 186);
+
+    // lod controller load, a full bar is right on budget
+    gDPFillRectangle(renderState->dl++, 64, 194, 64 + (int)(MIN(gMtLodController.load, 2.0f) * 64), 202);
+
+    // tile requests and misses saved by rows hidden behind other megatextures
+    gDPSetPrimColor(renderState->dl++, 255, 255, 0, 255, 255, 255);
+    gDPFillRectangle(renderState->dl++, 64, 210, 64 + gMtCoverage.skippedTileRequests, 218);
+    gDPFillRectangle(renderState->dl++, 64, 220, 64 + gMtCoverage.skippedTileMisses, 228);
 }
 
 int sceneRender(struct Scene* scene, struct RenderState* renderState, struct GraphicsTask* task) {
 
     struct CameraMatrixInfo cameraInfo;
-    cameraSetupMatrices(&scene->camera, renderState, (float)gScreenWidth / gScreenHeight, 1, &cameraInfo);
+    float aspectRatio = (float)gScreenWidth / gScreenHeight;
+    cameraSetupMatrices(&scene->camera, renderState, aspectRatio, 1, &cameraInfo);
     cameraApplyMatrices(renderState, &cameraInfo);
 
+    mtCameraPredictorUpdate(&scene->cameraPredictor, &scene->camera.transform);
+
+    struct Camera predictedCamera;
+    struct CameraMatrixInfo predictedCameraInfo;
+    struct CameraMatrixInfo* prefetchCameraInfo = NULL;
+    u32* prefetchVisibleSet = NULL;
+
+    int setSize = sizeof(u32) * ((gLoadedLevel->megatextureIndexCount + 31) >> 5);
+    u32* inViewSets = scene->inViewSets;
+
+    u32* visibleSet = levelDefinitionVisibleMegatextures(gLoadedLevel, &scene->camera.transform.position);
+    visibleSet = levelDefinitionMegatexturesInView(gLoadedLevel, &cameraInfo.cullingInformation, visibleSet, scene->bvhLastPlanes, inViewSets);
+
+    if (mtCameraPredictorPredict(&scene->cameraPredictor, &scene->camera, MT_PREFETCH_FRAMES, &predictedCamera)) {
+        cameraSetupCullingInformation(&predictedCamera, aspectRatio, &predictedCameraInfo);
+        prefetchCameraInfo = &predictedCameraInfo;
+        prefetchVisibleSet = levelDefinitionVisibleMegatextures(gLoadedLevel, &predictedCamera.transform.position);
+        prefetchVisibleSet = levelDefinitionMegatexturesInView(gLoadedLevel, &predictedCameraInfo.cullingInformation, prefetchVisibleSet, scene->bvhLastPlanes + gLoadedLevel->bvhNodeCount, (u32*)((char*)inViewSets + setSize));
+    }
+
     gSPDisplayList(renderState->dl++, static_tile_image);
 
     u8 color = 0;
@@ -84,7 +138,11 @@ int sceneRender(struct Scene* scene, struct RenderState* renderState, struct Gra
 
     gDPSetPrimColor(renderState->dl++, 255, 255, color, color, color, 255);
 
-    if (!megatexturesRenderAll(&scene->tileCache, gLoadedLevel->megatextureIndexes, gLoadedLevel->megatextureIndexCount, &cameraInfo, renderState)) {
+    mtLodControllerReportGraphicsTime(&gMtLodController, gLastGraphicsTaskTimeUs);
+
+    int didRender = megatexturesRenderAll(&scene->tileCache, gLoadedLevel->megatextureIndexes, gLoadedLevel->megatextureIndexCount, gLoadedLevel->bspNodes, visibleSet, &cameraInfo, prefetchCameraInfo, prefetchVisibleSet, renderState);
+
+    if (!didRender) {
         return 0;
     }
 
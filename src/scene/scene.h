@@ -7,12 +7,19 @@
 #include "../graphics/renderstate.h"
 #include "../graphics/graphics.h"
 #include "../megatextures/megatexture_tilecache.h"
+#include "../megatextures/megatexture_prefetch.h"
 
 #include "../audio/soundplayer.h"
 
 struct Scene {
     struct Camera camera;
     struct MTTileCache tileCache;
+    struct MTCameraPredictor cameraPredictor;
+    // the megatextures in view of the camera and the predicted camera
+    u32* inViewSets;
+    // the bvh plane that last culled each node, for the camera
+    // then the predicted camera, see mtBvhCull
+    u8* bvhLastPlanes;
     float verticalVelocity;
     float fadeTimer;
     ALSndId leftChannel;
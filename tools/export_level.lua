@@ -2,13 +2,20 @@
 local sk_definition_writer = require('sk_definition_writer')
 local megatexture = require('tools.export_level.megatexture')
 local collision = require('tools.export_level.collision')
+local visibility = require('tools.export_level.visibility')
 
 sk_definition_writer.add_header('"levels/level_definition.h"')
 
 sk_definition_writer.add_definition("world", "struct LevelDefinition", "_geo", {
     megatextureIndexes = sk_definition_writer.reference_to(megatexture.megatexture_indexes, 1),
     megatextureIndexCount = #megatexture.megatexture_indexes,
+    bspNodes = megatexture.bsp_nodes and sk_definition_writer.reference_to(megatexture.bsp_nodes, 1),
+    bvhNodes = megatexture.bvh_nodes and sk_definition_writer.reference_to(megatexture.bvh_nodes, 1),
+    bvhIndices = megatexture.bvh_indices and sk_definition_writer.reference_to(megatexture.bvh_indices, 1),
+    bvhNodeCount = megatexture.bvh_nodes and #megatexture.bvh_nodes or 0,
 
     collisionQuads = sk_definition_writer.reference_to(collision.colliders, 1),
     collisionQuadCount = #collision.colliders,
+
+    visibility = visibility.visibility,
 })
\ No newline at end of file
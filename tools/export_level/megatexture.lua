@@ -512,7 +512,44 @@ local function is_power_of_2(value)
     return true
 end
 
-local function build_megatexture_model(world_mesh)
+-- rip-map layers are squashed 2 and 4 times along one axis, see
+-- MT_MAX_RIP_SHIFT in src/megatextures/megatexture_renderer.h
+local RIP_MAP_MAX_SHIFT = 2
+local RIP_AXIS_NAMES = {[0] = 'u', [1] = 'v'}
+
+-- each chain starts with the texture squashed along axis and keeps
+-- halving it like the regular layers while that axis is a tile or more
+local function build_rip_chains(uv_basis, normal, edge_loops, texture)
+    local result = {}
+
+    for axis = 0, 1 do
+        for ratio_shift = 1, RIP_MAP_MAX_SHIFT do
+            local width = axis == 0 and texture.width >> ratio_shift or texture.width
+            local height = axis == 1 and texture.height >> ratio_shift or texture.height
+            local layers = {}
+
+            while (axis == 0 and width or height) >= 32 do
+                local current_texture = texture:resize(width, height)
+                local lod = RIP_AXIS_NAMES[axis] .. ratio_shift .. '_' .. (#layers + 1)
+                table.insert(layers, build_tiles_at_lod(uv_basis, normal, edge_loops, current_texture, lod))
+                width = math.max(1, width >> 1)
+                height = math.max(1, height >> 1)
+            end
+
+            if #layers > 0 then
+                table.insert(result, {axis = axis, ratio_shift = ratio_shift, layers = layers})
+            end
+        end
+    end
+
+    return result
+end
+
+-- edge_loops is the outline of the part of world_mesh to build, the
+-- whole mesh if nil. name prefixes everything written for the model so
+-- each piece of a split mesh needs its own. With rip_map it also gets
+-- layers squashed along each axis for when it is seen at a grazing angle
+local function build_megatexture_model(world_mesh, edge_loops, name, rip_map)
     local texture = world_mesh.material.tiles[1].texture
 
     if not texture then
@@ -531,7 +568,7 @@ local function build_megatexture_model(world_mesh)
     local result = {}
 
     local uv_basis = determine_uv_basis(world_mesh)
-    local edge_loops = build_mesh_outline(world_mesh)
+    edge_loops = edge_loops or build_mesh_outline(world_mesh)
 
     local lod = 1
 
@@ -542,16 +579,435 @@ local function build_megatexture_model(world_mesh)
     end
 
     return {
-        name = world_mesh.name,
+        name = name or world_mesh.name,
         layers = result,
+        rip_chains = rip_map and build_rip_chains(uv_basis, world_mesh.normals[1], edge_loops, texture) or {},
         uv_basis = uv_basis,
         normal = world_mesh.normals[1],
         texture = texture,
     }
 end
 
+-- see src/megatextures/megatexture_tile_codec.h for the format
+local compress_tiles = true
+
+local TILE_PIXEL_COUNT = 32 * 32
+local TILE_SIZE = TILE_PIXEL_COUNT * 2
+local CODEC_MATCH = 0x8000
+local CODEC_MIN_MATCH = 2
+local CODEC_MAX_MATCH = CODEC_MIN_MATCH + 0x1F
+local CODEC_MAX_DISTANCE = 0x400
+local CODEC_SEARCH_DEPTH = 32
+
+local function tile_pixels(tile_data)
+    local result = {}
+
+    for _, element in ipairs(tile_data) do
+        for shift = 48, 0, -16 do
+            table.insert(result, (element >> shift) & 0xFFFF)
+        end
+    end
+
+    return result
+end
+
+local function find_longest_match(pixels, index, chains)
+    if index == #pixels then
+        return 0, 0
+    end
+
+    local positions = chains[(pixels[index] << 16) | pixels[index + 1]]
+
+    if not positions then
+        return 0, 0
+    end
+
+    local best_length = 0
+    local best_distance = 0
+
+    for chain_index = #positions, math.max(1, #positions - CODEC_SEARCH_DEPTH + 1), -1 do
+        local position = positions[chain_index]
+        local distance = index - position
+
+        if distance > CODEC_MAX_DISTANCE then
+            break
+        end
+
+        local length = 0
+
+        while length < CODEC_MAX_MATCH and index + length <= #pixels and pixels[position + length] == pixels[index + length] do
+            length = length + 1
+        end
+
+        if length > best_length then
+            best_length = length
+            best_distance = distance
+        end
+    end
+
+    return best_length, best_distance
+end
+
+local function add_to_chain(pixels, index, chains)
+    if index == #pixels then
+        return
+    end
+
+    local key = (pixels[index] << 16) | pixels[index + 1]
+    local positions = chains[key]
+
+    if not positions then
+        positions = {}
+        chains[key] = positions
+    end
+
+    table.insert(positions, index)
+end
+
+-- returns the compressed tile as a list of u64 or nil if the tile
+-- doesn't compress or couldn't be expanded in place
+local function compress_tile(tile_data)
+    local pixels = tile_pixels(tile_data)
+    local commands = {}
+    local chains = {}
+    local literals = {}
+
+    -- the decoder writes pixels over the compressed data in place. Track
+    -- how far the output gets ahead of the input to check that it never
+    -- overwrites commands that haven't been read yet
+    local bytes_written = 0
+    local bytes_read = 0
+    local max_lead = 0
+
+    local function end_command()
+        max_lead = math.max(max_lead, bytes_written - bytes_read)
+    end
+
+    local function flush_literals()
+        if #literals == 0 then
+            return
+        end
+
+        table.insert(commands, #literals)
+
+        for _, pixel in ipairs(literals) do
+            table.insert(commands, pixel)
+        end
+
+        bytes_read = bytes_read + 2 + #literals * 2
+        bytes_written = bytes_written + #literals * 2
+        end_command()
+
+        literals = {}
+    end
+
+    local index = 1
+
+    while index <= #pixels do
+        local length, distance = find_longest_match(pixels, index, chains)
+
+        if length >= CODEC_MIN_MATCH then
+            flush_literals()
+
+            table.insert(commands, CODEC_MATCH | ((length - CODEC_MIN_MATCH) << 10) | (distance - 1))
+            bytes_read = bytes_read + 2
+            bytes_written = bytes_written + length * 2
+            end_command()
+
+            for offset = 0, length - 1 do
+                add_to_chain(pixels, index + offset, chains)
+            end
+
+            index = index + length
+        else
+            table.insert(literals, pixels[index])
+            add_to_chain(pixels, index, chains)
+            index = index + 1
+        end
+    end
+
+    flush_literals()
+
+    -- pad the front with empty literal commands to a multiple of 8 bytes
+    local padding = (4 - #commands % 4) % 4
+    local compressed_size = (#commands + padding) * 2
+
+    -- the data is placed at the end of the cache slot
+    if compressed_size >= TILE_SIZE or max_lead > TILE_SIZE - compressed_size + padding * 2 then
+        return nil
+    end
+
+    for i = 1, padding do
+        table.insert(commands, 1, 0)
+    end
+
+    local result = {}
+
+    for i = 1, #commands, 4 do
+        table.insert(result, (commands[i] << 48) | (commands[i + 1] << 32) | (commands[i + 2] << 16) | commands[i + 3])
+    end
+
+    return result
+end
+
+-- see enum MTTileFormat in src/megatextures/tile_index.h
+local TILE_FORMAT_RGBA16 = 0
+local TILE_FORMAT_CI8 = 1
+local TILE_FORMAT_CI4 = 2
+local TILE_FORMAT_IA8 = 3
+local TILE_FORMAT_I4 = 4
+
+-- tiles are stored in the smallest format that keeps every
+-- color channel within this many 8 bit steps of the original
+local adaptive_tile_formats = true
+local tile_format_max_error = 8
+
+local function rgba16_channels(pixel)
+    local r = (pixel >> 11) & 0x1F
+    local g = (pixel >> 6) & 0x1F
+    local b = (pixel >> 1) & 0x1F
+
+    return (r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2), pixel & 1
+end
+
+local function rgba16_error(a, b)
+    if (a & 1) ~= (b & 1) then
+        return math.huge
+    end
+
+    local ar, ag, ab = rgba16_channels(a)
+    local br, bg, bb = rgba16_channels(b)
+
+    return math.max(math.abs(ar - br), math.abs(ag - bg), math.abs(ab - bb))
+end
+
+-- packs a list of bytes into u64 padding the end with zeros
+local function bytes_to_u64(bytes)
+    local result = {}
+
+    for i = 1, #bytes, 8 do
+        local element = 0
+
+        for offset = 0, 7 do
+            element = (element << 8) | (bytes[i + offset] or 0)
+        end
+
+        table.insert(result, element)
+    end
+
+    return result
+end
+
+-- I4 for opaque greyscale tiles, IA8 if some pixels are transparent
+local function encode_intensity_tile(pixels)
+    local intensities = {}
+    local has_alpha = false
+
+    for _, pixel in ipairs(pixels) do
+        local r, g, b, a = rgba16_channels(pixel)
+        local intensity = math.floor((r + g + b) / 3 * 15 / 255 + 0.5)
+        local expanded = intensity * 17
+
+        if math.max(math.abs(expanded - r), math.abs(expanded - g), math.abs(expanded - b)) > tile_format_max_error then
+            return nil
+        end
+
+        has_alpha = has_alpha or a == 0
+        table.insert(intensities, {intensity = intensity, alpha = a})
+    end
+
+    local bytes = {}
+
+    if has_alpha then
+        for _, texel in ipairs(intensities) do
+            table.insert(bytes, (texel.intensity << 4) | (texel.alpha * 0xF))
+        end
+
+        return TILE_FORMAT_IA8, bytes_to_u64(bytes)
+    end
+
+    for i = 1, #intensities, 2 do
+        table.insert(bytes, (intensities[i].intensity << 4) | intensities[i + 1].intensity)
+    end
+
+    return TILE_FORMAT_I4, bytes_to_u64(bytes)
+end
+
+-- CI8 or CI4 with the palette after the texels. If the tile has more
+-- colors than fit in the palette the most common are kept and the
+-- rest are replaced with the closest one if it is close enough
+local function encode_palette_tile(pixels, max_colors)
+    local counts = {}
+    local colors = {}
+
+    for _, pixel in ipairs(pixels) do
+        if not counts[pixel] then
+            counts[pixel] = 0
+            table.insert(colors, pixel)
+        end
+
+        counts[pixel] = counts[pixel] + 1
+    end
+
+    table.sort(colors, function(a, b)
+        if counts[a] ~= counts[b] then
+            return counts[a] > counts[b]
+        end
+
+        return a < b
+    end)
+
+    local palette = {}
+    local palette_index = {}
+
+    for i = 1, math.min(#colors, max_colors) do
+        table.insert(palette, colors[i])
+        palette_index[colors[i]] = i - 1
+    end
+
+    for i = max_colors + 1, #colors do
+        local color = colors[i]
+        local best_index = nil
+        local best_error = tile_format_max_error + 1
+
+        for index, entry in ipairs(palette) do
+            local color_error = rgba16_error(color, entry)
+
+            if color_error < best_error then
+                best_error = color_error
+                best_index = index - 1
+            end
+        end
+
+        if not best_index then
+            return nil
+        end
+
+        palette_index[color] = best_index
+    end
+
+    local bytes = {}
+
+    if max_colors == 16 then
+        for i = 1, #pixels, 2 do
+            table.insert(bytes, (palette_index[pixels[i]] << 4) | palette_index[pixels[i + 1]])
+        end
+    else
+        for _, pixel in ipairs(pixels) do
+            table.insert(bytes, palette_index[pixel])
+        end
+    end
+
+    -- the palette is loaded in 8 byte words
+    while #palette % 4 ~= 0 do
+        table.insert(palette, 0)
+    end
+
+    for _, color in ipairs(palette) do
+        table.insert(bytes, color >> 8)
+        table.insert(bytes, color & 0xFF)
+    end
+
+    return max_colors == 16 and TILE_FORMAT_CI4 or TILE_FORMAT_CI8, bytes_to_u64(bytes)
+end
+
+-- returns the format and data of the smallest encoding of a tile
+local function encode_tile(tile_data)
+    local best_format = TILE_FORMAT_RGBA16
+    local best_data = tile_data
+
+    local compressed = compress_tiles and compress_tile(tile_data)
+
+    if compressed then
+        best_data = compressed
+    end
+
+    -- an uncompressed tile wins ties since it doesn't need decoding
+    local best_is_compressed = compressed and true or false
+
+    if not adaptive_tile_formats then
+        return best_format, best_data
+    end
+
+    local pixels = tile_pixels(tile_data)
+    local encodings = {
+        {encode_intensity_tile(pixels)},
+        {encode_palette_tile(pixels, 16)},
+        {encode_palette_tile(pixels, 256)},
+    }
+
+    for _, encoding in ipairs(encodings) do
+        local format, data = encoding[1], encoding[2]
+
+        if format and (#data < #best_data or (#data == #best_data and best_is_compressed)) then
+            best_format = format
+            best_data = data
+            best_is_compressed = false
+        end
+    end
+
+    return best_format, best_data
+end
+
+-- every unique tile in the level. Identical tiles from any image layer
+-- of any megatexture are only written once so they share a rom address
+-- and the tile cache treats them as the same tile
+local tile_pool = {}
+local tile_pool_size = 0
+local tile_pool_entries = {}
+
+sk_definition_writer.add_definition('megatexture_tiles', 'u64[]', '_img', tile_pool)
+
+local function add_tile_to_pool(tile_data)
+    local content_key = table.concat(tile_data, ',')
+    local existing = tile_pool_entries[content_key]
+
+    if existing then
+        return existing
+    end
+
+    local format
+    format, tile_data = encode_tile(tile_data)
+
+    if tile_pool_size >= (1 << 21) then
+        error('megatexture tiles are larger than the 16MB that can be addressed')
+    end
+
+    -- format, offset and size minus one in 8 byte units
+    local entry = (format << 29) | (tile_pool_size << 8) | (#tile_data - 1)
+
+    for _, element in ipairs(tile_data) do
+        table.insert(tile_pool, element)
+        tile_pool_size = tile_pool_size + 1
+
+        if tile_pool_size % 8 == 0 then
+            table.insert(tile_pool, sk_definition_writer.newline)
+        end
+    end
+
+    table.insert(tile_pool, sk_definition_writer.newline)
+
+    tile_pool_entries[content_key] = entry
+
+    return entry
+end
+
 local image_index = {}
 
+-- interleaves the bits of x and y so tiles near each other on
+-- screen end up near each other in rom and can share a dma
+local function morton_key(x, y)
+    local result = 0
+    local bit = 0
+
+    while (x >> bit) > 0 or (y >> bit) > 0 do
+        result = result | (((x >> bit) & 1) << (bit * 2)) | (((y >> bit) & 1) << (bit * 2 + 1))
+        bit = bit + 1
+    end
+
+    return result
+end
+
 local function get_tiles_reference(tile_layer)
     local key = tile_layer.texture.name .. '_' .. tile_layer.texture.width .. 'x' .. tile_layer.texture.height
 
@@ -559,32 +1015,34 @@ local function get_tiles_reference(tile_layer)
         return image_index[key]
     end
 
-    local image_data = {}
+    local tile_offsets = {}
+    local tile_order = {}
+    local x_tiles = #tile_layer.texture_tiles[1]
 
-    local data_index = 0
-
-    for _, row in pairs(tile_layer.texture_tiles) do
-        for _, tile in pairs(row) do
-            local tile_data = tile:get_data()
-
-            for _, element in pairs(tile_data) do
-                table.insert(image_data, element)
-                data_index = data_index + 1
+    for y, row in ipairs(tile_layer.texture_tiles) do
+        for x, tile in ipairs(row) do
+            table.insert(tile_order, {x = x, y = y, tile = tile, key = morton_key(x - 1, y - 1)})
+        end
+    end
 
-                if data_index % 8 == 0 then
-                    table.insert(image_data, sk_definition_writer.newline)
-                end
-            end
+    table.sort(tile_order, function(a, b) return a.key < b.key end)
 
-            table.insert(image_data, sk_definition_writer.newline)
-        end
+    -- tiles are added to rom in morton order but the offsets
+    -- are still indexed by row so the runtime lookup is unchanged
+    for _, entry in ipairs(tile_order) do
+        tile_offsets[(entry.y - 1) * x_tiles + entry.x] = add_tile_to_pool(entry.tile:get_data())
     end
 
-    sk_definition_writer.add_definition(key, 'u64[]', '_img', image_data)
+    sk_definition_writer.add_definition(key .. '_offsets', 'u32[]', '_geo', tile_offsets)
+
+    local result = {
+        tileSource = sk_definition_writer.reference_to(tile_pool, 1),
+        tileOffsets = sk_definition_writer.reference_to(tile_offsets, 1),
+    }
 
-    image_index[key] = sk_definition_writer.reference_to(image_data, 1)
+    image_index[key] = result
 
-    return image_index[key]
+    return result
 end
 
 local function determine_vertex_mapping(previous_loop, loop, next_loop)
@@ -659,10 +1117,8 @@ local function determine_vertex_mapping(previous_loop, loop, next_loop)
     }
 end
 
+-- vertices are stored as where they are on the texture, see struct MTVertex
 local function convert_vertex(vertex, megatexture_model)
-    local scaled = vertex * sk_input.settings.fixed_point_scale
-    local scaled_normal = megatexture_model.normal * 127
-
     local right = megatexture_model.uv_basis.right
     local up = megatexture_model.uv_basis.up
 
@@ -674,20 +1130,10 @@ local function convert_vertex(vertex, megatexture_model)
     u = math.floor(u * megatexture_model.texture.width * (1 << 5) + 0.5)
     v = math.floor(v * megatexture_model.texture.height * (1 << 5) + 0.5)
 
-    if u >= 0x8000 then
-        u = 0x7FFF
-    end
-
-    if v >= 0x8000 then
-        v = 0x7FFF
-    end
-
-    return {{
-        {math.floor(scaled.x + 0.5), math.floor(scaled.y + 0.5), math.floor(scaled.z + 0.5)},
-        0,
-        {u, v},
-        {math.floor(scaled_normal.x + 0.5), math.floor(scaled_normal.y + 0.5), math.floor(scaled_normal.z + 0.5), 255},
-    }}
+    return {
+        math.max(0, math.min(u, 0xFFFF)),
+        math.max(0, math.min(v, 0xFFFF)),
+    }
 end
 
 local function calc_bits_needed(width)
@@ -969,12 +1415,242 @@ local function fill_mesh(megatexture_model, loops)
     return { vertices = vertices, faces = faces }
 end
 
+-- see gbi.h, triangles are baked for F3DEX2
+local VERTEX_CACHE_SIZE = 32
+local G_TRI1 = 0x05
+local G_TRI2 = 0x06
+local G_ENDDL = 0xDF
+
+local function triangle_word(a, b, c)
+    return ((a * 2) << 16) | ((b * 2) << 8) | (c * 2)
+end
+
+-- returns the commands to draw a list of triangle indices
+local function bake_triangles(indices)
+    local result = {}
+    local index = 1
+
+    while index + 5 <= #indices do
+        table.insert(result, {{
+            (G_TRI2 << 24) | triangle_word(indices[index], indices[index + 1], indices[index + 2]),
+            triangle_word(indices[index + 3], indices[index + 4], indices[index + 5]),
+        }})
+        index = index + 6
+    end
+
+    if index + 2 <= #indices then
+        table.insert(result, {{(G_TRI1 << 24) | triangle_word(indices[index], indices[index + 1], indices[index + 2]), 0}})
+    end
+
+    table.insert(result, {{G_ENDDL << 24, 0}})
+
+    return result
+end
+
+-- splits a row into windows of vertices that fit in the vertex cache
+-- and bakes the triangles of each tile relative to its window. The
+-- window is carried over from the row before so short rows share a
+-- single vertex load at runtime. Returns the baked tiles of the row
+local function bake_row_triangles(row_tiles, triangles, previous_triangles, window)
+    local row_end = nil
+    local result = {}
+
+    for _, tile in ipairs(row_tiles) do
+        if #tile.indices > 0 then
+            row_end = tile.startVertex + tile.vertexCount
+        end
+    end
+
+    -- a row only continues the window if all of it fits, otherwise
+    -- the row would need one more load than if it started its own
+    if window.start and row_end and row_end - window.start > VERTEX_CACHE_SIZE then
+        window.start = nil
+    end
+
+    for _, tile in ipairs(row_tiles) do
+        local indices = tile.indices
+
+        if #indices > 0 and tile.vertexCount > VERTEX_CACHE_SIZE then
+            print('warning: a megatexture tile has ' .. tile.vertexCount .. ' vertices, more than fit in the vertex cache. It will not be drawn')
+            indices = {}
+        end
+
+        local baked = {
+            startVertex = tile.startVertex,
+            vertexCount = tile.vertexCount,
+        }
+
+        if #indices > 0 then
+            if not window.start or tile.startVertex + tile.vertexCount - window.start > VERTEX_CACHE_SIZE then
+                window.start = tile.startVertex
+            end
+
+            local window_start = window.start
+
+            local window_indices = {}
+
+            for _, index in ipairs(indices) do
+                table.insert(window_indices, index + tile.startVertex - window_start)
+            end
+
+            local key = table.concat(window_indices, ', ')
+            local triangle_start = previous_triangles[key]
+
+            if not triangle_start then
+                triangle_start = #triangles
+                previous_triangles[key] = triangle_start
+
+                for _, command in ipairs(bake_triangles(window_indices)) do
+                    table.insert(triangles, command)
+                end
+            end
+
+            baked.windowStart = window_start
+            baked.triangleStart = triangle_start
+            baked.triangleCount = #window_indices // 3
+        else
+            baked.windowStart = window.start or tile.startVertex
+            baked.triangleStart = 0
+            baked.triangleCount = 0
+        end
+
+        table.insert(result, baked)
+    end
+
+    return result
+end
+
+-- layers with at least this many tiles on a side are only drawn near
+-- the camera so their meshes are read from rom in blocks of rows as
+-- they are needed instead of staying in ram, see megatexture_mesh_cache.h
+local MESH_STREAM_MIN_AXIS = 16
+-- MT_MESH_BLOCK_SIZE
+local MESH_BLOCK_SIZE = 8 * 1024
+
+local function push_u16(bytes, value)
+    table.insert(bytes, (value >> 8) & 0xFF)
+    table.insert(bytes, value & 0xFF)
+end
+
+local function push_u32(bytes, value)
+    push_u16(bytes, (value >> 16) & 0xFFFF)
+    push_u16(bytes, value & 0xFFFF)
+end
+
+local function pad_to_u64(bytes)
+    while #bytes % 8 ~= 0 do
+        table.insert(bytes, 0)
+    end
+end
+
+-- bakes the rows from first_row to last_row into the bytes of a struct
+-- MTMeshBlock. Triangles are numbered from the start of the block and
+-- the vertex window starts over so the block doesn't need any other
+local function bake_mesh_block(rows, first_row, last_row, min_tile_x, max_tile_x, vertices)
+    local triangles = {}
+    local previous_triangles = {}
+    local window = {}
+    local tiles = {}
+    local first_vertex = nil
+    local vertex_end = nil
+
+    for y = first_row, last_row do
+        for x, tile in ipairs(bake_row_triangles(rows[y], triangles, previous_triangles, window)) do
+            if x >= min_tile_x and x <= max_tile_x then
+                table.insert(tiles, tile)
+                first_vertex = math.min(first_vertex or tile.startVertex, tile.startVertex)
+                vertex_end = math.max(vertex_end or 0, tile.startVertex + tile.vertexCount)
+            end
+        end
+    end
+
+    local bytes = {}
+
+    for _, tile in ipairs(tiles) do
+        push_u16(bytes, tile.startVertex)
+        push_u16(bytes, tile.windowStart)
+        push_u16(bytes, tile.triangleStart)
+        table.insert(bytes, tile.triangleCount)
+        table.insert(bytes, tile.vertexCount)
+    end
+
+    pad_to_u64(bytes)
+    local vertex_offset = #bytes
+
+    for i = first_vertex + 1, vertex_end do
+        push_u16(bytes, vertices[i][1])
+        push_u16(bytes, vertices[i][2])
+    end
+
+    pad_to_u64(bytes)
+    local triangle_offset = #bytes
+
+    for _, command in ipairs(triangles) do
+        push_u32(bytes, command[1][1])
+        push_u32(bytes, command[1][2])
+    end
+
+    return {
+        bytes = bytes,
+        vertex_offset = vertex_offset,
+        triangle_offset = triangle_offset,
+        first_vertex = first_vertex,
+        vertex_end = vertex_end,
+    }
+end
+
+-- splits the rows into the fewest blocks that each fit in
+-- MESH_BLOCK_SIZE. Returns nil if a single row doesn't fit
+local function bake_mesh_blocks(rows, min_tile_x, min_tile_y, max_tile_x, max_tile_y, vertices)
+    for block_rows = max_tile_y - min_tile_y + 1, 1, -1 do
+        local blocks = {}
+        local fits = true
+
+        for first_row = min_tile_y, max_tile_y, block_rows do
+            local block = bake_mesh_block(rows, first_row, math.min(first_row + block_rows - 1, max_tile_y), min_tile_x, max_tile_x, vertices)
+
+            if #block.bytes > MESH_BLOCK_SIZE then
+                fits = false
+                break
+            end
+
+            table.insert(blocks, block)
+        end
+
+        if fits then
+            return blocks, block_rows
+        end
+    end
+
+    return nil
+end
+
+local function write_mesh_blocks(megatexture_model, layer, blocks)
+    local result = {}
+
+    for index, block in ipairs(blocks) do
+        local data = bytes_to_u64(block.bytes)
+
+        sk_definition_writer.add_definition(megatexture_model.name .. '_mesh_' .. layer.lod .. '_' .. (index - 1), 'u64[]', '_img', data)
+
+        table.insert(result, {
+            romAddress = sk_definition_writer.reference_to(data, 1),
+            size = #data * 8,
+            vertexOffset = block.vertex_offset,
+            triangleOffset = block.triangle_offset,
+            firstVertex = block.first_vertex,
+            vertexEnd = block.vertex_end,
+        })
+    end
+
+    sk_definition_writer.add_definition(megatexture_model.name .. '_mesh_blocks_' .. layer.lod, 'struct MTMeshBlock[]', '_geo', result)
+
+    return result
+end
+
 local function write_mesh_tiles(megatexture_model, layer)
     local vertices = {}
-    local indices = {}
-    local index_count = 0
-    local previous_indices = {}
-    local tiles = {}
+    local rows = {}
 
     min_tile_x = layer.tile_count_x
     min_tile_y = layer.tile_count_y
@@ -983,6 +1659,7 @@ local function write_mesh_tiles(megatexture_model, layer)
     max_tile_y = 0
 
     for y, row in ipairs(layer.mesh_tiles) do
+        local row_tiles = {}
         local current_mesh_data = nil
         local next_mesh_data = row[1] and fill_mesh(megatexture_model, row[1])
         local prev_overlap = nil
@@ -1027,109 +1704,445 @@ local function write_mesh_tiles(megatexture_model, layer)
                 table.insert(current_indices, vertex_mapping.old_to_new_index[triangle[3]] - 1)
             end
 
-            local indices_as_string = table.concat(current_indices, ', ')
+            table.insert(row_tiles, {
+                startVertex = beginning_vertex - 1,
+                vertexCount = #current_loop,
+                indices = current_indices,
+            })
+        end
 
-            local index_information = previous_indices[indices_as_string]
+        table.insert(rows, row_tiles)
+    end
 
-            if index_information then
-                if #current_indices > 0 then
-                    table.insert(indices, sk_definition_writer.comment(table.concat(current_indices, ', ') .. ' reused from previous entry'))
-                    table.insert(indices, sk_definition_writer.newline)
-                end
-            else
-                index_information = {
-                    start_index = index_count,
-                    index_count = #current_indices,
-                }
-                previous_indices[indices_as_string] = index_information
-
-                for _, current in ipairs(current_indices) do
-                    table.insert(indices, current)
-                end
+    local result = {
+        vertexCount = #vertices,
 
-                index_count = index_count + #current_indices
-                table.insert(indices, sk_definition_writer.newline)
-            end
+        minTileX = min_tile_x - 1,
+        minTileY = min_tile_y - 1,
+        maxTileX = max_tile_x,
+        maxTileY = max_tile_y,
+    }
 
-            table.insert(tiles, {
-                startVertex = beginning_vertex - 1,
-                startIndex = index_information.start_index,
-                indexCount = index_information.index_count,
-                vertexCount = #current_loop,
-            })
+    if math.max(layer.tile_count_x, layer.tile_count_y) >= MESH_STREAM_MIN_AXIS and max_tile_y >= min_tile_y then
+        local blocks, block_rows = bake_mesh_blocks(rows, min_tile_x, min_tile_y, max_tile_x, max_tile_y, vertices)
+
+        if blocks then
+            result.blocks = sk_definition_writer.reference_to(write_mesh_blocks(megatexture_model, layer, blocks), 1)
+            result.blockRows = block_rows
+            return result
         end
 
-        table.insert(indices, sk_definition_writer.newline)
+        print('warning: a row of ' .. megatexture_model.name .. ' is larger than a mesh block, its mesh will stay in ram')
     end
 
+    local triangles = {}
+    local previous_triangles = {}
+    local window = {}
     local filtered_tiles = {}
 
-    for index, tile in ipairs(tiles) do
-        offset = index - 1
-        x = (offset % layer.tile_count_x) + 1
-        y = (offset // layer.tile_count_x) + 1
-
-        if x >= min_tile_x and x <= max_tile_x and y >= min_tile_y and y <= max_tile_y then
-            table.insert(filtered_tiles, tile)
+    for y, row_tiles in ipairs(rows) do
+        for x, tile in ipairs(bake_row_triangles(row_tiles, triangles, previous_triangles, window)) do
+            if x >= min_tile_x and x <= max_tile_x and y >= min_tile_y and y <= max_tile_y then
+                table.insert(filtered_tiles, tile)
+            end
         end
     end
 
-    sk_definition_writer.add_definition(megatexture_model.name .. '_vertices_' .. layer.lod, 'Vtx[]', '_geo', vertices)
-    sk_definition_writer.add_definition(megatexture_model.name .. '_indices_' .. layer.lod, 'u8[]', '_geo', indices)
+    sk_definition_writer.add_definition(megatexture_model.name .. '_vertices_' .. layer.lod, 'struct MTVertex[]', '_geo', vertices)
+    sk_definition_writer.add_definition(megatexture_model.name .. '_triangles_' .. layer.lod, 'Gfx[]', '_geo', triangles)
     sk_definition_writer.add_definition(megatexture_model.name .. '_tiles_' .. layer.lod, 'struct MTMeshTile[]', '_geo', filtered_tiles)
 
-    return {
-        vertices = sk_definition_writer.reference_to(vertices, 1),
-        indices = sk_definition_writer.reference_to(indices, 1),
-        tiles = sk_definition_writer.reference_to(filtered_tiles, 1),
+    result.vertices = sk_definition_writer.reference_to(vertices, 1)
+    result.triangles = sk_definition_writer.reference_to(triangles, 1)
+    result.tiles = sk_definition_writer.reference_to(filtered_tiles, 1)
 
-        minTileX = min_tile_x - 1,
-        minTileY = min_tile_y - 1,
-        maxTileX = max_tile_x,
-        maxTileY = max_tile_y,
-    }
-end 
+    return result
+end
+
+-- true if no texel of the layer is transparent
+local function is_layer_opaque(layer)
+    for _, row in ipairs(layer.texture_tiles) do
+        for _, tile in ipairs(row) do
+            for _, pixel in ipairs(tile_pixels(tile:get_data())) do
+                if pixel & 1 == 0 then
+                    return false
+                end
+            end
+        end
+    end
+
+    return true
+end
+
+-- a megatexture only hides what is behind it where its outline fills
+-- the rectangle around it in uv space
+local OCCLUDER_AREA_TOLERANCE = 0.001
+
+-- returns the uv bounds of the outline if it fills them
+local function find_occluder_uv(uv_basis, edge_loops)
+    local right_scale = 1 / uv_basis.right:dot(uv_basis.right)
+    local up_scale = 1 / uv_basis.up:dot(uv_basis.up)
+
+    local min_u = math.huge
+    local min_v = math.huge
+    local max_u = -math.huge
+    local max_v = -math.huge
+    local area = 0
+
+    for _, loop in ipairs(edge_loops) do
+        local uvs = {}
+
+        for _, point in ipairs(loop) do
+            local offset = point - uv_basis.origin
+            local u = offset:dot(uv_basis.right) * right_scale
+            local v = offset:dot(uv_basis.up) * up_scale
+
+            min_u = math.min(min_u, u)
+            min_v = math.min(min_v, v)
+            max_u = math.max(max_u, u)
+            max_v = math.max(max_v, v)
+
+            table.insert(uvs, {u = u, v = v})
+        end
+
+        -- holes wind the other way so they are subtracted
+        for index, uv in ipairs(uvs) do
+            local next_uv = uvs[index % #uvs + 1]
+            area = area + uv.u * next_uv.v - next_uv.u * uv.v
+        end
+    end
+
+    local bounds_area = (max_u - min_u) * (max_v - min_v)
+
+    if bounds_area <= 0 or math.abs(math.abs(area) * 0.5 - bounds_area) > bounds_area * OCCLUDER_AREA_TOLERANCE then
+        return nil
+    end
+
+    return {x = min_u, y = min_v}, {x = max_u, y = max_v}
+end
+
+local MT_NO_PARENT_LAYER = 0xFF
 
-local function write_tile_index(world_mesh, megatexture_model, sort_group)
+local function write_image_layer(megatexture_model, layer, layers, imageLayers, u_shift, v_shift, parent_layer)
+    table.insert(layers, write_mesh_tiles(megatexture_model, layer))
+
+    local tiles_reference = get_tiles_reference(layer)
+
+    table.insert(imageLayers, {
+        tileSource = tiles_reference.tileSource,
+        tileOffsets = tiles_reference.tileOffsets,
+        xTiles = layer.tile_count_x,
+        yTiles = layer.tile_count_y,
+        maxTileAxisTileCount = math.max(layer.tile_count_x, layer.tile_count_y),
+        uShift = u_shift,
+        vShift = v_shift,
+        parentLayer = parent_layer,
+    })
+end
+
+local function write_tile_index(surface, megatexture_model, is_opaque)
     local layers = {}
     local imageLayers = {}
+    local layer_count = #megatexture_model.layers
+
+    for index, layer in ipairs(megatexture_model.layers) do
+        write_image_layer(megatexture_model, layer, layers, imageLayers, index - 1, index - 1, index < layer_count and index or MT_NO_PARENT_LAYER)
+    end
 
-    for _, layer in pairs(megatexture_model.layers) do
-        table.insert(layers, write_mesh_tiles(megatexture_model, layer))
+    -- rip layers come after the regular layers, see struct MTRipChain
+    local rip_chains = {}
+
+    for _, chain in ipairs(megatexture_model.rip_chains) do
+        local first_layer = #layers
+
+        for index, layer in ipairs(chain.layers) do
+            local squashed_shift = index - 1 + chain.ratio_shift
+            -- the last layer falls back to the regular layer
+            -- with the texels of the squashed axis
+            local parent_layer = index < #chain.layers and first_layer + index or math.min(squashed_shift, layer_count - 1)
+
+            write_image_layer(
+                megatexture_model,
+                layer,
+                layers,
+                imageLayers,
+                chain.axis == 0 and squashed_shift or index - 1,
+                chain.axis == 1 and squashed_shift or index - 1,
+                parent_layer
+            )
+        end
 
-        table.insert(imageLayers, {
-            tileSource = get_tiles_reference(layer),
-            xTiles = layer.tile_count_x,
-            yTiles = layer.tile_count_y,
-            maxTileAxisTileCount = math.max(layer.tile_count_x, layer.tile_count_y),
+        table.insert(rip_chains, {
+            firstLayer = first_layer,
+            layerCount = #chain.layers,
+            axis = chain.axis,
+            ratioShift = chain.ratio_shift,
         })
     end
 
-    sk_definition_writer.add_definition(world_mesh.name .. '__mesh_layers', 'struct MTMeshLayer[]', '_geo', layers)
-    sk_definition_writer.add_definition(world_mesh.name .. '__image_layers', 'struct MTImageLayer[]', '_geo', imageLayers)
+    if #rip_chains > 0 then
+        sk_definition_writer.add_definition(surface.name .. '__rip_chains', 'struct MTRipChain[]', '_geo', rip_chains)
+    end
+
+    sk_definition_writer.add_definition(surface.name .. '__mesh_layers', 'struct MTMeshLayer[]', '_geo', layers)
+    sk_definition_writer.add_definition(surface.name .. '__image_layers', 'struct MTImageLayer[]', '_geo', imageLayers)
+
+    local occluder_min_uv = nil
+    local occluder_max_uv = nil
+
+    if is_opaque then
+        occluder_min_uv, occluder_max_uv = find_occluder_uv(megatexture_model.uv_basis, surface.edge_loops)
+    end
 
     return {
         meshLayers = sk_definition_writer.reference_to(layers, 1),
         imageLayers = sk_definition_writer.reference_to(imageLayers, 1),
-        layerCount = #layers,
-        boundingBox = world_mesh.bb,
+        layerCount = layer_count,
+        ripChains = #rip_chains > 0 and sk_definition_writer.reference_to(rip_chains, 1) or nil,
+        ripChainCount = #rip_chains,
+        ripLayerCount = #layers - layer_count,
+        boundingBox = surface.bb,
         uvBasis = {
             uvOrigin = megatexture_model.uv_basis.origin,
             uvRight = megatexture_model.uv_basis.right,
             uvUp = megatexture_model.uv_basis.up,
-            normal = world_mesh.normals[1],
+            normal = surface.normal,
         },
         minUv = {x = layers[1].minTileX / imageLayers[1].xTiles, y = layers[1].minTileY / imageLayers[1].yTiles},
         maxUv = {x = layers[1].maxTileX / imageLayers[1].xTiles, y = layers[1].maxTileY / imageLayers[1].yTiles},
+        occluderMinUv = occluder_min_uv or {x = 0, y = 0},
+        occluderMaxUv = occluder_max_uv or {x = 0, y = 0},
         worldPixelSize = math.sqrt(
             (megatexture_model.uv_basis.right:magnitude() / megatexture_model.texture.width) *
             (megatexture_model.uv_basis.up:magnitude() / megatexture_model.texture.height)
         ),
-        sortGroup = sort_group,
+        sortGroup = surface.sort_group,
     }
 end
 
+-- megatextures are split along each others planes into a bsp tree so
+-- they can be drawn in order without sorting them at runtime, see
+-- src/megatextures/megatexture_bsp.h. When false they are sorted by
+-- sort_group and then by distance from the camera every frame
+local build_bsp = true
+-- each split adds a megatexture so it costs more than an unbalanced tree
+local BSP_SPLIT_COST = 8
+
+local function create_surface(world_mesh, sort_group, rip_map)
+    local normal = world_mesh.normals[1]
+
+    return {
+        world_mesh = world_mesh,
+        name = world_mesh.name,
+        edge_loops = build_mesh_outline(world_mesh),
+        normal = normal,
+        plane = sk_math.plane3_with_point(normal, world_mesh.vertices[1]),
+        plane_d = -normal:dot(world_mesh.vertices[1]),
+        bb = world_mesh.bb,
+        sort_group = sort_group,
+        rip_map = rip_map,
+    }
+end
+
+local function edge_loops_bb(edge_loops)
+    local min = nil
+    local max = nil
+
+    for _, loop in ipairs(edge_loops) do
+        for _, point in ipairs(loop) do
+            if min then
+                min = sk_math.vector3(math.min(min.x, point.x), math.min(min.y, point.y), math.min(min.z, point.z))
+                max = sk_math.vector3(math.max(max.x, point.x), math.max(max.y, point.y), math.max(max.z, point.z))
+            else
+                min = point
+                max = point
+            end
+        end
+    end
+
+    return {min = min, max = max}
+end
+
+local function bb_union(a, b)
+    if not a then
+        return b
+    end
+
+    return {
+        min = sk_math.vector3(math.min(a.min.x, b.min.x), math.min(a.min.y, b.min.y), math.min(a.min.z, b.min.z)),
+        max = sk_math.vector3(math.max(a.max.x, b.max.x), math.max(a.max.y, b.max.y), math.max(a.max.z, b.max.z)),
+    }
+end
+
+-- returns the closest and furthest distance of surface from plane,
+-- both are 0 if surface is in the plane
+local function surface_distance_range(surface, plane)
+    local min_distance = 0
+    local max_distance = 0
+
+    for _, loop in ipairs(surface.edge_loops) do
+        for _, point in ipairs(loop) do
+            local distance = distance_to_cutting_mesh(point, plane)
+            min_distance = math.min(min_distance, distance)
+            max_distance = math.max(max_distance, distance)
+        end
+    end
+
+    return min_distance, max_distance
+end
+
+local function split_surface_piece(surface, edge_loops, suffix)
+    if #edge_loops == 0 then
+        return nil
+    end
+
+    return {
+        world_mesh = surface.world_mesh,
+        name = surface.name .. suffix,
+        edge_loops = edge_loops,
+        normal = surface.normal,
+        plane = surface.plane,
+        plane_d = surface.plane_d,
+        bb = edge_loops_bb(edge_loops),
+        sort_group = surface.sort_group,
+        rip_map = surface.rip_map,
+        is_split = true,
+    }
+end
+
+-- returns the part of surface behind plane then the part in front
+local function split_surface(surface, plane)
+    local behind_loops, front_loops = split_mesh_outline(surface.edge_loops, surface.normal, plane)
+
+    return split_surface_piece(surface, behind_loops, '_b'), split_surface_piece(surface, front_loops, '_f')
+end
+
+local function choose_bsp_splitter(surfaces)
+    local result = nil
+    local result_cost = math.huge
+
+    for _, candidate in ipairs(surfaces) do
+        local front_count = 0
+        local back_count = 0
+        local split_count = 0
+
+        for _, surface in ipairs(surfaces) do
+            if surface ~= candidate then
+                local min_distance, max_distance = surface_distance_range(surface, candidate.plane)
+
+                if min_distance < 0 and max_distance > 0 then
+                    split_count = split_count + 1
+                elseif max_distance > 0 then
+                    front_count = front_count + 1
+                elseif min_distance < 0 then
+                    back_count = back_count + 1
+                end
+            end
+        end
+
+        local cost = split_count * BSP_SPLIT_COST + math.abs(front_count - back_count)
+
+        if cost < result_cost then
+            result = candidate
+            result_cost = cost
+        end
+    end
+
+    return result
+end
+
+local function build_bsp_node(surfaces)
+    if #surfaces == 0 then
+        return nil
+    end
+
+    local splitter = choose_bsp_splitter(surfaces)
+
+    local front_surfaces = {}
+    local back_surfaces = {}
+    local result = {
+        plane = {
+            normal = splitter.normal,
+            d = splitter.plane_d,
+        },
+        surfaces = {},
+    }
+
+    for _, surface in ipairs(surfaces) do
+        local min_distance, max_distance = 0, 0
+
+        if surface ~= splitter then
+            min_distance, max_distance = surface_distance_range(surface, splitter.plane)
+        end
+
+        if min_distance == 0 and max_distance == 0 then
+            table.insert(result.surfaces, surface)
+        elseif min_distance >= 0 then
+            table.insert(front_surfaces, surface)
+        elseif max_distance <= 0 then
+            table.insert(back_surfaces, surface)
+        else
+            local behind, front = split_surface(surface, splitter.plane)
+
+            if behind then
+                table.insert(back_surfaces, behind)
+            end
+
+            if front then
+                table.insert(front_surfaces, front)
+            end
+        end
+    end
+
+    result.front = build_bsp_node(front_surfaces)
+    result.back = build_bsp_node(back_surfaces)
+
+    return result
+end
+
+-- writes the tree in depth first order. The surfaces of each node are
+-- added to ordered_surfaces together so a node only needs a range of
+-- megatexture indices
+local function flatten_bsp_node(node, bsp_nodes, ordered_surfaces)
+    local node_index = #bsp_nodes
+    local bb = nil
+
+    local result = {
+        plane = node.plane,
+        firstIndex = #ordered_surfaces,
+        indexCount = #node.surfaces,
+    }
+
+    table.insert(bsp_nodes, result)
+
+    for _, surface in ipairs(node.surfaces) do
+        table.insert(ordered_surfaces, surface)
+        bb = bb_union(bb, surface.bb)
+    end
+
+    result.front = -1
+    result.back = -1
+
+    if node.front then
+        result.front = flatten_bsp_node(node.front, bsp_nodes, ordered_surfaces)
+        bb = bb_union(bb, bsp_nodes[result.front + 1].boundingBox)
+    end
+
+    if node.back then
+        result.back = flatten_bsp_node(node.back, bsp_nodes, ordered_surfaces)
+        bb = bb_union(bb, bsp_nodes[result.back + 1].boundingBox)
+    end
+
+    result.boundingBox = bb
+
+    return node_index
+end
+
 local megatexture_indexes = {}
+-- the geometry of each megatexture in the same order as
+-- megatexture_indexes, used to find what can be seen from where
+local megatexture_surfaces = {}
+local bsp_nodes = nil
 
 local megatexture_nodes = sk_scene.nodes_for_type('@megatexture')
 
@@ -1143,29 +2156,173 @@ local function find_sort_group(arguments)
     return 0
 end
 
+-- megatextures named with rip_map get rip-map layers, worth it for
+-- floors and walls mostly seen at a grazing angle
+local function has_rip_map(arguments)
+    for _, arg in ipairs(arguments) do
+        if arg == 'rip_map' then
+            return true
+        end
+    end
+
+    return false
+end
+
 for _, node in ipairs(megatexture_nodes) do
     node.sort_group = find_sort_group(node.arguments)
+    node.rip_map = has_rip_map(node.arguments)
 end
 
 table.sort(megatexture_nodes, function(a, b) 
     return a.sort_group < b.sort_group
 end)
 
+local surfaces = {}
+
 for _, node in ipairs(megatexture_nodes) do
     if #node.node.meshes > 0 then
         local world_mesh = node.node.meshes[1]:transform(node.node.full_transformation)
-        print('processing ' .. world_mesh.name)
-        local megatexture_model = build_megatexture_model(world_mesh)
-        local megatexture_index = write_tile_index(world_mesh, megatexture_model, node.sort_group)
-        table.insert(megatexture_indexes, megatexture_index) 
+        table.insert(surfaces, create_surface(world_mesh, node.sort_group, node.rip_map))
     end
 end
 
+if build_bsp and #surfaces > 0 then
+    local ordered_surfaces = {}
+    bsp_nodes = {}
+    flatten_bsp_node(build_bsp_node(surfaces), bsp_nodes, ordered_surfaces)
+    print('bsp: ' .. #surfaces .. ' megatextures split into ' .. #ordered_surfaces .. ' in ' .. #bsp_nodes .. ' nodes')
+    surfaces = ordered_surfaces
+
+    sk_definition_writer.add_definition('bsp_nodes', 'struct MTBspNode[]', '_geo', bsp_nodes)
+end
+
+-- the pieces of a split megatexture share its texture
+local opaque_meshes = {}
+
+for _, surface in ipairs(surfaces) do
+    print('processing ' .. surface.name)
+    local megatexture_model = build_megatexture_model(surface.world_mesh, surface.edge_loops, surface.name, surface.rip_map)
+
+    if opaque_meshes[surface.world_mesh] == nil then
+        -- megatextures with see through texels don't hide what is behind them
+        opaque_meshes[surface.world_mesh] = is_layer_opaque(megatexture_model.layers[1])
+    end
+
+    local megatexture_index = write_tile_index(surface, megatexture_model, opaque_meshes[surface.world_mesh])
+    table.insert(megatexture_indexes, megatexture_index)
+
+    table.insert(megatexture_surfaces, {
+        mesh = surface.world_mesh,
+        normal = surface.normal,
+        bb = surface.bb,
+        -- the outline of the part of mesh that is this megatexture
+        edge_loops = surface.edge_loops,
+        is_split = surface.is_split,
+        opaque = opaque_meshes[surface.world_mesh],
+    })
+end
+
 sk_definition_writer.add_definition('indexes', 'struct MTTileIndex[]', '_geo', megatexture_indexes)
 
+-- megatextures are grouped into a tree of bounding boxes so whole groups
+-- can be culled at once, see src/megatextures/megatexture_bvh.h
+local BVH_MAX_LEAF_SIZE = 4
+
+local function bb_center(bb)
+    return (bb.min + bb.max) * 0.5
+end
+
+local function build_bvh_node(node, items, bvh_nodes, bvh_indices)
+    local bb = nil
+
+    for _, item in ipairs(items) do
+        bb = bb_union(bb, item.bb)
+    end
+
+    node.boundingBox = bb
+
+    if #items <= BVH_MAX_LEAF_SIZE then
+        node.first = #bvh_indices
+        node.indexCount = #items
+
+        for _, item in ipairs(items) do
+            table.insert(bvh_indices, item.index)
+        end
+
+        return
+    end
+
+    -- split in half along the axis the centers are most spread out on
+    local center_bb = nil
+
+    for _, item in ipairs(items) do
+        local center = bb_center(item.bb)
+        center_bb = bb_union(center_bb, {min = center, max = center})
+    end
+
+    local extent = center_bb.max - center_bb.min
+    local axis = 'x'
+
+    if extent.y > extent[axis] then
+        axis = 'y'
+    end
+
+    if extent.z > extent[axis] then
+        axis = 'z'
+    end
+
+    table.sort(items, function(a, b)
+        return bb_center(a.bb)[axis] < bb_center(b.bb)[axis]
+    end)
+
+    local half = #items // 2
+    local left_items = {}
+    local right_items = {}
+
+    for index, item in ipairs(items) do
+        table.insert(index <= half and left_items or right_items, item)
+    end
+
+    -- children are next to each other so a node only needs the first
+    local left_node = {}
+    local right_node = {}
+    node.first = #bvh_nodes
+    node.indexCount = 0
+    table.insert(bvh_nodes, left_node)
+    table.insert(bvh_nodes, right_node)
+
+    build_bvh_node(left_node, left_items, bvh_nodes, bvh_indices)
+    build_bvh_node(right_node, right_items, bvh_nodes, bvh_indices)
+end
+
+local bvh_nodes = nil
+local bvh_indices = nil
+
+if #megatexture_indexes > 0 then
+    local items = {}
+
+    for index, megatexture_index in ipairs(megatexture_indexes) do
+        table.insert(items, {bb = megatexture_index.boundingBox, index = index - 1})
+    end
+
+    local root = {}
+    bvh_nodes = {root}
+    bvh_indices = {}
+    build_bvh_node(root, items, bvh_nodes, bvh_indices)
+
+    sk_definition_writer.add_definition('bvh_nodes', 'struct MTBvhNode[]', '_geo', bvh_nodes)
+    sk_definition_writer.add_definition('bvh_indices', 'u16[]', '_geo', bvh_indices)
+end
+
 sk_definition_writer.add_header('<ultra64.h>')
 sk_definition_writer.add_header('"megatextures/tile_index.h"')
+sk_definition_writer.add_header('"megatextures/megatexture_bsp.h"')
+sk_definition_writer.add_header('"megatextures/megatexture_bvh.h"')
 
 return {
-    megatexture_indexes = megatexture_indexes
+    megatexture_indexes = megatexture_indexes,
+    megatexture_surfaces = megatexture_surfaces,
+    bsp_nodes = bsp_nodes,
+    bvh_nodes = bvh_nodes,
+    bvh_indices = bvh_indices,
 }
\ No newline at end of file
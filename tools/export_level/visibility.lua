@@ -0,0 +1,355 @@
+local sk_definition_writer = require('sk_definition_writer')
+local sk_math = require('sk_math')
+local megatexture = require('tools.export_level.megatexture')
+local collision = require('tools.export_level.collision')
+
+-- the space the player can walk around in is split into square cells on
+-- the xz plane. Each cell stores which megatextures can be seen from
+-- somewhere inside it, see struct LevelVisibility. A megatexture is only
+-- left out of a cell when it is hidden from every point the camera can
+-- be at in the cell, so nothing pops in
+local CELL_SIZE = 2.0
+-- PLAYER_CROUCH_HEAD_HEIGHT and PLAYER_HEAD_HEIGHT in src/scene/scene.c
+local MIN_EYE_HEIGHT = 1.5
+local MAX_EYE_HEIGHT = 3.0
+-- GROUND_HEIGHT in src/scene/scene.c, the player can stand anywhere on it
+local GROUND_HEIGHT = 0.0
+-- collision quads facing up at least this much can be stood on
+local FLOOR_MIN_NORMAL_Y = 0.7
+local EPSILON = 0.0001
+
+-- the sign of the turns around a loop of points, 0 if it isn't convex
+local function convex_orientation(loop, normal)
+    local result = 0
+
+    for i = 1, #loop do
+        local a = loop[i]
+        local b = loop[i % #loop + 1]
+        local c = loop[(i + 1) % #loop + 1]
+        local turn = (b - a):cross(c - b):dot(normal)
+
+        if turn > EPSILON then
+            if result < 0 then
+                return 0
+            end
+
+            result = 1
+        elseif turn < -EPSILON then
+            if result > 0 then
+                return 0
+            end
+
+            result = -1
+        end
+    end
+
+    return result
+end
+
+-- the convex polygons a surface is made of. A single convex outline
+-- is kept whole, otherwise each triangle of the mesh is used
+local function build_occluder_polygons(surface)
+    local result = {}
+
+    if #surface.edge_loops == 1 then
+        local loop = surface.edge_loops[1]
+        local orientation = convex_orientation(loop, surface.normal)
+
+        if orientation ~= 0 then
+            table.insert(result, {points = loop, orientation = orientation})
+            return result
+        end
+    end
+
+    local mesh = surface.mesh
+
+    for _, face in pairs(mesh.faces) do
+        local a = mesh.vertices[face[1]]
+        local b = mesh.vertices[face[2]]
+        local c = mesh.vertices[face[3]]
+        local turn = (b - a):cross(c - a):dot(surface.normal)
+
+        if math.abs(turn) > EPSILON then
+            table.insert(result, {points = {a, b, c}, orientation = turn > 0 and 1 or -1})
+        end
+    end
+
+    return result
+end
+
+-- sets of points that each have to be hidden for the surface to be
+-- hidden. Smaller sets let different occluders hide different parts
+local function build_targets(surface)
+    if surface.is_split then
+        -- the triangles are of the whole mesh, the loops
+        -- are the part of it that is this megatexture
+        return surface.edge_loops
+    end
+
+    local mesh = surface.mesh
+    local result = {}
+
+    for _, face in pairs(mesh.faces) do
+        table.insert(result, {mesh.vertices[face[1]], mesh.vertices[face[2]], mesh.vertices[face[3]]})
+    end
+
+    return result
+end
+
+local function build_surface(surface)
+    return {
+        mesh = surface.mesh,
+        targets = build_targets(surface),
+        polygons = surface.opaque and build_occluder_polygons(surface) or {},
+        normal = surface.normal,
+        d = -surface.normal:dot(surface.mesh.vertices[1]),
+        bb = surface.bb,
+    }
+end
+
+-- true if the segment from start to finish passes through the inside of
+-- polygon. Touching an edge doesn't count
+local function does_segment_cross(surface, polygon, start, finish)
+    local start_distance = surface.normal:dot(start) + surface.d
+    local finish_distance = surface.normal:dot(finish) + surface.d
+
+    if not ((start_distance > EPSILON and finish_distance < -EPSILON) or (start_distance < -EPSILON and finish_distance > EPSILON)) then
+        return false
+    end
+
+    local point = start:lerp(finish, start_distance / (start_distance - finish_distance))
+    local points = polygon.points
+
+    for i = 1, #points do
+        local a = points[i]
+        local b = points[i % #points + 1]
+
+        if (b - a):cross(point - a):dot(surface.normal) * polygon.orientation <= EPSILON then
+            return false
+        end
+    end
+
+    return true
+end
+
+-- polygon is convex, as are the box the corners are of and the hull of
+-- target. If every segment from a corner to a point of target crosses
+-- polygon then so does every segment from the box to the hull
+local function does_polygon_hide(surface, polygon, corners, target)
+    for _, corner in ipairs(corners) do
+        for _, point in ipairs(target) do
+            if not does_segment_cross(surface, polygon, corner, point) then
+                return false
+            end
+        end
+    end
+
+    return true
+end
+
+-- occluders is the opaque surfaces with the whole box on one side
+local function can_see_surface(occluders, surface, corners)
+    local is_front_facing = false
+
+    -- matches mtIsBackFacing
+    for _, corner in ipairs(corners) do
+        if surface.normal:dot(corner) + surface.d > 0 then
+            is_front_facing = true
+            break
+        end
+    end
+
+    if not is_front_facing then
+        return false
+    end
+
+    for _, target in ipairs(surface.targets) do
+        local is_hidden = false
+
+        for _, occluder in ipairs(occluders) do
+            if occluder.mesh ~= surface.mesh then
+                for _, polygon in ipairs(occluder.polygons) do
+                    if does_polygon_hide(occluder, polygon, corners, target) then
+                        is_hidden = true
+                        break
+                    end
+                end
+            end
+
+            if is_hidden then
+                break
+            end
+        end
+
+        if not is_hidden then
+            return true
+        end
+    end
+
+    return false
+end
+
+-- the lowest and highest the camera can be over a rectangle of the xz plane
+local function eye_height_range(min_x, min_z, max_x, max_z)
+    local low = GROUND_HEIGHT
+    local high = GROUND_HEIGHT
+
+    for _, collider in ipairs(collision.colliders) do
+        if collider.plane.normal.y >= FLOOR_MIN_NORMAL_Y and
+            min_x <= collider.bb.max.x and max_x >= collider.bb.min.x and
+            min_z <= collider.bb.max.z and max_z >= collider.bb.min.z then
+            low = math.min(low, collider.bb.min.y)
+            high = math.max(high, collider.bb.max.y)
+        end
+    end
+
+    return low + MIN_EYE_HEIGHT, high + MAX_EYE_HEIGHT
+end
+
+local function box_corners(min, max)
+    local result = {}
+
+    for i = 0, 7 do
+        table.insert(result, sk_math.vector3(
+            (i & 1) == 0 and min.x or max.x,
+            (i & 2) == 0 and min.y or max.y,
+            (i & 4) == 0 and min.z or max.z
+        ))
+    end
+
+    return result
+end
+
+-- the opaque surfaces the whole box is in front of or behind
+local function box_occluders(surfaces, corners)
+    local result = {}
+
+    for _, surface in ipairs(surfaces) do
+        if #surface.polygons > 0 then
+            local in_front = 0
+            local behind = 0
+
+            for _, corner in ipairs(corners) do
+                local distance = surface.normal:dot(corner) + surface.d
+
+                if distance > EPSILON then
+                    in_front = in_front + 1
+                elseif distance < -EPSILON then
+                    behind = behind + 1
+                end
+            end
+
+            if in_front == #corners or behind == #corners then
+                table.insert(result, surface)
+            end
+        end
+    end
+
+    return result
+end
+
+local function build_visibility(surfaces)
+    if #surfaces == 0 then
+        return {}
+    end
+
+    -- the player can't walk far past the megatextures and floors
+    local min_x = math.huge
+    local min_z = math.huge
+    local max_x = -math.huge
+    local max_z = -math.huge
+
+    local function add_bb(bb)
+        min_x = math.min(min_x, bb.min.x)
+        min_z = math.min(min_z, bb.min.z)
+        max_x = math.max(max_x, bb.max.x)
+        max_z = math.max(max_z, bb.max.z)
+    end
+
+    for _, surface in ipairs(surfaces) do
+        add_bb(surface.bb)
+    end
+
+    for _, collider in ipairs(collision.colliders) do
+        add_bb(collider.bb)
+    end
+
+    local x_cells = math.max(1, math.ceil((max_x - min_x) / CELL_SIZE))
+    local z_cells = math.max(1, math.ceil((max_z - min_z) / CELL_SIZE))
+    local words_per_set = (#surfaces + 31) // 32
+
+    local cell_sets = {}
+    local visibility_sets = {}
+    local set_indices = {}
+    local set_count = 0
+
+    for z = 0, z_cells - 1 do
+        for x = 0, x_cells - 1 do
+            local visible = {}
+            local min_y, max_y = eye_height_range(min_x + x * CELL_SIZE, min_z + z * CELL_SIZE, min_x + (x + 1) * CELL_SIZE, min_z + (z + 1) * CELL_SIZE)
+            local corners = box_corners(
+                sk_math.vector3(min_x + x * CELL_SIZE, min_y, min_z + z * CELL_SIZE),
+                sk_math.vector3(min_x + (x + 1) * CELL_SIZE, max_y, min_z + (z + 1) * CELL_SIZE)
+            )
+            local occluders = box_occluders(surfaces, corners)
+
+            for surface_index, surface in ipairs(surfaces) do
+                if can_see_surface(occluders, surface, corners) then
+                    visible[surface_index] = true
+                end
+            end
+
+            local words = {}
+
+            for word = 1, words_per_set do
+                words[word] = 0
+            end
+
+            for surface_index, _ in pairs(visible) do
+                local bit = surface_index - 1
+                words[bit // 32 + 1] = words[bit // 32 + 1] | (1 << (bit % 32))
+            end
+
+            -- neighboring cells usually see the same things so sets are shared
+            local key = table.concat(words, ',')
+            local set_index = set_indices[key]
+
+            if not set_index then
+                set_index = set_count
+                set_indices[key] = set_index
+                set_count = set_count + 1
+
+                for _, word in ipairs(words) do
+                    table.insert(visibility_sets, word)
+                end
+            end
+
+            table.insert(cell_sets, set_index)
+        end
+    end
+
+    sk_definition_writer.add_definition('visibility_cell_sets', 'u16[]', '_geo', cell_sets)
+    sk_definition_writer.add_definition('visibility_sets', 'u32[]', '_geo', visibility_sets)
+
+    print('visibility: ' .. x_cells .. 'x' .. z_cells .. ' cells share ' .. set_count .. ' sets')
+
+    return {
+        minX = min_x,
+        minZ = min_z,
+        cellSize = CELL_SIZE,
+        xCells = x_cells,
+        zCells = z_cells,
+        cellSets = sk_definition_writer.reference_to(cell_sets, 1),
+        visibilitySets = sk_definition_writer.reference_to(visibility_sets, 1),
+    }
+end
+
+local surfaces = {}
+
+for _, surface in ipairs(megatexture.megatexture_surfaces) do
+    table.insert(surfaces, build_surface(surface))
+end
+
+return {
+    visibility = build_visibility(surfaces),
+}